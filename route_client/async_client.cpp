@@ -0,0 +1,222 @@
+#include "async_client.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <grpc/grpc.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/support/channel_arguments.h>
+
+namespace routeguide {
+
+    namespace {
+        struct GetFeatureCall {
+            grpc::ClientContext context_;
+            Point request_;
+            Feature response_;
+        };
+
+        // Reads every feature straight into the result, then reports it.
+        class ListFeaturesCall final : public grpc::ClientReadReactor<Feature> {
+        public:
+            ListFeaturesCall(RouteGuide::Stub* stub, const Rectangle& rectangle,
+                AsyncRouteGuideClient::FeatureListCallback done)
+                : rectangle_(rectangle), done_(std::move(done)) {
+                stub->async()->ListFeatures(&context_, &rectangle_, this);
+                StartRead(NextFeature());
+                StartCall();
+            }
+            void OnReadDone(bool ok) override {
+                if (ok) {
+                    StartRead(NextFeature());
+                }
+                else {
+                    // The slot of the read that found the end of the stream.
+                    result_.features.pop_back();
+                }
+            }
+            void OnDone(const grpc::Status& status) override {
+                result_.status = status;
+                if (status.ok()) {
+                    // The server names the next page in the trailing metadata.
+                    const auto& trailers = context_.GetServerTrailingMetadata();
+                    auto token = trailers.find("routeguide-next-page-token");
+                    if (token != trailers.end()) {
+                        result_.next_page_token.assign(token->second.data(),
+                            token->second.size());
+                    }
+                }
+                AsyncRouteGuideClient::FeatureListCallback done = std::move(done_);
+                FeatureListResult result = std::move(result_);
+                delete this;
+                done(std::move(result));
+            }
+
+        private:
+            Feature* NextFeature() {
+                result_.features.emplace_back();
+                return &result_.features.back();
+            }
+
+            grpc::ClientContext context_;
+            Rectangle rectangle_;
+            FeatureListResult result_;
+            AsyncRouteGuideClient::FeatureListCallback done_;
+        };
+
+        // Writes the notes one after the other while reading the replies,
+        // with no thread of its own.
+        class RouteChatCall final
+            : public grpc::ClientBidiReactor<RouteNote, RouteNote> {
+        public:
+            RouteChatCall(RouteGuide::Stub* stub, std::vector<RouteNote> notes,
+                AsyncRouteGuideClient::NoteCallback on_note,
+                AsyncRouteGuideClient::StatusCallback done)
+                : notes_(std::move(notes)), on_note_(std::move(on_note)),
+                done_(std::move(done)) {
+                stub->async()->RouteChat(&context_, this);
+                StartRead(&reply_);
+                WriteNext();
+                StartCall();
+            }
+            void OnWriteDone(bool ok) override {
+                if (ok) {
+                    WriteNext();
+                }
+            }
+            void OnReadDone(bool ok) override {
+                if (ok) {
+                    on_note_(reply_);
+                    StartRead(&reply_);
+                }
+            }
+            void OnDone(const grpc::Status& status) override {
+                AsyncRouteGuideClient::StatusCallback done = std::move(done_);
+                delete this;
+                done(status);
+            }
+
+        private:
+            void WriteNext() {
+                if (next_ < notes_.size()) {
+                    StartWrite(&notes_[next_++]);
+                }
+                else {
+                    StartWritesDone();
+                }
+            }
+
+            grpc::ClientContext context_;
+            std::vector<RouteNote> notes_;
+            size_t next_ = 0;
+            RouteNote reply_;
+            AsyncRouteGuideClient::NoteCallback on_note_;
+            AsyncRouteGuideClient::StatusCallback done_;
+        };
+    }
+
+    ChannelPool::ChannelPool(const std::string& target, int channels) {
+        for (int i = 0; i < (std::max)(channels, 1); i++) {
+            grpc::ChannelArguments args;
+            args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+            channels_.push_back(grpc::CreateCustomChannel(
+                target, grpc::InsecureChannelCredentials(), args));
+            stubs_.push_back(RouteGuide::NewStub(channels_.back()));
+        }
+    }
+
+    bool ChannelPool::WaitForConnected(std::chrono::system_clock::time_point deadline) {
+        for (const std::shared_ptr<grpc::Channel>& channel : channels_) {
+            if (!channel->WaitForConnected(deadline)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    AsyncRouteGuideClient::AsyncRouteGuideClient(const AsyncClientOptions& options)
+        : pool_(options.target, options.channels),
+        max_inflight_((std::max)(options.max_inflight, 1)) {}
+
+    AsyncRouteGuideClient::~AsyncRouteGuideClient() {
+        Drain();
+    }
+
+    void AsyncRouteGuideClient::GetFeature(const Point& point, FeatureCallback done) {
+        Acquire();
+        auto* call = new GetFeatureCall;
+        call->request_ = point;
+        pool_.Next()->async()->GetFeature(&call->context_, &call->request_,
+            &call->response_, [this, call, done = std::move(done)](grpc::Status status) {
+                FeatureResult result{ std::move(status), std::move(call->response_) };
+                delete call;
+                Release();
+                done(std::move(result));
+            });
+    }
+
+    std::future<FeatureResult> AsyncRouteGuideClient::GetFeature(const Point& point) {
+        auto promise = std::make_shared<std::promise<FeatureResult>>();
+        std::future<FeatureResult> future = promise->get_future();
+        GetFeature(point, [promise](FeatureResult result) {
+            promise->set_value(std::move(result));
+            });
+        return future;
+    }
+
+    void AsyncRouteGuideClient::ListFeatures(const Rectangle& rectangle,
+        FeatureListCallback done) {
+        Acquire();
+        new ListFeaturesCall(pool_.Next(), rectangle,
+            [this, done = std::move(done)](FeatureListResult result) {
+                Release();
+                done(std::move(result));
+            });
+    }
+
+    std::future<FeatureListResult> AsyncRouteGuideClient::ListFeatures(
+        const Rectangle& rectangle) {
+        auto promise = std::make_shared<std::promise<FeatureListResult>>();
+        std::future<FeatureListResult> future = promise->get_future();
+        ListFeatures(rectangle, [promise](FeatureListResult result) {
+            promise->set_value(std::move(result));
+            });
+        return future;
+    }
+
+    void AsyncRouteGuideClient::RouteChat(std::vector<RouteNote> notes,
+        NoteCallback on_note, StatusCallback done) {
+        Acquire();
+        new RouteChatCall(pool_.Next(), std::move(notes), std::move(on_note),
+            [this, done = std::move(done)](const grpc::Status& status) {
+                Release();
+                done(status);
+            });
+    }
+
+    void AsyncRouteGuideClient::Drain() {
+        std::unique_lock<std::mutex> lock(mu_);
+        slot_free_.wait(lock, [this] { return inflight_ == 0; });
+    }
+
+    int AsyncRouteGuideClient::inflight() const {
+        std::unique_lock<std::mutex> lock(mu_);
+        return inflight_;
+    }
+
+    void AsyncRouteGuideClient::Acquire() {
+        std::unique_lock<std::mutex> lock(mu_);
+        slot_free_.wait(lock, [this] { return inflight_ < max_inflight_; });
+        inflight_++;
+    }
+
+    void AsyncRouteGuideClient::Release() {
+        std::unique_lock<std::mutex> lock(mu_);
+        inflight_--;
+        // Both the starters and Drain() wait on slot_free_.
+        slot_free_.notify_all();
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,117 @@
+#ifndef ROUTE_CLIENT_ASYNC_CLIENT_H
+#define ROUTE_CLIENT_ASYNC_CLIENT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpcpp/channel.h>
+#include "route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+    // A fixed set of channels to one target. Every channel gets a private
+    // subchannel pool, so each is its own connection and calls spread over
+    // them instead of queueing on one HTTP/2 connection.
+    class ChannelPool {
+    public:
+        ChannelPool(const std::string& target, int channels);
+
+        // Waits for every channel to connect. False if one does not by
+        // deadline.
+        bool WaitForConnected(std::chrono::system_clock::time_point deadline);
+
+        size_t size() const { return stubs_.size(); }
+        RouteGuide::Stub* stub(size_t i) const { return stubs_[i % stubs_.size()].get(); }
+        // The channels in turn.
+        RouteGuide::Stub* Next() { return stub(next_.fetch_add(1, std::memory_order_relaxed)); }
+
+    private:
+        std::vector<std::shared_ptr<grpc::Channel>> channels_;
+        std::vector<std::unique_ptr<RouteGuide::Stub>> stubs_;
+        std::atomic<size_t> next_{ 0 };
+    };
+
+    struct AsyncClientOptions {
+        std::string target = "localhost:50051";
+        int channels = 1;
+        // Calls outstanding at once, over all channels. Starting another
+        // blocks until one finishes.
+        int max_inflight = 64;
+    };
+
+    struct FeatureResult {
+        grpc::Status status;
+        Feature feature;
+    };
+
+    struct FeatureListResult {
+        grpc::Status status;
+        std::vector<Feature> features;
+        // The token of the next page, empty on the last one.
+        std::string next_page_token;
+    };
+
+    // Non-blocking RouteGuide client for callers that keep many calls in
+    // flight from a few threads. Every call is started on the callback API
+    // and returns at once, with a future or a callback for the result; the
+    // callbacks run on gRPC's threads, after the call has given back its
+    // slot. Calls go round-robin over the pool's channels.
+    //
+    // Safe to use from any number of threads. Starting a call blocks while
+    // max_inflight are outstanding, so a callback that starts another call
+    // may wait on the completion of others. The destructor waits for the
+    // outstanding calls.
+    class AsyncRouteGuideClient {
+    public:
+        using FeatureCallback = std::function<void(FeatureResult)>;
+        using FeatureListCallback = std::function<void(FeatureListResult)>;
+        using NoteCallback = std::function<void(const RouteNote&)>;
+        using StatusCallback = std::function<void(const grpc::Status&)>;
+
+        explicit AsyncRouteGuideClient(const AsyncClientOptions& options);
+        ~AsyncRouteGuideClient();
+
+        bool WaitForConnected(std::chrono::system_clock::time_point deadline) {
+            return pool_.WaitForConnected(deadline);
+        }
+
+        void GetFeature(const Point& point, FeatureCallback done);
+        std::future<FeatureResult> GetFeature(const Point& point);
+
+        // Reads the whole (page of the) listing before calling back.
+        void ListFeatures(const Rectangle& rectangle, FeatureListCallback done);
+        std::future<FeatureListResult> ListFeatures(const Rectangle& rectangle);
+
+        // Sends notes and passes each note the server sends back to
+        // on_note, then done the final status. Both run on gRPC's threads.
+        void RouteChat(std::vector<RouteNote> notes, NoteCallback on_note,
+            StatusCallback done);
+
+        // Blocks until no call is outstanding.
+        void Drain();
+
+        int inflight() const;
+
+    private:
+        // Takes a slot for a new call, waiting for one if max_inflight are
+        // out.
+        void Acquire();
+        void Release();
+
+        ChannelPool pool_;
+        const int max_inflight_;
+        mutable std::mutex mu_;
+        std::condition_variable slot_free_;
+        int inflight_ = 0;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_CLIENT_ASYNC_CLIENT_H
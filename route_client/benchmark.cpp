@@ -0,0 +1,623 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <grpcpp/client_context.h>
+#include "async_client.h"
+#include "latency_histogram.h"
+#include "route_batch.h"
+#include "route_guide.grpc.pb.h"
+
+namespace routeguide {
+
+    namespace {
+        using Clock = std::chrono::steady_clock;
+
+        enum RpcKind {
+            kGetFeature,
+            kListFeatures,
+            kRecordRoute,
+            kRouteChat,
+            kGetFeatures,
+            kNearestFeatures,
+            kFeaturesWithinRadius,
+            kRecordRouteBatched,
+            kRpcKinds,
+        };
+        const char* const kRpcNames[kRpcKinds] = {
+            "GetFeature", "ListFeatures", "RecordRoute", "RouteChat", "GetFeatures",
+            "NearestFeatures", "FeaturesWithinRadius", "RecordRouteBatched" };
+        const char* const kMixNames[kRpcKinds] = {
+            "get", "list", "route", "chat", "getfeatures", "near", "radius", "routebatch" };
+
+        const int32_t kMaxLatitude = 900000000;
+        const int32_t kMaxLongitude = 1800000000;
+
+        // Quotes s as a JSON string.
+        std::string JsonString(const std::string& s) {
+            std::string out = "\"";
+            for (char c : s) {
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                    out += c;
+                }
+                else if (static_cast<unsigned char>(c) < 0x20) {
+                    char escape[8];
+                    std::snprintf(escape, sizeof(escape), "\\u%04x",
+                        static_cast<unsigned>(c));
+                    out += escape;
+                }
+                else {
+                    out += c;
+                }
+            }
+            return out + "\"";
+        }
+
+        // Parses "name=weight,..." into one weight per RpcKind.
+        bool ParseMix(const std::string& mix, std::vector<double>* weights) {
+            weights->assign(kRpcKinds, 0.0);
+            std::stringstream items(mix);
+            std::string item;
+            while (std::getline(items, item, ',')) {
+                size_t equals = item.find('=');
+                std::string name = item.substr(0, equals);
+                int kind = 0;
+                while (kind < kRpcKinds && name != kMixNames[kind]) {
+                    kind++;
+                }
+                if (kind == kRpcKinds || equals == std::string::npos) {
+                    std::cout << "Bad --mix entry '" << item << "'" << std::endl;
+                    return false;
+                }
+                (*weights)[kind] = std::atof(item.c_str() + equals + 1);
+            }
+            for (double w : *weights) {
+                if (w > 0) {
+                    return true;
+                }
+            }
+            std::cout << "--mix gives every RPC a weight of 0" << std::endl;
+            return false;
+        }
+
+        // Draws requests around the features of the DB, so that lookups hit
+        // real features about half of the time and rectangles and routes
+        // cover populated areas.
+        class Workload {
+        public:
+            Workload(const std::vector<Feature>& features,
+                const BenchmarkOptions& options, uint64_t seed)
+                : features_(features), options_(options), rng_(options.seed) {
+                // Drawn before seeding, so every thread gets the same ones.
+                for (int i = 0; i < options_.list_rectangles; i++) {
+                    popular_.push_back(NewRectangle());
+                }
+                rng_.seed(seed);
+            }
+
+            Point RandomPoint() {
+                const Point& base = RandomFeature().location();
+                if (rng_() % 2 == 0) {
+                    return base;
+                }
+                return Jitter(base, options_.list_span / 2);
+            }
+
+            Rectangle RandomRectangle() {
+                if (!popular_.empty()) {
+                    return popular_[rng_() % popular_.size()];
+                }
+                return NewRectangle();
+            }
+
+            // A walk away from a feature in small random steps.
+            void RandomRoute(std::vector<Point>* route) {
+                route->clear();
+                Point point = RandomFeature().location();
+                int32_t step = (std::max)(options_.list_span / 100, 1);
+                for (int i = 0; i < options_.route_points; i++) {
+                    route->push_back(point);
+                    point = Jitter(point, step);
+                }
+            }
+
+            void RandomNotes(std::vector<RouteNote>* notes) {
+                notes->clear();
+                for (int i = 0; i < options_.chat_notes; i++) {
+                    RouteNote note;
+                    *note.mutable_location() = RandomFeature().location();
+                    note.set_message("benchmark note " + std::to_string(rng_() % 1000));
+                    notes->push_back(note);
+                }
+            }
+
+            PointList RandomPointList() {
+                PointList points;
+                for (int i = 0; i < options_.batch_points; i++) {
+                    *points.add_points() = RandomPoint();
+                }
+                return points;
+            }
+
+        private:
+            Rectangle NewRectangle() {
+                Point center = RandomPoint();
+                Rectangle rect;
+                int32_t half = options_.list_span / 2;
+                *rect.mutable_lo() = Offset(center, -half, -half);
+                *rect.mutable_hi() = Offset(center, half, half);
+                return rect;
+            }
+
+            const Feature& RandomFeature() {
+                return features_[rng_() % features_.size()];
+            }
+
+            Point Jitter(const Point& point, int32_t spread) {
+                std::uniform_int_distribution<int32_t> offset(-spread, spread);
+                return Offset(point, offset(rng_), offset(rng_));
+            }
+
+            static Point Offset(const Point& point, int64_t latitude, int64_t longitude) {
+                Point p;
+                p.set_latitude(static_cast<int32_t>((std::max)(int64_t{ -kMaxLatitude },
+                    (std::min)(int64_t{ kMaxLatitude }, point.latitude() + latitude))));
+                p.set_longitude(static_cast<int32_t>((std::max)(int64_t{ -kMaxLongitude },
+                    (std::min)(int64_t{ kMaxLongitude }, point.longitude() + longitude))));
+                return p;
+            }
+
+            const std::vector<Feature>& features_;
+            const BenchmarkOptions& options_;
+            std::mt19937_64 rng_;
+            std::vector<Rectangle> popular_;
+        };
+
+        struct RpcStats {
+            LatencyHistogram latency;  // Nanoseconds.
+            uint64_t errors = 0;
+        };
+
+        // One driver thread, which starts calls on schedule, and the
+        // statistics of those calls. Calls complete on gRPC's callback
+        // threads and report back through Done().
+        class Driver {
+        public:
+            Driver(const BenchmarkOptions& options, const std::vector<double>& weights,
+                const ChannelPool& pool, const std::vector<Feature>& features, int index,
+                Clock::time_point start, Clock::time_point measure_from,
+                Clock::time_point end)
+                : options_(options), weights_(weights), pool_(pool),
+                workload_(features, options, options.seed + index), index_(index),
+                start_(start), measure_from_(measure_from), end_(end) {}
+
+            void Run();
+            void Done(RpcKind kind, Clock::time_point due, const grpc::Status& status);
+
+            const RpcStats& stats(int kind) const { return stats_[kind]; }
+
+        private:
+            void Start(RpcKind kind, Clock::time_point due, RouteGuide::Stub* stub);
+
+            const BenchmarkOptions& options_;
+            const std::vector<double>& weights_;
+            const ChannelPool& pool_;
+            Workload workload_;
+            int index_;
+            Clock::time_point start_;
+            Clock::time_point measure_from_;
+            Clock::time_point end_;
+            std::mutex mu_;
+            std::condition_variable slot_free_;
+            int outstanding_ = 0;
+            RpcStats stats_[kRpcKinds];
+        };
+
+        // What every call reports when it completes.
+        struct CallInfo {
+            Driver* driver;
+            RpcKind kind;
+            Clock::time_point due;
+        };
+
+        // Deletes call, then reports it, so that nothing of the call is
+        // left once the driver has seen its last completion.
+        template <typename Call>
+        void Complete(Call* call, const grpc::Status& status) {
+            CallInfo info = call->info_;
+            delete call;
+            info.driver->Done(info.kind, info.due, status);
+        }
+
+        template <typename Request, typename Response>
+        struct UnaryCall {
+            explicit UnaryCall(const CallInfo& info) : info_(info) {}
+
+            CallInfo info_;
+            grpc::ClientContext context_;
+            Request request_;
+            Response response_;
+        };
+
+        class ListFeaturesCall final : public grpc::ClientReadReactor<Feature> {
+        public:
+            ListFeaturesCall(const CallInfo& info, RouteGuide::Stub* stub,
+                const Rectangle& rectangle)
+                : info_(info), rectangle_(rectangle) {
+                stub->async()->ListFeatures(&context_, &rectangle_, this);
+                StartRead(&feature_);
+                StartCall();
+            }
+            void OnReadDone(bool ok) override {
+                if (ok) {
+                    StartRead(&feature_);
+                }
+            }
+            void OnDone(const grpc::Status& status) override { Complete(this, status); }
+
+            CallInfo info_;
+
+        private:
+            grpc::ClientContext context_;
+            Rectangle rectangle_;
+            Feature feature_;
+        };
+
+        void StartRecordRoute(RouteGuide::Stub* stub, grpc::ClientContext* context,
+            RouteSummary* summary, grpc::ClientWriteReactor<Point>* reactor) {
+            stub->async()->RecordRoute(context, summary, reactor);
+        }
+
+        void StartRecordRoute(RouteGuide::Stub* stub, grpc::ClientContext* context,
+            RouteSummary* summary, grpc::ClientWriteReactor<RouteBatch>* reactor) {
+            stub->async()->RecordRouteBatched(context, summary, reactor);
+        }
+
+        // RecordRoute with one Point per message, or RecordRouteBatched with
+        // a RouteBatch per message.
+        template <typename Message>
+        class RecordRouteCall final : public grpc::ClientWriteReactor<Message> {
+        public:
+            RecordRouteCall(const CallInfo& info, RouteGuide::Stub* stub,
+                std::vector<Message> route)
+                : info_(info), route_(std::move(route)) {
+                StartRecordRoute(stub, &context_, &summary_, this);
+                WriteNext();
+                this->StartCall();
+            }
+            void OnWriteDone(bool ok) override {
+                if (ok) {
+                    WriteNext();
+                }
+            }
+            void OnDone(const grpc::Status& status) override { Complete(this, status); }
+
+            CallInfo info_;
+
+        private:
+            void WriteNext() {
+                if (next_ < route_.size()) {
+                    this->StartWrite(&route_[next_++]);
+                }
+                else {
+                    this->StartWritesDone();
+                }
+            }
+
+            grpc::ClientContext context_;
+            std::vector<Message> route_;
+            size_t next_ = 0;
+            RouteSummary summary_;
+        };
+
+        class RouteChatCall final
+            : public grpc::ClientBidiReactor<RouteNote, RouteNote> {
+        public:
+            RouteChatCall(const CallInfo& info, RouteGuide::Stub* stub,
+                std::vector<RouteNote> notes)
+                : info_(info), notes_(std::move(notes)) {
+                stub->async()->RouteChat(&context_, this);
+                StartRead(&reply_);
+                WriteNext();
+                StartCall();
+            }
+            void OnWriteDone(bool ok) override {
+                if (ok) {
+                    WriteNext();
+                }
+            }
+            void OnReadDone(bool ok) override {
+                if (ok) {
+                    StartRead(&reply_);
+                }
+            }
+            void OnDone(const grpc::Status& status) override { Complete(this, status); }
+
+            CallInfo info_;
+
+        private:
+            void WriteNext() {
+                if (next_ < notes_.size()) {
+                    StartWrite(&notes_[next_++]);
+                }
+                else {
+                    StartWritesDone();
+                }
+            }
+
+            grpc::ClientContext context_;
+            std::vector<RouteNote> notes_;
+            size_t next_ = 0;
+            RouteNote reply_;
+        };
+
+        void Driver::Run() {
+            std::discrete_distribution<int> pick(weights_.begin(), weights_.end());
+            std::mt19937_64 rng(options_.seed * 7919 + index_);
+            bool open_loop = options_.qps > 0;
+            auto interval = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(
+                    open_loop ? options_.threads / options_.qps : 0));
+            // Stagger the threads' schedules across one interval.
+            Clock::time_point due = start_ + interval * index_ / options_.threads;
+            size_t next_stub = index_;
+            for (;;) {
+                if (open_loop) {
+                    due += interval;
+                    if (due >= end_) {
+                        break;
+                    }
+                    std::this_thread::sleep_until(due);
+                }
+                {
+                    std::unique_lock<std::mutex> lock(mu_);
+                    slot_free_.wait(lock, [this] { return outstanding_ < options_.inflight; });
+                    outstanding_++;
+                }
+                if (!open_loop) {
+                    due = Clock::now();
+                    if (due >= end_) {
+                        std::unique_lock<std::mutex> lock(mu_);
+                        outstanding_--;
+                        break;
+                    }
+                }
+                Start(static_cast<RpcKind>(pick(rng)), due, pool_.stub(next_stub++));
+            }
+            std::unique_lock<std::mutex> lock(mu_);
+            slot_free_.wait(lock, [this] { return outstanding_ == 0; });
+        }
+
+        void Driver::Start(RpcKind kind, Clock::time_point due, RouteGuide::Stub* stub) {
+            CallInfo info = { this, kind, due };
+            switch (kind) {
+            case kGetFeature: {
+                auto* call = new UnaryCall<Point, Feature>(info);
+                call->request_ = workload_.RandomPoint();
+                stub->async()->GetFeature(&call->context_, &call->request_,
+                    &call->response_, [call](grpc::Status status) {
+                        Complete(call, status);
+                    });
+                break;
+            }
+            case kGetFeatures: {
+                auto* call = new UnaryCall<PointList, FeatureList>(info);
+                call->request_ = workload_.RandomPointList();
+                stub->async()->GetFeatures(&call->context_, &call->request_,
+                    &call->response_, [call](grpc::Status status) {
+                        Complete(call, status);
+                    });
+                break;
+            }
+            case kNearestFeatures: {
+                auto* call = new UnaryCall<NearestRequest, NearbyFeatureList>(info);
+                *call->request_.mutable_point() = workload_.RandomPoint();
+                call->request_.set_k(options_.near_k);
+                stub->async()->NearestFeatures(&call->context_, &call->request_,
+                    &call->response_, [call](grpc::Status status) {
+                        Complete(call, status);
+                    });
+                break;
+            }
+            case kFeaturesWithinRadius: {
+                auto* call = new UnaryCall<RadiusRequest, NearbyFeatureList>(info);
+                *call->request_.mutable_point() = workload_.RandomPoint();
+                call->request_.set_metres(options_.radius_metres);
+                stub->async()->FeaturesWithinRadius(&call->context_, &call->request_,
+                    &call->response_, [call](grpc::Status status) {
+                        Complete(call, status);
+                    });
+                break;
+            }
+            case kListFeatures:
+                new ListFeaturesCall(info, stub, workload_.RandomRectangle());
+                break;
+            case kRecordRoute: {
+                std::vector<Point> route;
+                workload_.RandomRoute(&route);
+                new RecordRouteCall<Point>(info, stub, std::move(route));
+                break;
+            }
+            case kRecordRouteBatched: {
+                std::vector<Point> route;
+                workload_.RandomRoute(&route);
+                std::vector<RouteBatch> batches;
+                RouteBatchEncoder encoder;
+                size_t per_batch = (std::max)(options_.routebatch_points, 1);
+                for (size_t i = 0; i < route.size(); i++) {
+                    if (i % per_batch == 0) {
+                        batches.emplace_back();
+                    }
+                    encoder.Add(route[i].latitude(), route[i].longitude(), &batches.back());
+                }
+                new RecordRouteCall<RouteBatch>(info, stub, std::move(batches));
+                break;
+            }
+            case kRouteChat: {
+                std::vector<RouteNote> notes;
+                workload_.RandomNotes(&notes);
+                new RouteChatCall(info, stub, std::move(notes));
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        void Driver::Done(RpcKind kind, Clock::time_point due,
+            const grpc::Status& status) {
+            Clock::time_point now = Clock::now();
+            std::unique_lock<std::mutex> lock(mu_);
+            if (due >= measure_from_) {
+                if (status.ok()) {
+                    stats_[kind].latency.Record(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count()));
+                }
+                else {
+                    stats_[kind].errors++;
+                }
+            }
+            outstanding_--;
+            slot_free_.notify_one();
+        }
+
+        double Micros(uint64_t nanos) { return nanos / 1000.0; }
+
+        void WriteLatencyJson(std::ostream& out, const LatencyHistogram& h) {
+            out << "{\"p50\": " << Micros(h.Percentile(50))
+                << ", \"p90\": " << Micros(h.Percentile(90))
+                << ", \"p99\": " << Micros(h.Percentile(99))
+                << ", \"p999\": " << Micros(h.Percentile(99.9))
+                << ", \"max\": " << Micros(h.max())
+                << ", \"mean\": " << Micros(static_cast<uint64_t>(h.mean())) << "}";
+        }
+    }
+
+    bool RunBenchmark(const BenchmarkOptions& options,
+        const std::vector<Feature>& features) {
+        std::vector<double> weights;
+        if (!ParseMix(options.mix, &weights)) {
+            return false;
+        }
+        if (features.empty() || options.threads < 1 || options.channels < 1 ||
+            options.inflight < 1 || options.duration_seconds <= 0) {
+            std::cout << "The benchmark needs a non-empty DB and at least one"
+                " thread, channel and in-flight call." << std::endl;
+            return false;
+        }
+
+        ChannelPool pool(options.target, options.channels);
+        if (!pool.WaitForConnected(
+            std::chrono::system_clock::now() + std::chrono::seconds(10))) {
+            std::cout << "Cannot connect to " << options.target << std::endl;
+            return false;
+        }
+
+        auto warmup = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.warmup_seconds));
+        auto duration = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.duration_seconds));
+        Clock::time_point start = Clock::now();
+        Clock::time_point measure_from = start + warmup;
+        Clock::time_point end = measure_from + duration;
+
+        std::vector<std::unique_ptr<Driver>> drivers;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < options.threads; i++) {
+            drivers.emplace_back(new Driver(options, weights, pool, features, i, start,
+                measure_from, end));
+            threads.emplace_back(&Driver::Run, drivers.back().get());
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        RpcStats totals[kRpcKinds];
+        LatencyHistogram all;
+        uint64_t all_errors = 0;
+        for (const auto& driver : drivers) {
+            for (int kind = 0; kind < kRpcKinds; kind++) {
+                totals[kind].latency.Merge(driver->stats(kind).latency);
+                totals[kind].errors += driver->stats(kind).errors;
+            }
+        }
+        for (int kind = 0; kind < kRpcKinds; kind++) {
+            all.Merge(totals[kind].latency);
+            all_errors += totals[kind].errors;
+        }
+
+        double seconds = options.duration_seconds;
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-20s %10s %8s %10s %10s %10s %10s %10s %10s",
+            "rpc", "count", "errors", "qps", "p50_us", "p90_us", "p99_us", "p999_us",
+            "max_us");
+        std::cout << line << std::endl;
+        for (int kind = 0; kind <= kRpcKinds; kind++) {
+            const LatencyHistogram& h = kind < kRpcKinds ? totals[kind].latency : all;
+            uint64_t errors = kind < kRpcKinds ? totals[kind].errors : all_errors;
+            if (h.count() == 0 && errors == 0) {
+                continue;
+            }
+            std::snprintf(line, sizeof(line),
+                "%-20s %10llu %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f",
+                kind < kRpcKinds ? kRpcNames[kind] : "all",
+                static_cast<unsigned long long>(h.count()),
+                static_cast<unsigned long long>(errors), h.count() / seconds,
+                Micros(h.Percentile(50)), Micros(h.Percentile(90)),
+                Micros(h.Percentile(99)), Micros(h.Percentile(99.9)), Micros(h.max()));
+            std::cout << line << std::endl;
+        }
+
+        if (options.json_out.empty()) {
+            return true;
+        }
+        std::ostringstream json;
+        json << "{\"target\": " << JsonString(options.target) << ", \"threads\": "
+            << options.threads << ", \"channels\": " << options.channels
+            << ", \"inflight\": " << options.inflight << ", \"target_qps\": "
+            << options.qps << ", \"duration_seconds\": " << seconds
+            << ", \"mix\": " << JsonString(options.mix) << ", \"rpcs\": {";
+        bool first = true;
+        for (int kind = 0; kind < kRpcKinds; kind++) {
+            const RpcStats& s = totals[kind];
+            if (s.latency.count() == 0 && s.errors == 0) {
+                continue;
+            }
+            json << (first ? "" : ", ") << "\"" << kRpcNames[kind] << "\": {\"count\": "
+                << s.latency.count() << ", \"errors\": " << s.errors << ", \"qps\": "
+                << s.latency.count() / seconds << ", \"latency_us\": ";
+            WriteLatencyJson(json, s.latency);
+            json << "}";
+            first = false;
+        }
+        json << "}, \"total\": {\"count\": " << all.count() << ", \"errors\": "
+            << all_errors << ", \"qps\": " << all.count() / seconds
+            << ", \"latency_us\": ";
+        WriteLatencyJson(json, all);
+        json << "}}\n";
+
+        if (options.json_out == "-") {
+            std::cout << json.str();
+            return true;
+        }
+        std::ofstream out(options.json_out);
+        out << json.str();
+        if (!out) {
+            std::cout << "Cannot write " << options.json_out << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+}  // namespace routeguide
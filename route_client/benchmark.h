@@ -0,0 +1,60 @@
+#ifndef ROUTE_CLIENT_BENCHMARK_H
+#define ROUTE_CLIENT_BENCHMARK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "route_guide.pb.h"
+
+namespace routeguide {
+
+    struct BenchmarkOptions {
+        std::string target = "localhost:50051";
+        // Driver threads; each keeps up to inflight RPCs outstanding.
+        int threads = 1;
+        // Separate channels (connections). Calls go round-robin over them.
+        int channels = 1;
+        int inflight = 1;
+        // Total calls started per second, spread over the threads. Calls are
+        // due on a fixed schedule and their latency is measured from when
+        // they were due, so a stalled server shows up in the percentiles. 0
+        // runs closed-loop: each finished call starts the next.
+        double qps = 0;
+        double duration_seconds = 10;
+        // Calls that start during the warm-up are not measured.
+        double warmup_seconds = 1;
+        // Relative weights of the RPCs, e.g. "get=60,list=10,route=10".
+        // Names: get, list, route, chat, getfeatures (GetFeatures), near,
+        // radius, routebatch (RecordRouteBatched).
+        std::string mix = "get=60,list=10,route=10,chat=10,getfeatures=10";
+        // Points per RecordRoute and RecordRouteBatched route, per
+        // GetFeatures request and per RouteBatch message, and notes per
+        // RouteChat.
+        int route_points = 100;
+        int batch_points = 100;
+        int routebatch_points = 100;
+        int chat_notes = 4;
+        // k of NearestFeatures and the radius of FeaturesWithinRadius.
+        int near_k = 10;
+        double radius_metres = 10000;
+        // Side of the ListFeatures rectangles, in E7 degrees.
+        int32_t list_span = 1000000;
+        // If set, ListFeatures asks for one of this many rectangles, the same
+        // on every thread, instead of a new one each time.
+        int list_rectangles = 0;
+        uint64_t seed = 1;
+        // Where to write the JSON result; "-" for stdout, empty for none.
+        std::string json_out;
+    };
+
+    // Runs the load described by options against options.target, with
+    // points, rectangles, routes and notes drawn around the features of the
+    // DB. Prints a summary per RPC and writes the JSON result. Returns false
+    // if the options are invalid or the result cannot be written.
+    bool RunBenchmark(const BenchmarkOptions& options,
+        const std::vector<Feature>& features);
+
+}  // namespace routeguide
+
+#endif  // ROUTE_CLIENT_BENCHMARK_H
@@ -0,0 +1,83 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace routeguide {
+
+    namespace {
+        // Values below kSubBuckets are exact; every power of two from there
+        // up to 2^63 adds kSubBuckets more.
+        const size_t kBucketCount = LatencyHistogram::kSubBuckets *
+            (64 - LatencyHistogram::kSubBucketBits + 1);
+
+        int HighestBit(uint64_t value) {
+            int bit = 0;
+            while (value >>= 1) {
+                bit++;
+            }
+            return bit;
+        }
+    }
+
+    LatencyHistogram::LatencyHistogram() : counts_(kBucketCount, 0) {}
+
+    size_t LatencyHistogram::IndexOf(uint64_t value) {
+        if (value < kSubBuckets) {
+            return static_cast<size_t>(value);
+        }
+        int shift = HighestBit(value) - kSubBucketBits;
+        // value >> shift is in [kSubBuckets, 2 * kSubBuckets).
+        return static_cast<size_t>(kSubBuckets * (shift + 1) +
+            ((value >> shift) - kSubBuckets));
+    }
+
+    uint64_t LatencyHistogram::HighestValueAt(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        int shift = static_cast<int>(index / kSubBuckets) - 1;
+        uint64_t sub = kSubBuckets + index % kSubBuckets;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::Record(uint64_t value) {
+        counts_[IndexOf(value)]++;
+        count_++;
+        min_ = (std::min)(min_, value);
+        max_ = (std::max)(max_, value);
+        sum_ += value;
+    }
+
+    void LatencyHistogram::Merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        min_ = (std::min)(min_, other.min_);
+        max_ = (std::max)(max_, other.max_);
+        sum_ += other.sum_;
+    }
+
+    double LatencyHistogram::mean() const {
+        return count_ == 0 ? 0.0 : static_cast<double>(sum_ / count_);
+    }
+
+    uint64_t LatencyHistogram::Percentile(double percentile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(
+            std::ceil(percentile / 100.0 * static_cast<double>(count_)));
+        rank = (std::max)(rank, uint64_t{ 1 });
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return (std::min)(HighestValueAt(i), max_);
+            }
+        }
+        return max_;
+    }
+
+}  // namespace routeguide
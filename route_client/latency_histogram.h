@@ -0,0 +1,48 @@
+#ifndef ROUTE_CLIENT_LATENCY_HISTOGRAM_H
+#define ROUTE_CLIENT_LATENCY_HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace routeguide {
+
+    // Log-linear histogram in the style of HdrHistogram. Each power of two
+    // is split into kSubBuckets equal sub-buckets, so every value is kept to
+    // within 1/kSubBuckets (under 1%) of itself, and the whole uint64 range
+    // fits in a fixed array of about 7,500 counters. Recording is one
+    // increment; histograms of the same kind merge by adding counters.
+    class LatencyHistogram {
+    public:
+        static constexpr int kSubBucketBits = 7;
+        static constexpr uint64_t kSubBuckets = uint64_t{ 1 } << kSubBucketBits;
+
+        LatencyHistogram();
+
+        void Record(uint64_t value);
+        void Merge(const LatencyHistogram& other);
+
+        uint64_t count() const { return count_; }
+        uint64_t min() const { return count_ == 0 ? 0 : min_; }
+        uint64_t max() const { return max_; }
+        double mean() const;
+
+        // The smallest recorded value that percentile percent of the values
+        // are at or below, as the highest value of its sub-bucket.
+        uint64_t Percentile(double percentile) const;
+
+    private:
+        static size_t IndexOf(uint64_t value);
+        static uint64_t HighestValueAt(size_t index);
+
+        std::vector<uint64_t> counts_;
+        uint64_t count_ = 0;
+        uint64_t min_ = UINT64_MAX;
+        uint64_t max_ = 0;
+        // Long double so that a long run's total does not lose the mean.
+        long double sum_ = 0;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_CLIENT_LATENCY_HISTOGRAM_H
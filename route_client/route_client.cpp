@@ -17,13 +17,15 @@
  */
 
 #include <chrono>
+#include <cstdlib>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <random>
 #include <string>
 #include <thread>
-#include <fstream>
-#include <sstream>
+#include <utility>
+#include <vector>
 
 
 #include <grpc/grpc.h>
@@ -31,6 +33,10 @@
 #include <grpcpp/client_context.h>
 #include <grpcpp/create_channel.h>
 #include <grpcpp/security/credentials.h>
+#include "async_client.h"
+#include "benchmark.h"
+#include "db_loader.h"
+#include "route_batch.h"
 #ifdef BAZEL_BUILD
 #include "examples/protos/route_guide.grpc.pb.h"
 #else
@@ -40,135 +46,155 @@
 
 namespace routeguide {
 
-    std::string GetDbFileContent(int argc, char** argv) {
+    struct ClientOptions {
         std::string db_path;
-        std::string arg_str("--db_path");
-        if (argc > 1) {
-            std::string argv_1 = argv[1];
-            size_t start_position = argv_1.find(arg_str);
-            if (start_position != std::string::npos) {
-                start_position += arg_str.size();
-                if (argv_1[start_position] == ' ' || argv_1[start_position] == '=') {
-                    db_path = argv_1.substr(start_position + 1);
-                }
-            }
-        }
-        else {
+        std::string target = "localhost:50051";
+        // Run the load generator instead of the demo calls.
+        bool benchmark = false;
+        // Print the server's metrics instead of running the demo calls.
+        bool metrics = false;
+        BenchmarkOptions bench;
+    };
+
+    // Accepts --name=value and --name value for each option, like the
+    // server. --benchmark takes no value.
+    bool ParseClientOptions(int argc, char** argv, ClientOptions* options) {
 #ifdef BAZEL_BUILD
-            db_path = "cpp/route_guide/route_guide_db.json";
+        options->db_path = "cpp/route_guide/route_guide_db.json";
 #else
-            db_path = "route_guide_db.json";
+        options->db_path = "route_guide_db.json";
 #endif
-        }
-        std::ifstream db_file(db_path);
-        if (!db_file.is_open()) {
-            std::cout << "Failed to open " << db_path << std::endl;
-            abort();
-        }
-        std::stringstream db;
-        db << db_file.rdbuf();
-        return db.str();
-    }
-
-    // A simple parser for the json db file. It requires the db file to have the
-    // exact form of [{"location": { "latitude": 123, "longitude": 456}, "name":
-    // "the name can be empty" }, { ... } ... The spaces will be stripped.
-    class Parser {
-    public:
-        explicit Parser(const std::string& db) : db_(db) {
-            // Remove all spaces.
-            db_.erase(std::remove_if(db_.begin(), db_.end(), isspace), db_.end());
-            if (!Match("[")) {
-                SetFailedAndReturnFalse();
+        BenchmarkOptions& bench = options->bench;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            std::string value;
+            size_t equals = arg.find('=');
+            if (equals != std::string::npos) {
+                value = arg.substr(equals + 1);
+                arg.resize(equals);
             }
-        }
-
-        bool Finished() { return current_ >= db_.size(); }
-
-        bool TryParseOne(Feature* feature) {
-            if (failed_ || Finished() || !Match("{")) {
-                return SetFailedAndReturnFalse();
+            else if (arg == "--benchmark" || arg == "--metrics") {
+                (arg == "--benchmark" ? options->benchmark : options->metrics) = true;
+                continue;
             }
-            if (!Match(location_) || !Match("{") || !Match(latitude_)) {
-                return SetFailedAndReturnFalse();
+            else if (i + 1 < argc) {
+                value = argv[++i];
             }
-            long temp = 0;
-            ReadLong(&temp);
-            feature->mutable_location()->set_latitude(temp);
-            if (!Match(",") || !Match(longitude_)) {
-                return SetFailedAndReturnFalse();
+            if (arg == "--db_path") {
+                options->db_path = value;
             }
-            ReadLong(&temp);
-            feature->mutable_location()->set_longitude(temp);
-            if (!Match("},") || !Match(name_) || !Match("\"")) {
-                return SetFailedAndReturnFalse();
+            else if (arg == "--target") {
+                options->target = value;
             }
-            size_t name_start = current_;
-            while (current_ != db_.size() && db_[current_++] != '"') {
+            else if (arg == "--benchmark") {
+                options->benchmark = value != "false" && value != "0";
             }
-            if (current_ == db_.size()) {
-                return SetFailedAndReturnFalse();
+            else if (arg == "--metrics") {
+                options->metrics = value != "false" && value != "0";
             }
-            feature->set_name(db_.substr(name_start, current_ - name_start - 1));
-            if (!Match("},")) {
-                if (db_[current_ - 1] == ']' && current_ == db_.size()) {
-                    return true;
-                }
-                return SetFailedAndReturnFalse();
+            else if (arg == "--threads") {
+                bench.threads = std::atoi(value.c_str());
+            }
+            else if (arg == "--channels") {
+                bench.channels = std::atoi(value.c_str());
+            }
+            else if (arg == "--inflight") {
+                bench.inflight = std::atoi(value.c_str());
+            }
+            else if (arg == "--qps") {
+                bench.qps = std::atof(value.c_str());
+            }
+            else if (arg == "--duration_seconds") {
+                bench.duration_seconds = std::atof(value.c_str());
+            }
+            else if (arg == "--warmup_seconds") {
+                bench.warmup_seconds = std::atof(value.c_str());
+            }
+            else if (arg == "--mix") {
+                bench.mix = value;
+            }
+            else if (arg == "--route_points") {
+                bench.route_points = std::atoi(value.c_str());
+            }
+            else if (arg == "--batch_points") {
+                bench.batch_points = std::atoi(value.c_str());
+            }
+            else if (arg == "--routebatch_points") {
+                bench.routebatch_points = std::atoi(value.c_str());
+            }
+            else if (arg == "--near_k") {
+                bench.near_k = std::atoi(value.c_str());
+            }
+            else if (arg == "--radius_metres") {
+                bench.radius_metres = std::atof(value.c_str());
+            }
+            else if (arg == "--chat_notes") {
+                bench.chat_notes = std::atoi(value.c_str());
+            }
+            else if (arg == "--list_span") {
+                bench.list_span = std::atoi(value.c_str());
+            }
+            else if (arg == "--list_rectangles") {
+                bench.list_rectangles = std::atoi(value.c_str());
+            }
+            else if (arg == "--seed") {
+                bench.seed = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (arg == "--json_out") {
+                bench.json_out = value;
+            }
+            else {
+                std::cout << "Unknown flag " << arg << std::endl
+                    << "Usage: route_client [--db_path=path/to/db] [--target=host:port]"
+                    " [--metrics]"
+                    " [--benchmark [--threads=N] [--channels=N] [--inflight=N]"
+                    " [--qps=N] [--duration_seconds=N] [--warmup_seconds=N]"
+                    " [--mix=get=60,list=10,route=10,chat=10,getfeatures=10]"
+                    " [--route_points=N] [--batch_points=N]"
+                    " [--routebatch_points=N] [--chat_notes=N]"
+                    " [--near_k=N] [--radius_metres=N]"
+                    " [--list_span=N] [--list_rectangles=N] [--seed=N]"
+                    " [--json_out=path|-]]" << std::endl;
+                return false;
             }
-            return true;
         }
+        bench.target = options->target;
+        return true;
+    }
 
-    private:
-        bool SetFailedAndReturnFalse() {
-            failed_ = true;
+    // Fetches the server's metrics and prints them as they are.
+    bool PrintMetrics(const std::string& target) {
+        std::unique_ptr<RouteGuideAdmin::Stub> admin = RouteGuideAdmin::NewStub(
+            grpc::CreateChannel(target, grpc::InsecureChannelCredentials()));
+        grpc::ClientContext context;
+        MetricsReply reply;
+        grpc::Status status = admin->GetMetrics(&context, MetricsRequest(), &reply);
+        if (!status.ok()) {
+            std::cout << "GetMetrics rpc failed: " << status.error_message() << std::endl;
             return false;
         }
+        std::cout << reply.prometheus_text();
+        return true;
+    }
 
-        bool Match(const std::string& prefix) {
-            bool eq = db_.substr(current_, prefix.size()) == prefix;
-            current_ += prefix.size();
-            return eq;
+    // Loads the JSON DB at db_path into features with the same loader the
+    // server uses.
+    bool LoadFeatureList(const std::string& db_path,
+        std::vector<Feature>* features) {
+        FeatureStore store;
+        std::string error;
+        if (!LoadJsonDb(db_path, &store, &error)) {
+            std::cout << "Error loading the db file " << db_path << ": " << error
+                << std::endl;
+            return false;
         }
-
-        void ReadLong(long* l) {
-            size_t start = current_;
-            while (current_ != db_.size() && db_[current_] != ',' &&
-                db_[current_] != '}') {
-                current_++;
-            }
-            // It will throw an exception if fails.
-            *l = std::stol(db_.substr(start, current_ - start));
+        features->resize(store.size());
+        for (size_t i = 0; i < store.size(); i++) {
+            store.CopyTo(i, &(*features)[i]);
         }
-
-        bool failed_ = false;
-        std::string db_;
-        size_t current_ = 0;
-        const std::string location_ = "\"location\":";
-        const std::string latitude_ = "\"latitude\":";
-        const std::string longitude_ = "\"longitude\":";
-        const std::string name_ = "\"name\":";
-    };
-
-    void ParseDb(const std::string& db, std::vector<Feature>* feature_list) {
-        feature_list->clear();
-        std::string db_content(db);
-        db_content.erase(
-            std::remove_if(db_content.begin(), db_content.end(), isspace),
-            db_content.end());
-
-        Parser parser(db_content);
-        Feature feature;
-        while (!parser.Finished()) {
-            feature_list->push_back(Feature());
-            if (!parser.TryParseOne(&feature_list->back())) {
-                std::cout << "Error parsing the db file";
-                feature_list->clear();
-                break;
-            }
-        }
-        std::cout << "DB parsed, loaded " << feature_list->size() << " features."
+        std::cout << "DB parsed, loaded " << features->size() << " features."
             << std::endl;
+        return true;
     }
 
 }  
@@ -210,10 +236,11 @@ RouteNote MakeRouteNote(const std::string& message, long latitude,
 
 class RouteGuideClient {
 public:
-    RouteGuideClient(std::shared_ptr<Channel> channel, const std::string& db)
-        : stub_(RouteGuide::NewStub(channel)) {
-        routeguide::ParseDb(db, &feature_list_);
-    }
+    // async makes the pipelined calls and RouteChat.
+    RouteGuideClient(std::shared_ptr<Channel> channel,
+        routeguide::AsyncRouteGuideClient* async, std::vector<Feature> features)
+        : stub_(RouteGuide::NewStub(channel)), async_(async),
+        feature_list_(std::move(features)) {}
 
     void GetFeature() {
         Point point;
@@ -252,6 +279,45 @@ public:
         }
     }
 
+    // Lists the features of the same rectangle nearest its centre first, a
+    // few at a time, following the page tokens.
+    void ListNearestFeatures() {
+        routeguide::Rectangle rect;
+        rect.mutable_lo()->set_latitude(400000000);
+        rect.mutable_lo()->set_longitude(-750000000);
+        rect.mutable_hi()->set_latitude(420000000);
+        rect.mutable_hi()->set_longitude(-730000000);
+        rect.set_order(routeguide::Rectangle::DISTANCE_FROM_CENTER);
+        rect.set_max_results(5);
+        const int kPages = 2;
+        for (int page = 1; page <= kPages; page++) {
+            ClientContext context;
+            Feature feature;
+            std::unique_ptr<ClientReader<Feature> > reader(
+                stub_->ListFeatures(&context, rect));
+            std::cout << "Page " << page << " of the features nearest 41, -74:"
+                << std::endl;
+            while (reader->Read(&feature)) {
+                std::cout << "Found feature called " << feature.name() << " at "
+                    << feature.location().latitude() / kCoordFactor_ << ", "
+                    << feature.location().longitude() / kCoordFactor_ << std::endl;
+            }
+            Status status = reader->Finish();
+            if (!status.ok()) {
+                std::cout << "ListFeatures rpc failed: " << status.error_message()
+                    << std::endl;
+                return;
+            }
+            // The server names the next page in the trailing metadata.
+            const auto& trailers = context.GetServerTrailingMetadata();
+            auto token = trailers.find("routeguide-next-page-token");
+            if (token == trailers.end()) {
+                break;
+            }
+            rect.set_page_token(std::string(token->second.data(), token->second.size()));
+        }
+    }
+
     void RecordRoute() {
         Point point;
         RouteSummary stats;
@@ -284,7 +350,7 @@ public:
             std::cout << "Finished trip with " << stats.point_count() << " points\n"
                 << "Passed " << stats.feature_count() << " features\n"
                 << "Travelled " << stats.distance() << " meters\n"
-                << "It took " << stats.elapsed_time() << " seconds"
+                << "It took " << stats.elapsed_time_micros() / 1e6 << " seconds"
                 << std::endl;
         }
         else {
@@ -292,40 +358,219 @@ public:
         }
     }
 
-    void RouteChat() {
+    // Sends a route through every feature in the DB, in DB order, as
+    // delta-encoded batches of up to 16 points stamped a second apart.
+    void RecordRouteBatched() {
+        RouteSummary stats;
+        ClientContext context;
+        const int kBatchPoints = 16;
+        int64_t time_millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+
+        std::unique_ptr<ClientWriter<routeguide::RouteBatch> > writer(
+            stub_->RecordRouteBatched(&context, &stats));
+        routeguide::RouteBatchEncoder encoder;
+        routeguide::RouteBatch batch;
+        for (size_t i = 0; i < feature_list_.size(); i++) {
+            const Point& p = feature_list_[i].location();
+            encoder.Add(p.latitude(), p.longitude(), time_millis, &batch);
+            time_millis += 1000;
+            if (batch.latitude_deltas_size() == kBatchPoints ||
+                i + 1 == feature_list_.size()) {
+                if (!writer->Write(batch)) {
+                    break;
+                }
+                batch.Clear();
+            }
+        }
+        writer->WritesDone();
+        Status status = writer->Finish();
+        if (status.ok()) {
+            std::cout << "Finished batched trip with " << stats.point_count()
+                << " points\n"
+                << "Passed " << stats.feature_count() << " features\n"
+                << "Travelled " << stats.distance() << " meters" << std::endl;
+        }
+        else {
+            std::cout << "RecordRouteBatched rpc failed: " << status.error_message()
+                << std::endl;
+        }
+    }
+
+    // Asks for the features closest to a point, by count and by radius.
+    void NearestFeatures() {
+        routeguide::NearestRequest nearest;
+        *nearest.mutable_point() = MakePoint(409146138, -746188906);
+        nearest.set_k(3);
+        routeguide::NearbyFeatureList features;
+        ClientContext context;
+        Status status = stub_->NearestFeatures(&context, nearest, &features);
+        if (!status.ok()) {
+            std::cout << "NearestFeatures rpc failed." << std::endl;
+            return;
+        }
+        std::cout << "The " << nearest.k() << " features nearest 40.9146, -74.6189:"
+            << std::endl;
+        PrintNearby(features);
+
+        routeguide::RadiusRequest radius;
+        *radius.mutable_point() = nearest.point();
+        radius.set_metres(20000);
+        ClientContext radius_context;
+        status = stub_->FeaturesWithinRadius(&radius_context, radius, &features);
+        if (!status.ok()) {
+            std::cout << "FeaturesWithinRadius rpc failed." << std::endl;
+            return;
+        }
+        std::cout << "Features within " << radius.metres() / 1000 << " km:" << std::endl;
+        PrintNearby(features);
+    }
+
+    // Looks up the location of every feature in the DB, once in a single
+    // GetFeatures call, once over StreamFeatures in batches and once with a
+    // GetFeature call per point, all in flight together.
+    void GetFeatures() {
+        std::vector<Point> points;
+        points.reserve(feature_list_.size());
+        for (const Feature& f : feature_list_) {
+            points.push_back(f.location());
+        }
+        std::vector<Feature> features;
+        if (LookupFeatures(points, &features)) {
+            PrintLookup("GetFeatures", points.size(), features);
+        }
+        if (StreamLookupFeatures(points, 16, &features)) {
+            PrintLookup("StreamFeatures", points.size(), features);
+        }
+        if (PipelinedLookupFeatures(points, &features)) {
+            PrintLookup("Pipelined GetFeature", points.size(), features);
+        }
+    }
+
+    // Returns the features at points, in order, from one GetFeatures call.
+    bool LookupFeatures(const std::vector<Point>& points,
+        std::vector<Feature>* features) {
+        routeguide::PointList request;
+        routeguide::FeatureList response;
+        ClientContext context;
+        request.mutable_points()->Reserve(static_cast<int>(points.size()));
+        for (const Point& point : points) {
+            *request.add_points() = point;
+        }
+        Status status = stub_->GetFeatures(&context, request, &response);
+        if (!status.ok()) {
+            std::cout << "GetFeatures rpc failed." << std::endl;
+            return false;
+        }
+        features->assign(response.features().begin(), response.features().end());
+        return true;
+    }
+
+    // Returns the features at points, in order, sending batch_size points per
+    // message over one StreamFeatures stream. Batches are written from a
+    // second thread so that requests and responses overlap.
+    bool StreamLookupFeatures(const std::vector<Point>& points, size_t batch_size,
+        std::vector<Feature>* features) {
         ClientContext context;
+        std::shared_ptr<ClientReaderWriter<routeguide::PointList,
+            routeguide::FeatureList> > stream(stub_->StreamFeatures(&context));
+
+        std::thread writer([stream, &points, batch_size]() {
+            routeguide::PointList batch;
+            for (size_t i = 0; i < points.size(); i += batch_size) {
+                batch.Clear();
+                size_t end = (std::min)(points.size(), i + batch_size);
+                for (size_t j = i; j < end; j++) {
+                    *batch.add_points() = points[j];
+                }
+                if (!stream->Write(batch)) {
+                    break;
+                }
+            }
+            stream->WritesDone();
+            });
 
-        std::shared_ptr<ClientReaderWriter<RouteNote, RouteNote> > stream(
-            stub_->RouteChat(&context));
+        features->clear();
+        routeguide::FeatureList response;
+        while (stream->Read(&response)) {
+            features->insert(features->end(), response.features().begin(),
+                response.features().end());
+        }
+        writer.join();
+        Status status = stream->Finish();
+        if (!status.ok() || features->size() != points.size()) {
+            std::cout << "StreamFeatures rpc failed." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Returns the features at points, in order, from one GetFeature call
+    // per point, started back to back.
+    bool PipelinedLookupFeatures(const std::vector<Point>& points,
+        std::vector<Feature>* features) {
+        std::vector<std::future<routeguide::FeatureResult>> results;
+        results.reserve(points.size());
+        for (const Point& point : points) {
+            results.push_back(async_->GetFeature(point));
+        }
+        features->clear();
+        bool ok = true;
+        for (auto& result : results) {
+            routeguide::FeatureResult r = result.get();
+            ok = ok && r.status.ok();
+            features->push_back(std::move(r.feature));
+        }
+        if (!ok) {
+            std::cout << "Pipelined GetFeature rpc failed." << std::endl;
+        }
+        return ok;
+    }
 
-        std::thread writer([stream]() {
-            std::vector<RouteNote> notes{ MakeRouteNote("First message", 0, 0),
-                                         MakeRouteNote("Second message", 0, 1),
-                                         MakeRouteNote("Third message", 1, 0),
-                                         MakeRouteNote("Fourth message", 0, 0) };
+    void RouteChat() {
+        std::vector<RouteNote> notes{ MakeRouteNote("First message", 0, 0),
+                                     MakeRouteNote("Second message", 0, 1),
+                                     MakeRouteNote("Third message", 1, 0),
+                                     MakeRouteNote("Fourth message", 0, 0) };
         for (const RouteNote& note : notes) {
             std::cout << "Sending message " << note.message() << " at "
                 << note.location().latitude() << ", "
                 << note.location().longitude() << std::endl;
-            stream->Write(note);
         }
-        stream->WritesDone();
-            });
-
-        RouteNote server_note;
-        while (stream->Read(&server_note)) {
+        std::promise<Status> done;
+        async_->RouteChat(std::move(notes), [](const RouteNote& server_note) {
             std::cout << "Got message " << server_note.message() << " at "
                 << server_note.location().latitude() << ", "
                 << server_note.location().longitude() << std::endl;
-        }
-        writer.join();
-        Status status = stream->Finish();
-        if (!status.ok()) {
+            }, [&done](const Status& status) { done.set_value(status); });
+        if (!done.get_future().get().ok()) {
             std::cout << "RouteChat rpc failed." << std::endl;
         }
     }
 
 private:
+    void PrintNearby(const routeguide::NearbyFeatureList& features) {
+        for (const routeguide::NearbyFeature& nearby : features.features()) {
+            const Feature& f = nearby.feature();
+            std::cout << "Found feature called " << f.name() << " at "
+                << f.location().latitude() / kCoordFactor_ << ", "
+                << f.location().longitude() / kCoordFactor_ << ", "
+                << static_cast<int>(nearby.metres()) << " m away" << std::endl;
+        }
+    }
+
+    void PrintLookup(const std::string& rpc, size_t point_count,
+        const std::vector<Feature>& features) {
+        size_t named = 0;
+        for (const Feature& f : features) {
+            if (!f.name().empty()) {
+                named++;
+            }
+        }
+        std::cout << rpc << " found " << named << " named features at "
+            << point_count << " points." << std::endl;
+    }
+
     bool GetOneFeature(const Point& point, Feature* feature) {
         ClientContext context;
         Status status = stub_->GetFeature(&context, point, feature);
@@ -352,23 +597,47 @@ private:
 
     const float kCoordFactor_ = 10000000.0;
     std::unique_ptr<RouteGuide::Stub> stub_;
+    routeguide::AsyncRouteGuideClient* async_;
     std::vector<Feature> feature_list_;
 };
 
 int main(int argc, char** argv) {
-    // Expect only arg: --db_path=path/to/route_guide_db.json.
-    std::string db = routeguide::GetDbFileContent(argc, argv);
+    // Expected args: --db_path=path/to/route_guide_db.json, optionally
+    // --target=host:port, and --benchmark plus its options for a load test.
+    routeguide::ClientOptions options;
+    if (!routeguide::ParseClientOptions(argc, argv, &options)) {
+        return 1;
+    }
+    if (options.metrics) {
+        return routeguide::PrintMetrics(options.target) ? 0 : 1;
+    }
+    std::vector<Feature> features;
+    if (!routeguide::LoadFeatureList(options.db_path, &features)) {
+        return 1;
+    }
+    if (options.benchmark) {
+        return routeguide::RunBenchmark(options.bench, features) ? 0 : 1;
+    }
+    routeguide::AsyncClientOptions async_options;
+    async_options.target = options.target;
+    routeguide::AsyncRouteGuideClient async(async_options);
     RouteGuideClient guide(
-        grpc::CreateChannel("localhost:50051",
+        grpc::CreateChannel(options.target,
             grpc::InsecureChannelCredentials()),
-        db);
+        &async, std::move(features));
 
     std::cout << "-------------- GetFeature --------------" << std::endl;
     guide.GetFeature();
     std::cout << "-------------- ListFeatures --------------" << std::endl;
     guide.ListFeatures();
+    guide.ListNearestFeatures();
     std::cout << "-------------- RecordRoute --------------" << std::endl;
     guide.RecordRoute();
+    guide.RecordRouteBatched();
+    std::cout << "-------------- NearestFeatures --------------" << std::endl;
+    guide.NearestFeatures();
+    std::cout << "-------------- GetFeatures --------------" << std::endl;
+    guide.GetFeatures();
     std::cout << "-------------- RouteChat --------------" << std::endl;
     guide.RouteChat();
 
@@ -0,0 +1,14 @@
+#include "admin_service.h"
+
+#include "route_router.h"
+
+namespace routeguide {
+
+    grpc::Status AdminService::GetMetrics(grpc::ServerContext* /*context*/,
+        const MetricsRequest* /*request*/, MetricsReply* reply) {
+        reply->set_prometheus_text(state_ != nullptr ? state_->MetricsText()
+            : router_->MetricsText());
+        return grpc::Status::OK;
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,31 @@
+#ifndef ROUTE_SERVER_ADMIN_SERVICE_H
+#define ROUTE_SERVER_ADMIN_SERVICE_H
+
+#include <grpcpp/server_context.h>
+#include "route_guide.grpc.pb.h"
+#include "route_guide_state.h"
+
+namespace routeguide {
+
+    class RouteRouter;
+
+    // RouteGuideAdmin, served synchronously next to either RouteGuide server
+    // or the router. A scrape reads the metrics without locks, apart from
+    // taking each note shard's lock briefly for its totals.
+    class AdminService final : public RouteGuideAdmin::Service {
+    public:
+        explicit AdminService(const RouteGuideState* state) : state_(state) {}
+        explicit AdminService(const RouteRouter* router) : router_(router) {}
+
+        grpc::Status GetMetrics(grpc::ServerContext* context,
+            const MetricsRequest* request, MetricsReply* reply) override;
+
+    private:
+        // Exactly one is set.
+        const RouteGuideState* state_ = nullptr;
+        const RouteRouter* router_ = nullptr;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_ADMIN_SERVICE_H
@@ -0,0 +1,663 @@
+#include "async_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <optional>
+
+#include <grpc/support/time.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server_builder.h>
+#include <grpcpp/server_context.h>
+#include "rpc_arena.h"
+#include "wire_buffer.h"
+
+namespace routeguide {
+
+    namespace {
+        using grpc::ServerAsyncReader;
+        using grpc::ServerAsyncReaderWriter;
+        using grpc::ServerAsyncResponseWriter;
+        using grpc::ServerAsyncWriter;
+        using grpc::ServerCompletionQueue;
+        using grpc::ServerContext;
+        using grpc::Status;
+
+        // How long Shutdown() lets open calls finish before cancelling them.
+        const auto kShutdownGrace = std::chrono::seconds(1);
+
+        // What the polling threads find on a completion queue. Proceed()
+        // runs on the polling thread when the tagged operation completes.
+        class Tag {
+        public:
+            virtual ~Tag() = default;
+            virtual void Proceed(bool ok) = 0;
+        };
+
+        // Tag that forwards to a member function, for calls that keep more
+        // than one operation outstanding.
+        template <typename C>
+        class MemberTag final : public Tag {
+        public:
+            MemberTag(C* call, void (C::*handler)(bool))
+                : call_(call), handler_(handler) {}
+            void Proceed(bool ok) override { (call_->*handler_)(ok); }
+
+        private:
+            C* call_;
+            void (C::*handler_)(bool);
+        };
+
+        // One RPC in flight. The object is its own completion-queue tag, and
+        // most calls keep a single operation outstanding, so Proceed() just
+        // steps them along; the call deletes itself once it is done. A call
+        // re-arms its RPC type with a fresh object as soon as it is matched,
+        // so every queue always has one request of each kind pending. The
+        // timer runs from the match until the call is deleted.
+        class Call : public Tag {
+        public:
+            Call(RawAsyncService* service, ServerCompletionQueue* cq,
+                RouteGuideState* state)
+                : service_(service), cq_(cq), state_(state) {}
+
+        protected:
+            RawAsyncService* service_;
+            ServerCompletionQueue* cq_;
+            RouteGuideState* state_;
+            ServerContext context_;
+            std::optional<RpcTimer> timer_;
+        };
+
+        // A simple RPC answered straight from RouteGuideState: GetFeatures,
+        // NearestFeatures and FeaturesWithinRadius differ only in their types
+        // and the two methods named. The messages live on the call's arena.
+        template <typename Request, typename Response>
+        class UnaryCall final : public Call {
+        public:
+            using RequestMethod = void (RawAsyncService::*)(ServerContext*,
+                Request*, ServerAsyncResponseWriter<Response>*, grpc::CompletionQueue*,
+                ServerCompletionQueue*, void*);
+            using Handler = void (RouteGuideState::*)(const Request&, Response*) const;
+
+            UnaryCall(RawAsyncService* service, ServerCompletionQueue* cq,
+                RouteGuideState* state, Rpc rpc, RequestMethod request, Handler handler)
+                : Call(service, cq, state), rpc_(rpc), request_method_(request),
+                handler_(handler), request_(arena_.Create<Request>()),
+                response_(arena_.Create<Response>()), responder_(&context_) {
+                (service_->*request_method_)(&context_, request_, &responder_, cq_,
+                    cq_, this);
+            }
+
+            void Proceed(bool ok) override {
+                if (finishing_ || !ok) {
+                    delete this;
+                    return;
+                }
+                new UnaryCall(service_, cq_, state_, rpc_, request_method_, handler_);
+                timer_.emplace(state_->metrics(), rpc_);
+                (state_->*handler_)(*request_, response_);
+                finishing_ = true;
+                responder_.Finish(*response_, Status::OK, this);
+            }
+
+        private:
+            Rpc rpc_;
+            RequestMethod request_method_;
+            Handler handler_;
+            // Holds the request and response, so that building a response
+            // of many features does not allocate each one.
+            RpcArena arena_;
+            Request* request_;
+            Response* response_;
+            ServerAsyncResponseWriter<Response> responder_;
+            bool finishing_ = false;
+        };
+
+        // GetFeature, raw: the response is the feature's wire bytes.
+        class GetFeatureCall final : public Call {
+        public:
+            GetFeatureCall(RawAsyncService* service, ServerCompletionQueue* cq,
+                RouteGuideState* state)
+                : Call(service, cq, state), responder_(&context_) {
+                service_->RequestGetFeature(&context_, &request_, &responder_, cq_, cq_,
+                    this);
+            }
+
+            void Proceed(bool ok) override {
+                if (finishing_ || !ok) {
+                    delete this;
+                    return;
+                }
+                new GetFeatureCall(service_, cq_, state_);
+                timer_.emplace(state_->metrics(), Rpc::kGetFeature);
+                finishing_ = true;
+                std::string error;
+                if (!state_->GetFeature(request_, &response_, &error)) {
+                    responder_.FinishWithError(
+                        Status(grpc::StatusCode::INVALID_ARGUMENT, error), this);
+                    return;
+                }
+                responder_.Finish(response_, Status::OK, this);
+            }
+
+        private:
+            grpc::ByteBuffer request_;
+            grpc::ByteBuffer response_;
+            ServerAsyncResponseWriter<grpc::ByteBuffer> responder_;
+            bool finishing_ = false;
+        };
+
+        // ListFeatures, raw: each feature is written as its wire bytes. A
+        // page can be long, so the call also asks to be told when it is done
+        // and stops writing once the client has gone. It is deleted when both
+        // its last operation and the done notice are back.
+        class ListFeaturesCall final : public Call {
+        public:
+            ListFeaturesCall(RawAsyncService* service,
+                ServerCompletionQueue* cq, RouteGuideState* state)
+                : Call(service, cq, state), writer_(&context_),
+                done_tag_(this, &ListFeaturesCall::OnDone) {
+                // Only delivered if the request is matched.
+                context_.AsyncNotifyWhenDone(&done_tag_);
+                service_->RequestListFeatures(&context_, &request_, &writer_, cq_,
+                    cq_, this);
+            }
+
+            void Proceed(bool ok) override {
+                if (stage_ == Stage::kRequest && !ok) {
+                    delete this;
+                    return;
+                }
+                if (stage_ == Stage::kFinish || !ok) {
+                    stage_ = Stage::kDone;
+                    DeleteIfDone();
+                    return;
+                }
+                if (stage_ == Stage::kRequest) {
+                    new ListFeaturesCall(service_, cq_, state_);
+                    timer_.emplace(state_->metrics(), Rpc::kListFeatures);
+                    std::string error;
+                    page_ = state_->ListFeatures(request_, &error);
+                    if (page_ == nullptr) {
+                        stage_ = Stage::kFinish;
+                        writer_.Finish(Status(grpc::StatusCode::INVALID_ARGUMENT, error),
+                            this);
+                        return;
+                    }
+                    if (!page_->next_page_token.empty()) {
+                        context_.AddTrailingMetadata(kNextPageTokenKey,
+                            page_->next_page_token);
+                    }
+                    stage_ = Stage::kWrite;
+                }
+                WriteNext();
+            }
+
+        private:
+            enum class Stage { kRequest, kWrite, kFinish, kDone };
+
+            void OnDone(bool /*ok*/) {
+                done_ = true;
+                DeleteIfDone();
+            }
+
+            void DeleteIfDone() {
+                if (done_ && stage_ == Stage::kDone) {
+                    delete this;
+                }
+            }
+
+            void WriteNext() {
+                if (context_.IsCancelled()) {
+                    stage_ = Stage::kDone;
+                    DeleteIfDone();
+                    return;
+                }
+                size_t n = page_->positions.size();
+                if (next_ == n) {
+                    stage_ = Stage::kFinish;
+                    writer_.Finish(Status::OK, this);
+                    return;
+                }
+                feature_ = WireBuffer(page_->db->encoded().Get(page_->positions[next_]));
+                grpc::WriteOptions options = ListWriteOptions(next_, n);
+                if (++next_ == n) {
+                    // The last feature goes out together with the status.
+                    stage_ = Stage::kFinish;
+                    writer_.WriteAndFinish(feature_, options, Status::OK, this);
+                    return;
+                }
+                writer_.Write(feature_, options, this);
+            }
+
+            grpc::ByteBuffer request_;
+            ServerAsyncWriter<grpc::ByteBuffer> writer_;
+            MemberTag<ListFeaturesCall> done_tag_;
+            Stage stage_ = Stage::kRequest;
+            bool done_ = false;
+            std::shared_ptr<const FeaturePage> page_;
+            size_t next_ = 0;
+            grpc::ByteBuffer feature_;
+        };
+
+        // Adds a RecordRoute or RecordRouteBatched message to the route.
+        bool AddToRoute(RouteRecorder* recorder, const Point& point,
+            std::string* /*error*/) {
+            recorder->Add(point);
+            return true;
+        }
+
+        bool AddToRoute(RouteRecorder* recorder, const RouteBatch& batch,
+            std::string* error) {
+            return recorder->Add(batch, error);
+        }
+
+        // RecordRoute and RecordRouteBatched, which differ only in the
+        // message read from the stream.
+        template <typename Message>
+        class RecordRouteCall final : public Call {
+        public:
+            using RequestMethod = void (RawAsyncService::*)(ServerContext*,
+                ServerAsyncReader<RouteSummary, Message>*, grpc::CompletionQueue*,
+                ServerCompletionQueue*, void*);
+
+            RecordRouteCall(RawAsyncService* service, ServerCompletionQueue* cq,
+                RouteGuideState* state, Rpc rpc, RequestMethod request)
+                : Call(service, cq, state), rpc_(rpc), request_method_(request),
+                reader_(&context_) {
+                (service_->*request_method_)(&context_, &reader_, cq_, cq_, this);
+            }
+
+            void Proceed(bool ok) override {
+                switch (stage_) {
+                case Stage::kRequest:
+                    if (!ok) {
+                        delete this;
+                        return;
+                    }
+                    new RecordRouteCall(service_, cq_, state_, rpc_, request_method_);
+                    timer_.emplace(state_->metrics(), rpc_);
+                    recorder_.emplace(*state_);
+                    stage_ = Stage::kRead;
+                    break;
+                case Stage::kRead:
+                    if (!ok) {
+                        // The client has sent its last point.
+                        recorder_->Finish(&summary_);
+                        stage_ = Stage::kFinish;
+                        reader_.Finish(summary_, Status::OK, this);
+                        return;
+                    }
+                    if (!AddToRoute(&*recorder_, message_, &error_)) {
+                        stage_ = Stage::kFinish;
+                        reader_.FinishWithError(
+                            Status(grpc::StatusCode::INVALID_ARGUMENT, error_), this);
+                        return;
+                    }
+                    break;
+                case Stage::kFinish:
+                    delete this;
+                    return;
+                }
+                reader_.Read(&message_, this);
+            }
+
+        private:
+            enum class Stage { kRequest, kRead, kFinish };
+
+            Rpc rpc_;
+            RequestMethod request_method_;
+            ServerAsyncReader<RouteSummary, Message> reader_;
+            Stage stage_ = Stage::kRequest;
+            std::optional<RouteRecorder> recorder_;
+            Message message_;
+            RouteSummary summary_;
+            std::string error_;
+        };
+
+        // Reads a note, writes back the earlier notes at its location one at a
+        // time, then reads the next note, exactly like the synchronous loop.
+        // With live delivery on, notes that other clients post later at the
+        // stream's locations are written as well; the subscriber wakes the
+        // call through an alarm on its queue. The read, a write and the alarm
+        // can then be outstanding together, so each has its own tag, and the
+        // call is deleted once none is left.
+        class RouteChatCall final : public Call {
+        public:
+            RouteChatCall(RawAsyncService* service,
+                ServerCompletionQueue* cq, RouteGuideState* state)
+                : Call(service, cq, state), stream_(&context_),
+                read_tag_(this, &RouteChatCall::OnRead),
+                write_tag_(this, &RouteChatCall::OnWrite),
+                wake_tag_(this, &RouteChatCall::OnWake),
+                saved_tag_(this, &RouteChatCall::OnSaved),
+                finish_tag_(this, &RouteChatCall::OnFinish),
+                note_(arena_.Create<RouteNote>()), outbox_(arena_.Create<NoteList>()) {
+                service_->RequestRouteChat(&context_, &stream_, cq_, cq_, this);
+            }
+
+            // The request was matched.
+            void Proceed(bool ok) override {
+                if (!ok) {
+                    delete this;
+                    return;
+                }
+                new RouteChatCall(service_, cq_, state_);
+                timer_.emplace(state_->metrics(), Rpc::kRouteChat);
+                // Runs on the posting thread, under the subscriber's lock.
+                subscriber_ = state_->NewSubscriber([this] {
+                    wake_.Set(cq_, gpr_now(GPR_CLOCK_MONOTONIC), &wake_tag_);
+                });
+                Pump();
+            }
+
+        private:
+            void OnRead(bool ok) {
+                pending_--;
+                reading_ = false;
+                if (!ok) {
+                    // The client is done sending, or the call is gone.
+                    read_done_ = true;
+                }
+                else if (!broken_) {
+                    ticket_ = state_->RouteChat(*note_, outbox_, subscriber_);
+                }
+                Pump();
+            }
+
+            void OnSaved(bool /*ok*/) {
+                pending_--;
+                Pump();
+            }
+
+            void OnWrite(bool ok) {
+                pending_--;
+                writing_ = false;
+                if (ok) {
+                    if (++next_write_ == outbox_->size()) {
+                        // Keeps the notes' buffers for the next ones.
+                        outbox_->Clear();
+                        next_write_ = 0;
+                    }
+                }
+                else {
+                    broken_ = true;
+                    EndChat();
+                }
+                Pump();
+            }
+
+            void OnWake(bool ok) {
+                wake_outstanding_ = false;
+                // Not ok when EndChat() cancelled the alarm.
+                if (ok && subscriber_ != nullptr) {
+                    woken_ = true;
+                }
+                Pump();
+            }
+
+            void OnFinish(bool /*ok*/) {
+                pending_--;
+                finished_ = true;
+                Pump();
+            }
+
+            // Starts whatever comes next: the next queued write, else another
+            // read, else Finish once the client is done and all is written.
+            void Pump() {
+                if (broken_ || finishing_) {
+                    if ((finished_ || broken_) && pending_ == 0 && !wake_outstanding_) {
+                        delete this;
+                    }
+                    return;
+                }
+                if (writing_) {
+                    return;
+                }
+                if (outbox_->empty() && woken_) {
+                    woken_ = false;
+                    subscriber_->Drain(outbox_);
+                }
+                if (!outbox_->empty()) {
+                    writing_ = true;
+                    pending_++;
+                    stream_.Write(outbox_->Get(next_write_), &write_tag_);
+                    return;
+                }
+                if (read_done_) {
+                    if (ticket_ != 0) {
+                        // Finishes once the notes are saved; the result
+                        // comes back from the log's thread through the alarm.
+                        uint64_t ticket = ticket_;
+                        ticket_ = 0;
+                        pending_++;
+                        state_->OnNotesSaved(ticket, [this](bool saved) {
+                            save_failed_ = !saved;
+                            saved_.Set(cq_, gpr_now(GPR_CLOCK_MONOTONIC), &saved_tag_);
+                        });
+                        return;
+                    }
+                    if (pending_ > 0) {
+                        // Still saving.
+                        return;
+                    }
+                    EndChat();
+                    finishing_ = true;
+                    pending_++;
+                    stream_.Finish(save_failed_
+                        ? Status(grpc::StatusCode::INTERNAL,
+                            "RouteChat notes could not be written to the note log")
+                        : Status::OK, &finish_tag_);
+                    return;
+                }
+                if (!reading_) {
+                    reading_ = true;
+                    pending_++;
+                    stream_.Read(note_, &read_tag_);
+                }
+            }
+
+            void EndChat() {
+                if (subscriber_ == nullptr) {
+                    return;
+                }
+                // A wake that was issued but has not fired yet must be
+                // cancelled, and its tag waited for, before the call can go.
+                if (state_->EndChat(subscriber_) && !woken_) {
+                    wake_outstanding_ = true;
+                    wake_.Cancel();
+                }
+                subscriber_ = nullptr;
+                woken_ = false;
+            }
+
+            ServerAsyncReaderWriter<RouteNote, RouteNote> stream_;
+            MemberTag<RouteChatCall> read_tag_;
+            MemberTag<RouteChatCall> write_tag_;
+            MemberTag<RouteChatCall> wake_tag_;
+            MemberTag<RouteChatCall> saved_tag_;
+            MemberTag<RouteChatCall> finish_tag_;
+            grpc::Alarm wake_;
+            // Fires once the notes are saved.
+            grpc::Alarm saved_;
+            std::shared_ptr<NoteSubscriber> subscriber_;
+            // The note read and the notes to write, on the call's arena and
+            // reused for the whole stream.
+            RpcArena arena_;
+            RouteNote* note_;
+            // Written front to back from next_write_, and cleared once all
+            // are written. Queueing more never moves the note being written:
+            // the list only holds pointers to its notes.
+            NoteList* outbox_;
+            int next_write_ = 0;
+            // Ticket of the last note not yet waited for (see
+            // RouteGuideState::RouteChat), and whether saving failed.
+            uint64_t ticket_ = 0;
+            bool save_failed_ = false;
+            // Read, write, save and Finish operations not completed yet.
+            int pending_ = 0;
+            bool reading_ = false;
+            bool writing_ = false;
+            bool read_done_ = false;
+            bool woken_ = false;
+            bool wake_outstanding_ = false;
+            bool broken_ = false;
+            bool finishing_ = false;
+            bool finished_ = false;
+        };
+
+        // Answers each PointList with its FeatureList before reading the next.
+        class StreamFeaturesCall final : public Call {
+        public:
+            StreamFeaturesCall(RawAsyncService* service,
+                ServerCompletionQueue* cq, RouteGuideState* state)
+                : Call(service, cq, state), stream_(&context_) {
+                service_->RequestStreamFeatures(&context_, &stream_, cq_, cq_, this);
+            }
+
+            void Proceed(bool ok) override {
+                switch (stage_) {
+                case Stage::kRequest:
+                    if (!ok) {
+                        delete this;
+                        return;
+                    }
+                    new StreamFeaturesCall(service_, cq_, state_);
+                    timer_.emplace(state_->metrics(), Rpc::kStreamFeatures);
+                    break;
+                case Stage::kRead:
+                    if (!ok) {
+                        stage_ = Stage::kFinish;
+                        stream_.Finish(Status::OK, this);
+                        return;
+                    }
+                    features_.Clear();
+                    state_->GetFeatures(points_, &features_);
+                    stage_ = Stage::kWrite;
+                    stream_.Write(features_, this);
+                    return;
+                case Stage::kWrite:
+                    if (!ok) {
+                        delete this;
+                        return;
+                    }
+                    break;
+                case Stage::kFinish:
+                    delete this;
+                    return;
+                }
+                stage_ = Stage::kRead;
+                stream_.Read(&points_, this);
+            }
+
+        private:
+            enum class Stage { kRequest, kRead, kWrite, kFinish };
+
+            ServerAsyncReaderWriter<FeatureList, PointList> stream_;
+            Stage stage_ = Stage::kRequest;
+            PointList points_;
+            FeatureList features_;
+        };
+    }
+
+    AsyncRouteGuideServer::AsyncRouteGuideServer(RouteGuideState* state,
+        int completion_queues)
+        : state_(state), completion_queue_count_((std::max)(completion_queues, 1)) {}
+
+    AsyncRouteGuideServer::~AsyncRouteGuideServer() {
+        Shutdown();
+        Wait();
+    }
+
+    void AsyncRouteGuideServer::Run(const std::string& address) {
+        if (Start(address)) {
+            Wait();
+        }
+    }
+
+    bool AsyncRouteGuideServer::Start(const std::string& address) {
+        grpc::ServerBuilder builder;
+        if (!address.empty()) {
+            builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+        }
+        builder.RegisterService(&service_);
+        for (grpc::Service* service : extra_services_) {
+            builder.RegisterService(service);
+        }
+        for (int i = 0; i < completion_queue_count_; i++) {
+            cqs_.push_back(builder.AddCompletionQueue());
+        }
+        server_ = builder.BuildAndStart();
+        if (server_ == nullptr) {
+            std::cout << "Failed to listen on " << address << std::endl;
+            return false;
+        }
+        for (auto& cq : cqs_) {
+            new GetFeatureCall(&service_, cq.get(), state_);
+            new UnaryCall<PointList, FeatureList>(&service_, cq.get(), state_,
+                Rpc::kGetFeatures,
+                &RawAsyncService::RequestGetFeatures,
+                &RouteGuideState::GetFeatures);
+            new UnaryCall<NearestRequest, NearbyFeatureList>(&service_, cq.get(),
+                state_, Rpc::kNearestFeatures,
+                &RawAsyncService::RequestNearestFeatures,
+                &RouteGuideState::NearestFeatures);
+            new UnaryCall<RadiusRequest, NearbyFeatureList>(&service_, cq.get(),
+                state_, Rpc::kFeaturesWithinRadius,
+                &RawAsyncService::RequestFeaturesWithinRadius,
+                &RouteGuideState::FeaturesWithinRadius);
+            new ListFeaturesCall(&service_, cq.get(), state_);
+            new RecordRouteCall<Point>(&service_, cq.get(), state_, Rpc::kRecordRoute,
+                &RawAsyncService::RequestRecordRoute);
+            new RecordRouteCall<RouteBatch>(&service_, cq.get(), state_,
+                Rpc::kRecordRouteBatched, &RawAsyncService::RequestRecordRouteBatched);
+            new RouteChatCall(&service_, cq.get(), state_);
+            new StreamFeaturesCall(&service_, cq.get(), state_);
+            threads_.emplace_back(&AsyncRouteGuideServer::Poll, this, cq.get());
+        }
+        if (!address.empty()) {
+            std::cout << "Server listening on " << address << " with "
+                << completion_queue_count_ << " completion queue(s)" << std::endl;
+        }
+        return true;
+    }
+
+    void AsyncRouteGuideServer::Wait() {
+        if (threads_.empty()) {
+            return;
+        }
+        // Wait() returns once Shutdown() has finished every call. Only then
+        // can the queues be shut down: no call may start an operation on a
+        // queue that is already shutting down.
+        server_->Wait();
+        for (auto& cq : cqs_) {
+            cq->Shutdown();
+        }
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+        threads_.clear();
+    }
+
+    std::shared_ptr<grpc::Channel> AsyncRouteGuideServer::InProcessChannel() {
+        return server_->InProcessChannel(grpc::ChannelArguments());
+    }
+
+    void AsyncRouteGuideServer::Shutdown() {
+        if (server_ != nullptr) {
+            server_->Shutdown(std::chrono::system_clock::now() + kShutdownGrace);
+        }
+    }
+
+    void AsyncRouteGuideServer::Poll(ServerCompletionQueue* cq) {
+        void* tag;
+        bool ok;
+        // Next() keeps returning events after Shutdown() until the queue is
+        // drained, so every pending call gets to delete itself.
+        while (cq->Next(&tag, &ok)) {
+            static_cast<Tag*>(tag)->Proceed(ok);
+        }
+    }
+
+}  // namespace routeguide
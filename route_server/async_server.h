@@ -0,0 +1,60 @@
+#ifndef ROUTE_SERVER_ASYNC_SERVER_H
+#define ROUTE_SERVER_ASYNC_SERVER_H
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/channel.h>
+#include <grpcpp/completion_queue.h>
+#include <grpcpp/server.h>
+#include "route_guide.grpc.pb.h"
+#include "route_guide_state.h"
+
+namespace routeguide {
+
+    // The service the completion-queue server registers. GetFeature and
+    // ListFeatures are raw: they answer from the DB's wire bytes.
+    using RawAsyncService = RouteGuide::WithRawMethod_GetFeature<
+        RouteGuide::WithRawMethod_ListFeatures<RouteGuide::AsyncService>>;
+
+    // RouteGuide served through the completion-queue API. Every call is a
+    // small state machine that keeps at most one operation outstanding, so an
+    // idle stream costs memory but no thread. Each completion queue is polled
+    // by exactly one thread and owns the calls it accepted.
+    class AsyncRouteGuideServer {
+    public:
+        AsyncRouteGuideServer(RouteGuideState* state, int completion_queues);
+        ~AsyncRouteGuideServer();
+
+        // Registers another (synchronous) service on the same port. Call
+        // before Run().
+        void AddService(grpc::Service* service) { extra_services_.push_back(service); }
+        // Starts listening on address and blocks until Shutdown().
+        void Run(const std::string& address);
+        // Run() in two steps: Start() returns once the server is serving, on
+        // address if it is not empty, and Wait() blocks until Shutdown().
+        bool Start(const std::string& address);
+        void Wait();
+        // Stops accepting calls, cancels the open ones and drains the queues.
+        void Shutdown();
+
+        // A channel to the started server that bypasses the network.
+        std::shared_ptr<grpc::Channel> InProcessChannel();
+
+    private:
+        void Poll(grpc::ServerCompletionQueue* cq);
+
+        RouteGuideState* state_;
+        int completion_queue_count_;
+        RawAsyncService service_;
+        std::vector<grpc::Service*> extra_services_;
+        std::unique_ptr<grpc::Server> server_;
+        std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+        std::vector<std::thread> threads_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_ASYNC_SERVER_H
@@ -0,0 +1,83 @@
+#include "db_watcher.h"
+
+#include <atomic>
+#include <csignal>
+#include <iostream>
+#include <system_error>
+
+namespace routeguide {
+
+    namespace {
+        // How often the watcher looks for a pending SIGHUP.
+        const auto kSignalTick = std::chrono::milliseconds(250);
+
+        // Set by the signal handler, which may do little else.
+        std::atomic<bool> reload_requested(false);
+
+#ifdef SIGHUP
+        extern "C" void OnSighup(int) {
+            reload_requested.store(true);
+        }
+#endif
+    }
+
+    DbWatcher::DbWatcher(RouteGuideState* state, const std::string& db_path,
+        std::chrono::seconds poll_interval)
+        : state_(state), db_path_(db_path), poll_interval_(poll_interval) {
+        std::error_code ec;
+        last_write_time_ = std::filesystem::last_write_time(db_path_, ec);
+#ifdef SIGHUP
+        std::signal(SIGHUP, OnSighup);
+#else
+        if (poll_interval_.count() == 0) {
+            return;  // Nothing to watch for.
+        }
+#endif
+        thread_ = std::thread(&DbWatcher::Run, this);
+    }
+
+    DbWatcher::~DbWatcher() {
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        stop_cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void DbWatcher::Run() {
+        auto next_poll = std::chrono::steady_clock::now() + poll_interval_;
+        std::unique_lock<std::mutex> lock(mu_);
+        while (!stop_cv_.wait_for(lock, kSignalTick, [this] { return stop_; })) {
+            if (reload_requested.exchange(false)) {
+                Reload("SIGHUP");
+            }
+            if (poll_interval_.count() == 0 ||
+                std::chrono::steady_clock::now() < next_poll) {
+                continue;
+            }
+            next_poll = std::chrono::steady_clock::now() + poll_interval_;
+            std::error_code ec;
+            auto write_time = std::filesystem::last_write_time(db_path_, ec);
+            if (!ec && write_time != last_write_time_) {
+                Reload("file change");
+            }
+        }
+    }
+
+    void DbWatcher::Reload(const char* reason) {
+        // Remember the version being loaded, so a failed load is retried
+        // only once the file changes again.
+        std::error_code ec;
+        last_write_time_ = std::filesystem::last_write_time(db_path_, ec);
+        std::cout << "Reloading " << db_path_.string() << " on " << reason << std::endl;
+        std::string error;
+        if (!state_->ReloadDb(&error)) {
+            std::cout << "Reload failed, still serving the previous DB: " << error
+                << std::endl;
+        }
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,44 @@
+#ifndef ROUTE_SERVER_DB_WATCHER_H
+#define ROUTE_SERVER_DB_WATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "route_guide_state.h"
+
+namespace routeguide {
+
+    // Reloads the feature DB in the background when asked to by SIGHUP
+    // (where the platform has it) or, if poll_interval is non-zero, when
+    // the file's modification time changes. The load runs on the watcher's
+    // own thread; calls keep being served from the old DB until the new one
+    // is published.
+    class DbWatcher {
+    public:
+        DbWatcher(RouteGuideState* state, const std::string& db_path,
+            std::chrono::seconds poll_interval);
+        ~DbWatcher();
+        DbWatcher(const DbWatcher&) = delete;
+        DbWatcher& operator=(const DbWatcher&) = delete;
+
+    private:
+        void Run();
+        void Reload(const char* reason);
+
+        RouteGuideState* state_;
+        std::filesystem::path db_path_;
+        std::chrono::seconds poll_interval_;
+        std::filesystem::file_time_type last_write_time_;
+        std::mutex mu_;
+        std::condition_variable stop_cv_;
+        bool stop_ = false;
+        std::thread thread_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_DB_WATCHER_H
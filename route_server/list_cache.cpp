@@ -0,0 +1,88 @@
+#include "list_cache.h"
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace routeguide {
+
+    namespace {
+        // Allocator and bookkeeping overhead of an entry: its list and map
+        // nodes and the page's control block.
+        const size_t kEntryOverhead = 128;
+
+        // What an entry counts against the capacity.
+        size_t EntryBytes(std::string_view key, const FeaturePage& page) {
+            return kEntryOverhead + sizeof(FeaturePage) + key.size() +
+                page.positions.capacity() * sizeof(uint32_t) +
+                page.next_page_token.capacity();
+        }
+    }
+
+    ListCache::ListCache(size_t capacity, size_t shard_count) {
+        size_t count = 1;
+        while (count < shard_count) {
+            count <<= 1;
+        }
+        shards_.reset(new Shard[count]);
+        mask_ = count - 1;
+        shard_capacity_ = capacity / count;
+    }
+
+    void ListCache::Reset(const FeatureDb* db) {
+        for (size_t i = 0; i <= mask_; i++) {
+            Shard& shard = shards_[i];
+            std::unique_lock<std::mutex> lock(shard.mu);
+            shard.db = db;
+            shard.index.clear();
+            shard.entries.clear();
+            shard.bytes = 0;
+        }
+    }
+
+    std::shared_ptr<const FeaturePage> ListCache::Find(std::string_view key) {
+        if (!enabled()) {
+            return nullptr;
+        }
+        Shard& shard = ShardFor(std::hash<std::string_view>()(key));
+        std::unique_lock<std::mutex> lock(shard.mu);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            return nullptr;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return it->second->page;
+    }
+
+    void ListCache::Insert(std::string_view key,
+        std::shared_ptr<const FeaturePage> page) {
+        size_t bytes = EntryBytes(key, *page);
+        if (!enabled() || bytes > shard_capacity_ / 4) {
+            return;
+        }
+        size_t hash = std::hash<std::string_view>()(key);
+        Shard& shard = ShardFor(hash);
+        std::unique_lock<std::mutex> lock(shard.mu);
+        // A page of an older DB, computed while a reload was published, or
+        // of a newer one not yet announced through Reset().
+        if (page->db.get() != shard.db || shard.index.count(key) != 0) {
+            return;
+        }
+        size_t& miss = shard.misses[hash % kMissSlots];
+        if (miss != hash) {
+            miss = hash;
+            return;
+        }
+        while (shard.bytes + bytes > shard_capacity_) {
+            Entry& last = shard.entries.back();
+            shard.bytes -= last.bytes;
+            shard.index.erase(std::string_view(last.key));
+            shard.entries.pop_back();
+        }
+        shard.entries.push_front(Entry{std::string(key), std::move(page), bytes});
+        shard.index.emplace(std::string_view(shard.entries.front().key),
+            shard.entries.begin());
+        shard.bytes += bytes;
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,87 @@
+#ifndef ROUTE_SERVER_LIST_CACHE_H
+#define ROUTE_SERVER_LIST_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "feature_db.h"
+#include "list_page.h"
+
+namespace routeguide {
+
+    // Least-recently-used cache of ListFeatures pages, keyed by the
+    // serialized request, so a popular rectangle is answered without
+    // querying the grid or ordering and paging its matches again. The
+    // features themselves are sent from the DB's wire bytes.
+    //
+    // The cache is split into shards chosen by a hash of the key, each with
+    // its own mutex and an equal part of the capacity, which counts the
+    // approximate heap bytes of the cached pages. A page larger than a
+    // quarter of a shard is not cached. A page is only cached the second time
+    // its request misses: each shard remembers the hashes of recent misses in
+    // a small direct-mapped table, so rectangles asked for once do not churn
+    // the cache.
+    //
+    // Every page belongs to one DB: Reset() drops the pages of the previous
+    // one, and pages of any other DB are never returned or stored, so a
+    // reload cannot leave stale pages behind.
+    class ListCache {
+    public:
+        // capacity is in bytes; 0 disables the cache.
+        explicit ListCache(size_t capacity, size_t shard_count = 16);
+
+        bool enabled() const { return shard_capacity_ > 0; }
+
+        // Forgets every page and accepts pages of db from now on.
+        void Reset(const FeatureDb* db);
+
+        // The page cached for key, or nullptr.
+        std::shared_ptr<const FeaturePage> Find(std::string_view key);
+
+        // Caches page under key if it was served from the current DB, is small
+        // enough and missed before, evicting the least recently used pages to
+        // make room.
+        void Insert(std::string_view key, std::shared_ptr<const FeaturePage> page);
+
+    private:
+        // Recent misses remembered per shard.
+        static const size_t kMissSlots = 1024;
+
+        struct Entry {
+            std::string key;
+            std::shared_ptr<const FeaturePage> page;
+            size_t bytes;
+        };
+
+        // Padded to a cache line so neighbouring shard mutexes do not share one.
+        struct alignas(64) Shard {
+            std::mutex mu;
+            const FeatureDb* db = nullptr;
+            // Most recently used first.
+            std::list<Entry> entries;
+            // Keyed by views of the entries' keys.
+            std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+            size_t bytes = 0;
+            // Hashes of recently missed keys, by their low bits.
+            size_t misses[kMissSlots] = {};
+        };
+
+        Shard& ShardFor(size_t hash) {
+            // The top bits; the low ones pick the bucket inside the shard map
+            // and the miss slot.
+            return shards_[(hash >> 20) & mask_];
+        }
+
+        std::unique_ptr<Shard[]> shards_;
+        size_t mask_ = 0;
+        size_t shard_capacity_ = 0;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_LIST_CACHE_H
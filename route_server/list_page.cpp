@@ -0,0 +1,188 @@
+#include "list_page.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace routeguide {
+
+    const char kNextPageTokenKey[] = "routeguide-next-page-token";
+
+    namespace {
+        // Tokens are "db:<position>" and "near:<distance bits in hex>:<position>".
+        const char kDbOrderPrefix[] = "db:";
+        const char kDistancePrefix[] = "near:";
+
+        // A feature's place in distance order. The distance is recomputed
+        // the same way on every page, so comparing it exactly is safe; the
+        // position breaks ties.
+        struct Ranked {
+            double metres;
+            uint32_t position;
+
+            bool operator<(const Ranked& other) const {
+                return metres < other.metres ||
+                    (metres == other.metres && position < other.position);
+            }
+        };
+
+        // More than half the Earth's circumference, so no token SelectPage
+        // issued carries a distance beyond it.
+        const double kMaxMetres = 2.1e7;
+
+        // Digits only: strtoull would also take leading spaces, a sign and,
+        // in base 16, "0x".
+        bool ParseNumber(const char* text, int base, char end, uint64_t* value,
+            const char** rest) {
+            const char* stop = text;
+            while (base == 10 ? std::isdigit(static_cast<unsigned char>(*stop)) :
+                std::isxdigit(static_cast<unsigned char>(*stop))) {
+                stop++;
+            }
+            if (stop == text || *stop != end) {
+                return false;
+            }
+            errno = 0;
+            *value = std::strtoull(text, nullptr, base);
+            if (errno == ERANGE) {
+                return false;
+            }
+            *rest = stop;
+            return true;
+        }
+
+        bool ParsePageToken(const std::string& token, Rectangle::Order order,
+            Ranked* after) {
+            const char* text = token.c_str();
+            const char* rest = nullptr;
+            uint64_t position = 0;
+            if (order == Rectangle::DB_ORDER) {
+                if (token.compare(0, sizeof(kDbOrderPrefix) - 1, kDbOrderPrefix) != 0 ||
+                    !ParseNumber(text + sizeof(kDbOrderPrefix) - 1, 10, '\0', &position,
+                        &rest)) {
+                    return false;
+                }
+                after->metres = 0;
+            }
+            else {
+                uint64_t bits = 0;
+                if (token.compare(0, sizeof(kDistancePrefix) - 1, kDistancePrefix) != 0 ||
+                    !ParseNumber(text + sizeof(kDistancePrefix) - 1, 16, ':', &bits,
+                        &rest) ||
+                    rest != text + sizeof(kDistancePrefix) - 1 + 16 ||
+                    !ParseNumber(rest + 1, 10, '\0', &position, &rest)) {
+                    return false;
+                }
+                std::memcpy(&after->metres, &bits, sizeof(bits));
+                if (!(after->metres >= 0 && after->metres <= kMaxMetres)) {
+                    return false;
+                }
+            }
+            if (position > UINT32_MAX) {
+                return false;
+            }
+            after->position = static_cast<uint32_t>(position);
+            return true;
+        }
+
+        std::string DistanceToken(const Ranked& last) {
+            uint64_t bits;
+            std::memcpy(&bits, &last.metres, sizeof(bits));
+            char hex[17];
+            static const char kDigits[] = "0123456789abcdef";
+            for (int i = 15; i >= 0; i--) {
+                hex[i] = kDigits[bits & 15];
+                bits >>= 4;
+            }
+            hex[16] = '\0';
+            return std::string(kDistancePrefix) + hex + ":" +
+                std::to_string(last.position);
+        }
+    }
+
+    grpc::WriteOptions ListWriteOptions(size_t k, size_t n) {
+        grpc::WriteOptions options;
+        // The first write carries the initial metadata; buffering it can
+        // hold back the whole stream.
+        if (k != 0 && k + 1 != n && (k + 1) % kListFlushEvery != 0) {
+            options.set_buffer_hint();
+        }
+        return options;
+    }
+
+    GeoPoint ListCenter(const Rectangle& request) {
+        int64_t center_latitude =
+            (int64_t{ request.lo().latitude() } + request.hi().latitude()) / 2;
+        int64_t center_longitude =
+            (int64_t{ request.lo().longitude() } + request.hi().longitude()) / 2;
+        return ToGeoPoint(static_cast<int32_t>(center_latitude),
+            static_cast<int32_t>(center_longitude));
+    }
+
+    bool SelectPage(const Rectangle& request, FeaturePage* page, std::string* error) {
+        std::vector<uint32_t>& positions = page->positions;
+        page->next_page_token.clear();
+        if (request.max_results() < 0) {
+            *error = "max_results must not be negative";
+            return false;
+        }
+        if (request.order() != Rectangle::DB_ORDER &&
+            request.order() != Rectangle::DISTANCE_FROM_CENTER) {
+            *error = "unknown order " + std::to_string(request.order());
+            return false;
+        }
+        size_t limit = static_cast<size_t>(request.max_results());
+        bool resume = !request.page_token().empty();
+        Ranked after = { 0, 0 };
+        if (resume && !ParsePageToken(request.page_token(), request.order(), &after)) {
+            *error = "malformed page_token for this order";
+            return false;
+        }
+        if (resume && after.position >= page->db->store().size()) {
+            *error = "page_token out of range";
+            return false;
+        }
+
+        if (request.order() == Rectangle::DB_ORDER) {
+            if (resume) {
+                positions.erase(positions.begin(), std::upper_bound(positions.begin(),
+                    positions.end(), after.position));
+            }
+            if (limit != 0 && positions.size() > limit) {
+                positions.resize(limit);
+                page->next_page_token = kDbOrderPrefix + std::to_string(positions.back());
+            }
+            return true;
+        }
+
+        const FeatureStore& store = page->db->store();
+        GeoPoint center = ListCenter(request);
+        std::vector<Ranked> ranked;
+        ranked.reserve(positions.size());
+        for (uint32_t i : positions) {
+            Ranked r = { HaversineMetres(center,
+                ToGeoPoint(store.latitude(i), store.longitude(i))), i };
+            if (!resume || after < r) {
+                ranked.push_back(r);
+            }
+        }
+        bool more = limit != 0 && ranked.size() > limit;
+        if (more) {
+            // Only the page itself needs sorting.
+            std::partial_sort(ranked.begin(), ranked.begin() + limit, ranked.end());
+            ranked.resize(limit);
+            page->next_page_token = DistanceToken(ranked.back());
+        }
+        else {
+            std::sort(ranked.begin(), ranked.end());
+        }
+        positions.clear();
+        for (const Ranked& r : ranked) {
+            positions.push_back(r.position);
+        }
+        return true;
+    }
+
+}  // namespace routeguide
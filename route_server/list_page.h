@@ -0,0 +1,54 @@
+#ifndef ROUTE_SERVER_LIST_PAGE_H
+#define ROUTE_SERVER_LIST_PAGE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <grpcpp/impl/call_op_set.h>
+#include "feature_db.h"
+#include "geo_distance.h"
+#include "route_guide.pb.h"
+
+namespace routeguide {
+
+    // Trailing metadata entry that carries the token of the next page.
+    extern const char kNextPageTokenKey[];
+
+    // ListFeatures writes features with a buffer hint, which lets gRPC pack
+    // them into shared frames, and lets the first, every this many and the
+    // last one flush, so the client still receives a steady stream. The
+    // handlers also check for cancellation this often.
+    const size_t kListFlushEvery = 64;
+
+    // Write options for the k-th of n features.
+    grpc::WriteOptions ListWriteOptions(size_t k, size_t n);
+
+    // The point distance order measures from: the centre of the request's
+    // rectangle.
+    GeoPoint ListCenter(const Rectangle& request);
+
+    // One ListFeatures response: the positions to send from db, and the
+    // token of the next page, empty if this page is the last.
+    struct FeaturePage {
+        std::shared_ptr<const FeatureDb> db;
+        std::vector<uint32_t> positions;
+        std::string next_page_token;
+    };
+
+    // Orders, resumes and limits the results of a ListFeatures request.
+    // page->positions holds the features inside the rectangle in store
+    // order, and is left holding the page to send. Returns false, with error
+    // set, if the request is invalid or its page token is malformed, out of
+    // range for page->db or was issued for another order.
+    //
+    // A token names the last feature sent (its position, and for distance
+    // order its distance) rather than an offset, so resuming costs one pass
+    // over the matches. Positions refer to the DB that served the page;
+    // after a reload a resumed listing may skip or repeat features.
+    bool SelectPage(const Rectangle& request, FeaturePage* page, std::string* error);
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_LIST_PAGE_H
@@ -0,0 +1,635 @@
+#include "note_log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace routeguide {
+
+    namespace {
+        // Segments and snapshots start with their magic bytes, then hold
+        // records: the body's size and CRC-32, then the body, which is the
+        // note's time in Unix milliseconds, its latitude and longitude and
+        // its message. Integers are in the machine's byte order.
+        const char kSegmentMagic[8] = { 'R', 'G', 'N', 'O', 'T', 'L', 'O', 'G' };
+        const char kSnapshotMagic[8] = { 'R', 'G', 'N', 'O', 'T', 'S', 'N', 'P' };
+        const size_t kRecordHeaderBytes = 2 * sizeof(uint32_t);
+        const size_t kBodyFixedBytes = sizeof(int64_t) + 2 * sizeof(int32_t);
+
+        const char kFilePrefix[] = "notes-";
+        const char kSegmentSuffix[] = ".log";
+        const char kSnapshotSuffix[] = ".snapshot";
+        const char kTempSuffix[] = ".tmp";
+
+        uint32_t Crc32(const char* data, size_t size) {
+            static const std::vector<uint32_t> table = [] {
+                std::vector<uint32_t> t(256);
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++) {
+                        c = (c & 1) != 0 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    }
+                    t[i] = c;
+                }
+                return t;
+            }();
+            uint32_t crc = 0xffffffffu;
+            for (size_t i = 0; i < size; i++) {
+                crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+            }
+            return crc ^ 0xffffffffu;
+        }
+
+        int64_t UnixMillis() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        void EncodeRecord(const RouteNote& note, int64_t unix_millis, std::string* out) {
+            const std::string& message = note.message();
+            uint32_t size = static_cast<uint32_t>(kBodyFixedBytes + message.size());
+            size_t start = out->size();
+            out->resize(start + kRecordHeaderBytes + size);
+            char* body = &(*out)[start + kRecordHeaderBytes];
+            int32_t latitude = note.location().latitude();
+            int32_t longitude = note.location().longitude();
+            std::memcpy(body, &unix_millis, sizeof(unix_millis));
+            std::memcpy(body + 8, &latitude, sizeof(latitude));
+            std::memcpy(body + 12, &longitude, sizeof(longitude));
+            std::memcpy(body + kBodyFixedBytes, message.data(), message.size());
+            uint32_t crc = Crc32(body, size);
+            std::memcpy(&(*out)[start], &size, sizeof(size));
+            std::memcpy(&(*out)[start + 4], &crc, sizeof(crc));
+        }
+
+        // "notes-<number><suffix>"; numbers are zero-padded so names sort.
+        std::string FileName(uint64_t number, const char* suffix) {
+            char digits[21];
+            std::snprintf(digits, sizeof(digits), "%020llu",
+                static_cast<unsigned long long>(number));
+            return std::string(kFilePrefix) + digits + suffix;
+        }
+
+        bool ParseFileName(const std::string& name, const char* suffix, uint64_t* number) {
+            size_t prefix = sizeof(kFilePrefix) - 1;
+            size_t suffix_size = std::strlen(suffix);
+            if (name.size() <= prefix + suffix_size ||
+                name.compare(0, prefix, kFilePrefix) != 0 ||
+                name.compare(name.size() - suffix_size, suffix_size, suffix) != 0) {
+                return false;
+            }
+            std::string digits = name.substr(prefix, name.size() - prefix - suffix_size);
+            if (digits.find_first_not_of("0123456789") != std::string::npos) {
+                return false;
+            }
+            *number = std::strtoull(digits.c_str(), nullptr, 10);
+            return true;
+        }
+
+        // An append-only file that can be synced to disk.
+        class LogFile {
+        public:
+            ~LogFile() { Close(); }
+
+            bool Open(const std::string& path) {
+                Close();
+#ifdef _WIN32
+                fd_ = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY,
+                    _S_IREAD | _S_IWRITE);
+#else
+                fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+                return fd_ >= 0;
+            }
+
+            bool Append(const char* data, size_t size) {
+                while (size > 0) {
+#ifdef _WIN32
+                    int written = _write(fd_, data,
+                        static_cast<unsigned int>((std::min)(size, size_t{ 1 } << 30)));
+#else
+                    ssize_t written = write(fd_, data, size);
+                    if (written < 0 && errno == EINTR) {
+                        continue;
+                    }
+#endif
+                    if (written <= 0) {
+                        return false;
+                    }
+                    data += written;
+                    size -= static_cast<size_t>(written);
+                }
+                return true;
+            }
+
+            bool Sync() {
+#ifdef _WIN32
+                return _commit(fd_) == 0;
+#elif defined(__linux__)
+                return fdatasync(fd_) == 0;
+#else
+                return fsync(fd_) == 0;
+#endif
+            }
+
+            void Close() {
+                if (fd_ >= 0) {
+#ifdef _WIN32
+                    _close(fd_);
+#else
+                    close(fd_);
+#endif
+                    fd_ = -1;
+                }
+            }
+
+            bool is_open() const { return fd_ >= 0; }
+
+        private:
+            int fd_ = -1;
+        };
+
+        // Makes the creation, renaming and removal of files in dir durable.
+        // Windows has no such call, and needs none.
+        bool SyncDirectory(const std::string& dir) {
+#ifdef _WIN32
+            return true;
+#else
+            int fd = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return false;
+            }
+            bool ok = fsync(fd) == 0;
+            close(fd);
+            return ok;
+#endif
+        }
+
+        // A record found in a mapped file, and what it decodes to.
+        struct Record {
+            const char* body;
+            uint32_t size;
+            uint32_t crc;
+            bool valid;
+            int64_t unix_millis;
+            int32_t latitude;
+            int32_t longitude;
+            size_t shard;
+        };
+
+        // Runs work(i) for i in [0, threads) on that many threads.
+        void RunOnThreads(size_t threads, const std::function<void(size_t)>& work) {
+            std::vector<std::thread> pool;
+            for (size_t i = 1; i < threads; i++) {
+                pool.emplace_back(work, i);
+            }
+            work(0);
+            for (std::thread& thread : pool) {
+                thread.join();
+            }
+        }
+    }
+
+    NoteLog::NoteLog(const NoteLogOptions& options, NoteStore* store,
+        ServerMetrics* metrics)
+        : options_(options), store_(store), metrics_(metrics) {}
+
+    NoteLog::~NoteLog() {
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            stopping_ = true;
+        }
+        flush_cv_.notify_all();
+        durable_cv_.notify_all();
+        if (snapshotter_.joinable()) {
+            snapshotter_.join();
+        }
+        if (flusher_.joinable()) {
+            flusher_.join();
+        }
+    }
+
+    std::string NoteLog::SegmentPath(uint64_t segment) const {
+        return (std::filesystem::path(options_.dir) /
+            FileName(segment, kSegmentSuffix)).string();
+    }
+
+    std::string NoteLog::SnapshotPath(uint64_t segment) const {
+        return (std::filesystem::path(options_.dir) /
+            FileName(segment, kSnapshotSuffix)).string();
+    }
+
+    bool NoteLog::Open(std::string* error) {
+        std::error_code ec;
+        std::filesystem::create_directories(options_.dir, ec);
+        if (ec) {
+            *error = "cannot create " + options_.dir + ": " + ec.message();
+            return false;
+        }
+        // A snapshot is named after the first segment it does not cover.
+        std::vector<uint64_t> segments;
+        uint64_t snapshot = 0;
+        bool has_snapshot = false;
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dir, ec)) {
+            std::string name = entry.path().filename().string();
+            uint64_t number = 0;
+            if (ParseFileName(name, kSegmentSuffix, &number)) {
+                segments.push_back(number);
+            }
+            else if (ParseFileName(name, kSnapshotSuffix, &number)) {
+                snapshot = has_snapshot ? (std::max)(snapshot, number) : number;
+                has_snapshot = true;
+            }
+            else if (name.size() > sizeof(kTempSuffix) &&
+                name.compare(name.size() - sizeof(kTempSuffix) + 1,
+                    sizeof(kTempSuffix) - 1, kTempSuffix) == 0) {
+                // A snapshot that was never finished.
+                std::filesystem::remove(entry.path(), ec);
+            }
+        }
+        if (ec) {
+            *error = "cannot list " + options_.dir + ": " + ec.message();
+            return false;
+        }
+        std::sort(segments.begin(), segments.end());
+
+        std::vector<std::string> replayed;
+        uint64_t next_segment = (std::max)(snapshot, uint64_t{ 1 });
+        for (uint64_t segment : segments) {
+            if (segment >= snapshot) {
+                replayed.push_back(SegmentPath(segment));
+                next_segment = (std::max)(next_segment, segment + 1);
+            }
+        }
+        if (!Replay(has_snapshot ? SnapshotPath(snapshot) : std::string(), replayed,
+            error)) {
+            return false;
+        }
+        // Left behind by a crash between a snapshot and the cleanup after it.
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dir, ec)) {
+            uint64_t number = 0;
+            std::string name = entry.path().filename().string();
+            if ((ParseFileName(name, kSegmentSuffix, &number) ||
+                ParseFileName(name, kSnapshotSuffix, &number)) &&
+                number < snapshot) {
+                std::filesystem::remove(entry.path(), ec);
+            }
+        }
+
+        // Never appends to a segment that may end in a torn record.
+        segment_ = next_segment;
+        flusher_ = std::thread(&NoteLog::Flush, this);
+        if (options_.snapshot_interval.count() > 0) {
+            snapshotter_ = std::thread(&NoteLog::SnapshotLoop, this);
+        }
+        return true;
+    }
+
+    bool NoteLog::Replay(const std::string& snapshot,
+        const std::vector<std::string>& segments, std::string* error) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<MappedFile>> files;
+        std::vector<Record> records;
+        // Where each file's records end in records.
+        std::vector<size_t> file_ends;
+        std::vector<std::string> paths = segments;
+        if (!snapshot.empty()) {
+            paths.insert(paths.begin(), snapshot);
+        }
+        // Files that end in a torn or corrupt record.
+        std::vector<bool> torn(paths.size(), false);
+        for (size_t f = 0; f < paths.size(); f++) {
+            const char* magic = f == 0 && !snapshot.empty() ? kSnapshotMagic : kSegmentMagic;
+            std::unique_ptr<MappedFile> file(new MappedFile());
+            if (!file->Open(paths[f], error)) {
+                return false;
+            }
+            const char* data = file->data();
+            size_t size = file->size();
+            if (size >= sizeof(kSegmentMagic) &&
+                std::memcmp(data, magic, sizeof(kSegmentMagic)) != 0) {
+                *error = paths[f] + " is not a note log file";
+                return false;
+            }
+            // Shorter than the magic only if a crash cut it off there.
+            size_t pos = sizeof(kSegmentMagic);
+            while (pos + kRecordHeaderBytes <= size) {
+                Record record = {};
+                std::memcpy(&record.size, data + pos, sizeof(record.size));
+                std::memcpy(&record.crc, data + pos + 4, sizeof(record.crc));
+                if (record.size < kBodyFixedBytes ||
+                    record.size > size - pos - kRecordHeaderBytes) {
+                    break;
+                }
+                record.body = data + pos + kRecordHeaderBytes;
+                records.push_back(record);
+                pos += kRecordHeaderBytes + record.size;
+            }
+            torn[f] = pos < size && size > sizeof(kSegmentMagic);
+            file_ends.push_back(records.size());
+            file->AdviseSequential();
+            files.push_back(std::move(file));
+        }
+
+        size_t threads = options_.replay_threads;
+        if (threads == 0) {
+            threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+        }
+        threads = (std::min)(threads, store_->shard_count());
+        // Checks and decodes the records, each thread a contiguous range, and
+        // sorts them by the thread that restores them: owned[d][t] lists, in
+        // log order, the records of thread t's shards that thread d decoded.
+        std::vector<std::vector<std::vector<size_t>>> owned(threads,
+            std::vector<std::vector<size_t>>(threads));
+        RunOnThreads(threads, [&](size_t d) {
+            size_t begin = records.size() * d / threads;
+            size_t end = records.size() * (d + 1) / threads;
+            for (size_t i = begin; i < end; i++) {
+                Record& r = records[i];
+                r.valid = Crc32(r.body, r.size) == r.crc;
+                if (r.valid) {
+                    std::memcpy(&r.unix_millis, r.body, sizeof(r.unix_millis));
+                    std::memcpy(&r.latitude, r.body + 8, sizeof(r.latitude));
+                    std::memcpy(&r.longitude, r.body + 12, sizeof(r.longitude));
+                    r.shard = store_->ShardOf(r.latitude, r.longitude);
+                    owned[d][r.shard % threads].push_back(i);
+                }
+            }
+        });
+        // A bad record ends its file: what follows may not be records at all.
+        size_t file_begin = 0;
+        for (size_t f = 0; f < file_ends.size(); f++) {
+            bool bad = false;
+            for (size_t i = file_begin; i < file_ends[f]; i++) {
+                bad = bad || !records[i].valid;
+                records[i].valid = !bad;
+            }
+            torn[f] = torn[f] || bad;
+            file_begin = file_ends[f];
+        }
+        size_t torn_files = static_cast<size_t>(std::count(torn.begin(), torn.end(), true));
+
+        // Restores the records, each thread those of its note store shards in
+        // log order: the decoding threads' ranges follow one another.
+        std::chrono::milliseconds ttl = store_->limits().ttl;
+        int64_t now_millis = UnixMillis();
+        std::vector<size_t> restored(threads, 0);
+        RunOnThreads(threads, [&](size_t t) {
+            RouteNote note;
+            for (size_t d = 0; d < threads; d++) {
+                for (size_t i : owned[d][t]) {
+                    const Record& r = records[i];
+                    if (!r.valid) {
+                        continue;
+                    }
+                    std::chrono::milliseconds age(
+                        (std::max)(now_millis - r.unix_millis, int64_t{ 0 }));
+                    if (ttl.count() != 0 && age >= ttl) {
+                        continue;
+                    }
+                    note.mutable_location()->set_latitude(r.latitude);
+                    note.mutable_location()->set_longitude(r.longitude);
+                    note.set_message(r.body + kBodyFixedBytes, r.size - kBodyFixedBytes);
+                    store_->Restore(note, age);
+                    restored[t]++;
+                }
+            }
+        });
+        size_t total = 0;
+        for (size_t n : restored) {
+            total += n;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        std::cout << "Note log: restored " << total << " of " << records.size()
+            << " notes from " << paths.size() << " files on " << threads
+            << " threads in " << elapsed.count() << " ms";
+        if (torn_files != 0) {
+            std::cout << "; " << torn_files << " files ended in a torn record";
+        }
+        std::cout << "." << std::endl;
+        return true;
+    }
+
+    uint64_t NoteLog::Post(const RouteNote& note, NoteList* earlier,
+        const std::shared_ptr<NoteSubscriber>& subscriber) {
+        // Encoded before taking any lock, into a buffer the thread keeps.
+        thread_local std::string record;
+        record.clear();
+        EncodeRecord(note, UnixMillis(), &record);
+
+        std::shared_lock<std::shared_mutex> post_lock(post_mu_);
+        store_->Post(note, earlier, subscriber);
+        std::unique_lock<std::mutex> lock(mu_);
+        buffer_ += record;
+        uint64_t ticket = ++appended_;
+        lock.unlock();
+        flush_cv_.notify_one();
+        return ticket;
+    }
+
+    bool NoteLog::WaitDurable(uint64_t ticket) {
+        std::unique_lock<std::mutex> lock(mu_);
+        durable_cv_.wait(lock, [this, ticket] { return durable_ >= ticket; });
+        return !failed_;
+    }
+
+    void NoteLog::OnDurable(uint64_t ticket, std::function<void(bool)> done) {
+        std::unique_lock<std::mutex> lock(mu_);
+        if (durable_ >= ticket) {
+            bool ok = !failed_;
+            lock.unlock();
+            done(ok);
+            return;
+        }
+        waiters_.emplace_back(ticket, std::move(done));
+    }
+
+    void NoteLog::Flush() {
+        LogFile file;
+        std::string batch;
+        std::vector<std::function<void(bool)>> done;
+        std::unique_lock<std::mutex> lock(mu_);
+        while (true) {
+            flush_cv_.wait(lock, [this] {
+                return !buffer_.empty() || open_segment_ != segment_ || stopping_;
+            });
+            if (open_segment_ != segment_ && switch_bytes_ == 0) {
+                // Everything before the switch is on disk (see Snapshot()).
+                uint64_t segment = segment_;
+                lock.unlock();
+                bool ok = file.Open(SegmentPath(segment)) &&
+                    file.Append(kSegmentMagic, sizeof(kSegmentMagic)) &&
+                    SyncDirectory(options_.dir);
+                if (!ok) {
+                    std::cout << "Error opening note log segment " << SegmentPath(segment)
+                        << std::endl;
+                    metrics_->note_log_errors.Add();
+                }
+                lock.lock();
+                failed_ = failed_ || !ok;
+                open_segment_ = segment;
+                durable_cv_.notify_all();
+                continue;
+            }
+            if (buffer_.empty()) {
+                // Stopping, with everything written.
+                break;
+            }
+
+            // Everything posted so far goes out in one write and one sync;
+            // posts meanwhile fill the other buffer for the next round. With
+            // a switch pending, only what precedes it, to the old segment.
+            uint64_t ticket = appended_;
+            if (open_segment_ != segment_) {
+                ticket = switch_ticket_;
+                batch.assign(buffer_, 0, switch_bytes_);
+                buffer_.erase(0, switch_bytes_);
+                switch_bytes_ = 0;
+            }
+            else {
+                batch.swap(buffer_);
+            }
+            uint64_t notes = ticket - durable_;
+            lock.unlock();
+            auto start = std::chrono::steady_clock::now();
+            bool ok = file.is_open() && file.Append(batch.data(), batch.size()) &&
+                file.Sync();
+            metrics_->note_log_sync_nanos.Record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count()));
+            metrics_->note_log_commit_notes.Record(notes);
+            if (!ok) {
+                metrics_->note_log_errors.Add();
+            }
+            batch.clear();
+
+            lock.lock();
+            if (!ok && !failed_) {
+                std::cout << "Error writing the note log; notes are no longer saved"
+                    << std::endl;
+            }
+            failed_ = failed_ || !ok;
+            durable_ = ticket;
+            auto first_done = std::partition(waiters_.begin(), waiters_.end(),
+                [ticket](const std::pair<uint64_t, std::function<void(bool)>>& w) {
+                return w.first > ticket;
+            });
+            for (auto it = first_done; it != waiters_.end(); ++it) {
+                done.push_back(std::move(it->second));
+            }
+            waiters_.erase(first_done, waiters_.end());
+            durable_cv_.notify_all();
+            if (!done.empty()) {
+                bool result = !failed_;
+                lock.unlock();
+                for (std::function<void(bool)>& callback : done) {
+                    callback(result);
+                }
+                done.clear();
+                lock.lock();
+            }
+        }
+    }
+
+    bool NoteLog::Snapshot(std::string* error) {
+        std::unique_lock<std::mutex> snapshot_lock(snapshot_mu_);
+        std::vector<uint64_t> marks;
+        uint64_t ticket = 0;
+        uint64_t first_segment = 0;
+        {
+            // With no post half done, the notes logged so far are exactly
+            // those the store holds before its marks.
+            std::unique_lock<std::shared_mutex> no_posts(post_mu_);
+            marks = store_->Marks();
+            std::unique_lock<std::mutex> lock(mu_);
+            ticket = appended_;
+            first_segment = ++segment_;
+            switch_bytes_ = buffer_.size();
+            switch_ticket_ = ticket;
+            snapshotted_ = ticket;
+        }
+        flush_cv_.notify_one();
+
+        std::string data(kSnapshotMagic, sizeof(kSnapshotMagic));
+        int64_t now_millis = UnixMillis();
+        store_->Export([&data, now_millis](const RouteNote& note,
+            std::chrono::steady_clock::duration age) {
+            EncodeRecord(note, now_millis -
+                std::chrono::duration_cast<std::chrono::milliseconds>(age).count(),
+                &data);
+        }, marks);
+        {
+            // The flusher writes out the old segments and closes them, which
+            // Windows cannot delete while they are open, before the new one.
+            std::unique_lock<std::mutex> lock(mu_);
+            durable_cv_.wait(lock, [this, ticket, first_segment] {
+                return durable_ >= ticket && open_segment_ >= first_segment;
+            });
+        }
+
+        std::string path = SnapshotPath(first_segment);
+        std::string temp_path = path + kTempSuffix;
+        std::remove(temp_path.c_str());
+        LogFile file;
+        bool ok = file.Open(temp_path) && file.Append(data.data(), data.size()) &&
+            file.Sync();
+        file.Close();
+        std::error_code ec;
+        if (ok) {
+            std::filesystem::rename(temp_path, path, ec);
+            ok = !ec && SyncDirectory(options_.dir);
+        }
+        if (!ok) {
+            *error = "cannot write note snapshot " + path;
+            std::remove(temp_path.c_str());
+            metrics_->note_log_errors.Add();
+            return false;
+        }
+        metrics_->note_log_snapshots.Add();
+
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dir, ec)) {
+            uint64_t number = 0;
+            std::string name = entry.path().filename().string();
+            if ((ParseFileName(name, kSegmentSuffix, &number) ||
+                ParseFileName(name, kSnapshotSuffix, &number)) &&
+                number < first_segment) {
+                std::filesystem::remove(entry.path(), ec);
+            }
+        }
+        SyncDirectory(options_.dir);
+        return true;
+    }
+
+    void NoteLog::SnapshotLoop() {
+        std::unique_lock<std::mutex> lock(mu_);
+        while (!stopping_) {
+            auto deadline = std::chrono::steady_clock::now() + options_.snapshot_interval;
+            durable_cv_.wait_until(lock, deadline, [this] { return stopping_; });
+            if (stopping_ || appended_ == snapshotted_) {
+                continue;
+            }
+            lock.unlock();
+            std::string error;
+            if (!Snapshot(&error)) {
+                std::cout << "Error writing note snapshot: " << error << std::endl;
+            }
+            lock.lock();
+        }
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,127 @@
+#ifndef ROUTE_SERVER_NOTE_LOG_H
+#define ROUTE_SERVER_NOTE_LOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "note_store.h"
+#include "route_guide.pb.h"
+#include "server_metrics.h"
+
+namespace routeguide {
+
+    struct NoteLogOptions {
+        // Directory of the log segments and snapshots; created if missing.
+        std::string dir;
+        // How often the store is snapshotted and the log before it dropped,
+        // if notes arrived since the last snapshot. 0 never does.
+        std::chrono::seconds snapshot_interval = std::chrono::seconds(300);
+        // Threads replaying the log at startup; 0 takes one per core.
+        size_t replay_threads = 0;
+    };
+
+    // Write-ahead log that keeps the notes of a NoteStore across restarts.
+    //
+    // Post() stores a note and appends it to an in-memory buffer; a flusher
+    // thread writes the whole buffer and syncs it to disk in one go, so the
+    // posts that arrive during one sync share the next one (group commit).
+    // Callers that must know a note is on disk wait for its ticket.
+    //
+    // The log is split into numbered segments. Every snapshot_interval the
+    // store itself, which only holds what its limits keep, is written out
+    // as a snapshot naming the first segment after it, and the older
+    // segments are deleted. Open() restores the newest snapshot and the
+    // segments after it; a torn record at the end of a segment, as a crash
+    // leaves it, ends that segment. Records are replayed on several threads,
+    // split by note store shard so that each shard sees them in log order.
+    //
+    // Notes posted at the same instant at one location may be logged in
+    // either order.
+    class NoteLog {
+    public:
+        NoteLog(const NoteLogOptions& options, NoteStore* store, ServerMetrics* metrics);
+        // Writes out every note posted so far, then stops the threads.
+        ~NoteLog();
+        NoteLog(const NoteLog&) = delete;
+        NoteLog& operator=(const NoteLog&) = delete;
+
+        // Restores the store from the directory and starts a new segment
+        // and the threads. On failure returns false and says why in error.
+        bool Open(std::string* error);
+
+        // NoteStore::Post(), logging the note. Returns its ticket.
+        uint64_t Post(const RouteNote& note, NoteList* earlier,
+            const std::shared_ptr<NoteSubscriber>& subscriber);
+
+        // Blocks until the note with ticket, and every one before it, is on
+        // disk. False once a write or sync has failed: from then on notes
+        // are only kept in memory.
+        bool WaitDurable(uint64_t ticket);
+        // Calls done with WaitDurable()'s result once ticket is on disk: at
+        // once if it already is, else on the flusher thread.
+        void OnDurable(uint64_t ticket, std::function<void(bool)> done);
+
+        // Writes a snapshot now and drops the segments it covers. Posts only
+        // wait while the new segment is started, not while the store is
+        // copied and written or the old segments synced.
+        bool Snapshot(std::string* error);
+
+    private:
+        std::string SegmentPath(uint64_t segment) const;
+        std::string SnapshotPath(uint64_t segment) const;
+        // Restores snapshot, then segments, into the store.
+        bool Replay(const std::string& snapshot, const std::vector<std::string>& segments,
+            std::string* error);
+        void Flush();
+        void SnapshotLoop();
+
+        NoteLogOptions options_;
+        NoteStore* store_;
+        ServerMetrics* metrics_;
+
+        // Held shared by every Post() and exclusively by Snapshot() while it
+        // starts a new segment, so that the store's marks taken then split
+        // the notes exactly as the segments do.
+        std::shared_mutex post_mu_;
+        // One snapshot at a time, so that at most one segment switch waits.
+        std::mutex snapshot_mu_;
+
+        std::mutex mu_;
+        // Signals the flusher: records to write, a new segment or stop.
+        std::condition_variable flush_cv_;
+        // Signals WaitDurable() and Snapshot().
+        std::condition_variable durable_cv_;
+        // Encoded records not yet handed to the flusher.
+        std::string buffer_;
+        uint64_t appended_ = 0;
+        uint64_t durable_ = 0;
+        bool failed_ = false;
+        // Segment new records go to, and the one the flusher has open.
+        uint64_t segment_ = 0;
+        uint64_t open_segment_ = 0;
+        // While the two differ: the bytes at the front of buffer_ that still
+        // go to the open segment, and the last ticket among them.
+        size_t switch_bytes_ = 0;
+        uint64_t switch_ticket_ = 0;
+        std::vector<std::pair<uint64_t, std::function<void(bool)>>> waiters_;
+        bool stopping_ = false;
+        // Tickets covered by the last snapshot.
+        uint64_t snapshotted_ = 0;
+
+        std::thread flusher_;
+        std::thread snapshotter_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_NOTE_LOG_H
@@ -0,0 +1,270 @@
+#include "note_store.h"
+
+#include <algorithm>
+
+namespace routeguide {
+
+    namespace {
+        // Bytes a string holds on the heap, not counting its inline buffer.
+        size_t HeapBytes(const std::string& s) {
+            static const size_t inline_capacity = std::string().capacity();
+            return s.capacity() - inline_capacity;
+        }
+    }
+
+    NoteStore::NoteStore(const NoteLimits& limits, size_t shard_count)
+        : limits_(limits) {
+        size_t count = 1;
+        while (count < shard_count) {
+            count <<= 1;
+        }
+        shards_.reset(new Shard[count]);
+        mask_ = count - 1;
+        // Round down so the shards together never exceed max_notes, but keep
+        // at least one note per shard.
+        max_arrivals_per_shard_ = limits_.max_notes == 0 ? 0 :
+            (std::max)(limits_.max_notes / count, static_cast<size_t>(1));
+        if (limits_.ttl.count() != 0) {
+            sweeper_ = std::thread(&NoteStore::SweepLoop, this);
+        }
+    }
+
+    NoteStore::~NoteStore() {
+        {
+            std::unique_lock<std::mutex> lock(sweep_mu_);
+            stopping_ = true;
+        }
+        sweep_cv_.notify_all();
+        if (sweeper_.joinable()) {
+            sweeper_.join();
+        }
+    }
+
+    void NoteStore::Post(const RouteNote& note, NoteList* earlier,
+        const std::shared_ptr<NoteSubscriber>& subscriber) {
+        Insert(note, Clock::now(), earlier, subscriber);
+    }
+
+    void NoteStore::Restore(const RouteNote& note, Clock::duration age) {
+        Insert(note, Clock::now() - age, nullptr, nullptr);
+    }
+
+    void NoteStore::Insert(const RouteNote& note, Clock::time_point now,
+        NoteList* earlier, const std::shared_ptr<NoteSubscriber>& subscriber) {
+        uint64_t key = PackPointKey(note.location().latitude(),
+            note.location().longitude());
+        Shard& shard = ShardFor(key);
+        Clock::time_point lock_start = Clock::now();
+        std::unique_lock<std::mutex> lock(shard.mu, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            // Only contended posts pay for timing the wait.
+            lock.lock();
+            shard.lock_waits++;
+            shard.lock_wait_nanos += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - lock_start).count());
+        }
+
+        Expire(&shard, now);
+        if (max_arrivals_per_shard_ != 0 &&
+            shard.arrivals.size() >= max_arrivals_per_shard_) {
+            Location* oldest = OldestLocation(&shard);
+            if (oldest != nullptr) {
+                shard.evicted_global_cap++;
+                EvictOldest(&shard, shard.arrivals.front().key, oldest);
+            }
+            shard.arrivals.Pop();
+        }
+
+        Location& location = shard.locations[key];
+        RingBuffer<StoredNote>& notes = location.notes;
+        for (size_t i = 0; earlier != nullptr && i < notes.size(); i++) {
+            RouteNote* copy = earlier->Add();
+            copy->mutable_location()->CopyFrom(note.location());
+            copy->set_message(notes[i].message);
+        }
+        for (const std::shared_ptr<NoteSubscriber>& other : location.subscribers) {
+            if (other != subscriber && !other->Deliver(note)) {
+                shard.dropped_live++;
+            }
+        }
+        if (subscriber != nullptr) {
+            std::vector<uint64_t>& keys = subscriber->keys();
+            if (std::find(keys.begin(), keys.end(), key) == keys.end()) {
+                keys.push_back(key);
+                location.subscribers.push_back(subscriber);
+            }
+        }
+        if (limits_.max_notes_per_location != 0 &&
+            notes.size() >= limits_.max_notes_per_location) {
+            // Its arrival entry goes stale and is skipped when it comes up.
+            shard.evicted_location_cap++;
+            notes.Pop();
+            shard.notes--;
+        }
+
+        size_t capacity = notes.capacity();
+        StoredNote& stored = notes.Push();
+        shard.bytes += (notes.capacity() - capacity) * sizeof(StoredNote);
+        capacity = HeapBytes(stored.message);
+        stored.message.assign(note.message());
+        shard.bytes += HeapBytes(stored.message) - capacity;
+        stored.sequence = shard.next_sequence++;
+        stored.time = now;
+        shard.notes++;
+
+        capacity = shard.arrivals.capacity();
+        Arrival& arrival = shard.arrivals.Push();
+        shard.bytes += (shard.arrivals.capacity() - capacity) * sizeof(Arrival);
+        arrival.key = key;
+        arrival.sequence = stored.sequence;
+    }
+
+    void NoteStore::Unsubscribe(const std::shared_ptr<NoteSubscriber>& subscriber) {
+        for (uint64_t key : subscriber->keys()) {
+            Shard& shard = ShardFor(key);
+            std::unique_lock<std::mutex> lock(shard.mu);
+            auto it = shard.locations.find(key);
+            if (it == shard.locations.end()) {
+                continue;
+            }
+            std::vector<std::shared_ptr<NoteSubscriber>>& subscribers =
+                it->second.subscribers;
+            subscribers.erase(
+                std::remove(subscribers.begin(), subscribers.end(), subscriber),
+                subscribers.end());
+            EraseIfUnused(&shard, key, &it->second);
+        }
+        subscriber->keys().clear();
+    }
+
+    void NoteStore::Sweep() {
+        for (size_t i = 0; i <= mask_; i++) {
+            Shard& shard = shards_[i];
+            std::unique_lock<std::mutex> lock(shard.mu);
+            Expire(&shard, Clock::now());
+        }
+    }
+
+    void NoteStore::SweepLoop() {
+        std::unique_lock<std::mutex> lock(sweep_mu_);
+        while (!sweep_cv_.wait_for(lock, std::chrono::seconds(1),
+            [this] { return stopping_; })) {
+            lock.unlock();
+            Sweep();
+            lock.lock();
+        }
+    }
+
+    void NoteStore::Expire(Shard* shard, Clock::time_point now) {
+        if (limits_.ttl.count() == 0) {
+            return;
+        }
+        // Arrivals are in time order, so expired notes are all at the front.
+        while (!shard->arrivals.empty()) {
+            Location* oldest = OldestLocation(shard);
+            if (oldest != nullptr) {
+                if (now - oldest->notes.front().time < limits_.ttl) {
+                    break;
+                }
+                shard->expired++;
+                EvictOldest(shard, shard->arrivals.front().key, oldest);
+            }
+            shard->arrivals.Pop();
+        }
+    }
+
+    std::vector<uint64_t> NoteStore::Marks() const {
+        std::vector<uint64_t> marks(mask_ + 1);
+        for (size_t i = 0; i <= mask_; i++) {
+            Shard& shard = shards_[i];
+            std::unique_lock<std::mutex> lock(shard.mu);
+            marks[i] = shard.next_sequence;
+        }
+        return marks;
+    }
+
+    void NoteStore::Export(const std::function<void(const RouteNote&,
+        Clock::duration)>& visit, const std::vector<uint64_t>& marks) const {
+        RouteNote note;
+        std::vector<std::pair<uint64_t, const StoredNote*>> stored;
+        for (size_t i = 0; i <= mask_; i++) {
+            Shard& shard = shards_[i];
+            std::unique_lock<std::mutex> lock(shard.mu);
+            Clock::time_point now = Clock::now();
+            uint64_t mark = marks.empty() ? UINT64_MAX : marks[i];
+            // Sequence numbers give the arrival order across locations.
+            stored.clear();
+            for (const auto& entry : shard.locations) {
+                const RingBuffer<StoredNote>& notes = entry.second.notes;
+                for (size_t j = 0; j < notes.size() && notes[j].sequence < mark; j++) {
+                    // Expired, but not swept yet.
+                    if (limits_.ttl.count() != 0 && now - notes[j].time >= limits_.ttl) {
+                        continue;
+                    }
+                    stored.emplace_back(entry.first, &notes[j]);
+                }
+            }
+            std::sort(stored.begin(), stored.end(),
+                [](const std::pair<uint64_t, const StoredNote*>& a,
+                    const std::pair<uint64_t, const StoredNote*>& b) {
+                return a.second->sequence < b.second->sequence;
+            });
+            for (const auto& entry : stored) {
+                note.mutable_location()->set_latitude(
+                    static_cast<int32_t>(entry.first >> 32));
+                note.mutable_location()->set_longitude(
+                    static_cast<int32_t>(entry.first & 0xffffffff));
+                note.set_message(entry.second->message);
+                visit(note, now - entry.second->time);
+            }
+        }
+    }
+
+    NoteStoreStats NoteStore::Stats() const {
+        NoteStoreStats stats;
+        for (size_t i = 0; i <= mask_; i++) {
+            Shard& shard = shards_[i];
+            std::unique_lock<std::mutex> lock(shard.mu);
+            stats.notes += shard.notes;
+            stats.bytes += shard.bytes;
+            stats.evicted_location_cap += shard.evicted_location_cap;
+            stats.evicted_global_cap += shard.evicted_global_cap;
+            stats.expired += shard.expired;
+            stats.dropped_live += shard.dropped_live;
+            stats.lock_waits += shard.lock_waits;
+            stats.lock_wait_nanos += shard.lock_wait_nanos;
+        }
+        return stats;
+    }
+
+    NoteStore::Location* NoteStore::OldestLocation(Shard* shard) {
+        const Arrival& oldest = shard->arrivals.front();
+        auto it = shard->locations.find(oldest.key);
+        if (it == shard->locations.end() || it->second.notes.empty() ||
+            it->second.notes.front().sequence != oldest.sequence) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    void NoteStore::EvictOldest(Shard* shard, uint64_t key, Location* location) {
+        location->notes.Pop();
+        shard->notes--;
+        EraseIfUnused(shard, key, location);
+    }
+
+    void NoteStore::EraseIfUnused(Shard* shard, uint64_t key, Location* location) {
+        if (!location->notes.empty() || !location->subscribers.empty()) {
+            return;
+        }
+        // Give an idle location's memory back rather than keep its ring.
+        size_t bytes = location->notes.capacity() * sizeof(StoredNote);
+        for (const StoredNote& slot : location->notes.slots()) {
+            bytes += HeapBytes(slot.message);
+        }
+        shard->bytes -= bytes;
+        shard->locations.erase(key);
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,201 @@
+#ifndef ROUTE_SERVER_NOTE_STORE_H
+#define ROUTE_SERVER_NOTE_STORE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "note_subscriber.h"
+#include "point_key.h"
+#include "ring_buffer.h"
+#include "route_guide.pb.h"
+
+namespace routeguide {
+
+    // Bounds on the RouteChat history. Zero disables a bound.
+    struct NoteLimits {
+        // Notes kept at any one location; the oldest is evicted first.
+        size_t max_notes_per_location = 256;
+        // Notes kept overall. Enforced per shard, as max_notes divided evenly
+        // between the shards, so the total can fall short of it but never
+        // exceed it.
+        size_t max_notes = 1 << 20;
+        // Notes older than this are dropped. They are never returned; their
+        // memory is freed by the next post to their shard or by the sweep
+        // that runs every second.
+        std::chrono::seconds ttl = std::chrono::seconds(0);
+    };
+
+    struct NoteStoreStats {
+        size_t notes = 0;
+        // Heap bytes held for notes: ring slots, message buffers and the
+        // eviction queues. Hash map nodes are not counted.
+        size_t bytes = 0;
+        uint64_t evicted_location_cap = 0;
+        uint64_t evicted_global_cap = 0;
+        uint64_t expired = 0;
+        // Live notes dropped from full subscriber queues.
+        uint64_t dropped_live = 0;
+        // Posts that found their shard locked, and how long they waited.
+        uint64_t lock_waits = 0;
+        uint64_t lock_wait_nanos = 0;
+    };
+
+    // Notes received by RouteChat, grouped by location. The store is split
+    // into shards chosen by a hash of the location, each with its own mutex,
+    // so chats at different points rarely contend, and a lookup only visits
+    // the notes stored at its own point.
+    //
+    // Each location keeps its notes in a ring buffer whose slots, message
+    // buffers included, are reused as old notes are evicted. Each shard also
+    // queues its notes in arrival order, which tells it the oldest note to
+    // drop when the shard is full or the note has outlived the TTL.
+    //
+    // A location also lists the live subscribers of the streams that posted
+    // there. New notes are delivered to them under the shard lock, which
+    // keeps them in store order; a delivery only copies into the
+    // subscriber's bounded queue, it never waits for the client.
+    class NoteStore {
+    public:
+        // shard_count is rounded up to a power of two.
+        explicit NoteStore(const NoteLimits& limits = NoteLimits(),
+            size_t shard_count = 64);
+        // Stops the sweep, if there is a TTL.
+        ~NoteStore();
+        NoteStore(const NoteStore&) = delete;
+        NoteStore& operator=(const NoteStore&) = delete;
+
+        // Appends note, first copying the notes stored earlier at the same
+        // location into earlier. Only the note's shard is locked, and never
+        // while the caller writes the copies back to a client. If subscriber
+        // is set it is subscribed to the location, and the note is delivered
+        // to every other subscriber there.
+        void Post(const RouteNote& note, NoteList* earlier,
+            const std::shared_ptr<NoteSubscriber>& subscriber = nullptr);
+
+        // Stores a note received age ago, as read back from a note log: it
+        // is evicted and expires as if it had been posted then, but nothing
+        // is copied or delivered.
+        void Restore(const RouteNote& note, std::chrono::steady_clock::duration age);
+
+        // Where each shard's arrivals stand. Taken while nothing is posted,
+        // it splits the notes into those posted before and after it.
+        std::vector<uint64_t> Marks() const;
+
+        // Calls visit with every stored note and its age, shard by shard
+        // and in arrival order within a shard, so restoring them in this
+        // order rebuilds the same store. Locks one shard at a time. Given
+        // marks, leaves out the notes posted after they were taken.
+        void Export(const std::function<void(const RouteNote&,
+            std::chrono::steady_clock::duration)>& visit,
+            const std::vector<uint64_t>& marks = std::vector<uint64_t>()) const;
+
+        // The shard holding the notes at a point. Posts to different shards
+        // never depend on each other.
+        size_t ShardOf(int32_t latitude, int32_t longitude) const {
+            return ShardIndex(PackPointKey(latitude, longitude));
+        }
+
+        // Removes subscriber from every location it posted to.
+        void Unsubscribe(const std::shared_ptr<NoteSubscriber>& subscriber);
+
+        // Drops the expired notes of every shard. With a TTL, a thread of the
+        // store calls it every second, so that shards nobody posts to give
+        // their memory back too.
+        void Sweep();
+
+        NoteStoreStats Stats() const;
+
+        const NoteLimits& limits() const { return limits_; }
+        size_t shard_count() const { return mask_ + 1; }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct StoredNote {
+            uint64_t sequence = 0;
+            Clock::time_point time;
+            std::string message;
+        };
+
+        struct Arrival {
+            uint64_t key = 0;
+            uint64_t sequence = 0;
+        };
+
+        struct Location {
+            RingBuffer<StoredNote> notes;
+            std::vector<std::shared_ptr<NoteSubscriber>> subscribers;
+        };
+
+        struct KeyHash {
+            size_t operator()(uint64_t key) const {
+                return static_cast<size_t>(MixPointKey(key));
+            }
+        };
+
+        // Padded to a cache line so neighbouring shard mutexes do not share one.
+        struct alignas(64) Shard {
+            std::mutex mu;
+            std::unordered_map<uint64_t, Location, KeyHash> locations;
+            // One entry per stored note, oldest first. Entries of notes that
+            // the per-location cap already evicted stay until they reach the
+            // front, so the queue length also bounds the live notes.
+            RingBuffer<Arrival> arrivals;
+            uint64_t next_sequence = 0;
+            size_t notes = 0;
+            size_t bytes = 0;
+            uint64_t evicted_location_cap = 0;
+            uint64_t evicted_global_cap = 0;
+            uint64_t expired = 0;
+            uint64_t dropped_live = 0;
+            uint64_t lock_waits = 0;
+            uint64_t lock_wait_nanos = 0;
+        };
+
+        size_t ShardIndex(uint64_t key) const {
+            // The top bits; the low ones pick the bucket inside the shard map.
+            return (MixPointKey(key) >> 40) & mask_;
+        }
+        Shard& ShardFor(uint64_t key) { return shards_[ShardIndex(key)]; }
+
+        // Drops the notes of a locked shard that are older than the TTL at
+        // now.
+        void Expire(Shard* shard, Clock::time_point now);
+        void SweepLoop();
+
+        // Post() and Restore() for a note stored at now.
+        void Insert(const RouteNote& note, Clock::time_point now, NoteList* earlier,
+            const std::shared_ptr<NoteSubscriber>& subscriber);
+
+        // The location of the oldest arrival, if that arrival's note is still
+        // stored (and therefore first in it); else nullptr.
+        Location* OldestLocation(Shard* shard);
+        // Evicts the first note of location, the one at key.
+        void EvictOldest(Shard* shard, uint64_t key, Location* location);
+        // Erases the location at key once it has no notes and no subscribers.
+        void EraseIfUnused(Shard* shard, uint64_t key, Location* location);
+
+        NoteLimits limits_;
+        size_t max_arrivals_per_shard_;
+        std::unique_ptr<Shard[]> shards_;
+        size_t mask_;
+
+        std::mutex sweep_mu_;
+        // Wakes the sweep to stop.
+        std::condition_variable sweep_cv_;
+        bool stopping_ = false;
+        std::thread sweeper_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_NOTE_STORE_H
@@ -0,0 +1,46 @@
+#include "note_subscriber.h"
+
+#include <utility>
+
+namespace routeguide {
+
+    NoteSubscriber::NoteSubscriber(size_t capacity, std::function<void()> wake)
+        : capacity_(capacity == 0 ? 1 : capacity), wake_(std::move(wake)) {}
+
+    bool NoteSubscriber::Deliver(const RouteNote& note) {
+        std::unique_lock<std::mutex> lock(mu_);
+        if (closed_) {
+            return true;
+        }
+        bool kept_all = true;
+        if (queue_.size() == capacity_) {
+            queue_.Pop();
+            kept_all = false;
+        }
+        queue_.Push().CopyFrom(note);
+        // Called under the lock so that it never races with Close().
+        if (armed_) {
+            armed_ = false;
+            wake_();
+        }
+        return kept_all;
+    }
+
+    void NoteSubscriber::Drain(NoteList* out) {
+        std::unique_lock<std::mutex> lock(mu_);
+        // Copied rather than moved, so that the queue's slots keep their
+        // buffers too.
+        while (!queue_.empty()) {
+            out->Add()->CopyFrom(queue_.front());
+            queue_.Pop();
+        }
+        armed_ = true;
+    }
+
+    bool NoteSubscriber::Close() {
+        std::unique_lock<std::mutex> lock(mu_);
+        closed_ = true;
+        return !armed_;
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,61 @@
+#ifndef ROUTE_SERVER_NOTE_SUBSCRIBER_H
+#define ROUTE_SERVER_NOTE_SUBSCRIBER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "ring_buffer.h"
+#include "route_guide.pb.h"
+
+namespace routeguide {
+
+    // Notes handed to a RouteChat stream to write. Clear() keeps the
+    // elements, buffers included, for the next Add(), so a stream that
+    // reuses one list stops allocating once it has held its largest batch.
+    using NoteList = google::protobuf::RepeatedPtrField<RouteNote>;
+
+    // Bounded queue of notes pushed live to one RouteChat stream. Publishers
+    // never block on a slow reader: when the queue is full the oldest note
+    // is dropped to make room.
+    //
+    // The consumer passes a wake function, which is called once when notes
+    // arrive and not again until the consumer has taken them with Drain().
+    // Both servers use it to set an alarm that drains the queue from the
+    // stream's own thread.
+    class NoteSubscriber {
+    public:
+        NoteSubscriber(size_t capacity, std::function<void()> wake);
+        NoteSubscriber(const NoteSubscriber&) = delete;
+        NoteSubscriber& operator=(const NoteSubscriber&) = delete;
+
+        // Queues a copy of note. Returns false if an older note was dropped.
+        bool Deliver(const RouteNote& note);
+
+        // Copies the queued notes to the end of out, empties the queue and
+        // re-arms the wake function.
+        void Drain(NoteList* out);
+
+        // Stops deliveries. Returns true if the wake function was called
+        // and its notes have not been drained since.
+        bool Close();
+
+        // Locations the subscriber has posted to. Only its own stream, which
+        // posts one note at a time, touches them.
+        std::vector<uint64_t>& keys() { return keys_; }
+
+    private:
+        const size_t capacity_;
+        const std::function<void()> wake_;
+        std::mutex mu_;
+        RingBuffer<RouteNote> queue_;
+        bool armed_ = true;
+        bool closed_ = false;
+        std::vector<uint64_t> keys_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_NOTE_SUBSCRIBER_H
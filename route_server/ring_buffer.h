@@ -0,0 +1,66 @@
+#ifndef ROUTE_SERVER_RING_BUFFER_H
+#define ROUTE_SERVER_RING_BUFFER_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace routeguide {
+
+    // FIFO over a power-of-two array of slots. Popping an element leaves its
+    // slot constructed, and Push() hands the slot back for reuse, so a
+    // steady stream of pushes and pops keeps reusing the same allocations
+    // (including any buffers the elements own) instead of churning the heap.
+    // The array only grows when a push finds every slot in use.
+    template <typename T>
+    class RingBuffer {
+    public:
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        size_t capacity() const { return slots_.size(); }
+
+        // i-th element counting from the oldest.
+        T& operator[](size_t i) { return slots_[(head_ + i) & (slots_.size() - 1)]; }
+        const T& operator[](size_t i) const {
+            return slots_[(head_ + i) & (slots_.size() - 1)];
+        }
+        T& front() { return slots_[head_]; }
+        const T& front() const { return slots_[head_]; }
+
+        // Appends an element and returns its slot, which may still hold an
+        // element popped earlier; the caller overwrites it.
+        T& Push() {
+            if (size_ == slots_.size()) {
+                Grow();
+            }
+            T& slot = slots_[(head_ + size_) & (slots_.size() - 1)];
+            size_++;
+            return slot;
+        }
+
+        void Pop() {
+            head_ = (head_ + 1) & (slots_.size() - 1);
+            size_--;
+        }
+
+        // Every slot, live or not, for accounting the memory they hold.
+        const std::vector<T>& slots() const { return slots_; }
+
+    private:
+        void Grow() {
+            std::vector<T> slots(slots_.empty() ? 4 : slots_.size() * 2);
+            for (size_t i = 0; i < slots_.size(); i++) {
+                slots[i] = std::move((*this)[i]);
+            }
+            slots_.swap(slots);
+            head_ = 0;
+        }
+
+        std::vector<T> slots_;
+        size_t head_ = 0;
+        size_t size_ = 0;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_RING_BUFFER_H
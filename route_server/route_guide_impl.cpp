@@ -0,0 +1,356 @@
+#include "route_guide_impl.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <grpc/support/time.h>
+#include <grpcpp/alarm.h>
+#include "rpc_arena.h"
+#include "wire_buffer.h"
+
+namespace routeguide {
+
+    namespace {
+        // ListFeatures on the callback API, with one write outstanding at a
+        // time. Each feature is written as its wire bytes; a cancelled call
+        // fails its next write, which ends it.
+        class ListFeaturesReactor final
+            : public grpc::ServerWriteReactor<grpc::ByteBuffer> {
+        public:
+            ListFeaturesReactor(RouteGuideState* state,
+                grpc::CallbackServerContext* context, const grpc::ByteBuffer& request)
+                : timer_(state->metrics(), Rpc::kListFeatures) {
+                std::string error;
+                page_ = state->ListFeatures(request, &error);
+                if (page_ == nullptr) {
+                    Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, error));
+                    return;
+                }
+                if (!page_->next_page_token.empty()) {
+                    context->AddTrailingMetadata(kNextPageTokenKey,
+                        page_->next_page_token);
+                }
+                WriteNext();
+            }
+
+            void OnWriteDone(bool ok) override {
+                if (!ok) {
+                    Finish(grpc::Status::CANCELLED);
+                    return;
+                }
+                WriteNext();
+            }
+
+            // May run while a write is outstanding; the next WriteNext finishes.
+            void OnCancel() override { cancelled_ = true; }
+
+            void OnDone() override { delete this; }
+
+        private:
+            void WriteNext() {
+                if (cancelled_) {
+                    Finish(grpc::Status::CANCELLED);
+                    return;
+                }
+                size_t n = page_->positions.size();
+                if (next_ == n) {
+                    Finish(grpc::Status::OK);
+                    return;
+                }
+                feature_ = WireBuffer(
+                    page_->db->encoded().Get(page_->positions[next_]));
+                grpc::WriteOptions options = ListWriteOptions(next_, n);
+                if (++next_ == n) {
+                    // The last feature goes out together with the status.
+                    StartWriteAndFinish(&feature_, options, grpc::Status::OK);
+                    return;
+                }
+                StartWrite(&feature_, options);
+            }
+
+            RpcTimer timer_;
+            std::shared_ptr<const FeaturePage> page_;
+            size_t next_ = 0;
+            grpc::ByteBuffer feature_;
+            std::atomic<bool> cancelled_{ false };
+        };
+
+        // RouteChat on the callback API. Like the completion-queue server's
+        // RouteChatCall it keeps one read and one write outstanding at most,
+        // and needs no thread of its own: live notes set an alarm, whose
+        // callback drains them into the outbox. The reactions run on gRPC's
+        // threads, so the state is guarded by mu_.
+        class RouteChatReactor final
+            : public grpc::ServerBidiReactor<RouteNote, RouteNote> {
+        public:
+            explicit RouteChatReactor(RouteGuideState* state)
+                : state_(state), timer_(state->metrics(), Rpc::kRouteChat),
+                note_(arena_.Create<RouteNote>()), outbox_(arena_.Create<NoteList>()) {
+                subscriber_ = state_->NewSubscriber([this] { Wake(); });
+                std::lock_guard<std::mutex> lock(mu_);
+                Pump();
+            }
+
+            void OnReadDone(bool ok) override {
+                std::lock_guard<std::mutex> lock(mu_);
+                reading_ = false;
+                if (!ok) {
+                    // The client is done sending, or the call is gone.
+                    read_done_ = true;
+                }
+                else {
+                    ticket_ = state_->RouteChat(*note_, outbox_, subscriber_);
+                }
+                Pump();
+            }
+
+            void OnWriteDone(bool ok) override {
+                std::lock_guard<std::mutex> lock(mu_);
+                writing_ = false;
+                if (!ok) {
+                    EndChat();
+                    if (!finished_) {
+                        finished_ = true;
+                        Finish(grpc::Status::CANCELLED);
+                    }
+                    return;
+                }
+                if (++next_write_ == outbox_->size()) {
+                    // Keeps the notes' buffers for the next ones.
+                    outbox_->Clear();
+                    next_write_ = 0;
+                }
+                Pump();
+            }
+
+            void OnDone() override {
+                bool last;
+                {
+                    std::lock_guard<std::mutex> lock(mu_);
+                    // No wake can start once the subscriber is closed.
+                    EndChat();
+                    done_ = true;
+                    last = alarms_ == 0;
+                }
+                if (last) {
+                    delete this;
+                }
+            }
+
+        private:
+            // Runs on the posting thread, under the subscriber's lock, so it must
+            // not take mu_. The subscriber calls it once per Drain(), and a fresh
+            // alarm each time never re-arms one whose callback is still running.
+            void Wake() {
+                alarms_++;
+                wake_.reset(new grpc::Alarm());
+                wake_->Set(gpr_now(GPR_CLOCK_MONOTONIC), [this](bool /*ok*/) {
+                    std::unique_lock<std::mutex> lock(mu_);
+                    if (subscriber_ != nullptr) {
+                        woken_ = true;
+                        Pump();
+                    }
+                    ReleaseAlarm(&lock);
+                });
+            }
+
+            void OnSaved(bool /*ok*/) {
+                std::unique_lock<std::mutex> lock(mu_);
+                saving_ = false;
+                Pump();
+                ReleaseAlarm(&lock);
+            }
+
+            // Deletes the reactor if gRPC is done with it and this was the last
+            // alarm outstanding.
+            void ReleaseAlarm(std::unique_lock<std::mutex>* lock) {
+                bool last = --alarms_ == 0 && done_;
+                lock->unlock();
+                if (last) {
+                    delete this;
+                }
+            }
+
+            // Starts whatever comes next: the next queued write, else another read,
+            // else Finish once the client is done, all is written and the notes
+            // are saved. Called with mu_ held.
+            void Pump() {
+                if (finished_ || done_ || writing_) {
+                    return;
+                }
+                if (outbox_->empty() && woken_) {
+                    woken_ = false;
+                    subscriber_->Drain(outbox_);
+                }
+                if (!outbox_->empty()) {
+                    writing_ = true;
+                    StartWrite(&outbox_->Get(next_write_));
+                    return;
+                }
+                if (read_done_) {
+                    if (ticket_ != 0) {
+                        // The result may come at once or on the log's thread; either
+                        // way it comes back through an alarm, outside this call.
+                        uint64_t ticket = ticket_;
+                        ticket_ = 0;
+                        saving_ = true;
+                        alarms_++;
+                        state_->OnNotesSaved(ticket, [this](bool saved) {
+                            save_failed_ = !saved;
+                            saved_.Set(gpr_now(GPR_CLOCK_MONOTONIC),
+                                [this](bool ok) { OnSaved(ok); });
+                        });
+                        return;
+                    }
+                    if (saving_) {
+                        return;
+                    }
+                    EndChat();
+                    finished_ = true;
+                    Finish(save_failed_ ?
+                        grpc::Status(grpc::StatusCode::INTERNAL,
+                            "RouteChat notes could not be written to the note log") :
+                        grpc::Status::OK);
+                    return;
+                }
+                if (!reading_) {
+                    reading_ = true;
+                    StartRead(note_);
+                }
+            }
+
+            void EndChat() {
+                if (subscriber_ != nullptr) {
+                    state_->EndChat(subscriber_);
+                    subscriber_ = nullptr;
+                    woken_ = false;
+                }
+            }
+
+            RouteGuideState* state_;
+            RpcTimer timer_;
+            std::mutex mu_;
+            std::shared_ptr<NoteSubscriber> subscriber_;
+            // The note read and the notes to write, on the call's arena and reused
+            // for the whole stream. The outbox is written front to back from
+            // next_write_ and cleared once all are written; queueing more never
+            // moves the note being written.
+            RpcArena arena_;
+            RouteNote* note_;
+            NoteList* outbox_;
+            int next_write_ = 0;
+            // Set by Wake() only, which the subscriber serializes.
+            std::unique_ptr<grpc::Alarm> wake_;
+            // Fires once the notes are saved.
+            grpc::Alarm saved_;
+            // Alarms whose callbacks have not run yet; the reactor outlives them.
+            std::atomic<int> alarms_{ 0 };
+            // Ticket of the last note not yet waited for (see
+            // RouteGuideState::RouteChat), and whether saving failed.
+            uint64_t ticket_ = 0;
+            bool save_failed_ = false;
+            bool reading_ = false;
+            bool writing_ = false;
+            bool read_done_ = false;
+            bool woken_ = false;
+            bool saving_ = false;
+            bool finished_ = false;
+            bool done_ = false;
+        };
+
+    }
+
+    grpc::ServerUnaryReactor* RouteGuideImpl::GetFeature(
+        grpc::CallbackServerContext* context, const grpc::ByteBuffer* request,
+        grpc::ByteBuffer* response) {
+        RpcTimer timer(state_->metrics(), Rpc::kGetFeature);
+        grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+        std::string error;
+        if (!state_->GetFeature(*request, response, &error)) {
+            reactor->Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, error));
+        }
+        else {
+            reactor->Finish(grpc::Status::OK);
+        }
+        return reactor;
+    }
+
+    grpc::ServerWriteReactor<grpc::ByteBuffer>* RouteGuideImpl::ListFeatures(
+        grpc::CallbackServerContext* context, const grpc::ByteBuffer* request) {
+        return new ListFeaturesReactor(state_, context, *request);
+    }
+
+    grpc::Status RouteGuideImpl::RecordRoute(grpc::ServerContext* /*context*/,
+        grpc::ServerReader<Point>* reader, RouteSummary* summary) {
+        RpcTimer timer(state_->metrics(), Rpc::kRecordRoute);
+        Point point;
+        RouteRecorder recorder(*state_);
+        while (reader->Read(&point)) {
+            recorder.Add(point);
+        }
+        recorder.Finish(summary);
+
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RouteGuideImpl::RecordRouteBatched(grpc::ServerContext* /*context*/,
+        grpc::ServerReader<RouteBatch>* reader, RouteSummary* summary) {
+        RpcTimer timer(state_->metrics(), Rpc::kRecordRouteBatched);
+        RouteBatch batch;
+        RouteRecorder recorder(*state_);
+        std::string error;
+        while (reader->Read(&batch)) {
+            if (!recorder.Add(batch, &error)) {
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+            }
+        }
+        recorder.Finish(summary);
+
+        return grpc::Status::OK;
+    }
+
+    grpc::ServerBidiReactor<RouteNote, RouteNote>* RouteGuideImpl::RouteChat(
+        grpc::CallbackServerContext* /*context*/) {
+        return new RouteChatReactor(state_);
+    }
+
+    grpc::Status RouteGuideImpl::GetFeatures(grpc::ServerContext* /*context*/,
+        const PointList* points, FeatureList* features) {
+        RpcTimer timer(state_->metrics(), Rpc::kGetFeatures);
+        state_->GetFeatures(*points, features);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RouteGuideImpl::StreamFeatures(grpc::ServerContext* /*context*/,
+        grpc::ServerReaderWriter<FeatureList, PointList>* stream) {
+        RpcTimer timer(state_->metrics(), Rpc::kStreamFeatures);
+        PointList points;
+        FeatureList features;
+        while (stream->Read(&points)) {
+            features.Clear();
+            state_->GetFeatures(points, &features);
+            if (!stream->Write(features)) {
+                break;
+            }
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RouteGuideImpl::NearestFeatures(grpc::ServerContext* /*context*/,
+        const NearestRequest* request, NearbyFeatureList* features) {
+        RpcTimer timer(state_->metrics(), Rpc::kNearestFeatures);
+        state_->NearestFeatures(*request, features);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RouteGuideImpl::FeaturesWithinRadius(grpc::ServerContext* /*context*/,
+        const RadiusRequest* request, NearbyFeatureList* features) {
+        RpcTimer timer(state_->metrics(), Rpc::kFeaturesWithinRadius);
+        state_->FeaturesWithinRadius(*request, features);
+        return grpc::Status::OK;
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,47 @@
+#ifndef ROUTE_SERVER_ROUTE_GUIDE_IMPL_H
+#define ROUTE_SERVER_ROUTE_GUIDE_IMPL_H
+
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/byte_buffer.h>
+#include "route_guide.grpc.pb.h"
+#include "route_guide_state.h"
+
+namespace routeguide {
+
+    // RouteGuide served through gRPC's own threads. GetFeature and
+    // ListFeatures are raw callback methods, answered from the DB's wire
+    // bytes, and RouteChat is a callback method too; the rest are
+    // synchronous.
+    class RouteGuideImpl final : public RouteGuide::WithRawCallbackMethod_GetFeature<
+        RouteGuide::WithRawCallbackMethod_ListFeatures<
+        RouteGuide::WithCallbackMethod_RouteChat<RouteGuide::Service>>> {
+    public:
+        explicit RouteGuideImpl(RouteGuideState* state) : state_(state) {}
+
+        grpc::ServerUnaryReactor* GetFeature(grpc::CallbackServerContext* context,
+            const grpc::ByteBuffer* request, grpc::ByteBuffer* response) override;
+        grpc::ServerWriteReactor<grpc::ByteBuffer>* ListFeatures(
+            grpc::CallbackServerContext* context,
+            const grpc::ByteBuffer* request) override;
+        grpc::Status RecordRoute(grpc::ServerContext* context,
+            grpc::ServerReader<Point>* reader, RouteSummary* summary) override;
+        grpc::Status RecordRouteBatched(grpc::ServerContext* context,
+            grpc::ServerReader<RouteBatch>* reader, RouteSummary* summary) override;
+        grpc::ServerBidiReactor<RouteNote, RouteNote>* RouteChat(
+            grpc::CallbackServerContext* context) override;
+        grpc::Status GetFeatures(grpc::ServerContext* context, const PointList* points,
+            FeatureList* features) override;
+        grpc::Status StreamFeatures(grpc::ServerContext* context,
+            grpc::ServerReaderWriter<FeatureList, PointList>* stream) override;
+        grpc::Status NearestFeatures(grpc::ServerContext* context,
+            const NearestRequest* request, NearbyFeatureList* features) override;
+        grpc::Status FeaturesWithinRadius(grpc::ServerContext* context,
+            const RadiusRequest* request, NearbyFeatureList* features) override;
+
+    private:
+        RouteGuideState* state_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_ROUTE_GUIDE_IMPL_H
@@ -0,0 +1,340 @@
+#include "route_guide_state.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+#include "shard_map.h"
+#include "wire_buffer.h"
+
+namespace routeguide {
+
+    namespace {
+        bool LoadDb(const std::string& db_path, const RouteGuideOptions& options,
+            FeatureDb* db, std::string* error) {
+            if (!db->Load(db_path, error)) {
+                return false;
+            }
+            if (options.shard_count > 1) {
+                size_t loaded = db->store().size();
+                RetainShard(ShardMap(options.shard_count, options.shard_tile_degrees),
+                    options.shard_index, db);
+                std::cout << "Shard " << options.shard_index << " of "
+                    << options.shard_count << " keeps " << db->store().size()
+                    << " of " << loaded << " features." << std::endl;
+            }
+            std::cout << (db->mapped() ? "DB snapshot mapped, serving " : "DB parsed, loaded ")
+                << db->store().size() << " features (" << db->store().MemoryUsage()
+                << " bytes on the heap, and " << db->encoded().MemoryUsage()
+                << " of wire bytes)." << std::endl;
+            return true;
+        }
+    }
+
+    RouteGuideState::RouteGuideState(const std::string& db_path,
+        const RouteGuideOptions& options)
+        : options_(options), db_path_(db_path), notes_(options.note_limits),
+        list_cache_(options.list_cache_bytes) {
+        std::string error;
+        if (!ReloadDb(&error)) {
+            std::cout << "Error loading the db file " << db_path << ": " << error
+                << std::endl;
+            auto db = std::make_shared<FeatureDb>();
+            list_cache_.Reset(db.get());
+            std::atomic_store(&db_, std::shared_ptr<const FeatureDb>(std::move(db)));
+        }
+        if (options_.route_batch_points == 0) {
+            options_.route_batch_points = 1;
+        }
+        if (options_.route_workers > 0) {
+            route_workers_.reset(new WorkerPool(options_.route_workers));
+        }
+        if (!options_.note_log_dir.empty()) {
+            NoteLogOptions log_options;
+            log_options.dir = options_.note_log_dir;
+            log_options.snapshot_interval = options_.note_snapshot_interval;
+            note_log_.reset(new NoteLog(log_options, &notes_, &metrics_));
+            if (!note_log_->Open(&error)) {
+                std::cout << "Error opening the note log in " << options_.note_log_dir
+                    << ": " << error << "; notes are kept in memory only" << std::endl;
+                note_log_.reset();
+            }
+        }
+    }
+
+    bool RouteGuideState::ReloadDb(std::string* error) {
+        // One load at a time; readers never take this lock.
+        std::unique_lock<std::mutex> lock(reload_mu_);
+        auto db = std::make_shared<FeatureDb>();
+        if (!LoadDb(db_path_, options_, db.get(), error)) {
+            metrics_.failed_loads.Add();
+            return false;
+        }
+        const FeatureDb* published = db.get();
+        std::atomic_store(&db_, std::shared_ptr<const FeatureDb>(std::move(db)));
+        // After the store, so a page of the old DB that is cached meanwhile
+        // is dropped here, and one cached later is refused.
+        list_cache_.Reset(published);
+        metrics_.loads.Add();
+        return true;
+    }
+
+    namespace {
+        void FillFeature(const FeatureDb& db, const Point& point, Feature* feature) {
+            std::string_view name = db.FeatureName(point.latitude(), point.longitude());
+            feature->set_name(name.data(), name.size());
+            feature->mutable_location()->CopyFrom(point);
+        }
+    }
+
+    bool RouteGuideState::GetFeature(const grpc::ByteBuffer& request,
+        grpc::ByteBuffer* response, std::string* error) const {
+        grpc::Slice bytes = WireSlice(request);
+        Point point;
+        if (!point.ParseFromArray(bytes.begin(), static_cast<int>(bytes.size()))) {
+            *error = "malformed Point";
+            return false;
+        }
+        std::shared_ptr<const FeatureDb> current = db();
+        uint32_t i = current->point_index().Find(point.latitude(), point.longitude());
+        if (i != PointIndex::kNotFound) {
+            // The feature's own location is the point asked for.
+            *response = WireBuffer(current->encoded().Get(i));
+            return true;
+        }
+        Feature feature;
+        feature.mutable_location()->CopyFrom(point);
+        *response = WireBuffer(feature.SerializeAsString());
+        return true;
+    }
+
+    void RouteGuideState::GetFeatures(const PointList& points,
+        FeatureList* features) const {
+        features->mutable_features()->Reserve(
+            features->features_size() + points.points_size());
+        std::shared_ptr<const FeatureDb> current = db();
+        metrics_.lookup_points.Record(points.points_size());
+        for (const Point& point : points.points()) {
+            FillFeature(*current, point, features->add_features());
+        }
+    }
+
+    std::shared_ptr<const FeaturePage> RouteGuideState::ListFeatures(
+        const grpc::ByteBuffer& request, std::string* error) const {
+        grpc::Slice bytes = WireSlice(request);
+        std::string_view key = SliceView(bytes);
+        if (std::shared_ptr<const FeaturePage> cached = list_cache_.Find(key)) {
+            metrics_.list_cache_hits.Add();
+            return cached;
+        }
+        Rectangle rectangle;
+        if (!rectangle.ParseFromArray(key.data(), static_cast<int>(key.size()))) {
+            *error = "malformed Rectangle";
+            return nullptr;
+        }
+        const Point& lo = rectangle.lo();
+        const Point& hi = rectangle.hi();
+        Bounds bounds;
+        bounds.left = (std::min)(lo.longitude(), hi.longitude());
+        bounds.right = (std::max)(lo.longitude(), hi.longitude());
+        bounds.top = (std::max)(lo.latitude(), hi.latitude());
+        bounds.bottom = (std::min)(lo.latitude(), hi.latitude());
+        auto page = std::make_shared<FeaturePage>();
+        page->db = db();
+        metrics_.list_scanned.Record(page->db->Query(bounds, &page->positions));
+        metrics_.list_matched.Record(page->positions.size());
+        if (!SelectPage(rectangle, page.get(), error)) {
+            return nullptr;
+        }
+        if (list_cache_.enabled()) {
+            metrics_.list_cache_misses.Add();
+            list_cache_.Insert(key, page);
+        }
+        return page;
+    }
+
+    namespace {
+        void FillNearby(const FeatureDb& db,
+            const std::vector<SphereIndex::Neighbor>& neighbors,
+            NearbyFeatureList* features) {
+            features->mutable_features()->Reserve(static_cast<int>(neighbors.size()));
+            for (const SphereIndex::Neighbor& n : neighbors) {
+                NearbyFeature* nearby = features->add_features();
+                db.store().CopyTo(n.position, nearby->mutable_feature());
+                nearby->set_metres(n.metres);
+            }
+        }
+    }
+
+    void RouteGuideState::NearestFeatures(const NearestRequest& request,
+        NearbyFeatureList* features) const {
+        size_t k = request.k() > 0 ? static_cast<size_t>(request.k()) : 0;
+        std::shared_ptr<const FeatureDb> current = db();
+        std::vector<SphereIndex::Neighbor> neighbors;
+        current->sphere_index().Nearest(request.point().latitude(),
+            request.point().longitude(), (std::min)(k, kMaxNearbyFeatures), &neighbors);
+        features->set_truncated(k > kMaxNearbyFeatures &&
+            current->store().size() > kMaxNearbyFeatures);
+        metrics_.nearby_results.Record(neighbors.size());
+        FillNearby(*current, neighbors, features);
+    }
+
+    void RouteGuideState::FeaturesWithinRadius(const RadiusRequest& request,
+        NearbyFeatureList* features) const {
+        size_t limit = kMaxNearbyFeatures;
+        if (request.max_results() > 0) {
+            limit = (std::min)(limit, static_cast<size_t>(request.max_results()));
+        }
+        std::shared_ptr<const FeatureDb> current = db();
+        std::vector<SphereIndex::Neighbor> neighbors;
+        size_t total = current->sphere_index().WithinRadius(request.point().latitude(),
+            request.point().longitude(), request.metres(), limit, &neighbors);
+        features->set_truncated(total > limit);
+        metrics_.nearby_results.Record(neighbors.size());
+        FillNearby(*current, neighbors, features);
+    }
+
+    std::shared_ptr<NoteSubscriber> RouteGuideState::NewSubscriber(
+        std::function<void()> wake) {
+        if (options_.live_note_queue == 0) {
+            return nullptr;
+        }
+        return std::make_shared<NoteSubscriber>(options_.live_note_queue,
+            std::move(wake));
+    }
+
+    uint64_t RouteGuideState::RouteChat(const RouteNote& note, NoteList* replies,
+        const std::shared_ptr<NoteSubscriber>& subscriber) {
+        size_t first_reply = replies->size();
+        uint64_t ticket = 0;
+        if (note_log_ != nullptr) {
+            ticket = note_log_->Post(note, replies, subscriber);
+        }
+        else {
+            notes_.Post(note, replies, subscriber);
+        }
+        metrics_.chat_matched.Record(replies->size() - first_reply);
+        return ticket;
+    }
+
+    void RouteGuideState::OnNotesSaved(uint64_t ticket, std::function<void(bool)> done) {
+        if (note_log_ == nullptr) {
+            done(true);
+            return;
+        }
+        note_log_->OnDurable(ticket, std::move(done));
+    }
+
+    bool RouteGuideState::EndChat(const std::shared_ptr<NoteSubscriber>& subscriber) {
+        notes_.Unsubscribe(subscriber);
+        return subscriber->Close();
+    }
+
+    std::string RouteGuideState::MetricsText() const {
+        return FormatMetrics(metrics_, notes_.Stats(), db()->store().size());
+    }
+
+    namespace {
+        // Batches a recorder may have queued on the worker pool before it
+        // waits for the oldest, which bounds the memory of a fast stream.
+        const size_t kMaxPendingBatches = 8;
+    }
+
+    RouteRecorder::RouteRecorder(const RouteGuideState& state)
+        : state_(state), db_(state.db()), start_time_(std::chrono::steady_clock::now()) {
+        latitudes_.reserve(state_.options().route_batch_points);
+        longitudes_.reserve(state_.options().route_batch_points);
+    }
+
+    void RouteRecorder::Add(const Point& point) {
+        latitudes_.push_back(point.latitude());
+        longitudes_.push_back(point.longitude());
+        if (latitudes_.size() == state_.options().route_batch_points) {
+            Flush();
+        }
+    }
+
+    bool RouteRecorder::Add(const RouteBatch& batch, std::string* error) {
+        if (!RouteBatchDecoder::Check(batch, error)) {
+            return false;
+        }
+        size_t batch_points = state_.options().route_batch_points;
+        int n = batch.latitude_deltas_size();
+        for (int i = 0; i < n;) {
+            // As many points as fit in the buffered batch.
+            size_t size = latitudes_.size();
+            int take = static_cast<int>((std::min)(static_cast<size_t>(n - i),
+                batch_points - size));
+            latitudes_.resize(size + take);
+            longitudes_.resize(size + take);
+            decoder_.Decode(batch, i, i + take, latitudes_.data() + size,
+                longitudes_.data() + size);
+            i += take;
+            if (latitudes_.size() == batch_points) {
+                Flush();
+            }
+        }
+        return true;
+    }
+
+    void RouteRecorder::Flush() {
+        DistanceModel model = state_.options().distance_model;
+        WorkerPool* workers = state_.route_workers();
+        if (workers == nullptr) {
+            total_.Append(MeasureRoute(*db_, latitudes_.data(), longitudes_.data(),
+                latitudes_.size(), model), model);
+            latitudes_.clear();
+            longitudes_.clear();
+            return;
+        }
+        auto task = std::make_shared<std::packaged_task<RouteStats()>>(
+            [db = db_, model, latitudes = std::move(latitudes_),
+            longitudes = std::move(longitudes_)]() {
+            return MeasureRoute(*db, latitudes.data(), longitudes.data(),
+                latitudes.size(), model);
+        });
+        pending_.push_back(task->get_future());
+        workers->Submit([task] { (*task)(); });
+        latitudes_ = std::vector<int32_t>();
+        longitudes_ = std::vector<int32_t>();
+        latitudes_.reserve(state_.options().route_batch_points);
+        longitudes_.reserve(state_.options().route_batch_points);
+        Collect(false);
+    }
+
+    void RouteRecorder::Collect(bool wait) {
+        DistanceModel model = state_.options().distance_model;
+        while (!pending_.empty()) {
+            std::future<RouteStats>& oldest = pending_.front();
+            if (!wait && pending_.size() <= kMaxPendingBatches &&
+                oldest.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return;
+            }
+            total_.Append(oldest.get(), model);
+            pending_.pop_front();
+        }
+    }
+
+    void RouteRecorder::Finish(RouteSummary* summary) {
+        DistanceModel model = state_.options().distance_model;
+        // The tail is measured here while the pool finishes the earlier batches.
+        RouteStats tail = MeasureRoute(*db_, latitudes_.data(),
+            longitudes_.data(), latitudes_.size(), model);
+        latitudes_.clear();
+        longitudes_.clear();
+        Collect(true);
+        total_.Append(tail, model);
+
+        auto elapsed = std::chrono::steady_clock::now() - start_time_;
+        state_.metrics()->route_points.Record(total_.point_count);
+        summary->set_point_count(static_cast<int32_t>(total_.point_count));
+        summary->set_feature_count(static_cast<int32_t>(total_.feature_count));
+        summary->set_distance(static_cast<int32_t>(std::llround(total_.distance.value())));
+        summary->set_elapsed_time(static_cast<int32_t>(
+            std::chrono::duration_cast<std::chrono::seconds>(elapsed).count()));
+        summary->set_elapsed_time_micros(
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,189 @@
+#ifndef ROUTE_SERVER_ROUTE_GUIDE_STATE_H
+#define ROUTE_SERVER_ROUTE_GUIDE_STATE_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpcpp/support/byte_buffer.h>
+#include "feature_db.h"
+#include "geo_distance.h"
+#include "list_cache.h"
+#include "list_page.h"
+#include "note_log.h"
+#include "note_store.h"
+#include "route_batch.h"
+#include "route_stats.h"
+#include "route_guide.pb.h"
+#include "server_metrics.h"
+#include "worker_pool.h"
+
+namespace routeguide {
+
+    // The most features NearestFeatures and FeaturesWithinRadius return.
+    const size_t kMaxNearbyFeatures = 100000;
+
+    struct RouteGuideOptions {
+        // Bounds on the RouteChat history.
+        NoteLimits note_limits;
+        // Capacity of each RouteChat stream's queue of notes that other
+        // clients post later at its locations. 0 disables live delivery.
+        size_t live_note_queue = 0;
+        // How RecordRoute measures the distance between points.
+        DistanceModel distance_model = DistanceModel::kHaversine;
+        // RecordRoute measures points in batches of this many.
+        size_t route_batch_points = 1024;
+        // Threads measuring RecordRoute batches in the background; 0 measures
+        // them on the thread that reads the stream.
+        size_t route_workers = 0;
+        // Bytes the ListFeatures page cache may hold; 0 disables it.
+        size_t list_cache_bytes = 64 << 20;
+        // In a sharded deployment, the shards and this server's place among
+        // them: it loads only the features of its own tiles (see ShardMap).
+        size_t shard_count = 1;
+        size_t shard_index = 0;
+        double shard_tile_degrees = 1.0;
+        // Directory of the RouteChat note log (see NoteLog); empty keeps the
+        // notes in memory only.
+        std::string note_log_dir;
+        // How often the note log is compacted into a snapshot.
+        std::chrono::seconds note_snapshot_interval = std::chrono::seconds(300);
+    };
+
+    // Everything the RouteGuide handlers share, independent of how RPCs are
+    // driven: the feature database and the notes received by RouteChat. The
+    // synchronous RouteGuideImpl and the completion-queue server both call
+    // into it, so they answer identically.
+    //
+    // The feature database can be replaced while serving. It is published
+    // through an atomic shared_ptr: a call takes a reference to the current
+    // DB once and uses it to the end, so a reload never blocks a reader and
+    // the old DB is freed when its last call finishes.
+    class RouteGuideState {
+    public:
+        RouteGuideState(const std::string& db_path, const RouteGuideOptions& options);
+
+        // The current feature database.
+        std::shared_ptr<const FeatureDb> db() const { return std::atomic_load(&db_); }
+        const RouteGuideOptions& options() const { return options_; }
+
+        // Loads the DB file again, building its indexes on the calling thread,
+        // and publishes it. On failure the current DB stays and error says
+        // why.
+        bool ReloadDb(std::string* error);
+
+        // Answers a serialized Point with the serialized feature there, sent
+        // from the DB's wire bytes; the name is empty if there is none. On a
+        // malformed request returns false and says why in error.
+        bool GetFeature(const grpc::ByteBuffer& request, grpc::ByteBuffer* response,
+            std::string* error) const;
+
+        // GetFeature for every point, appending one feature per point.
+        void GetFeatures(const PointList& points, FeatureList* features) const;
+
+        // The page of features that a serialized Rectangle asks for (see
+        // SelectPage), with the DB to read them from; repeated requests are
+        // answered from the page cache. On an invalid request returns nullptr
+        // and says why in error.
+        std::shared_ptr<const FeaturePage> ListFeatures(const grpc::ByteBuffer& request,
+            std::string* error) const;
+
+        // The request's k features nearest to its point, nearest first.
+        void NearestFeatures(const NearestRequest& request,
+            NearbyFeatureList* features) const;
+
+        // The features within the request's radius, nearest first.
+        void FeaturesWithinRadius(const RadiusRequest& request,
+            NearbyFeatureList* features) const;
+
+        // Returns the subscriber through which a new RouteChat stream receives
+        // notes posted later at its locations, or nullptr if live delivery
+        // is off. wake is passed on to NoteSubscriber.
+        std::shared_ptr<NoteSubscriber> NewSubscriber(std::function<void()> wake);
+
+        // Stores note and returns, in replies, copies of the notes received
+        // earlier at the same location. The caller writes the replies after
+        // the call returns, without holding any lock. subscriber, if set,
+        // starts receiving the notes posted at this location from now on.
+        // Returns the ticket to wait for before the note counts as saved;
+        // 0 if notes are not logged.
+        uint64_t RouteChat(const RouteNote& note, NoteList* replies,
+            const std::shared_ptr<NoteSubscriber>& subscriber = nullptr);
+
+        // Calls done once the note with ticket is saved, with false if it
+        // could not be (see NoteLog::OnDurable): at once if notes are not
+        // logged, else possibly on another thread.
+        void OnNotesSaved(uint64_t ticket, std::function<void(bool)> done);
+
+        // Ends the live delivery to subscriber; returns NoteSubscriber::Close().
+        bool EndChat(const std::shared_ptr<NoteSubscriber>& subscriber);
+
+        NoteStoreStats note_stats() const { return notes_.Stats(); }
+
+        // Recorded by the handlers and by the calls above.
+        ServerMetrics* metrics() const { return &metrics_; }
+        // All metrics in the Prometheus text format.
+        std::string MetricsText() const;
+
+        // Measures RecordRoute batches; nullptr if they are measured inline.
+        WorkerPool* route_workers() const { return route_workers_.get(); }
+
+    private:
+        RouteGuideOptions options_;
+        std::string db_path_;
+        // Only accessed through std::atomic_load and std::atomic_store.
+        std::shared_ptr<const FeatureDb> db_;
+        std::mutex reload_mu_;
+        NoteStore notes_;
+        std::unique_ptr<WorkerPool> route_workers_;
+        mutable ListCache list_cache_;
+        mutable ServerMetrics metrics_;
+        // Last, so it is stopped before the notes and metrics it uses go.
+        std::unique_ptr<NoteLog> note_log_;
+    };
+
+    // Accumulates the RouteSummary of one RecordRoute call. Points are
+    // buffered into batches; each full batch is measured into RouteStats,
+    // on the worker pool if there is one, while the stream keeps reading,
+    // and the partial stats are appended in route order as they complete.
+    // Finish() measures the last partial batch itself, so a long route
+    // costs little more than one batch after the client's WritesDone. The
+    // clock starts when the recorder is created, and the whole route is
+    // matched against the DB that was current then.
+    class RouteRecorder {
+    public:
+        explicit RouteRecorder(const RouteGuideState& state);
+
+        void Add(const Point& point);
+        // Adds the points of a RecordRouteBatched message, decoded straight
+        // into the batch buffers. On a malformed batch returns false and
+        // says why in error.
+        bool Add(const RouteBatch& batch, std::string* error);
+        void Finish(RouteSummary* summary);
+
+    private:
+        // Hands the buffered batch to the worker pool, or measures it inline.
+        void Flush();
+        // Appends the batches measured so far; with wait, all of them.
+        void Collect(bool wait);
+
+        const RouteGuideState& state_;
+        std::shared_ptr<const FeatureDb> db_;
+        std::chrono::steady_clock::time_point start_time_;
+        std::vector<int32_t> latitudes_;
+        std::vector<int32_t> longitudes_;
+        RouteBatchDecoder decoder_;
+        RouteStats total_;
+        // Batches on the worker pool, in route order.
+        std::deque<std::future<RouteStats>> pending_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_ROUTE_GUIDE_STATE_H
@@ -0,0 +1,995 @@
+#include "route_router.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <utility>
+
+#include <grpc/grpc.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include "geo_distance.h"
+#include "list_page.h"
+#include "route_batch.h"
+#include "route_stats.h"
+#include "wire_buffer.h"
+
+namespace routeguide {
+
+    namespace {
+        const char kGetFeatureMethod[] = "/routeguide.RouteGuide/GetFeature";
+
+        // Router page tokens are this prefix and one entry per shard,
+        // separated by commas: the backend token to resume the shard from,
+        // empty if it has not been listed yet, or kShardDone once it has
+        // nothing more to send.
+        const char kRouterTokenPrefix[] = "shards:";
+        const char kShardDone[] = "~";
+
+        bool ParseRouterToken(const std::string& token, size_t shard_count,
+            std::vector<std::string>* entries) {
+            size_t prefix = sizeof(kRouterTokenPrefix) - 1;
+            if (token.compare(0, prefix, kRouterTokenPrefix) != 0) {
+                return false;
+            }
+            entries->clear();
+            size_t begin = prefix;
+            while (true) {
+                size_t comma = token.find(',', begin);
+                if (comma == std::string::npos) {
+                    entries->push_back(token.substr(begin));
+                    break;
+                }
+                entries->push_back(token.substr(begin, comma - begin));
+                begin = comma + 1;
+            }
+            return entries->size() == shard_count;
+        }
+
+        std::string RouterToken(const std::vector<std::string>& entries) {
+            std::string token = kRouterTokenPrefix;
+            for (size_t i = 0; i < entries.size(); i++) {
+                if (i != 0) {
+                    token += ',';
+                }
+                token += entries[i];
+            }
+            return token;
+        }
+
+        // Counts a failed call to a shard. Cancelled ones follow the client's
+        // call and are not counted.
+        void CountShardStatus(ServerMetrics* metrics, const grpc::Status& status) {
+            if (!status.ok() && status.error_code() != grpc::StatusCode::CANCELLED) {
+                metrics->shard_errors.Add();
+            }
+        }
+
+        // Waits for a set of calls started on the callback API.
+        class CallGroup {
+        public:
+            explicit CallGroup(ServerMetrics* metrics) : metrics_(metrics) {}
+
+            void Add() {
+                std::unique_lock<std::mutex> lock(mu_);
+                pending_++;
+            }
+            void Done(const grpc::Status& status) {
+                CountShardStatus(metrics_, status);
+                std::unique_lock<std::mutex> lock(mu_);
+                if (!status.ok() && status_.ok()) {
+                    status_ = status;
+                }
+                // Under the lock: the waiter may free the group once it wakes.
+                if (--pending_ == 0) {
+                    all_done_.notify_all();
+                }
+            }
+            // The first failure, or OK, once every call is done.
+            grpc::Status Wait() {
+                std::unique_lock<std::mutex> lock(mu_);
+                all_done_.wait(lock, [this] { return pending_ == 0; });
+                return status_;
+            }
+
+        private:
+            ServerMetrics* metrics_;
+            std::mutex mu_;
+            std::condition_variable all_done_;
+            int pending_ = 0;
+            grpc::Status status_;
+        };
+
+        // Reads one shard's page of a ListFeatures, with the token of its
+        // next page. The owner frees it after the group's Wait().
+        class ShardListCall final : public grpc::ClientReadReactor<Feature> {
+        public:
+            ShardListCall(RouteGuide::Stub* stub, grpc::ServerContext* server_context,
+                const Rectangle& request, CallGroup* group)
+                : context_(grpc::ClientContext::FromServerContext(*server_context)),
+                request_(request), group_(group) {
+                group_->Add();
+                stub->async()->ListFeatures(context_.get(), &request_, this);
+                StartRead(NextFeature());
+                StartCall();
+            }
+            void OnReadDone(bool ok) override {
+                if (ok) {
+                    StartRead(NextFeature());
+                }
+                else {
+                    // The slot of the read that found the end of the stream.
+                    features_.pop_back();
+                }
+            }
+            void OnDone(const grpc::Status& status) override {
+                if (status.ok()) {
+                    const auto& trailers = context_->GetServerTrailingMetadata();
+                    auto token = trailers.find(kNextPageTokenKey);
+                    if (token != trailers.end()) {
+                        next_page_token_.assign(token->second.data(), token->second.size());
+                    }
+                }
+                group_->Done(status);
+            }
+
+            std::vector<Feature>& features() { return features_; }
+            const std::string& next_page_token() const { return next_page_token_; }
+
+        private:
+            Feature* NextFeature() {
+                features_.emplace_back();
+                return &features_.back();
+            }
+
+            std::unique_ptr<grpc::ClientContext> context_;
+            Rectangle request_;
+            CallGroup* group_;
+            std::vector<Feature> features_;
+            std::string next_page_token_;
+        };
+
+        // A feature of one shard's answer in the merged order: by distance,
+        // then shard, then place in the shard's answer, which keeps every
+        // shard's own order.
+        struct Merged {
+            double metres;
+            size_t shard;
+            size_t index;
+
+            bool operator<(const Merged& other) const {
+                if (metres != other.metres) {
+                    return metres < other.metres;
+                }
+                return shard < other.shard || (shard == other.shard && index < other.index);
+            }
+        };
+
+        // Merges the shards' nearest-first lists into features, keeping the
+        // limit nearest. Returns how many there were in all.
+        size_t MergeNearby(std::vector<NearbyFeatureList>* lists, size_t limit,
+            NearbyFeatureList* features) {
+            std::vector<Merged> merged;
+            for (size_t shard = 0; shard < lists->size(); shard++) {
+                const NearbyFeatureList& list = (*lists)[shard];
+                for (int i = 0; i < list.features_size(); i++) {
+                    merged.push_back({ list.features(i).metres(), shard,
+                        static_cast<size_t>(i) });
+                }
+            }
+            size_t total = merged.size();
+            if (total > limit) {
+                std::partial_sort(merged.begin(), merged.begin() + limit, merged.end());
+                merged.resize(limit);
+            }
+            else {
+                std::sort(merged.begin(), merged.end());
+            }
+            features->mutable_features()->Reserve(static_cast<int>(merged.size()));
+            for (const Merged& m : merged) {
+                features->add_features()->Swap(
+                    (*lists)[m.shard].mutable_features(static_cast<int>(m.index)));
+            }
+            return total;
+        }
+
+        // Sends each shard the points of one route that lie on its tiles, as
+        // RecordRouteBatched, and measures the whole route itself in batches
+        // as a backend would, so the summary matches an unsharded server's.
+        // The shards only count the features passed.
+        class RouteSplitter {
+        public:
+            RouteSplitter(const std::vector<std::unique_ptr<RouteGuide::Stub>>& stubs,
+                const ShardMap& shard_map, const RouteGuideOptions& options,
+                const FeatureDb& empty_db, ServerMetrics* metrics,
+                grpc::ServerContext* context)
+                : stubs_(stubs), shard_map_(shard_map), options_(options),
+                empty_db_(empty_db), metrics_(metrics), context_(context),
+                legs_(stubs.size()),
+                start_time_(std::chrono::steady_clock::now()) {}
+            ~RouteSplitter() {
+                // A route given up on: the shards need not finish it.
+                for (std::unique_ptr<Leg>& leg : legs_) {
+                    if (leg != nullptr) {
+                        leg->context->TryCancel();
+                        leg->writer->Finish();
+                    }
+                }
+            }
+
+            void Add(int32_t latitude, int32_t longitude) {
+                latitudes_.push_back(latitude);
+                longitudes_.push_back(longitude);
+                if (latitudes_.size() >= options_.route_batch_points) {
+                    Measure();
+                }
+                size_t shard = shard_map_.ShardOf(latitude, longitude);
+                std::unique_ptr<Leg>& leg = legs_[shard];
+                if (leg == nullptr) {
+                    leg.reset(new Leg);
+                    leg->context = grpc::ClientContext::FromServerContext(*context_);
+                    leg->writer = stubs_[shard]->RecordRouteBatched(
+                        leg->context.get(), &leg->summary);
+                }
+                leg->encoder.Add(latitude, longitude, &leg->batch);
+                if (static_cast<size_t>(leg->batch.latitude_deltas_size()) >=
+                    options_.route_batch_points) {
+                    // A failed write shows up in Finish().
+                    leg->writer->Write(leg->batch);
+                    leg->batch.Clear();
+                }
+            }
+
+            grpc::Status Finish(RouteSummary* summary) {
+                Measure();
+                // Every shard measures its tail at once, then each is waited for.
+                for (std::unique_ptr<Leg>& leg : legs_) {
+                    if (leg != nullptr) {
+                        if (leg->batch.latitude_deltas_size() > 0) {
+                            leg->writer->Write(leg->batch);
+                        }
+                        leg->writer->WritesDone();
+                    }
+                }
+                grpc::Status status;
+                for (std::unique_ptr<Leg>& leg : legs_) {
+                    if (leg != nullptr) {
+                        grpc::Status shard_status = leg->writer->Finish();
+                        CountShardStatus(metrics_, shard_status);
+                        if (!shard_status.ok() && status.ok()) {
+                            status = shard_status;
+                        }
+                        total_.feature_count += leg->summary.feature_count();
+                        leg.reset();
+                    }
+                }
+                if (!status.ok()) {
+                    return status;
+                }
+                auto elapsed = std::chrono::steady_clock::now() - start_time_;
+                summary->set_point_count(static_cast<int32_t>(total_.point_count));
+                summary->set_feature_count(static_cast<int32_t>(total_.feature_count));
+                summary->set_distance(
+                    static_cast<int32_t>(std::llround(total_.distance.value())));
+                summary->set_elapsed_time(static_cast<int32_t>(
+                    std::chrono::duration_cast<std::chrono::seconds>(elapsed).count()));
+                summary->set_elapsed_time_micros(
+                    std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+                return grpc::Status::OK;
+            }
+
+        private:
+            struct Leg {
+                std::unique_ptr<grpc::ClientContext> context;
+                RouteSummary summary;
+                std::unique_ptr<grpc::ClientWriter<RouteBatch>> writer;
+                RouteBatchEncoder encoder;
+                RouteBatch batch;
+            };
+
+            // Measures the buffered points; the empty DB counts no features.
+            void Measure() {
+                total_.Append(MeasureRoute(empty_db_, latitudes_.data(),
+                    longitudes_.data(), latitudes_.size(), options_.distance_model),
+                    options_.distance_model);
+                latitudes_.clear();
+                longitudes_.clear();
+            }
+
+            const std::vector<std::unique_ptr<RouteGuide::Stub>>& stubs_;
+            const ShardMap& shard_map_;
+            const RouteGuideOptions& options_;
+            const FeatureDb& empty_db_;
+            ServerMetrics* metrics_;
+            grpc::ServerContext* context_;
+            std::vector<std::unique_ptr<Leg>> legs_;
+            std::chrono::steady_clock::time_point start_time_;
+            std::vector<int32_t> latitudes_;
+            std::vector<int32_t> longitudes_;
+            RouteStats total_;
+        };
+
+        // Notes a RouteChat buffers each way: read from the client but not yet
+        // written to their shard, and received from the shards but not yet
+        // written to the client. Past it the router stops reading that side.
+        const size_t kChatWindow = 64;
+
+        // RouteChat through the shards, on the callback API. Each note goes
+        // to the shard owning its location, over one leg per shard opened on
+        // its first note and kept open until the client's stream ends, for
+        // the shard's live notes. Every leg has at most one read and one
+        // write outstanding, as does the client's stream. All reactions take
+        // mu_; the call is freed once it is finished, which waits for every
+        // leg to be done.
+        class RouterChat final : public grpc::ServerBidiReactor<RouteNote, RouteNote> {
+        public:
+            RouterChat(const std::vector<std::unique_ptr<RouteGuide::Stub>>& stubs,
+                const ShardMap& shard_map, ServerMetrics* metrics,
+                grpc::CallbackServerContext* context)
+                : stubs_(stubs), shard_map_(shard_map), metrics_(metrics),
+                timer_(metrics, Rpc::kRouteChat), context_(context), legs_(stubs.size()) {
+                std::lock_guard<std::mutex> lock(mu_);
+                Pump();
+            }
+
+            void OnReadDone(bool ok) override {
+                std::lock_guard<std::mutex> lock(mu_);
+                reading_ = false;
+                if (!ok) {
+                    // The client is done sending, or the call is gone.
+                    read_done_ = true;
+                }
+                else if (!broken_) {
+                    size_t shard = shard_map_.ShardOf(note_.location().latitude(),
+                        note_.location().longitude());
+                    std::unique_ptr<Leg>& leg = legs_[shard];
+                    if (leg == nullptr) {
+                        leg.reset(new Leg(this, stubs_[shard].get()));
+                        open_legs_++;
+                    }
+                    leg->queue_.push_back(note_);
+                    queued_++;
+                }
+                Pump();
+            }
+
+            void OnWriteDone(bool ok) override {
+                std::lock_guard<std::mutex> lock(mu_);
+                writing_ = false;
+                if (ok) {
+                    outbox_.pop_front();
+                }
+                else {
+                    // The client is gone: so are the legs.
+                    broken_ = true;
+                    outbox_.clear();
+                }
+                Pump();
+            }
+
+            void OnDone() override {
+                // Finish() waited for every leg to be done; this waits for
+                // the last one to leave mu_.
+                { std::lock_guard<std::mutex> lock(mu_); }
+                delete this;
+            }
+
+        private:
+            // One shard's RouteChat stream. Holds the call open until the
+            // router is done writing to it and reading from it, so Pump() may
+            // start its operations from any reaction.
+            class Leg final : public grpc::ClientBidiReactor<RouteNote, RouteNote> {
+            public:
+                Leg(RouterChat* chat, RouteGuide::Stub* stub)
+                    : chat_(chat),
+                    context_(grpc::ClientContext::FromCallbackServerContext(*chat->context_)) {
+                    stub->async()->RouteChat(context_.get(), this);
+                    AddHold();
+                    reading_ = true;
+                    StartRead(&reply_);
+                    StartCall();
+                }
+
+                void OnReadDone(bool ok) override {
+                    std::lock_guard<std::mutex> lock(chat_->mu_);
+                    reading_ = false;
+                    if (ok) {
+                        chat_->outbox_.push_back(std::move(reply_));
+                        reply_.Clear();
+                    }
+                    else {
+                        read_done_ = true;
+                    }
+                    chat_->Pump();
+                }
+
+                void OnWriteDone(bool ok) override {
+                    std::lock_guard<std::mutex> lock(chat_->mu_);
+                    writing_ = false;
+                    if (ok) {
+                        queue_.pop_front();
+                        chat_->queued_--;
+                    }
+                    else {
+                        // The shard failed, and says why in OnDone; its
+                        // remaining notes are dropped.
+                        chat_->queued_ -= queue_.size();
+                        queue_.clear();
+                        closed_ = true;
+                    }
+                    chat_->Pump();
+                }
+
+                void OnDone(const grpc::Status& status) override {
+                    std::lock_guard<std::mutex> lock(chat_->mu_);
+                    CountShardStatus(chat_->metrics_, status);
+                    if (!status.ok() && chat_->status_.ok()) {
+                        chat_->status_ = status;
+                    }
+                    chat_->open_legs_--;
+                    chat_->Pump();
+                }
+
+            private:
+                friend class RouterChat;
+
+                // Starts whatever the leg can do next; called under mu_.
+                void Pump() {
+                    if (chat_->broken_ && !closed_) {
+                        context_->TryCancel();
+                        chat_->queued_ -= queue_.size();
+                        queue_.clear();
+                        closed_ = true;
+                    }
+                    if (!closed_ && !writing_) {
+                        if (!queue_.empty()) {
+                            writing_ = true;
+                            StartWrite(&queue_.front());
+                        }
+                        else if (chat_->read_done_) {
+                            closed_ = true;
+                            StartWritesDone();
+                        }
+                    }
+                    if (!read_done_ && !reading_ && chat_->outbox_.size() < kChatWindow) {
+                        reading_ = true;
+                        StartRead(&reply_);
+                    }
+                    if (closed_ && read_done_ && !released_) {
+                        released_ = true;
+                        RemoveHold();
+                    }
+                }
+
+                RouterChat* chat_;
+                std::unique_ptr<grpc::ClientContext> context_;
+                // Notes for the shard; the front one is being written.
+                std::deque<RouteNote> queue_;
+                RouteNote reply_;
+                bool reading_ = false;
+                bool read_done_ = false;
+                bool writing_ = false;
+                // No more writes: WritesDone was sent, or the leg failed.
+                bool closed_ = false;
+                bool released_ = false;
+            };
+
+            // Starts whatever comes next on every stream, and finishes once
+            // the client is done (or gone) and every leg is done.
+            void Pump() {
+                if (!broken_) {
+                    if (!writing_ && !outbox_.empty()) {
+                        writing_ = true;
+                        StartWrite(&outbox_.front());
+                    }
+                    if (!read_done_ && !reading_ && queued_ < kChatWindow) {
+                        reading_ = true;
+                        StartRead(&note_);
+                    }
+                }
+                for (std::unique_ptr<Leg>& leg : legs_) {
+                    if (leg != nullptr) {
+                        leg->Pump();
+                    }
+                }
+                if (!finished_ && (read_done_ || broken_) && open_legs_ == 0 &&
+                    (broken_ || (outbox_.empty() && !writing_))) {
+                    finished_ = true;
+                    Finish(broken_ ? grpc::Status::CANCELLED : status_);
+                }
+            }
+
+            const std::vector<std::unique_ptr<RouteGuide::Stub>>& stubs_;
+            const ShardMap& shard_map_;
+            ServerMetrics* metrics_;
+            RpcTimer timer_;
+            grpc::CallbackServerContext* context_;
+            std::mutex mu_;
+            std::vector<std::unique_ptr<Leg>> legs_;
+            size_t open_legs_ = 0;
+            RouteNote note_;
+            // Notes for the client; the front one is being written.
+            std::deque<RouteNote> outbox_;
+            // Notes in the legs' queues.
+            size_t queued_ = 0;
+            bool reading_ = false;
+            bool read_done_ = false;
+            bool writing_ = false;
+            // A write to the client failed.
+            bool broken_ = false;
+            bool finished_ = false;
+            // The first failure of a leg.
+            grpc::Status status_;
+        };
+    }
+
+    RouteRouter::RouteRouter(const std::vector<std::string>& shards,
+        const RouteGuideOptions& options)
+        : options_(options), shard_map_(shards.size(), options.shard_tile_degrees) {
+        if (options_.route_batch_points == 0) {
+            options_.route_batch_points = 1;
+        }
+        for (const std::string& target : shards) {
+            grpc::ChannelArguments args;
+            // One connection per backend, not shared with other channels.
+            args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+            channels_.push_back(grpc::CreateCustomChannel(
+                target, grpc::InsecureChannelCredentials(), args));
+            stubs_.push_back(RouteGuide::NewStub(channels_.back()));
+            generic_stubs_.emplace_back(new grpc::GenericStub(channels_.back()));
+        }
+    }
+
+    bool RouteRouter::WaitForBackends(std::chrono::system_clock::time_point deadline) {
+        for (const std::shared_ptr<grpc::Channel>& channel : channels_) {
+            if (!channel->WaitForConnected(deadline)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string RouteRouter::MetricsText() const {
+        return FormatRouterMetrics(metrics_, stubs_.size());
+    }
+
+    template <typename Start>
+    grpc::Status RouteRouter::Scatter(grpc::ServerContext* context,
+        const std::vector<bool>& shards, Start start) {
+        CallGroup group(&metrics_);
+        std::vector<std::unique_ptr<grpc::ClientContext>> contexts(stubs_.size());
+        for (size_t shard = 0; shard < stubs_.size(); shard++) {
+            if (shards[shard]) {
+                contexts[shard] = grpc::ClientContext::FromServerContext(*context);
+                group.Add();
+                start(stubs_[shard].get(), shard, contexts[shard].get(),
+                    [&group](grpc::Status status) { group.Done(status); });
+            }
+        }
+        return group.Wait();
+    }
+
+    grpc::ServerUnaryReactor* RouteRouter::GetFeature(
+        grpc::CallbackServerContext* context, const grpc::ByteBuffer* request,
+        grpc::ByteBuffer* response) {
+        grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+        // Ends with the shard's call.
+        RpcTimer* timer = new RpcTimer(&metrics_, Rpc::kGetFeature);
+        grpc::Slice bytes = WireSlice(*request);
+        Point point;
+        if (!point.ParseFromArray(bytes.begin(), static_cast<int>(bytes.size()))) {
+            delete timer;
+            reactor->Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                "malformed Point"));
+            return reactor;
+        }
+        // The request and response buffers live until the reactor finishes,
+        // so the shard reads and writes them directly.
+        grpc::ClientContext* shard_context =
+            grpc::ClientContext::FromCallbackServerContext(*context).release();
+        generic_stubs_[shard_map_.ShardOf(point.latitude(), point.longitude())]->UnaryCall(
+            shard_context, kGetFeatureMethod, grpc::StubOptions(), request, response,
+            [this, reactor, shard_context, timer](grpc::Status status) {
+                delete shard_context;
+                CountShardStatus(&metrics_, status);
+                delete timer;
+                reactor->Finish(status);
+            });
+        return reactor;
+    }
+
+    grpc::Status RouteRouter::ListFeatures(grpc::ServerContext* context,
+        const Rectangle* request, grpc::ServerWriter<Feature>* writer) {
+        RpcTimer timer(&metrics_, Rpc::kListFeatures);
+        if (request->max_results() < 0) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                "max_results must not be negative");
+        }
+        if (request->order() != Rectangle::DB_ORDER &&
+            request->order() != Rectangle::DISTANCE_FROM_CENTER) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                "unknown order " + std::to_string(request->order()));
+        }
+        size_t n = stubs_.size();
+        std::vector<std::string> resume(n);
+        if (!request->page_token().empty() &&
+            !ParseRouterToken(request->page_token(), n, &resume)) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                "malformed page_token");
+        }
+        std::vector<bool> asked;
+        shard_map_.ShardsIn(request->lo().latitude(), request->lo().longitude(),
+            request->hi().latitude(), request->hi().longitude(), &asked);
+        for (size_t shard = 0; shard < n; shard++) {
+            if (!asked[shard]) {
+                resume[shard] = kShardDone;
+            }
+        }
+        if (request->max_results() == 0) {
+            return StreamList(context, *request, resume, writer);
+        }
+
+        CallGroup group(&metrics_);
+        std::vector<std::unique_ptr<ShardListCall>> calls(n);
+        for (size_t shard = 0; shard < n; shard++) {
+            if (resume[shard] == kShardDone) {
+                continue;
+            }
+            Rectangle shard_request = *request;
+            shard_request.set_page_token(resume[shard]);
+            calls[shard].reset(new ShardListCall(stubs_[shard].get(), context,
+                shard_request, &group));
+        }
+        grpc::Status status = group.Wait();
+        if (!status.ok()) {
+            return status;
+        }
+
+        // Every shard answered at most a page, in the order asked for; the
+        // page is the first limit of their merge.
+        bool by_distance = request->order() == Rectangle::DISTANCE_FROM_CENTER;
+        GeoPoint center = ListCenter(*request);
+        std::vector<Merged> merged;
+        for (size_t shard = 0; shard < n; shard++) {
+            if (calls[shard] == nullptr) {
+                continue;
+            }
+            const std::vector<Feature>& features = calls[shard]->features();
+            for (size_t i = 0; i < features.size(); i++) {
+                double metres = 0;
+                if (by_distance) {
+                    metres = HaversineMetres(center, ToGeoPoint(
+                        features[i].location().latitude(),
+                        features[i].location().longitude()));
+                }
+                merged.push_back({ metres, shard, i });
+            }
+        }
+        size_t limit = static_cast<size_t>(request->max_results());
+        if (merged.size() > limit) {
+            if (by_distance) {
+                std::partial_sort(merged.begin(), merged.begin() + limit, merged.end());
+            }
+            merged.resize(limit);
+        }
+        else if (by_distance) {
+            std::sort(merged.begin(), merged.end());
+        }
+
+        // Where each shard resumes: after its whole page if the merge
+        // used all of it, where it was if it used none, and otherwise
+        // after the part used, which only the shard can name.
+        std::vector<size_t> used(n, 0);
+        for (const Merged& m : merged) {
+            used[m.shard]++;
+        }
+        CallGroup resume_group(&metrics_);
+        std::vector<std::unique_ptr<ShardListCall>> resume_calls(n);
+        for (size_t shard = 0; shard < n; shard++) {
+            if (calls[shard] == nullptr) {
+                continue;
+            }
+            if (used[shard] == calls[shard]->features().size()) {
+                const std::string& next = calls[shard]->next_page_token();
+                resume[shard] = next.empty() ? kShardDone : next;
+                continue;
+            }
+            if (used[shard] == 0) {
+                continue;
+            }
+            Rectangle shard_request = *request;
+            shard_request.set_page_token(resume[shard]);
+            shard_request.set_max_results(static_cast<int32_t>(used[shard]));
+            resume_calls[shard].reset(new ShardListCall(stubs_[shard].get(),
+                context, shard_request, &resume_group));
+        }
+        status = resume_group.Wait();
+        if (!status.ok()) {
+            return status;
+        }
+        bool more = false;
+        for (size_t shard = 0; shard < n; shard++) {
+            if (resume_calls[shard] != nullptr) {
+                resume[shard] = resume_calls[shard]->next_page_token();
+            }
+            more = more || resume[shard] != kShardDone;
+        }
+        if (more) {
+            context->AddTrailingMetadata(kNextPageTokenKey, RouterToken(resume));
+        }
+
+        for (size_t k = 0; k < merged.size(); k++) {
+            const Merged& m = merged[k];
+            if (!writer->Write(calls[m.shard]->features()[m.index],
+                ListWriteOptions(k, merged.size()))) {
+                return grpc::Status::CANCELLED;
+            }
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RouteRouter::StreamList(grpc::ServerContext* context,
+        const Rectangle& request, const std::vector<std::string>& resume,
+        grpc::ServerWriter<Feature>* writer) {
+        // Every shard is asked at once; flow control keeps each at most a
+        // window ahead of what is written to the client.
+        struct Source {
+            std::unique_ptr<grpc::ClientContext> context;
+            std::unique_ptr<grpc::ClientReader<Feature>> reader;
+            Feature feature;
+            double metres = 0;
+            bool more = false;
+        };
+        size_t n = stubs_.size();
+        bool by_distance = request.order() == Rectangle::DISTANCE_FROM_CENTER;
+        GeoPoint center = ListCenter(request);
+        std::vector<Source> sources(n);
+        auto advance = [&](Source* source) {
+            source->more = source->reader->Read(&source->feature);
+            if (source->more && by_distance) {
+                source->metres = HaversineMetres(center, ToGeoPoint(
+                    source->feature.location().latitude(),
+                    source->feature.location().longitude()));
+            }
+        };
+        for (size_t shard = 0; shard < n; shard++) {
+            if (resume[shard] == kShardDone) {
+                continue;
+            }
+            Rectangle shard_request = request;
+            shard_request.set_page_token(resume[shard]);
+            sources[shard].context = grpc::ClientContext::FromServerContext(*context);
+            sources[shard].reader = stubs_[shard]->ListFeatures(
+                sources[shard].context.get(), shard_request);
+        }
+        for (Source& source : sources) {
+            if (source.reader != nullptr) {
+                advance(&source);
+            }
+        }
+
+        // The number of features is not known up front; the status flushes
+        // the last ones.
+        const size_t unknown_count = SIZE_MAX;
+        size_t k = 0;
+        bool cancelled = false;
+        if (!by_distance) {
+            // Shard 0's matches, then shard 1's and so on.
+            for (size_t shard = 0; shard < n && !cancelled; shard++) {
+                Source& source = sources[shard];
+                while (source.more) {
+                    if (!writer->Write(source.feature, ListWriteOptions(k++, unknown_count))) {
+                        cancelled = true;
+                        break;
+                    }
+                    advance(&source);
+                }
+            }
+        }
+        else {
+            // Every shard answers nearest first: a k-way merge of their
+            // streams, ties going to the lower shard.
+            auto later = [&sources](size_t a, size_t b) {
+                if (sources[a].metres != sources[b].metres) {
+                    return sources[a].metres > sources[b].metres;
+                }
+                return a > b;
+            };
+            std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+            for (size_t shard = 0; shard < n; shard++) {
+                if (sources[shard].more) {
+                    heads.push(shard);
+                }
+            }
+            while (!heads.empty()) {
+                size_t shard = heads.top();
+                heads.pop();
+                Source& source = sources[shard];
+                if (!writer->Write(source.feature, ListWriteOptions(k++, unknown_count))) {
+                    cancelled = true;
+                    break;
+                }
+                advance(&source);
+                if (source.more) {
+                    heads.push(shard);
+                }
+            }
+        }
+
+        grpc::Status status = cancelled ? grpc::Status::CANCELLED : grpc::Status::OK;
+        for (Source& source : sources) {
+            if (source.reader == nullptr) {
+                continue;
+            }
+            if (cancelled) {
+                source.context->TryCancel();
+            }
+            grpc::Status shard_status = source.reader->Finish();
+            CountShardStatus(&metrics_, shard_status);
+            if (!shard_status.ok() && status.ok()) {
+                status = shard_status;
+            }
+        }
+        return status;
+    }
+
+    grpc::Status RouteRouter::RecordRoute(grpc::ServerContext* context,
+        grpc::ServerReader<Point>* reader, RouteSummary* summary) {
+        RpcTimer timer(&metrics_, Rpc::kRecordRoute);
+        RouteSplitter route(stubs_, shard_map_, options_, empty_db_, &metrics_, context);
+        Point point;
+        while (reader->Read(&point)) {
+            route.Add(point.latitude(), point.longitude());
+        }
+        return route.Finish(summary);
+    }
+
+    grpc::Status RouteRouter::RecordRouteBatched(grpc::ServerContext* context,
+        grpc::ServerReader<RouteBatch>* reader, RouteSummary* summary) {
+        RpcTimer timer(&metrics_, Rpc::kRecordRouteBatched);
+        RouteSplitter route(stubs_, shard_map_, options_, empty_db_, &metrics_, context);
+        RouteBatch batch;
+        RouteBatchDecoder decoder;
+        std::vector<int32_t> latitudes;
+        std::vector<int32_t> longitudes;
+        std::string error;
+        while (reader->Read(&batch)) {
+            if (!RouteBatchDecoder::Check(batch, &error)) {
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, error);
+            }
+            int n = batch.latitude_deltas_size();
+            latitudes.resize(n);
+            longitudes.resize(n);
+            decoder.Decode(batch, 0, n, latitudes.data(), longitudes.data());
+            for (int i = 0; i < n; i++) {
+                route.Add(latitudes[i], longitudes[i]);
+            }
+        }
+        return route.Finish(summary);
+    }
+
+    grpc::ServerBidiReactor<RouteNote, RouteNote>* RouteRouter::RouteChat(
+        grpc::CallbackServerContext* context) {
+        return new RouterChat(stubs_, shard_map_, &metrics_, context);
+    }
+
+    grpc::Status RouteRouter::LookUp(grpc::ServerContext* context,
+        const PointList& points, FeatureList* features) {
+        size_t n = stubs_.size();
+        std::vector<PointList> requests(n);
+        std::vector<FeatureList> responses(n);
+        std::vector<size_t> owners(points.points_size());
+        std::vector<bool> asked(n, false);
+        for (int i = 0; i < points.points_size(); i++) {
+            const Point& point = points.points(i);
+            owners[i] = shard_map_.ShardOf(point.latitude(), point.longitude());
+            *requests[owners[i]].add_points() = point;
+            asked[owners[i]] = true;
+        }
+        grpc::Status status = Scatter(context, asked,
+            [&](RouteGuide::Stub* stub, size_t shard, grpc::ClientContext* shard_context,
+                std::function<void(grpc::Status)> done) {
+                stub->async()->GetFeatures(shard_context, &requests[shard],
+                    &responses[shard], std::move(done));
+            });
+        if (!status.ok()) {
+            return status;
+        }
+        // Each shard answered its points in the order they were asked.
+        std::vector<int> next(n, 0);
+        features->mutable_features()->Reserve(
+            features->features_size() + points.points_size());
+        for (size_t owner : owners) {
+            FeatureList& response = responses[owner];
+            if (next[owner] == response.features_size()) {
+                return grpc::Status(grpc::StatusCode::INTERNAL,
+                    "shard " + std::to_string(owner) + " answered too few features");
+            }
+            features->add_features()->Swap(response.mutable_features(next[owner]++));
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RouteRouter::GetFeatures(grpc::ServerContext* context,
+        const PointList* points, FeatureList* features) {
+        RpcTimer timer(&metrics_, Rpc::kGetFeatures);
+        return LookUp(context, *points, features);
+    }
+
+    grpc::Status RouteRouter::StreamFeatures(grpc::ServerContext* context,
+        grpc::ServerReaderWriter<FeatureList, PointList>* stream) {
+        RpcTimer timer(&metrics_, Rpc::kStreamFeatures);
+        PointList points;
+        FeatureList features;
+        while (stream->Read(&points)) {
+            features.Clear();
+            grpc::Status status = LookUp(context, points, &features);
+            if (!status.ok()) {
+                return status;
+            }
+            if (!stream->Write(features)) {
+                break;
+            }
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RouteRouter::NearestFeatures(grpc::ServerContext* context,
+        const NearestRequest* request, NearbyFeatureList* features) {
+        RpcTimer timer(&metrics_, Rpc::kNearestFeatures);
+        std::vector<NearbyFeatureList> responses(stubs_.size());
+        grpc::Status status = Scatter(context, std::vector<bool>(stubs_.size(), true),
+            [&](RouteGuide::Stub* stub, size_t shard, grpc::ClientContext* shard_context,
+                std::function<void(grpc::Status)> done) {
+                stub->async()->NearestFeatures(shard_context, request, &responses[shard],
+                    std::move(done));
+            });
+        if (!status.ok()) {
+            return status;
+        }
+        size_t k = request->k() > 0 ? static_cast<size_t>(request->k()) : 0;
+        size_t limit = (std::min)(k, kMaxNearbyFeatures);
+        bool truncated = false;
+        for (const NearbyFeatureList& response : responses) {
+            truncated = truncated || response.truncated();
+        }
+        // As from one server: cut short if the DB holds more than the cap.
+        size_t total = MergeNearby(&responses, limit, features);
+        features->set_truncated(k > kMaxNearbyFeatures &&
+            (truncated || total > kMaxNearbyFeatures));
+        return grpc::Status::OK;
+    }
+
+    grpc::Status RouteRouter::FeaturesWithinRadius(grpc::ServerContext* context,
+        const RadiusRequest* request, NearbyFeatureList* features) {
+        RpcTimer timer(&metrics_, Rpc::kFeaturesWithinRadius);
+        std::vector<NearbyFeatureList> responses(stubs_.size());
+        grpc::Status status = Scatter(context, std::vector<bool>(stubs_.size(), true),
+            [&](RouteGuide::Stub* stub, size_t shard, grpc::ClientContext* shard_context,
+                std::function<void(grpc::Status)> done) {
+                stub->async()->FeaturesWithinRadius(shard_context, request,
+                    &responses[shard], std::move(done));
+            });
+        if (!status.ok()) {
+            return status;
+        }
+        size_t limit = kMaxNearbyFeatures;
+        if (request->max_results() > 0) {
+            limit = (std::min)(limit, static_cast<size_t>(request->max_results()));
+        }
+        bool truncated = false;
+        for (const NearbyFeatureList& response : responses) {
+            truncated = truncated || response.truncated();
+        }
+        size_t total = MergeNearby(&responses, limit, features);
+        features->set_truncated(truncated || total > limit);
+        return grpc::Status::OK;
+    }
+
+}  // namespace routeguide
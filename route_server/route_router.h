@@ -0,0 +1,123 @@
+#ifndef ROUTE_SERVER_ROUTE_ROUTER_H
+#define ROUTE_SERVER_ROUTE_ROUTER_H
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <grpcpp/channel.h>
+#include <grpcpp/generic/generic_stub.h>
+#include <grpcpp/server_context.h>
+#include "route_guide.grpc.pb.h"
+#include "feature_db.h"
+#include "route_guide_state.h"
+#include "server_metrics.h"
+#include "shard_map.h"
+
+namespace routeguide {
+
+    // Front end of a geo-sharded deployment. Each backend is a route_server
+    // started with --shard_count and its own --shard_index, which loads only
+    // the features of its tiles; the router serves the whole RouteGuide
+    // service over them:
+    // - GetFeature goes, as raw bytes, to the shard owning the point.
+    // - GetFeatures and StreamFeatures split the points by shard and put the
+    //   answers back in request order.
+    // - ListFeatures asks only the shards whose tiles meet the rectangle, in
+    //   parallel, and merges their pages (see ListFeatures below).
+    // - NearestFeatures and FeaturesWithinRadius ask every shard and merge
+    //   by distance.
+    // - RecordRoute and RecordRouteBatched measure the route here and send
+    //   each shard its points, to count the features passed.
+    // - RouteChat sends each note to the shard owning its location, over one
+    //   stream per shard, and passes back whatever the shards send.
+    // Calls to the backends inherit the client's deadline and cancellation.
+    class RouteRouter final
+        : public RouteGuide::WithRawCallbackMethod_GetFeature<
+            RouteGuide::WithCallbackMethod_RouteChat<RouteGuide::Service>> {
+    public:
+        // shards are the backends' addresses, in shard order. options gives
+        // the tile size, the distance model and the RecordRoute batch size,
+        // and must match the backends'.
+        RouteRouter(const std::vector<std::string>& shards,
+            const RouteGuideOptions& options);
+
+        // Waits for every backend to connect. False if one does not by
+        // deadline.
+        bool WaitForBackends(std::chrono::system_clock::time_point deadline);
+
+        size_t shard_count() const { return stubs_.size(); }
+
+        // Recorded by the handlers, with the failed calls to the shards.
+        ServerMetrics* metrics() const { return &metrics_; }
+        // All metrics in the Prometheus text format.
+        std::string MetricsText() const;
+
+        grpc::ServerUnaryReactor* GetFeature(grpc::CallbackServerContext* context,
+            const grpc::ByteBuffer* request, grpc::ByteBuffer* response) override;
+
+        // Pages in DB order list the matches of shard 0 first, then those of
+        // shard 1 and so on; in distance order ties go to the lower shard.
+        // The page token holds one backend token per shard. A shard whose
+        // page was only partly used is asked again for just that part, to
+        // learn where the next page resumes. Without max_results the
+        // shards' streams are passed on as they arrive (see StreamList).
+        grpc::Status ListFeatures(grpc::ServerContext* context,
+            const Rectangle* request, grpc::ServerWriter<Feature>* writer) override;
+
+        grpc::Status RecordRoute(grpc::ServerContext* context,
+            grpc::ServerReader<Point>* reader, RouteSummary* summary) override;
+
+        grpc::Status RecordRouteBatched(grpc::ServerContext* context,
+            grpc::ServerReader<RouteBatch>* reader, RouteSummary* summary) override;
+
+        grpc::ServerBidiReactor<RouteNote, RouteNote>* RouteChat(
+            grpc::CallbackServerContext* context) override;
+
+        grpc::Status GetFeatures(grpc::ServerContext* context, const PointList* points,
+            FeatureList* features) override;
+
+        grpc::Status StreamFeatures(grpc::ServerContext* context,
+            grpc::ServerReaderWriter<FeatureList, PointList>* stream) override;
+
+        grpc::Status NearestFeatures(grpc::ServerContext* context,
+            const NearestRequest* request, NearbyFeatureList* features) override;
+
+        grpc::Status FeaturesWithinRadius(grpc::ServerContext* context,
+            const RadiusRequest* request, NearbyFeatureList* features) override;
+
+    private:
+        // Calls start(stub, shard, context, done) for every shard set in
+        // shards, each with a new client context, and waits for all of them
+        // to call done. Returns the first failure, or OK.
+        template <typename Start>
+        grpc::Status Scatter(grpc::ServerContext* context,
+            const std::vector<bool>& shards, Start start);
+
+        // ListFeatures without max_results: streams the matches of every
+        // shard not marked done in resume, in DB order shard by shard, and in
+        // distance order merged across the shards, holding one feature per
+        // shard.
+        grpc::Status StreamList(grpc::ServerContext* context, const Rectangle& request,
+            const std::vector<std::string>& resume, grpc::ServerWriter<Feature>* writer);
+
+        // GetFeatures through the owning shards.
+        grpc::Status LookUp(grpc::ServerContext* context, const PointList& points,
+            FeatureList* features);
+
+        RouteGuideOptions options_;
+        ShardMap shard_map_;
+        std::vector<std::shared_ptr<grpc::Channel>> channels_;
+        std::vector<std::unique_ptr<RouteGuide::Stub>> stubs_;
+        std::vector<std::unique_ptr<grpc::GenericStub>> generic_stubs_;
+        // RecordRoute measures routes against it, so only the shards count
+        // features.
+        FeatureDb empty_db_;
+        mutable ServerMetrics metrics_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_ROUTE_ROUTER_H
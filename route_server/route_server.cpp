@@ -2,13 +2,13 @@
 #include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstdlib>
 #include <memory>
 #include <string>
-#include <fstream>
 #include <algorithm>
-#include <cctype>
 #include <iostream>
-#include <sstream>
+#include <string_view>
 #include <vector>
 
 #include <grpc/grpc.h>
@@ -17,290 +17,253 @@
 #include <grpcpp/server_builder.h>
 #include <grpcpp/server_context.h>
 #include "route_guide.grpc.pb.h"
+#include "admin_service.h"
+#include "async_server.h"
+#include "db_snapshot.h"
+#include "db_watcher.h"
+#include "feature_db.h"
+#include "rect_filter.h"
+#include "route_guide_impl.h"
+#include "route_guide_state.h"
+#include "route_router.h"
+#include "shard_map.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
-using grpc::ServerContext;
-using grpc::ServerReader;
-using grpc::ServerReaderWriter;
-using grpc::ServerWriter;
-using grpc::Status;
-using routeguide::Feature;
-using routeguide::Point;
-using routeguide::Rectangle;
 using routeguide::RouteGuide;
-using routeguide::RouteNote;
-using routeguide::RouteSummary;
-using std::chrono::system_clock;
 
 
 namespace routeguide {
-    std::string GetDbFileContent(int argc, char** argv) {
+    struct ServerOptions {
+        // JSON DB or binary snapshot to serve.
         std::string db_path;
-        std::string arg_str("--db_path");
-        if (argc > 1) {
-            std::string argv_1 = argv[1];
-            size_t start_position = argv_1.find(arg_str);
-            if (start_position != std::string::npos) {
-                start_position += arg_str.size();
-                if (argv_1[start_position] == ' ' || argv_1[start_position] == '=') {
-                    db_path = argv_1.substr(start_position + 1);
-                }
-            }
-        }
-        else {
+        // If set, convert db_path into a binary snapshot at this path and
+        // exit instead of serving.
+        std::string write_snapshot;
+        // Serve with the completion-queue API, one polling thread per queue.
+        // 0 keeps the synchronous service.
+        int completion_queues = 0;
+        RouteGuideOptions guide;
+        // Reload the DB when its file changes, checking this often. 0 only
+        // reloads on SIGHUP.
+        int reload_poll_seconds = 0;
+        int port = 50051;
+        // If set, serve as the router of a sharded deployment whose
+        // backends listen at these addresses, in shard order.
+        std::vector<std::string> shards;
+    };
+
+    // Accepts --name=value and --name value for each option.
+    bool ParseServerOptions(int argc, char** argv, ServerOptions* options) {
 #ifdef BAZEL_BUILD
-            db_path = "cpp/route_guide/route_guide_db.json";
+        options->db_path = "cpp/route_guide/route_guide_db.json";
 #else
-            db_path = "route_guide_db.json";
+        options->db_path = "route_guide_db.json";
 #endif
-        }
-        std::ifstream db_file(db_path);
-        if (!db_file.is_open()) {
-            std::cout << "Failed to open " << db_path << std::endl;
-            abort();
-        }
-        std::stringstream db;
-        db << db_file.rdbuf();
-        return db.str();
-    }
-
-    // A simple parser for the json db file. It requires the db file to have the
-    // exact form of [{"location": { "latitude": 123, "longitude": 456}, "name":
-    // "the name can be empty" }, { ... } ... The spaces will be stripped.
-    class Parser {
-    public:
-        explicit Parser(const std::string& db) : db_(db) {
-            // Remove all spaces.
-            db_.erase(std::remove_if(db_.begin(), db_.end(), isspace), db_.end());
-            if (!Match("[")) {
-                SetFailedAndReturnFalse();
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            std::string value;
+            size_t equals = arg.find('=');
+            if (equals != std::string::npos) {
+                value = arg.substr(equals + 1);
+                arg.resize(equals);
             }
-        }
-
-        bool Finished() { return current_ >= db_.size(); }
-
-        bool TryParseOne(Feature* feature) {
-            if (failed_ || Finished() || !Match("{")) {
-                return SetFailedAndReturnFalse();
+            else if (i + 1 < argc) {
+                value = argv[++i];
+            }
+            if (arg == "--db_path") {
+                options->db_path = value;
+            }
+            else if (arg == "--write_snapshot") {
+                options->write_snapshot = value;
+            }
+            else if (arg == "--completion_queues") {
+                options->completion_queues = std::atoi(value.c_str());
+            }
+            else if (arg == "--max_notes_per_location") {
+                options->guide.note_limits.max_notes_per_location =
+                    std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (arg == "--max_notes") {
+                options->guide.note_limits.max_notes = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (arg == "--note_ttl_seconds") {
+                options->guide.note_limits.ttl = std::chrono::seconds(std::atoll(value.c_str()));
             }
-            if (!Match(location_) || !Match("{") || !Match(latitude_)) {
-                return SetFailedAndReturnFalse();
+            else if (arg == "--note_log_dir") {
+                options->guide.note_log_dir = value;
             }
-            long temp = 0;
-            ReadLong(&temp);
-            feature->mutable_location()->set_latitude(temp);
-            if (!Match(",") || !Match(longitude_)) {
-                return SetFailedAndReturnFalse();
+            else if (arg == "--note_snapshot_seconds") {
+                options->guide.note_snapshot_interval =
+                    std::chrono::seconds(std::atoll(value.c_str()));
             }
-            ReadLong(&temp);
-            feature->mutable_location()->set_longitude(temp);
-            if (!Match("},") || !Match(name_) || !Match("\"")) {
-                return SetFailedAndReturnFalse();
+            else if (arg == "--live_note_queue") {
+                options->guide.live_note_queue = std::strtoull(value.c_str(), nullptr, 10);
             }
-            size_t name_start = current_;
-            while (current_ != db_.size() && db_[current_++] != '"') {
+            else if (arg == "--distance_model") {
+                if (!ParseDistanceModel(value, &options->guide.distance_model)) {
+                    std::cout << "Unknown distance model " << value
+                        << "; expected haversine or vincenty" << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--route_batch_points") {
+                options->guide.route_batch_points =
+                    std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (arg == "--route_workers") {
+                options->guide.route_workers = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (arg == "--list_cache_bytes") {
+                options->guide.list_cache_bytes =
+                    std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (arg == "--reload_poll_seconds") {
+                options->reload_poll_seconds = std::atoi(value.c_str());
             }
-            if (current_ == db_.size()) {
-                return SetFailedAndReturnFalse();
+            else if (arg == "--port") {
+                options->port = std::atoi(value.c_str());
             }
-            feature->set_name(db_.substr(name_start, current_ - name_start - 1));
-            if (!Match("},")) {
-                if (db_[current_ - 1] == ']' && current_ == db_.size()) {
-                    return true;
+            else if (arg == "--shard_count") {
+                options->guide.shard_count = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (arg == "--shard_index") {
+                options->guide.shard_index = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (arg == "--shard_tile_degrees") {
+                options->guide.shard_tile_degrees = std::atof(value.c_str());
+            }
+            else if (arg == "--shards") {
+                options->shards.clear();
+                size_t begin = 0;
+                while (begin <= value.size()) {
+                    size_t comma = (std::min)(value.find(',', begin), value.size());
+                    if (comma > begin) {
+                        options->shards.push_back(value.substr(begin, comma - begin));
+                    }
+                    begin = comma + 1;
                 }
-                return SetFailedAndReturnFalse();
             }
-            return true;
+            else {
+                std::cout << "Unknown flag " << arg << std::endl
+                    << "Usage: route_server [--db_path=path/to/db]"
+                    " [--write_snapshot=path/to/snapshot]"
+                    " [--completion_queues=N] [--max_notes_per_location=N]"
+                    " [--max_notes=N] [--note_ttl_seconds=N] [--live_note_queue=N]"
+                    " [--note_log_dir=path/to/dir] [--note_snapshot_seconds=N]"
+                    " [--distance_model=haversine|vincenty]"
+                    " [--route_batch_points=N] [--route_workers=N]"
+                    " [--list_cache_bytes=N] [--reload_poll_seconds=N] [--port=N]"
+                    " [--shard_count=N --shard_index=I] [--shard_tile_degrees=D]"
+                    " [--shards=host:port,...]" << std::endl;
+                return false;
+            }
         }
-
-    private:
-        bool SetFailedAndReturnFalse() {
-            failed_ = true;
+        if (options->guide.shard_count == 0 ||
+            options->guide.shard_index >= options->guide.shard_count) {
+            std::cout << "--shard_index must be below --shard_count" << std::endl;
             return false;
         }
-
-        bool Match(const std::string& prefix) {
-            bool eq = db_.substr(current_, prefix.size()) == prefix;
-            current_ += prefix.size();
-            return eq;
+        if (!(options->guide.shard_tile_degrees > 0)) {
+            std::cout << "--shard_tile_degrees must be positive" << std::endl;
+            return false;
         }
+        return true;
+    }
 
-        void ReadLong(long* l) {
-            size_t start = current_;
-            while (current_ != db_.size() && db_[current_] != ',' &&
-                db_[current_] != '}') {
-                current_++;
-            }
-            // It will throw an exception if fails.
-            *l = std::stol(db_.substr(start, current_ - start));
+    // Loads options.db_path and writes it back out as a binary snapshot;
+    // with --shard_count, only the features of this server's shard.
+    bool ConvertDb(const ServerOptions& options) {
+        FeatureDb db;
+        std::string error;
+        if (!db.Load(options.db_path, &error)) {
+            std::cout << "Error loading the db file " << options.db_path << ": "
+                << error << std::endl;
+            return false;
         }
-
-        bool failed_ = false;
-        std::string db_;
-        size_t current_ = 0;
-        const std::string location_ = "\"location\":";
-        const std::string latitude_ = "\"latitude\":";
-        const std::string longitude_ = "\"longitude\":";
-        const std::string name_ = "\"name\":";
-    };
-
-    void ParseDb(const std::string& db, std::vector<Feature>* feature_list) {
-        feature_list->clear();
-        std::string db_content(db);
-        db_content.erase(
-            std::remove_if(db_content.begin(), db_content.end(), isspace),
-            db_content.end());
-
-        Parser parser(db_content);
-        Feature feature;
-        while (!parser.Finished()) {
-            feature_list->push_back(Feature());
-            if (!parser.TryParseOne(&feature_list->back())) {
-                std::cout << "Error parsing the db file";
-                feature_list->clear();
-                break;
-            }
+        if (options.guide.shard_count > 1) {
+            RetainShard(ShardMap(options.guide.shard_count,
+                options.guide.shard_tile_degrees), options.guide.shard_index, &db);
         }
-        std::cout << "DB parsed, loaded " << feature_list->size() << " features."
-            << std::endl;
-    }
-}
-
-float ConvertToRadians(float num) { return num * 3.1415926 / 180; }
-
-// The formula is based on http://mathforum.org/library/drmath/view/51879.html
-float GetDistance(const Point& start, const Point& end) {
-    const float kCoordFactor = 10000000.0;
-    float lat_1 = start.latitude() / kCoordFactor;
-    float lat_2 = end.latitude() / kCoordFactor;
-    float lon_1 = start.longitude() / kCoordFactor;
-    float lon_2 = end.longitude() / kCoordFactor;
-    float lat_rad_1 = ConvertToRadians(lat_1);
-    float lat_rad_2 = ConvertToRadians(lat_2);
-    float delta_lat_rad = ConvertToRadians(lat_2 - lat_1);
-    float delta_lon_rad = ConvertToRadians(lon_2 - lon_1);
-
-    float a = pow(sin(delta_lat_rad / 2), 2) +
-        cos(lat_rad_1) * cos(lat_rad_2) * pow(sin(delta_lon_rad / 2), 2);
-    float c = 2 * atan2(sqrt(a), sqrt(1 - a));
-    int R = 6371000;  // metres
-
-    return R * c;
-}
-
-std::string GetFeatureName(const Point& point,
-    const std::vector<Feature>& feature_list) {
-    for (const Feature& f : feature_list) {
-        if (f.location().latitude() == point.latitude() &&
-            f.location().longitude() == point.longitude()) {
-            return f.name();
+        if (!WriteSnapshot(db, options.write_snapshot, &error)) {
+            std::cout << "Error writing snapshot: " << error << std::endl;
+            return false;
         }
+        std::cout << "Wrote " << db.store().size() << " features to "
+            << options.write_snapshot << std::endl;
+        return true;
     }
-    return "";
 }
 
-class RouteGuideImpl final : public RouteGuide::Service {
-public:
-    explicit RouteGuideImpl(const std::string& db) {
-        routeguide::ParseDb(db, &feature_list_);
+// Serves the RouteGuide service of a sharded deployment from its backends.
+void RunRouter(const routeguide::ServerOptions& options,
+    const std::string& server_address) {
+    routeguide::RouteRouter router(options.shards, options.guide);
+    if (!router.WaitForBackends(
+        std::chrono::system_clock::now() + std::chrono::seconds(10))) {
+        std::cout << "Not every shard is reachable yet; calls to the missing ones"
+            " fail until they are." << std::endl;
     }
 
-    Status GetFeature(ServerContext* context, const Point* point,
-        Feature* feature) override {
-        feature->set_name(GetFeatureName(*point, feature_list_));
-        feature->mutable_location()->CopyFrom(*point);
-        return Status::OK;
-    }
-
-    Status ListFeatures(ServerContext* context,
-        const routeguide::Rectangle* rectangle,
-        ServerWriter<Feature>* writer) override {
-        auto lo = rectangle->lo();
-        auto hi = rectangle->hi();
-        long left = (std::min)(lo.longitude(), hi.longitude());
-        long right = (std::max)(lo.longitude(), hi.longitude());
-        long top = (std::max)(lo.latitude(), hi.latitude());
-        long bottom = (std::min)(lo.latitude(), hi.latitude());
-        for (const Feature& f : feature_list_) {
-            if (f.location().longitude() >= left &&
-                f.location().longitude() <= right &&
-                f.location().latitude() >= bottom && f.location().latitude() <= top) {
-                writer->Write(f);
-            }
-        }
-        return Status::OK;
-    }
-
-    Status RecordRoute(ServerContext* context, ServerReader<Point>* reader,
-        RouteSummary* summary) override {
-        Point point;
-        int point_count = 0;
-        int feature_count = 0;
-        float distance = 0.0;
-        Point previous;
+#ifdef SIGHUP
+    // The shards reload their DBs; a SIGHUP sent to every server must not
+    // stop the router, which has none.
+    std::signal(SIGHUP, SIG_IGN);
+#endif
+    routeguide::AdminService admin(&router);
 
-        system_clock::time_point start_time = system_clock::now();
-        while (reader->Read(&point)) {
-            point_count++;
-            if (!GetFeatureName(point, feature_list_).empty()) {
-                feature_count++;
-            }
-            if (point_count != 1) {
-                distance += GetDistance(previous, point);
-            }
-            previous = point;
-        }
-        system_clock::time_point end_time = system_clock::now();
-        summary->set_point_count(point_count);
-        summary->set_feature_count(feature_count);
-        summary->set_distance(static_cast<long>(distance));
-        auto secs =
-            std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
-        summary->set_elapsed_time(secs.count());
+    ServerBuilder builder;
+    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&router);
+    builder.RegisterService(&admin);
+    std::unique_ptr<Server> server(builder.BuildAndStart());
+    std::cout << "Router for " << router.shard_count() << " shards listening on "
+        << server_address << std::endl;
+    server->Wait();
+}
 
-        return Status::OK;
+void RunServer(const routeguide::ServerOptions& options) {
+    std::string server_address("0.0.0.0:" + std::to_string(options.port));
+    if (!options.shards.empty()) {
+        RunRouter(options, server_address);
+        return;
     }
-
-    Status RouteChat(ServerContext* context,
-        ServerReaderWriter<RouteNote, RouteNote>* stream) override {
-        RouteNote note;
-        while (stream->Read(&note)) {
-            std::unique_lock<std::mutex> lock(mu_);
-            for (const RouteNote& n : received_notes_) {
-                if (n.location().latitude() == note.location().latitude() &&
-                    n.location().longitude() == note.location().longitude()) {
-                    stream->Write(n);
-                }
-            }
-            received_notes_.push_back(note);
-        }
-
-        return Status::OK;
+    routeguide::RouteGuideState state(options.db_path, options.guide);
+    routeguide::DbWatcher watcher(&state, options.db_path,
+        std::chrono::seconds(options.reload_poll_seconds));
+    std::cout << "Rectangle filter kernel: " << routeguide::RectFilterKernelName()
+        << std::endl;
+    routeguide::AdminService admin(&state);
+    if (options.completion_queues > 0) {
+        routeguide::AsyncRouteGuideServer server(&state, options.completion_queues);
+        server.AddService(&admin);
+        server.Run(server_address);
+        return;
     }
-
-private:
-    std::vector<Feature> feature_list_;
-    std::mutex mu_;
-    std::vector<RouteNote> received_notes_;
-};
-
-void RunServer(const std::string& db_path) {
-    std::string server_address("0.0.0.0:50051");
-    RouteGuideImpl service(db_path);
+    routeguide::RouteGuideImpl service(&state);
 
     ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
     builder.RegisterService(&service);
+    builder.RegisterService(&admin);
     std::unique_ptr<Server> server(builder.BuildAndStart());
     std::cout << "Server listening on " << server_address << std::endl;
     server->Wait();
 }
 
 int main(int argc, char** argv) {
-    // Expect only arg: --db_path=path/to/route_guide_db.json.
-    std::string db = routeguide::GetDbFileContent(argc, argv);
-    RunServer(db);
+    // Expected args: --db_path=path/to/route_guide_db.json (or a snapshot), and
+    // optionally --write_snapshot=path/to/route_guide_db.rgdb to convert,
+    // --completion_queues=N to serve asynchronously or --shards=... to route
+    // to the shards of a sharded deployment.
+    routeguide::ServerOptions options;
+    if (!routeguide::ParseServerOptions(argc, argv, &options)) {
+        return 1;
+    }
+    if (!options.write_snapshot.empty()) {
+        return routeguide::ConvertDb(options) ? 0 : 1;
+    }
+    RunServer(options);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+#include "route_stats.h"
+
+#include <vector>
+
+namespace routeguide {
+
+    void RouteStats::Append(const RouteStats& next, DistanceModel model) {
+        if (next.point_count == 0) {
+            return;
+        }
+        if (point_count == 0) {
+            *this = next;
+            return;
+        }
+        distance.Add(DistanceMetres(ToGeoPoint(last_latitude, last_longitude),
+            ToGeoPoint(next.first_latitude, next.first_longitude), model));
+        distance.Add(next.distance);
+        point_count += next.point_count;
+        feature_count += next.feature_count;
+        last_latitude = next.last_latitude;
+        last_longitude = next.last_longitude;
+    }
+
+    RouteStats MeasureRoute(const FeatureDb& db, const int32_t* latitudes,
+        const int32_t* longitudes, size_t n, DistanceModel model) {
+        RouteStats stats;
+        if (n == 0) {
+            return stats;
+        }
+        stats.point_count = static_cast<int64_t>(n);
+        for (size_t i = 0; i < n; i++) {
+            if (!db.FeatureName(latitudes[i], longitudes[i]).empty()) {
+                stats.feature_count++;
+            }
+        }
+        std::vector<double> metres(n - 1);
+        SegmentLengths(latitudes, longitudes, n, model, metres.data());
+        for (double m : metres) {
+            stats.distance.Add(m);
+        }
+        stats.first_latitude = latitudes[0];
+        stats.first_longitude = longitudes[0];
+        stats.last_latitude = latitudes[n - 1];
+        stats.last_longitude = longitudes[n - 1];
+        return stats;
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,35 @@
+#ifndef ROUTE_SERVER_ROUTE_STATS_H
+#define ROUTE_SERVER_ROUTE_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "feature_db.h"
+#include "geo_distance.h"
+
+namespace routeguide {
+
+    // RecordRoute totals for one stretch of a route. Stretches are measured
+    // independently, in any order or in parallel, and joined with Append():
+    // joining adds the segment between the end of one stretch and the start
+    // of the next, so (a + b) + c equals a + (b + c).
+    struct RouteStats {
+        int64_t point_count = 0;
+        int64_t feature_count = 0;
+        DistanceSum distance;
+        int32_t first_latitude = 0;
+        int32_t first_longitude = 0;
+        int32_t last_latitude = 0;
+        int32_t last_longitude = 0;
+
+        // Extends this stretch by next, which directly follows it.
+        void Append(const RouteStats& next, DistanceModel model);
+    };
+
+    // Measures the stretch through the n points.
+    RouteStats MeasureRoute(const FeatureDb& db, const int32_t* latitudes,
+        const int32_t* longitudes, size_t n, DistanceModel model);
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_ROUTE_STATS_H
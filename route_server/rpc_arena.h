@@ -0,0 +1,41 @@
+#ifndef ROUTE_SERVER_RPC_ARENA_H
+#define ROUTE_SERVER_RPC_ARENA_H
+
+#include <cstddef>
+
+#include <google/protobuf/arena.h>
+
+namespace routeguide {
+
+    // Protobuf arena for the messages of one RPC, freed all at once when
+    // the call ends instead of message by message. Its first block is part
+    // of the object, so a call whose messages fit in it takes nothing from
+    // the heap for them.
+    class RpcArena {
+    public:
+        static constexpr size_t kInitialBlockBytes = 4096;
+
+        RpcArena() : arena_(Options(initial_block_)) {}
+        RpcArena(const RpcArena&) = delete;
+        RpcArena& operator=(const RpcArena&) = delete;
+
+        // A new message, or repeated field of messages, that allocates its
+        // own parts from the arena too.
+        template <typename T>
+        T* Create() { return google::protobuf::Arena::CreateMessage<T>(&arena_); }
+
+    private:
+        static google::protobuf::ArenaOptions Options(char* block) {
+            google::protobuf::ArenaOptions options;
+            options.initial_block = block;
+            options.initial_block_size = kInitialBlockBytes;
+            return options;
+        }
+
+        alignas(8) char initial_block_[kInitialBlockBytes];
+        google::protobuf::Arena arena_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_RPC_ARENA_H
@@ -0,0 +1,228 @@
+#include "server_metrics.h"
+
+#include <sstream>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace routeguide {
+
+    size_t MetricStripe() {
+        static std::atomic<size_t> next_stripe{ 0 };
+        thread_local size_t stripe =
+            next_stripe.fetch_add(1, std::memory_order_relaxed) % kMetricStripes;
+        return stripe;
+    }
+
+    uint64_t Counter::Value() const {
+        uint64_t total = 0;
+        for (const Stripe& stripe : stripes_) {
+            total += stripe.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    int Histogram::BucketOf(uint64_t value) {
+        if (value <= 1) {
+            return 0;
+        }
+        // The bucket is the bit width of value - 1.
+        uint64_t v = value - 1;
+        int width = 0;
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanReverse64(&index, v);
+        width = static_cast<int>(index) + 1;
+#else
+        width = 64 - __builtin_clzll(v);
+#endif
+        return width < kBuckets ? width : kBuckets - 1;
+    }
+
+    Histogram::Snapshot Histogram::Read() const {
+        Snapshot snapshot;
+        for (const Stripe& stripe : stripes_) {
+            for (int i = 0; i < kBuckets; i++) {
+                uint64_t n = stripe.buckets[i].load(std::memory_order_relaxed);
+                snapshot.buckets[i] += n;
+                snapshot.count += n;
+            }
+            snapshot.sum += stripe.sum.load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+    const char* RpcName(Rpc rpc) {
+        static const char* const kNames[kRpcCount] = { "GetFeature", "ListFeatures",
+            "RecordRoute", "RouteChat", "GetFeatures", "StreamFeatures",
+            "NearestFeatures", "FeaturesWithinRadius", "RecordRouteBatched" };
+        return kNames[static_cast<int>(rpc)];
+    }
+
+    RpcTimer::RpcTimer(ServerMetrics* metrics, Rpc rpc)
+        : metrics_(metrics), rpc_(rpc), start_(std::chrono::steady_clock::now()) {
+        metrics_->started[static_cast<int>(rpc_)].Add();
+    }
+
+    RpcTimer::~RpcTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        metrics_->latency_nanos[static_cast<int>(rpc_)].Record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    namespace {
+        class MetricsWriter {
+        public:
+            void Header(const char* name, const char* type, const char* help) {
+                out_ << "# HELP " << name << " " << help << "\n# TYPE " << name << " "
+                    << type << "\n";
+            }
+
+            // labels is empty or "name=\"value\"".
+            template <typename T>
+            void Sample(const char* name, const std::string& labels, T value) {
+                out_ << name;
+                if (!labels.empty()) {
+                    out_ << "{" << labels << "}";
+                }
+                out_ << " " << value << "\n";
+            }
+
+            // Buckets are cumulative; bounds are scaled by scale, e.g. 1e-9
+            // to report nanoseconds as seconds.
+            void WriteHistogram(const char* name, const std::string& labels,
+                const Histogram& histogram, double scale) {
+                Histogram::Snapshot snapshot = histogram.Read();
+                std::string prefix = labels.empty() ? "" : labels + ",";
+                uint64_t cumulative = 0;
+                for (int i = 0; i < Histogram::kBuckets; i++) {
+                    cumulative += snapshot.buckets[i];
+                    std::ostringstream le;
+                    if (i + 1 < Histogram::kBuckets) {
+                        le << Histogram::UpperBound(i) * scale;
+                    }
+                    else {
+                        le << "+Inf";
+                    }
+                    out_ << name << "_bucket{" << prefix << "le=\"" << le.str() << "\"} "
+                        << cumulative << "\n";
+                }
+                Sample((std::string(name) + "_sum").c_str(), labels, snapshot.sum * scale);
+                Sample((std::string(name) + "_count").c_str(), labels, snapshot.count);
+            }
+
+            std::string str() const { return out_.str(); }
+
+        private:
+            std::ostringstream out_;
+        };
+
+        std::string MethodLabel(int rpc) {
+            return std::string("method=\"") + RpcName(static_cast<Rpc>(rpc)) + "\"";
+        }
+
+        void WriteRpcMetrics(const ServerMetrics& metrics, MetricsWriter* w) {
+            w->Header("routeguide_rpcs_started_total", "counter", "RPCs started.");
+            for (int rpc = 0; rpc < kRpcCount; rpc++) {
+                w->Sample("routeguide_rpcs_started_total", MethodLabel(rpc),
+                    metrics.started[rpc].Value());
+            }
+            w->Header("routeguide_rpc_duration_seconds", "histogram",
+                "Duration of finished RPCs, streams included.");
+            for (int rpc = 0; rpc < kRpcCount; rpc++) {
+                w->WriteHistogram("routeguide_rpc_duration_seconds", MethodLabel(rpc),
+                    metrics.latency_nanos[rpc], 1e-9);
+            }
+        }
+    }
+
+    std::string FormatMetrics(const ServerMetrics& metrics,
+        const NoteStoreStats& notes, size_t features) {
+        MetricsWriter w;
+        WriteRpcMetrics(metrics, &w);
+        w.Header("routeguide_list_features_scanned", "histogram",
+            "Index entries tested per ListFeatures.");
+        w.WriteHistogram("routeguide_list_features_scanned", "", metrics.list_scanned, 1);
+        w.Header("routeguide_list_features_matched", "histogram",
+            "Features inside the rectangle per ListFeatures, before paging.");
+        w.WriteHistogram("routeguide_list_features_matched", "", metrics.list_matched, 1);
+        w.Header("routeguide_list_cache_hits_total", "counter",
+            "ListFeatures answered from the page cache.");
+        w.Sample("routeguide_list_cache_hits_total", "", metrics.list_cache_hits.Value());
+        w.Header("routeguide_list_cache_misses_total", "counter",
+            "ListFeatures that missed the page cache.");
+        w.Sample("routeguide_list_cache_misses_total", "", metrics.list_cache_misses.Value());
+        w.Header("routeguide_record_route_points", "histogram",
+            "Points received per RecordRoute.");
+        w.WriteHistogram("routeguide_record_route_points", "", metrics.route_points, 1);
+        w.Header("routeguide_route_chat_matched_notes", "histogram",
+            "Earlier notes returned per RouteChat message.");
+        w.WriteHistogram("routeguide_route_chat_matched_notes", "", metrics.chat_matched, 1);
+        w.Header("routeguide_lookup_points", "histogram",
+            "Points per GetFeatures request or StreamFeatures message.");
+        w.WriteHistogram("routeguide_lookup_points", "", metrics.lookup_points, 1);
+        w.Header("routeguide_nearby_results", "histogram",
+            "Features returned per NearestFeatures or FeaturesWithinRadius.");
+        w.WriteHistogram("routeguide_nearby_results", "", metrics.nearby_results, 1);
+
+        w.Header("routeguide_features", "gauge", "Features in the served DB.");
+        w.Sample("routeguide_features", "", features);
+        w.Header("routeguide_db_loads_total", "counter",
+            "DB loads published, the initial one included.");
+        w.Sample("routeguide_db_loads_total", "", metrics.loads.Value());
+        w.Header("routeguide_db_failed_loads_total", "counter",
+            "DB loads that failed and kept the previous DB.");
+        w.Sample("routeguide_db_failed_loads_total", "", metrics.failed_loads.Value());
+
+        w.Header("routeguide_notes", "gauge", "RouteChat notes stored.");
+        w.Sample("routeguide_notes", "", notes.notes);
+        w.Header("routeguide_note_bytes", "gauge", "Heap bytes held for stored notes.");
+        w.Sample("routeguide_note_bytes", "", notes.bytes);
+        w.Header("routeguide_notes_evicted_total", "counter",
+            "Notes dropped by the per-location cap, the global cap or the TTL.");
+        w.Sample("routeguide_notes_evicted_total", "reason=\"location_cap\"",
+            notes.evicted_location_cap);
+        w.Sample("routeguide_notes_evicted_total", "reason=\"global_cap\"",
+            notes.evicted_global_cap);
+        w.Sample("routeguide_notes_evicted_total", "reason=\"ttl\"", notes.expired);
+        w.Header("routeguide_live_notes_dropped_total", "counter",
+            "Live notes dropped from full subscriber queues.");
+        w.Sample("routeguide_live_notes_dropped_total", "", notes.dropped_live);
+        w.Header("routeguide_note_lock_waits_total", "counter",
+            "RouteChat posts that found their note shard locked.");
+        w.Sample("routeguide_note_lock_waits_total", "", notes.lock_waits);
+        w.Header("routeguide_note_lock_wait_seconds_total", "counter",
+            "Time RouteChat posts spent waiting for a note shard lock.");
+        w.Sample("routeguide_note_lock_wait_seconds_total", "",
+            notes.lock_wait_nanos * 1e-9);
+        w.Header("routeguide_note_log_commit_notes", "histogram",
+            "Notes made durable per note log sync.");
+        w.WriteHistogram("routeguide_note_log_commit_notes", "",
+            metrics.note_log_commit_notes, 1);
+        w.Header("routeguide_note_log_sync_seconds", "histogram",
+            "Duration of note log syncs.");
+        w.WriteHistogram("routeguide_note_log_sync_seconds", "",
+            metrics.note_log_sync_nanos, 1e-9);
+        w.Header("routeguide_note_log_snapshots_total", "counter",
+            "Note snapshots written.");
+        w.Sample("routeguide_note_log_snapshots_total", "",
+            metrics.note_log_snapshots.Value());
+        w.Header("routeguide_note_log_errors_total", "counter",
+            "Failed note log writes, syncs and snapshots.");
+        w.Sample("routeguide_note_log_errors_total", "", metrics.note_log_errors.Value());
+        return w.str();
+    }
+
+    std::string FormatRouterMetrics(const ServerMetrics& metrics, size_t shards) {
+        MetricsWriter w;
+        WriteRpcMetrics(metrics, &w);
+        w.Header("routeguide_router_shards", "gauge", "Shards behind the router.");
+        w.Sample("routeguide_router_shards", "", shards);
+        w.Header("routeguide_router_shard_errors_total", "counter",
+            "Failed calls to the shards, other than cancelled ones.");
+        w.Sample("routeguide_router_shard_errors_total", "", metrics.shard_errors.Value());
+        return w.str();
+    }
+
+}  // namespace routeguide
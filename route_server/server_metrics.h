@@ -0,0 +1,150 @@
+#ifndef ROUTE_SERVER_SERVER_METRICS_H
+#define ROUTE_SERVER_SERVER_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "note_store.h"
+
+namespace routeguide {
+
+    // Cache lines each metric is spread over. Threads are given stripes
+    // round-robin, so up to this many threads update a metric without
+    // sharing a line.
+    const size_t kMetricStripes = 16;
+
+    // The calling thread's stripe.
+    size_t MetricStripe();
+
+    // Monotonic counter. Each thread adds to its own stripe with a relaxed
+    // atomic add, so updates from the handlers never contend; Value() sums
+    // the stripes.
+    class Counter {
+    public:
+        void Add(uint64_t n = 1) {
+            stripes_[MetricStripe()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+        uint64_t Value() const;
+
+    private:
+        struct alignas(64) Stripe {
+            std::atomic<uint64_t> value{ 0 };
+        };
+        Stripe stripes_[kMetricStripes];
+    };
+
+    // Lock-free histogram over power-of-two buckets: bucket i counts the
+    // values in (2^(i-1), 2^i], bucket 0 also 0, and the last bucket
+    // everything above 2^39. Striped like Counter. A Read() racing with
+    // Record() may see a value in its bucket but not yet in the sum.
+    class Histogram {
+    public:
+        static const int kBuckets = 41;
+
+        struct Snapshot {
+            uint64_t buckets[kBuckets] = {};
+            uint64_t count = 0;
+            uint64_t sum = 0;
+        };
+
+        void Record(uint64_t value) {
+            Stripe& stripe = stripes_[MetricStripe()];
+            stripe.buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+            stripe.sum.fetch_add(value, std::memory_order_relaxed);
+        }
+        Snapshot Read() const;
+
+        // Upper bound of bucket i; the last bucket has none.
+        static uint64_t UpperBound(int i) { return uint64_t{ 1 } << i; }
+
+    private:
+        static int BucketOf(uint64_t value);
+
+        struct alignas(64) Stripe {
+            std::atomic<uint64_t> buckets[kBuckets] = {};
+            std::atomic<uint64_t> sum{ 0 };
+        };
+        Stripe stripes_[kMetricStripes];
+    };
+
+    enum class Rpc {
+        kGetFeature,
+        kListFeatures,
+        kRecordRoute,
+        kRouteChat,
+        kGetFeatures,
+        kStreamFeatures,
+        kNearestFeatures,
+        kFeaturesWithinRadius,
+        kRecordRouteBatched,
+    };
+    const int kRpcCount = 9;
+
+    const char* RpcName(Rpc rpc);
+
+    // Everything the handlers record. Distributions of sizes are per call
+    // (or per message for RouteChat and StreamFeatures).
+    struct ServerMetrics {
+        Counter started[kRpcCount];
+        // Nanoseconds from the call's start to its end; counts the calls that
+        // finished.
+        Histogram latency_nanos[kRpcCount];
+        // Grid entries tested and features inside the rectangle per
+        // ListFeatures.
+        Histogram list_scanned;
+        Histogram list_matched;
+        // ListFeatures answered from the page cache, and those that missed it
+        // while it was enabled.
+        Counter list_cache_hits;
+        Counter list_cache_misses;
+        Histogram route_points;
+        // Earlier notes returned per RouteChat message.
+        Histogram chat_matched;
+        // Points per GetFeatures request or StreamFeatures message.
+        Histogram lookup_points;
+        // Features returned per NearestFeatures or FeaturesWithinRadius.
+        Histogram nearby_results;
+        // DB loads published, the initial one included, and failed loads.
+        Counter loads;
+        Counter failed_loads;
+        // Notes made durable by each write and sync of the note log, and
+        // how long the sync took.
+        Histogram note_log_commit_notes;
+        Histogram note_log_sync_nanos;
+        Counter note_log_snapshots;
+        Counter note_log_errors;
+        // Calls a router made to its shards that failed, other than those
+        // cancelled with the client's call.
+        Counter shard_errors;
+    };
+
+    // Counts an RPC as started when created and records its latency, counting
+    // it as finished, when destroyed.
+    class RpcTimer {
+    public:
+        RpcTimer(ServerMetrics* metrics, Rpc rpc);
+        ~RpcTimer();
+        RpcTimer(const RpcTimer&) = delete;
+        RpcTimer& operator=(const RpcTimer&) = delete;
+
+    private:
+        ServerMetrics* metrics_;
+        Rpc rpc_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // The metrics, the note store's and the DB's size in the Prometheus text
+    // exposition format.
+    std::string FormatMetrics(const ServerMetrics& metrics,
+        const NoteStoreStats& notes, size_t features);
+
+    // A router's metrics in the same format: its RPCs, the number of shards
+    // and the failed calls to them.
+    std::string FormatRouterMetrics(const ServerMetrics& metrics, size_t shards);
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_SERVER_METRICS_H
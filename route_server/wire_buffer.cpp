@@ -0,0 +1,18 @@
+#include "wire_buffer.h"
+
+namespace routeguide {
+
+    grpc::ByteBuffer WireBuffer(std::string_view bytes) {
+        grpc::Slice slice(bytes.data(), bytes.size());
+        return grpc::ByteBuffer(&slice, 1);
+    }
+
+    grpc::Slice WireSlice(const grpc::ByteBuffer& buffer) {
+        grpc::Slice slice;
+        if (!buffer.DumpToSingleSlice(&slice).ok()) {
+            return grpc::Slice();
+        }
+        return slice;
+    }
+
+}  // namespace routeguide
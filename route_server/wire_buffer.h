@@ -0,0 +1,30 @@
+#ifndef ROUTE_SERVER_WIRE_BUFFER_H
+#define ROUTE_SERVER_WIRE_BUFFER_H
+
+#include <string_view>
+
+#include <grpcpp/support/byte_buffer.h>
+#include <grpcpp/support/slice.h>
+
+namespace routeguide {
+
+    // Methods served raw read their request and write their responses as
+    // serialized bytes, skipping protobuf on the way out.
+
+    // A buffer holding a copy of bytes, to be written as one message. The
+    // bytes are copied because the transport may still hold the buffer's
+    // slices after the write completes, and a reload can free the DB they
+    // come from.
+    grpc::ByteBuffer WireBuffer(std::string_view bytes);
+
+    // The bytes of buffer in one slice, copied only if it holds several.
+    grpc::Slice WireSlice(const grpc::ByteBuffer& buffer);
+
+    inline std::string_view SliceView(const grpc::Slice& slice) {
+        return std::string_view(reinterpret_cast<const char*>(slice.begin()),
+            slice.size());
+    }
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_WIRE_BUFFER_H
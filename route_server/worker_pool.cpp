@@ -0,0 +1,48 @@
+#include "worker_pool.h"
+
+#include <utility>
+
+namespace routeguide {
+
+    WorkerPool::WorkerPool(size_t threads) {
+        for (size_t i = 0; i < threads; i++) {
+            threads_.emplace_back(&WorkerPool::Run, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::Submit(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            tasks_.push_back(std::move(task));
+        }
+        ready_.notify_one();
+    }
+
+    void WorkerPool::Run() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+}  // namespace routeguide
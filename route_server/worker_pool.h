@@ -0,0 +1,39 @@
+#ifndef ROUTE_SERVER_WORKER_POOL_H
+#define ROUTE_SERVER_WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace routeguide {
+
+    // Fixed set of threads running submitted tasks in FIFO order. The
+    // destructor runs the tasks still queued, then joins the threads.
+    class WorkerPool {
+    public:
+        explicit WorkerPool(size_t threads);
+        ~WorkerPool();
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        void Submit(std::function<void()> task);
+
+        size_t size() const { return threads_.size(); }
+
+    private:
+        void Run();
+
+        std::mutex mu_;
+        std::condition_variable ready_;
+        std::deque<std::function<void()>> tasks_;
+        bool stopping_ = false;
+        std::vector<std::thread> threads_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTE_SERVER_WORKER_POOL_H
@@ -0,0 +1,112 @@
+#ifndef ROUTEGUIDE_CORE_COLUMN_H
+#define ROUTEGUIDE_CORE_COLUMN_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace routeguide {
+
+    // Contiguous read-mostly array that either owns its elements or views
+    // memory owned by someone else, such as a memory-mapped DB snapshot.
+    // Readers only see data() and size(); the mutators switch the column back
+    // to owned storage.
+    template <typename T>
+    class Column {
+    public:
+        Column() = default;
+        Column(const Column& other) { *this = other; }
+        Column(Column&& other) noexcept
+            : owned_(std::move(other.owned_)), data_(other.data_), size_(other.size_) {
+            other.data_ = nullptr;
+            other.size_ = 0;
+        }
+        Column& operator=(const Column& other) {
+            if (this != &other) {
+                owned_ = other.owned_;
+                if (other.data_ == other.owned_.data()) {
+                    Sync();
+                }
+                else {
+                    data_ = other.data_;
+                    size_ = other.size_;
+                }
+            }
+            return *this;
+        }
+        Column& operator=(Column&& other) noexcept {
+            if (this != &other) {
+                owned_ = std::move(other.owned_);
+                data_ = other.data_;
+                size_ = other.size_;
+                other.data_ = nullptr;
+                other.size_ = 0;
+            }
+            return *this;
+        }
+
+        const T* data() const { return data_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        const T& operator[](size_t i) const { return data_[i]; }
+        const T* begin() const { return data_; }
+        const T* end() const { return data_ + size_; }
+
+        // Points the column at size elements that outlive it.
+        void View(const T* data, size_t size) {
+            owned_.clear();
+            owned_.shrink_to_fit();
+            data_ = data;
+            size_ = size;
+        }
+
+        void Assign(std::vector<T> values) {
+            owned_ = std::move(values);
+            Sync();
+        }
+        void Clear() {
+            owned_.clear();
+            Sync();
+        }
+        void Reserve(size_t n) {
+            TakeOwnership();
+            owned_.reserve(n);
+            Sync();
+        }
+        void ShrinkToFit() {
+            owned_.shrink_to_fit();
+            Sync();
+        }
+        void PushBack(const T& value) {
+            TakeOwnership();
+            owned_.push_back(value);
+            Sync();
+        }
+        void Append(const T* values, size_t n) {
+            TakeOwnership();
+            owned_.insert(owned_.end(), values, values + n);
+            Sync();
+        }
+
+        // Heap bytes owned by the column; zero for views.
+        size_t OwnedBytes() const { return owned_.capacity() * sizeof(T); }
+
+    private:
+        void TakeOwnership() {
+            if (data_ != owned_.data()) {
+                owned_.assign(data_, data_ + size_);
+            }
+        }
+        void Sync() {
+            data_ = owned_.data();
+            size_ = owned_.size();
+        }
+
+        std::vector<T> owned_;
+        const T* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_COLUMN_H
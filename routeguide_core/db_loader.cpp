@@ -0,0 +1,409 @@
+#include "db_loader.h"
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "mapped_file.h"
+
+namespace routeguide {
+
+    namespace {
+        // Nesting limit for values that are skipped rather than understood.
+        const int kMaxSkipDepth = 64;
+
+        class JsonDbReader {
+        public:
+            JsonDbReader(const char* data, size_t size)
+                : begin_(data), p_(data), end_(data + size) {}
+
+            bool Read(FeatureStore* store) {
+                SkipWhitespace();
+                if (!Consume('[')) {
+                    return Fail("expected '['");
+                }
+                SkipWhitespace();
+                if (!Consume(']')) {
+                    for (;;) {
+                        if (!ReadFeature(store)) {
+                            return false;
+                        }
+                        SkipWhitespace();
+                        if (Consume(']')) {
+                            break;
+                        }
+                        if (!Consume(',')) {
+                            return Fail("expected ',' or ']' after feature");
+                        }
+                    }
+                }
+                SkipWhitespace();
+                if (p_ != end_) {
+                    return Fail("unexpected data after ']'");
+                }
+                return true;
+            }
+
+            const std::string& error() const { return error_; }
+
+        private:
+            bool ReadFeature(FeatureStore* store) {
+                SkipWhitespace();
+                if (!Consume('{')) {
+                    return Fail("expected '{' to start a feature");
+                }
+                int32_t latitude = 0;
+                int32_t longitude = 0;
+                std::string_view name;
+                std::string_view key;
+                for (bool first = true;; first = false) {
+                    SkipWhitespace();
+                    if (Consume('}')) {
+                        if (!first) {
+                            return Fail("expected key after ','");
+                        }
+                        break;
+                    }
+                    if (!ReadKey(&key)) {
+                        return false;
+                    }
+                    if (key == "location") {
+                        if (!ReadLocation(&latitude, &longitude)) {
+                            return false;
+                        }
+                    }
+                    else if (key == "name") {
+                        SkipWhitespace();
+                        if (!ReadString(&name, &name_scratch_)) {
+                            return false;
+                        }
+                    }
+                    else if (!SkipValue(0)) {
+                        return false;
+                    }
+                    SkipWhitespace();
+                    if (Consume('}')) {
+                        break;
+                    }
+                    if (!Consume(',')) {
+                        return Fail("expected ',' or '}' in feature");
+                    }
+                }
+                store->Add(latitude, longitude, name);
+                return true;
+            }
+
+            bool ReadLocation(int32_t* latitude, int32_t* longitude) {
+                SkipWhitespace();
+                if (!Consume('{')) {
+                    return Fail("expected '{' to start a location");
+                }
+                std::string_view key;
+                for (bool first = true;; first = false) {
+                    SkipWhitespace();
+                    if (Consume('}')) {
+                        if (!first) {
+                            return Fail("expected key after ','");
+                        }
+                        return true;
+                    }
+                    if (!ReadKey(&key)) {
+                        return false;
+                    }
+                    SkipWhitespace();
+                    if (key == "latitude") {
+                        if (!ReadInt32(latitude)) {
+                            return false;
+                        }
+                    }
+                    else if (key == "longitude") {
+                        if (!ReadInt32(longitude)) {
+                            return false;
+                        }
+                    }
+                    else if (!SkipValue(0)) {
+                        return false;
+                    }
+                    SkipWhitespace();
+                    if (Consume('}')) {
+                        return true;
+                    }
+                    if (!Consume(',')) {
+                        return Fail("expected ',' or '}' in location");
+                    }
+                }
+            }
+
+            // Reads `"key" :` and leaves the cursor on the value.
+            bool ReadKey(std::string_view* key) {
+                if (!ReadString(key, &key_scratch_)) {
+                    return false;
+                }
+                SkipWhitespace();
+                if (!Consume(':')) {
+                    return Fail("expected ':' after key");
+                }
+                return true;
+            }
+
+            bool ReadInt32(int32_t* value) {
+                int64_t parsed = 0;
+                const char* start = p_;
+                std::from_chars_result result = std::from_chars(p_, end_, parsed);
+                if (result.ec != std::errc() || result.ptr == start) {
+                    return Fail("expected an integer");
+                }
+                if (parsed < INT32_MIN || parsed > INT32_MAX) {
+                    return Fail("integer out of range");
+                }
+                if (result.ptr != end_ &&
+                    (*result.ptr == '.' || *result.ptr == 'e' || *result.ptr == 'E')) {
+                    p_ = result.ptr;
+                    return Fail("expected an integer");
+                }
+                p_ = result.ptr;
+                *value = static_cast<int32_t>(parsed);
+                return true;
+            }
+
+            // Reads a JSON string. Strings without escapes are returned as a
+            // view into the input; otherwise they are decoded into scratch.
+            bool ReadString(std::string_view* out, std::string* scratch) {
+                if (!Consume('"')) {
+                    return Fail("expected '\"'");
+                }
+                const char* start = p_;
+                while (p_ != end_ && *p_ != '"' && *p_ != '\\') {
+                    p_++;
+                }
+                if (p_ == end_) {
+                    return Fail("unterminated string");
+                }
+                if (*p_ == '"') {
+                    *out = std::string_view(start, p_ - start);
+                    p_++;
+                    return true;
+                }
+                scratch->assign(start, p_ - start);
+                while (p_ != end_ && *p_ != '"') {
+                    if (*p_ != '\\') {
+                        scratch->push_back(*p_++);
+                        continue;
+                    }
+                    if (!ReadEscape(scratch)) {
+                        return false;
+                    }
+                }
+                if (p_ == end_) {
+                    return Fail("unterminated string");
+                }
+                p_++;
+                *out = *scratch;
+                return true;
+            }
+
+            bool ReadEscape(std::string* out) {
+                p_++;  // The backslash.
+                if (p_ == end_) {
+                    return Fail("unterminated escape");
+                }
+                char c = *p_++;
+                switch (c) {
+                case '"': out->push_back('"'); return true;
+                case '\\': out->push_back('\\'); return true;
+                case '/': out->push_back('/'); return true;
+                case 'b': out->push_back('\b'); return true;
+                case 'f': out->push_back('\f'); return true;
+                case 'n': out->push_back('\n'); return true;
+                case 'r': out->push_back('\r'); return true;
+                case 't': out->push_back('\t'); return true;
+                case 'u': break;
+                default:
+                    p_--;
+                    return Fail("invalid escape");
+                }
+                uint32_t code = 0;
+                if (!ReadHex4(&code)) {
+                    return false;
+                }
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    // A high surrogate must be followed by a low one.
+                    uint32_t low = 0;
+                    if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') {
+                        return Fail("unpaired surrogate");
+                    }
+                    p_ += 2;
+                    if (!ReadHex4(&low)) {
+                        return false;
+                    }
+                    if (low < 0xDC00 || low > 0xDFFF) {
+                        return Fail("unpaired surrogate");
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                else if (code >= 0xDC00 && code <= 0xDFFF) {
+                    return Fail("unpaired surrogate");
+                }
+                AppendUtf8(code, out);
+                return true;
+            }
+
+            bool ReadHex4(uint32_t* code) {
+                if (end_ - p_ < 4) {
+                    return Fail("truncated \\u escape");
+                }
+                std::from_chars_result result = std::from_chars(p_, p_ + 4, *code, 16);
+                if (result.ec != std::errc() || result.ptr != p_ + 4) {
+                    return Fail("invalid \\u escape");
+                }
+                p_ += 4;
+                return true;
+            }
+
+            static void AppendUtf8(uint32_t code, std::string* out) {
+                if (code < 0x80) {
+                    out->push_back(static_cast<char>(code));
+                }
+                else if (code < 0x800) {
+                    out->push_back(static_cast<char>(0xC0 | (code >> 6)));
+                    out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                else if (code < 0x10000) {
+                    out->push_back(static_cast<char>(0xE0 | (code >> 12)));
+                    out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                    out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                else {
+                    out->push_back(static_cast<char>(0xF0 | (code >> 18)));
+                    out->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+                    out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                    out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+            }
+
+            // Skips any JSON value, for keys the loader does not know about.
+            bool SkipValue(int depth) {
+                if (depth > kMaxSkipDepth) {
+                    return Fail("value nested too deeply");
+                }
+                SkipWhitespace();
+                if (p_ == end_) {
+                    return Fail("expected a value");
+                }
+                std::string_view ignored;
+                switch (*p_) {
+                case '"':
+                    return ReadString(&ignored, &key_scratch_);
+                case '{':
+                case '[': {
+                    char close = *p_ == '{' ? '}' : ']';
+                    p_++;
+                    SkipWhitespace();
+                    if (Consume(close)) {
+                        return true;
+                    }
+                    for (;;) {
+                        if (close == '}') {
+                            SkipWhitespace();
+                            if (!ReadKey(&ignored)) {
+                                return false;
+                            }
+                        }
+                        if (!SkipValue(depth + 1)) {
+                            return false;
+                        }
+                        SkipWhitespace();
+                        if (Consume(close)) {
+                            return true;
+                        }
+                        if (!Consume(',')) {
+                            return Fail("expected ',' in skipped value");
+                        }
+                    }
+                }
+                default:
+                    if (SkipLiteral("true") || SkipLiteral("false") ||
+                        SkipLiteral("null")) {
+                        return true;
+                    }
+                    return SkipNumber();
+                }
+            }
+
+            bool SkipLiteral(const char* literal) {
+                size_t length = std::strlen(literal);
+                if (static_cast<size_t>(end_ - p_) >= length &&
+                    std::memcmp(p_, literal, length) == 0) {
+                    p_ += length;
+                    return true;
+                }
+                return false;
+            }
+
+            // Lenient: accepts anything made of number characters.
+            bool SkipNumber() {
+                const char* start = p_;
+                while (p_ != end_ && *p_ != '\0' &&
+                    std::strchr("0123456789.eE+-", *p_) != nullptr) {
+                    p_++;
+                }
+                if (p_ == start) {
+                    return Fail("expected a value");
+                }
+                return true;
+            }
+
+            void SkipWhitespace() {
+                while (p_ != end_ &&
+                    (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) {
+                    p_++;
+                }
+            }
+
+            bool Consume(char c) {
+                if (p_ != end_ && *p_ == c) {
+                    p_++;
+                    return true;
+                }
+                return false;
+            }
+
+            bool Fail(const char* what) {
+                error_ = "offset " + std::to_string(p_ - begin_) + ": " + what;
+                return false;
+            }
+
+            const char* begin_;
+            const char* p_;
+            const char* end_;
+            std::string name_scratch_;
+            std::string key_scratch_;
+            std::string error_;
+        };
+    }
+
+    bool ParseJsonDb(const char* data, size_t size, FeatureStore* store,
+        std::string* error) {
+        store->Clear();
+        JsonDbReader reader(data, size);
+        if (!reader.Read(store)) {
+            *error = reader.error();
+            store->Clear();
+            return false;
+        }
+        store->ShrinkToFit();
+        return true;
+    }
+
+    bool LoadJsonDb(const std::string& path, FeatureStore* store,
+        std::string* error) {
+        MappedFile file;
+        if (!file.Open(path, error)) {
+            return false;
+        }
+        file.AdviseSequential();
+        return ParseJsonDb(file.data(), file.size(), store, error);
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,27 @@
+#ifndef ROUTEGUIDE_CORE_DB_LOADER_H
+#define ROUTEGUIDE_CORE_DB_LOADER_H
+
+#include <cstddef>
+#include <string>
+
+#include "feature_store.h"
+
+namespace routeguide {
+
+    // Parses a JSON feature database of the form
+    //   [{"location": {"latitude": 123, "longitude": 456}, "name": "..."}, ...]
+    // straight into store in a single pass over data. Keys may come in any
+    // order, unknown keys are skipped, and names are kept verbatim (JSON
+    // escapes are decoded). On malformed input returns false, leaves store
+    // empty and sets error to a message that starts with the byte offset of
+    // the problem.
+    bool ParseJsonDb(const char* data, size_t size, FeatureStore* store,
+        std::string* error);
+
+    // Memory-maps the file at path and parses it with ParseJsonDb.
+    bool LoadJsonDb(const std::string& path, FeatureStore* store,
+        std::string* error);
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_DB_LOADER_H
@@ -0,0 +1,433 @@
+#include "db_snapshot.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+#include <utility>
+
+namespace routeguide {
+
+    namespace {
+        const char kMagic[8] = { 'R', 'G', 'D', 'B', 'S', 'N', 'A', 'P' };
+        // Version 1 ended the header at grid_ids and had no sphere index or
+        // wire bytes; it is still read, and those are built on load.
+        const uint32_t kVersion = 2;
+        const uint32_t kByteOrderMark = 0x01020304;
+        const uint64_t kSectionAlignment = 64;
+
+        enum SnapshotFlags : uint32_t {
+            kHasPointIndex = 1 << 0,
+            kHasGridIndex = 1 << 1,
+            kHasEncodedFeatures = 1 << 2,
+            kHasSphereIndex = 1 << 3,
+        };
+
+        struct Section {
+            uint64_t offset;
+            uint64_t bytes;
+        };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint32_t flags;
+            uint32_t reserved;
+            uint64_t feature_count;
+            uint64_t file_size;
+            Section latitudes;
+            Section longitudes;
+            Section name_offsets;
+            Section names;
+            uint64_t point_index_size;
+            Section point_slots;
+            GridIndex::Shape grid_shape;
+            Section grid_cell_start;
+            Section grid_latitudes;
+            Section grid_longitudes;
+            Section grid_ids;
+            Section encoded_offsets;
+            Section encoded_bytes;
+            Section sphere_coords;
+            Section sphere_ids;
+            Section sphere_axes;
+        };
+        static_assert(std::is_trivially_copyable<Header>::value,
+            "Header is written with a plain memcpy");
+        static_assert(sizeof(Header) == 296, "Header layout is part of the format");
+        static_assert(offsetof(Header, encoded_offsets) == 216,
+            "A version 1 header ends at grid_ids");
+        const size_t kVersion1HeaderBytes = 216;
+        static_assert(sizeof(PointIndex::Slot) == 16,
+            "PointIndex::Slot layout is part of the format");
+
+        uint64_t AlignUp(uint64_t offset) {
+            return (offset + kSectionAlignment - 1) & ~(kSectionAlignment - 1);
+        }
+
+        // Assigns file offsets to sections in the order they are written.
+        class Layout {
+        public:
+            Section Add(uint64_t bytes) {
+                Section section = { AlignUp(end_), bytes };
+                end_ = section.offset + bytes;
+                return section;
+            }
+            uint64_t end() const { return end_; }
+
+        private:
+            uint64_t end_ = sizeof(Header);
+        };
+
+        bool WriteSection(std::ofstream& out, const Section& section,
+            const void* data) {
+            static const char kZeros[kSectionAlignment] = {};
+            uint64_t position = static_cast<uint64_t>(out.tellp());
+            out.write(kZeros, static_cast<std::streamsize>(section.offset - position));
+            if (section.bytes > 0) {
+                out.write(static_cast<const char*>(data),
+                    static_cast<std::streamsize>(section.bytes));
+            }
+            return static_cast<bool>(out);
+        }
+
+        // Checks that a section lies inside the file, is aligned for T and
+        // holds exactly count elements, then returns it as a T array.
+        template <typename T>
+        bool CheckSection(const MappedFile& file, const Section& section,
+            uint64_t count, const char* what, const T** data, std::string* error) {
+            if (section.offset > file.size() ||
+                section.bytes > file.size() - section.offset ||
+                section.offset % alignof(T) != 0 ||
+                section.bytes != count * sizeof(T) ||
+                (count != 0 && section.bytes / count != sizeof(T))) {
+                *error = std::string("corrupt snapshot: bad ") + what + " section";
+                return false;
+            }
+            *data = reinterpret_cast<const T*>(file.data() + section.offset);
+            return true;
+        }
+
+        // True if values[0..count) never decreases.
+        template <typename T>
+        bool Ascending(const T* values, uint64_t count) {
+            for (uint64_t i = 1; i < count; i++) {
+                if (values[i] < values[i - 1]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // The shape must be one GridIndex::Build() could have made: RowOf()
+        // and ColumnOf() divide by the box size and multiply by the row and
+        // column counts.
+        bool ValidGridShape(const GridIndex::Shape& shape) {
+            if (shape.min_latitude > shape.max_latitude ||
+                shape.min_longitude > shape.max_longitude ||
+                shape.rows == 0 || shape.columns == 0) {
+                return false;
+            }
+            uint64_t height =
+                static_cast<uint64_t>(int64_t(shape.max_latitude) - shape.min_latitude) + 1;
+            uint64_t width =
+                static_cast<uint64_t>(int64_t(shape.max_longitude) - shape.min_longitude) + 1;
+            return shape.rows <= height && shape.columns <= width &&
+                static_cast<uint64_t>(shape.rows) * shape.columns <= GridIndex::kMaxCells;
+        }
+    }
+
+    bool IsSnapshot(const char* data, size_t size) {
+        return size >= sizeof(kMagic) && std::memcmp(data, kMagic, sizeof(kMagic)) == 0;
+    }
+
+    bool WriteSnapshot(const FeatureDb& db, const std::string& path,
+        std::string* error) {
+        const FeatureStore& store = db.store();
+        const PointIndex& point_index = db.point_index();
+        const GridIndex& grid_index = db.grid_index();
+        const EncodedFeatures& encoded = db.encoded();
+        const SphereIndex& sphere_index = db.sphere_index();
+        uint64_t n = store.size();
+        // An empty store has no offsets yet; the format always has n + 1.
+        const uint64_t kNoNames = 0;
+        const uint64_t* name_offsets = n == 0 ? &kNoNames : store.name_offsets();
+
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.byte_order = kByteOrderMark;
+        header.feature_count = n;
+        Layout layout;
+        header.latitudes = layout.Add(n * sizeof(int32_t));
+        header.longitudes = layout.Add(n * sizeof(int32_t));
+        header.name_offsets = layout.Add((n + 1) * sizeof(uint64_t));
+        header.names = layout.Add(store.name_bytes());
+        if (!point_index.slots().empty()) {
+            header.flags |= kHasPointIndex;
+            header.point_index_size = point_index.size();
+            header.point_slots =
+                layout.Add(point_index.slots().size() * sizeof(PointIndex::Slot));
+        }
+        if (!grid_index.cell_start().empty()) {
+            header.flags |= kHasGridIndex;
+            header.grid_shape = grid_index.shape();
+            header.grid_cell_start =
+                layout.Add(grid_index.cell_start().size() * sizeof(uint32_t));
+            header.grid_latitudes = layout.Add(n * sizeof(int32_t));
+            header.grid_longitudes = layout.Add(n * sizeof(int32_t));
+            header.grid_ids = layout.Add(n * sizeof(uint32_t));
+        }
+        if (encoded.offsets().size() == n + 1) {
+            header.flags |= kHasEncodedFeatures;
+            header.encoded_offsets = layout.Add((n + 1) * sizeof(uint64_t));
+            header.encoded_bytes = layout.Add(encoded.bytes().size());
+        }
+        if (sphere_index.size() == n) {
+            header.flags |= kHasSphereIndex;
+            header.sphere_coords = layout.Add(3 * n * sizeof(double));
+            header.sphere_ids = layout.Add(n * sizeof(uint32_t));
+            header.sphere_axes = layout.Add(n * sizeof(uint8_t));
+        }
+        header.file_size = layout.end();
+
+        std::string temp_path = path + ".tmp";
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                *error = "cannot create " + temp_path;
+                return false;
+            }
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            bool ok = WriteSection(out, header.latitudes, store.latitudes()) &&
+                WriteSection(out, header.longitudes, store.longitudes()) &&
+                WriteSection(out, header.name_offsets, name_offsets) &&
+                WriteSection(out, header.names, store.names());
+            if (ok && (header.flags & kHasPointIndex) != 0) {
+                ok = WriteSection(out, header.point_slots, point_index.slots().data());
+            }
+            if (ok && (header.flags & kHasGridIndex) != 0) {
+                ok = WriteSection(out, header.grid_cell_start,
+                    grid_index.cell_start().data()) &&
+                    WriteSection(out, header.grid_latitudes,
+                        grid_index.latitudes().data()) &&
+                    WriteSection(out, header.grid_longitudes,
+                        grid_index.longitudes().data()) &&
+                    WriteSection(out, header.grid_ids, grid_index.ids().data());
+            }
+            if (ok && (header.flags & kHasEncodedFeatures) != 0) {
+                ok = WriteSection(out, header.encoded_offsets, encoded.offsets().data()) &&
+                    WriteSection(out, header.encoded_bytes, encoded.bytes().data());
+            }
+            if (ok && (header.flags & kHasSphereIndex) != 0) {
+                ok = WriteSection(out, header.sphere_coords,
+                    sphere_index.coords().data()) &&
+                    WriteSection(out, header.sphere_ids, sphere_index.ids().data()) &&
+                    WriteSection(out, header.sphere_axes, sphere_index.axes().data());
+            }
+            out.close();
+            if (!ok || !out) {
+                *error = "cannot write " + temp_path;
+                std::remove(temp_path.c_str());
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec) {
+            *error = "cannot rename " + temp_path + " to " + path + ": " + ec.message();
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool ReadSnapshot(std::unique_ptr<MappedFile> file, FeatureDb* db,
+        std::string* error) {
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        if (file->size() < kVersion1HeaderBytes ||
+            !IsSnapshot(file->data(), file->size())) {
+            *error = "not a snapshot";
+            return false;
+        }
+        std::memcpy(&header, file->data(), kVersion1HeaderBytes);
+        if (header.byte_order != kByteOrderMark) {
+            *error = "snapshot was written with a different byte order";
+            return false;
+        }
+        if (header.version != 1 && header.version != kVersion) {
+            *error = "unsupported snapshot version " + std::to_string(header.version);
+            return false;
+        }
+        if (header.version == kVersion) {
+            if (file->size() < sizeof(header)) {
+                *error = "not a snapshot";
+                return false;
+            }
+            std::memcpy(&header, file->data(), sizeof(header));
+        }
+        else {
+            // The later flags name sections a version 1 header has no room for.
+            header.flags &= kHasPointIndex | kHasGridIndex;
+        }
+        if (header.file_size != file->size()) {
+            *error = "truncated snapshot";
+            return false;
+        }
+
+        uint64_t n = header.feature_count;
+        const int32_t* latitudes = nullptr;
+        const int32_t* longitudes = nullptr;
+        const uint64_t* name_offsets = nullptr;
+        const char* names = nullptr;
+        if (n >= UINT32_MAX ||
+            !CheckSection(*file, header.latitudes, n, "latitude", &latitudes, error) ||
+            !CheckSection(*file, header.longitudes, n, "longitude", &longitudes, error) ||
+            !CheckSection(*file, header.name_offsets, n + 1, "name offset",
+                &name_offsets, error) ||
+            !CheckSection(*file, header.names, header.names.bytes, "name", &names,
+                error)) {
+            if (error->empty()) {
+                *error = "corrupt snapshot: too many features";
+            }
+            return false;
+        }
+        if (name_offsets[0] != 0 || name_offsets[n] != header.names.bytes ||
+            !Ascending(name_offsets, n + 1)) {
+            *error = "corrupt snapshot: name offsets do not match the name arena";
+            return false;
+        }
+        db->mutable_store()->View(static_cast<size_t>(n), latitudes, longitudes,
+            name_offsets, names);
+
+        bool indexes_missing = false;
+        if ((header.flags & kHasPointIndex) != 0) {
+            const PointIndex::Slot* slots = nullptr;
+            uint64_t capacity = header.point_slots.bytes / sizeof(PointIndex::Slot);
+            if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+                !CheckSection(*file, header.point_slots, capacity, "point index",
+                    &slots, error)) {
+                if (error->empty()) {
+                    *error = "corrupt snapshot: bad point index size";
+                }
+                return false;
+            }
+            // Every slot must hold a feature or be empty, and one at least
+            // must be empty, or a lookup that misses would probe forever.
+            uint64_t used = 0;
+            for (uint64_t i = 0; i < capacity; i++) {
+                if (slots[i].value == PointIndex::kNotFound) {
+                    continue;
+                }
+                if (slots[i].value >= n) {
+                    *error = "corrupt snapshot: point index entry out of range";
+                    return false;
+                }
+                used++;
+            }
+            if (used != header.point_index_size || used == capacity) {
+                *error = "corrupt snapshot: bad point index size";
+                return false;
+            }
+            db->mutable_point_index()->View(slots, static_cast<size_t>(capacity),
+                static_cast<size_t>(header.point_index_size));
+        }
+        else {
+            indexes_missing = true;
+        }
+        if ((header.flags & kHasGridIndex) != 0) {
+            const GridIndex::Shape& shape = header.grid_shape;
+            if (!ValidGridShape(shape)) {
+                *error = "corrupt snapshot: bad grid shape";
+                return false;
+            }
+            uint64_t cells = static_cast<uint64_t>(shape.rows) * shape.columns;
+            const uint32_t* cell_start = nullptr;
+            const int32_t* grid_latitudes = nullptr;
+            const int32_t* grid_longitudes = nullptr;
+            const uint32_t* ids = nullptr;
+            if (cells == 0 ||
+                !CheckSection(*file, header.grid_cell_start, cells + 1, "grid cell",
+                    &cell_start, error) ||
+                !CheckSection(*file, header.grid_latitudes, n, "grid latitude",
+                    &grid_latitudes, error) ||
+                !CheckSection(*file, header.grid_longitudes, n, "grid longitude",
+                    &grid_longitudes, error) ||
+                !CheckSection(*file, header.grid_ids, n, "grid id", &ids, error)) {
+                if (error->empty()) {
+                    *error = "corrupt snapshot: empty grid";
+                }
+                return false;
+            }
+            if (cell_start[0] != 0 || cell_start[cells] != n ||
+                !Ascending(cell_start, cells + 1)) {
+                *error = "corrupt snapshot: grid cells do not cover the features";
+                return false;
+            }
+            for (uint64_t i = 0; i < n; i++) {
+                if (ids[i] >= n) {
+                    *error = "corrupt snapshot: grid entry out of range";
+                    return false;
+                }
+            }
+            db->mutable_grid_index()->View(shape, cell_start, grid_latitudes,
+                grid_longitudes, ids, static_cast<size_t>(n));
+        }
+        else {
+            indexes_missing = true;
+        }
+        if ((header.flags & kHasEncodedFeatures) != 0) {
+            const uint64_t* offsets = nullptr;
+            const char* bytes = nullptr;
+            if (!CheckSection(*file, header.encoded_offsets, n + 1, "encoded offset",
+                    &offsets, error) ||
+                !CheckSection(*file, header.encoded_bytes, header.encoded_bytes.bytes,
+                    "encoded feature", &bytes, error)) {
+                return false;
+            }
+            if (offsets[0] != 0 || offsets[n] != header.encoded_bytes.bytes ||
+                !Ascending(offsets, n + 1)) {
+                *error = "corrupt snapshot: encoded offsets do not match the encoded features";
+                return false;
+            }
+            db->mutable_encoded()->View(offsets, bytes, static_cast<size_t>(n));
+        }
+        else {
+            indexes_missing = true;
+        }
+        if ((header.flags & kHasSphereIndex) != 0) {
+            const double* coords = nullptr;
+            const uint32_t* ids = nullptr;
+            const uint8_t* axes = nullptr;
+            if (!CheckSection(*file, header.sphere_coords, 3 * n, "sphere coordinate",
+                    &coords, error) ||
+                !CheckSection(*file, header.sphere_ids, n, "sphere id", &ids, error) ||
+                !CheckSection(*file, header.sphere_axes, n, "sphere axis", &axes,
+                    error)) {
+                return false;
+            }
+            for (uint64_t i = 0; i < n; i++) {
+                if (ids[i] >= n || axes[i] > 2) {
+                    *error = "corrupt snapshot: sphere index entry out of range";
+                    return false;
+                }
+            }
+            db->mutable_sphere_index()->View(coords, ids, axes, static_cast<size_t>(n));
+        }
+        else {
+            indexes_missing = true;
+        }
+        db->set_backing(std::move(file));
+        if (indexes_missing) {
+            db->BuildIndexes();
+        }
+        return true;
+    }
+
+}  // namespace routeguide
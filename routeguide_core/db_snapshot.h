@@ -0,0 +1,39 @@
+#ifndef ROUTEGUIDE_CORE_DB_SNAPSHOT_H
+#define ROUTEGUIDE_CORE_DB_SNAPSHOT_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "feature_db.h"
+#include "mapped_file.h"
+
+namespace routeguide {
+
+    // Binary snapshot of a FeatureDb. The file is a fixed header followed by
+    // 64-byte aligned sections holding the raw columns of the FeatureStore
+    // (latitudes, longitudes, name offsets, name arena) and, optionally, the
+    // arrays of the point, grid and sphere indexes and the features' wire
+    // bytes. A server maps the file and serves straight from it, so startup
+    // does no parsing and several processes share one copy in the page
+    // cache. Integers are little-endian; the header records the byte order
+    // it was written with and readers reject a mismatch.
+
+    // True if data starts with the snapshot magic bytes.
+    bool IsSnapshot(const char* data, size_t size);
+
+    // Writes db to path. The file is written next to path and renamed into
+    // place, so a reader never sees a half-written snapshot.
+    bool WriteSnapshot(const FeatureDb& db, const std::string& path,
+        std::string* error);
+
+    // Validates the header, the section bounds and every offset and index
+    // entry that lookups follow, then points db at the mapped snapshot; db
+    // takes ownership of the mapping. Indexes missing from the snapshot are
+    // built in memory.
+    bool ReadSnapshot(std::unique_ptr<MappedFile> file, FeatureDb* db,
+        std::string* error);
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_DB_SNAPSHOT_H
@@ -0,0 +1,37 @@
+#include "encoded_features.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace routeguide {
+
+    void EncodedFeatures::Build(const FeatureStore& store) {
+        size_t n = store.size();
+        std::vector<uint64_t> offsets;
+        offsets.reserve(n + 1);
+        offsets.push_back(0);
+        // Besides the name, at most two tags and lengths and two tagged
+        // varints of up to ten bytes, for negative coordinates.
+        std::vector<char> bytes;
+        bytes.reserve(store.name_bytes() + n * 28);
+        Feature feature;
+        std::string scratch;
+        for (size_t i = 0; i < n; i++) {
+            store.CopyTo(i, &feature);
+            scratch.clear();
+            feature.AppendToString(&scratch);
+            bytes.insert(bytes.end(), scratch.begin(), scratch.end());
+            offsets.push_back(bytes.size());
+        }
+        bytes.shrink_to_fit();
+        offsets_.Assign(std::move(offsets));
+        bytes_.Assign(std::move(bytes));
+    }
+
+    void EncodedFeatures::View(const uint64_t* offsets, const char* bytes, size_t size) {
+        offsets_.View(offsets, size + 1);
+        bytes_.View(bytes, static_cast<size_t>(offsets[size]));
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,46 @@
+#ifndef ROUTEGUIDE_CORE_ENCODED_FEATURES_H
+#define ROUTEGUIDE_CORE_ENCODED_FEATURES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "column.h"
+#include "feature_store.h"
+
+namespace routeguide {
+
+    // Every feature of a store serialized as a Feature message, back to back
+    // in one arena, so that responses can send a feature's wire bytes
+    // instead of building and encoding a message each time. The bytes are
+    // exactly what Feature::SerializeToString produces for it.
+    class EncodedFeatures {
+    public:
+        void Build(const FeatureStore& store);
+
+        // Serves the features from arrays built earlier, e.g. ones stored in a
+        // DB snapshot: size + 1 offsets into bytes.
+        void View(const uint64_t* offsets, const char* bytes, size_t size);
+
+        size_t size() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+
+        // The serialized i-th feature.
+        std::string_view Get(size_t i) const {
+            return std::string_view(bytes_.data() + offsets_[i],
+                offsets_[i + 1] - offsets_[i]);
+        }
+
+        size_t MemoryUsage() const { return offsets_.OwnedBytes() + bytes_.OwnedBytes(); }
+
+        const Column<uint64_t>& offsets() const { return offsets_; }
+        const Column<char>& bytes() const { return bytes_; }
+
+    private:
+        // offsets_[i] .. offsets_[i + 1] is the i-th feature in bytes_.
+        Column<uint64_t> offsets_;
+        Column<char> bytes_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_ENCODED_FEATURES_H
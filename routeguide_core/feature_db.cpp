@@ -0,0 +1,60 @@
+#include "feature_db.h"
+
+#include <utility>
+
+#include "db_loader.h"
+#include "db_snapshot.h"
+
+namespace routeguide {
+
+    bool FeatureDb::Load(const std::string& path, std::string* error) {
+        backing_.reset();
+        store_.Clear();
+        std::unique_ptr<MappedFile> file(new MappedFile());
+        if (!file->Open(path, error)) {
+            return false;
+        }
+        if (IsSnapshot(file->data(), file->size())) {
+            return ReadSnapshot(std::move(file), this, error);
+        }
+        file->AdviseSequential();
+        if (!ParseJsonDb(file->data(), file->size(), &store_, error)) {
+            return false;
+        }
+        BuildIndexes();
+        return true;
+    }
+
+    void FeatureDb::Retain(const std::function<bool(int32_t, int32_t)>& keep) {
+        size_t kept = 0;
+        size_t name_bytes = 0;
+        for (size_t i = 0; i < store_.size(); i++) {
+            if (keep(store_.latitude(i), store_.longitude(i))) {
+                kept++;
+                name_bytes += store_.name(i).size();
+            }
+        }
+        if (kept == store_.size()) {
+            return;
+        }
+        FeatureStore retained;
+        retained.Reserve(kept, name_bytes);
+        for (size_t i = 0; i < store_.size(); i++) {
+            if (keep(store_.latitude(i), store_.longitude(i))) {
+                retained.Add(store_.latitude(i), store_.longitude(i), store_.name(i));
+            }
+        }
+        store_ = std::move(retained);
+        BuildIndexes();
+        // Nothing points into the mapping any more.
+        backing_.reset();
+    }
+
+    void FeatureDb::BuildIndexes() {
+        point_index_.Build(store_);
+        grid_index_.Build(store_);
+        sphere_index_.Build(store_);
+        encoded_.Build(store_);
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,80 @@
+#ifndef ROUTEGUIDE_CORE_FEATURE_DB_H
+#define ROUTEGUIDE_CORE_FEATURE_DB_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "encoded_features.h"
+#include "feature_store.h"
+#include "grid_index.h"
+#include "mapped_file.h"
+#include "point_index.h"
+#include "rect_filter.h"
+#include "sphere_index.h"
+
+namespace routeguide {
+
+    // The feature database the server answers from: the column store, the
+    // point, grid and sphere indexes over it and the features' wire bytes.
+    // When loaded from a binary snapshot all of them are views into the
+    // mapped file, which the FeatureDb keeps open.
+    class FeatureDb {
+    public:
+        // Loads path, which holds either a JSON DB or a binary snapshot written
+        // by WriteSnapshot (recognized by its magic bytes). Indexes that the
+        // snapshot does not carry are built.
+        bool Load(const std::string& path, std::string* error);
+
+        // (Re)builds all indexes from the store.
+        void BuildIndexes();
+
+        // Keeps only the features at points where keep is true, in store
+        // order, and rebuilds the indexes. A mapped DB that loses features
+        // is copied to the heap and its mapping closed.
+        void Retain(const std::function<bool(int32_t, int32_t)>& keep);
+
+        // Name of the first feature at point, or an empty view if none.
+        std::string_view FeatureName(int32_t latitude, int32_t longitude) const {
+            uint32_t i = point_index_.Find(latitude, longitude);
+            return i == PointIndex::kNotFound ? std::string_view() : store_.name(i);
+        }
+
+        // Appends the positions of the features inside bounds, in store order.
+        // Returns the number of index entries tested.
+        size_t Query(const Bounds& bounds, std::vector<uint32_t>* positions) const {
+            return grid_index_.Query(bounds, positions);
+        }
+
+        const FeatureStore& store() const { return store_; }
+        const PointIndex& point_index() const { return point_index_; }
+        const GridIndex& grid_index() const { return grid_index_; }
+        const SphereIndex& sphere_index() const { return sphere_index_; }
+        const EncodedFeatures& encoded() const { return encoded_; }
+        bool mapped() const { return backing_ != nullptr; }
+
+        // Used by the snapshot reader to serve everything from a mapping.
+        FeatureStore* mutable_store() { return &store_; }
+        PointIndex* mutable_point_index() { return &point_index_; }
+        GridIndex* mutable_grid_index() { return &grid_index_; }
+        SphereIndex* mutable_sphere_index() { return &sphere_index_; }
+        EncodedFeatures* mutable_encoded() { return &encoded_; }
+        void set_backing(std::unique_ptr<MappedFile> backing) {
+            backing_ = std::move(backing);
+        }
+
+    private:
+        std::unique_ptr<MappedFile> backing_;
+        FeatureStore store_;
+        PointIndex point_index_;
+        GridIndex grid_index_;
+        SphereIndex sphere_index_;
+        EncodedFeatures encoded_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_FEATURE_DB_H
@@ -0,0 +1,58 @@
+#include "feature_store.h"
+
+namespace routeguide {
+
+    void FeatureStore::Clear() {
+        latitudes_.Clear();
+        longitudes_.Clear();
+        name_offsets_.Clear();
+        names_.Clear();
+    }
+
+    void FeatureStore::Reserve(size_t feature_count, size_t name_bytes) {
+        latitudes_.Reserve(feature_count);
+        longitudes_.Reserve(feature_count);
+        name_offsets_.Reserve(feature_count + 1);
+        names_.Reserve(name_bytes);
+    }
+
+    void FeatureStore::ShrinkToFit() {
+        latitudes_.ShrinkToFit();
+        longitudes_.ShrinkToFit();
+        name_offsets_.ShrinkToFit();
+        names_.ShrinkToFit();
+    }
+
+    void FeatureStore::Add(int32_t latitude, int32_t longitude,
+        std::string_view name) {
+        if (name_offsets_.empty()) {
+            name_offsets_.PushBack(0);
+        }
+        latitudes_.PushBack(latitude);
+        longitudes_.PushBack(longitude);
+        names_.Append(name.data(), name.size());
+        name_offsets_.PushBack(names_.size());
+    }
+
+    void FeatureStore::View(size_t feature_count, const int32_t* latitudes,
+        const int32_t* longitudes, const uint64_t* name_offsets,
+        const char* names) {
+        latitudes_.View(latitudes, feature_count);
+        longitudes_.View(longitudes, feature_count);
+        name_offsets_.View(name_offsets, feature_count + 1);
+        names_.View(names, static_cast<size_t>(name_offsets[feature_count]));
+    }
+
+    void FeatureStore::CopyTo(size_t i, Feature* feature) const {
+        std::string_view n = name(i);
+        feature->set_name(n.data(), n.size());
+        feature->mutable_location()->set_latitude(latitudes_[i]);
+        feature->mutable_location()->set_longitude(longitudes_[i]);
+    }
+
+    size_t FeatureStore::MemoryUsage() const {
+        return latitudes_.OwnedBytes() + longitudes_.OwnedBytes() +
+            name_offsets_.OwnedBytes() + names_.OwnedBytes();
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,66 @@
+#ifndef ROUTEGUIDE_CORE_FEATURE_STORE_H
+#define ROUTEGUIDE_CORE_FEATURE_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "column.h"
+#include "route_guide.pb.h"
+
+namespace routeguide {
+
+    // Read-mostly column store for the feature database. Latitudes and
+    // longitudes live in two contiguous int32 arrays and all names share one
+    // string arena addressed by offset, so scans touch only the columns they
+    // need and there is no per-feature heap allocation. Feature messages are
+    // built from it only when a response is written. The columns can also
+    // view a mapped DB snapshot instead of owning their data.
+    class FeatureStore {
+    public:
+        void Clear();
+        void Reserve(size_t feature_count, size_t name_bytes);
+        void ShrinkToFit();
+
+        void Add(int32_t latitude, int32_t longitude, std::string_view name);
+
+        // Serves the store from memory owned elsewhere. name_offsets has
+        // feature_count + 1 entries and its last entry is the arena size.
+        void View(size_t feature_count, const int32_t* latitudes,
+            const int32_t* longitudes, const uint64_t* name_offsets,
+            const char* names);
+
+        size_t size() const { return latitudes_.size(); }
+        bool empty() const { return latitudes_.empty(); }
+
+        const int32_t* latitudes() const { return latitudes_.data(); }
+        const int32_t* longitudes() const { return longitudes_.data(); }
+        const uint64_t* name_offsets() const { return name_offsets_.data(); }
+        const char* names() const { return names_.data(); }
+        size_t name_bytes() const { return names_.size(); }
+        int32_t latitude(size_t i) const { return latitudes_[i]; }
+        int32_t longitude(size_t i) const { return longitudes_[i]; }
+        std::string_view name(size_t i) const {
+            return std::string_view(names_.data() + name_offsets_[i],
+                name_offsets_[i + 1] - name_offsets_[i]);
+        }
+
+        // Fills in a Feature message for the i-th feature.
+        void CopyTo(size_t i, Feature* feature) const;
+
+        // Heap bytes held by the columns and the name arena. Views of a
+        // snapshot do not count.
+        size_t MemoryUsage() const;
+
+    private:
+        Column<int32_t> latitudes_;
+        Column<int32_t> longitudes_;
+        // name_offsets_[i] .. name_offsets_[i + 1] is the i-th name in names_.
+        Column<uint64_t> name_offsets_;
+        Column<char> names_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_FEATURE_STORE_H
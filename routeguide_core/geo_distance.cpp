@@ -0,0 +1,170 @@
+#include "geo_distance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace routeguide {
+
+    namespace {
+        constexpr double kRadiansPerE7 = kPi / 180.0 / kCoordFactor;
+
+        // WGS-84.
+        constexpr double kSemiMajorAxis = 6378137.0;
+        constexpr double kFlattening = 1 / 298.257223563;
+        constexpr double kSemiMinorAxis = kSemiMajorAxis * (1 - kFlattening);
+        constexpr int kVincentyIterations = 200;
+
+        // sin^2(x / 2), the haversine of x.
+        inline double Hav(double x) {
+            double s = std::sin(x * 0.5);
+            return s * s;
+        }
+
+        inline double CentralAngle(double h) {
+            return 2 * std::asin(std::sqrt((std::min)(h, 1.0)));
+        }
+    }
+
+    bool ParseDistanceModel(const std::string& name, DistanceModel* model) {
+        if (name == "haversine") {
+            *model = DistanceModel::kHaversine;
+            return true;
+        }
+        if (name == "vincenty") {
+            *model = DistanceModel::kVincenty;
+            return true;
+        }
+        return false;
+    }
+
+    GeoPoint ToGeoPoint(int32_t latitude, int32_t longitude) {
+        GeoPoint p;
+        p.latitude = latitude * kRadiansPerE7;
+        p.longitude = longitude * kRadiansPerE7;
+        p.cos_latitude = std::cos(p.latitude);
+        return p;
+    }
+
+    double HaversineMetres(const GeoPoint& from, const GeoPoint& to) {
+        double h = Hav(to.latitude - from.latitude) +
+            from.cos_latitude * to.cos_latitude * Hav(to.longitude - from.longitude);
+        return kEarthRadiusMetres * CentralAngle(h);
+    }
+
+    double VincentyMetres(const GeoPoint& from, const GeoPoint& to) {
+        const double f = kFlattening;
+        double l = to.longitude - from.longitude;
+        // Reduced latitudes.
+        double u1 = std::atan((1 - f) * std::tan(from.latitude));
+        double u2 = std::atan((1 - f) * std::tan(to.latitude));
+        double sin_u1 = std::sin(u1), cos_u1 = std::cos(u1);
+        double sin_u2 = std::sin(u2), cos_u2 = std::cos(u2);
+
+        double lambda = l;
+        double sin_sigma = 0, cos_sigma = 0, sigma = 0;
+        double cos_sq_alpha = 0, cos_2sigma_m = 0;
+        for (int i = 0; i < kVincentyIterations; i++) {
+            double sin_lambda = std::sin(lambda), cos_lambda = std::cos(lambda);
+            double a = cos_u2 * sin_lambda;
+            double b = cos_u1 * sin_u2 - sin_u1 * cos_u2 * cos_lambda;
+            sin_sigma = std::sqrt(a * a + b * b);
+            if (sin_sigma == 0) {
+                return 0;  // Coincident points.
+            }
+            cos_sigma = sin_u1 * sin_u2 + cos_u1 * cos_u2 * cos_lambda;
+            sigma = std::atan2(sin_sigma, cos_sigma);
+            double sin_alpha = cos_u1 * cos_u2 * sin_lambda / sin_sigma;
+            cos_sq_alpha = 1 - sin_alpha * sin_alpha;
+            // Both points on the equator: cos_sq_alpha is 0 and so is the term.
+            cos_2sigma_m = cos_sq_alpha != 0 ?
+                cos_sigma - 2 * sin_u1 * sin_u2 / cos_sq_alpha : 0;
+            double c = f / 16 * cos_sq_alpha * (4 + f * (4 - 3 * cos_sq_alpha));
+            double previous = lambda;
+            lambda = l + (1 - c) * f * sin_alpha * (sigma + c * sin_sigma *
+                (cos_2sigma_m + c * cos_sigma * (-1 + 2 * cos_2sigma_m * cos_2sigma_m)));
+            if (std::abs(lambda - previous) < 1e-12) {
+                double u_sq = cos_sq_alpha *
+                    (kSemiMajorAxis * kSemiMajorAxis - kSemiMinorAxis * kSemiMinorAxis) /
+                    (kSemiMinorAxis * kSemiMinorAxis);
+                double big_a = 1 + u_sq / 16384 *
+                    (4096 + u_sq * (-768 + u_sq * (320 - 175 * u_sq)));
+                double big_b = u_sq / 1024 * (256 + u_sq * (-128 + u_sq * (74 - 47 * u_sq)));
+                double delta_sigma = big_b * sin_sigma * (cos_2sigma_m + big_b / 4 *
+                    (cos_sigma * (-1 + 2 * cos_2sigma_m * cos_2sigma_m) -
+                        big_b / 6 * cos_2sigma_m * (-3 + 4 * sin_sigma * sin_sigma) *
+                        (-3 + 4 * cos_2sigma_m * cos_2sigma_m)));
+                return kSemiMinorAxis * big_a * (sigma - delta_sigma);
+            }
+        }
+        // Nearly antipodal points, where the iteration does not converge.
+        return HaversineMetres(from, to);
+    }
+
+    double DistanceMetres(const GeoPoint& from, const GeoPoint& to,
+        DistanceModel model) {
+        return model == DistanceModel::kVincenty ? VincentyMetres(from, to) :
+            HaversineMetres(from, to);
+    }
+
+    void SegmentLengths(const int32_t* latitudes, const int32_t* longitudes,
+        size_t n, DistanceModel model, double* metres) {
+        if (n < 2) {
+            return;
+        }
+        std::vector<double> lat(n), lon(n), cos_lat(n);
+        for (size_t i = 0; i < n; i++) {
+            lat[i] = latitudes[i] * kRadiansPerE7;
+            lon[i] = longitudes[i] * kRadiansPerE7;
+        }
+        for (size_t i = 0; i < n; i++) {
+            cos_lat[i] = std::cos(lat[i]);
+        }
+        if (model == DistanceModel::kVincenty) {
+            // Full points: VincentyMetres falls back to the haversine, which
+            // needs the cosines, where it does not converge.
+            for (size_t i = 0; i + 1 < n; i++) {
+                GeoPoint from = { lat[i], lon[i], cos_lat[i] };
+                GeoPoint to = { lat[i + 1], lon[i + 1], cos_lat[i + 1] };
+                metres[i] = VincentyMetres(from, to);
+            }
+            return;
+        }
+        for (size_t i = 0; i + 1 < n; i++) {
+            double h = Hav(lat[i + 1] - lat[i]) +
+                cos_lat[i] * cos_lat[i + 1] * Hav(lon[i + 1] - lon[i]);
+            metres[i] = kEarthRadiusMetres * CentralAngle(h);
+        }
+    }
+
+    double PathLength(const int32_t* latitudes, const int32_t* longitudes,
+        size_t n, DistanceModel model) {
+        if (n < 2) {
+            return 0;
+        }
+        std::vector<double> metres(n - 1);
+        SegmentLengths(latitudes, longitudes, n, model, metres.data());
+        DistanceSum sum;
+        for (double m : metres) {
+            sum.Add(m);
+        }
+        return sum.value();
+    }
+
+    void DistanceSum::Add(double x) {
+        double t = sum_ + x;
+        if (std::abs(sum_) >= std::abs(x)) {
+            compensation_ += (sum_ - t) + x;
+        }
+        else {
+            compensation_ += (x - t) + sum_;
+        }
+        sum_ = t;
+    }
+
+    void DistanceSum::Add(const DistanceSum& other) {
+        Add(other.sum_);
+        Add(other.compensation_);
+    }
+
+}  // namespace routeguide
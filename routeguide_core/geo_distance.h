@@ -0,0 +1,70 @@
+#ifndef ROUTEGUIDE_CORE_GEO_DISTANCE_H
+#define ROUTEGUIDE_CORE_GEO_DISTANCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace routeguide {
+
+    // Points travel as E7 integers: degrees multiplied by 10^7.
+    constexpr double kCoordFactor = 1e7;
+    constexpr double kPi = 3.14159265358979323846;
+    // Mean Earth radius used by the spherical model, in metres.
+    constexpr double kEarthRadiusMetres = 6371000.0;
+
+    enum class DistanceModel {
+        // Great circle on a sphere of kEarthRadiusMetres. Cheap, and within
+        // about 0.5% of the ellipsoidal distance.
+        kHaversine,
+        // Geodesic on the WGS-84 ellipsoid by Vincenty's inverse formula,
+        // accurate to well under a millimetre. Several times slower.
+        kVincenty,
+    };
+
+    // Parses "haversine" or "vincenty".
+    bool ParseDistanceModel(const std::string& name, DistanceModel* model);
+
+    // A point in radians with its latitude cosine, which the haversine
+    // formula needs for both ends of every segment; computing it once per
+    // point halves the trigonometry along a route.
+    struct GeoPoint {
+        double latitude;
+        double longitude;
+        double cos_latitude;
+    };
+
+    GeoPoint ToGeoPoint(int32_t latitude, int32_t longitude);
+
+    double HaversineMetres(const GeoPoint& from, const GeoPoint& to);
+    double VincentyMetres(const GeoPoint& from, const GeoPoint& to);
+    double DistanceMetres(const GeoPoint& from, const GeoPoint& to,
+        DistanceModel model);
+
+    // Writes the n - 1 segment lengths of the path through the n points into
+    // metres. Points are converted once into flat scratch arrays and each
+    // pass is a plain loop over them, which the compiler can vectorise.
+    void SegmentLengths(const int32_t* latitudes, const int32_t* longitudes,
+        size_t n, DistanceModel model, double* metres);
+
+    // Total length of the path through the n points.
+    double PathLength(const int32_t* latitudes, const int32_t* longitudes,
+        size_t n, DistanceModel model);
+
+    // Neumaier's compensated sum: adding many small segment lengths to a
+    // large total keeps the bits a plain double sum would round away.
+    class DistanceSum {
+    public:
+        void Add(double x);
+        // Adds another sum, compensation included.
+        void Add(const DistanceSum& other);
+        double value() const { return sum_ + compensation_; }
+
+    private:
+        double sum_ = 0.0;
+        double compensation_ = 0.0;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_GEO_DISTANCE_H
@@ -0,0 +1,135 @@
+#include "grid_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace routeguide {
+
+    namespace {
+        // Average number of features per cell the grid is sized for.
+        const size_t kFeaturesPerCell = 4;
+    }
+
+    void GridIndex::Build(const FeatureStore& store) {
+        size_t n = store.size();
+        shape_ = Shape{ 0, -1, 0, -1, 0, 0 };
+        cell_start_.Clear();
+        latitudes_.Clear();
+        longitudes_.Clear();
+        ids_.Clear();
+        if (n == 0) {
+            return;
+        }
+
+        const int32_t* latitudes = store.latitudes();
+        const int32_t* longitudes = store.longitudes();
+        shape_.min_latitude = shape_.max_latitude = latitudes[0];
+        shape_.min_longitude = shape_.max_longitude = longitudes[0];
+        for (size_t i = 1; i < n; i++) {
+            shape_.min_latitude = (std::min)(shape_.min_latitude, latitudes[i]);
+            shape_.max_latitude = (std::max)(shape_.max_latitude, latitudes[i]);
+            shape_.min_longitude = (std::min)(shape_.min_longitude, longitudes[i]);
+            shape_.max_longitude = (std::max)(shape_.max_longitude, longitudes[i]);
+        }
+
+        // Pick the grid shape so that cells are roughly square in degrees.
+        double height =
+            static_cast<double>(shape_.max_latitude) - shape_.min_latitude + 1;
+        double width =
+            static_cast<double>(shape_.max_longitude) - shape_.min_longitude + 1;
+        double cells = static_cast<double>(
+            (std::min)((std::max)(n / kFeaturesPerCell, size_t{ 1 }), kMaxCells));
+        double columns = std::round(std::sqrt(cells * width / height));
+        columns = (std::max)(1.0, (std::min)({ columns, cells, width }));
+        double rows = (std::max)(1.0, (std::min)(std::floor(cells / columns), height));
+        shape_.columns = static_cast<uint32_t>(columns);
+        shape_.rows = static_cast<uint32_t>(rows);
+
+        // Counting sort of the features by cell. It is stable, so entries of a
+        // cell stay in store order.
+        size_t cell_count = static_cast<size_t>(shape_.rows) * shape_.columns;
+        std::vector<uint32_t> cell_of(n);
+        std::vector<uint32_t> cell_start(cell_count + 1, 0);
+        for (size_t i = 0; i < n; i++) {
+            cell_of[i] = RowOf(latitudes[i]) * shape_.columns + ColumnOf(longitudes[i]);
+            cell_start[cell_of[i] + 1]++;
+        }
+        for (size_t c = 0; c < cell_count; c++) {
+            cell_start[c + 1] += cell_start[c];
+        }
+        std::vector<int32_t> cell_latitudes(n);
+        std::vector<int32_t> cell_longitudes(n);
+        std::vector<uint32_t> ids(n);
+        std::vector<uint32_t> next(cell_start.begin(), cell_start.end() - 1);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t slot = next[cell_of[i]]++;
+            cell_latitudes[slot] = latitudes[i];
+            cell_longitudes[slot] = longitudes[i];
+            ids[slot] = static_cast<uint32_t>(i);
+        }
+        cell_start_.Assign(std::move(cell_start));
+        latitudes_.Assign(std::move(cell_latitudes));
+        longitudes_.Assign(std::move(cell_longitudes));
+        ids_.Assign(std::move(ids));
+    }
+
+    void GridIndex::View(const Shape& shape, const uint32_t* cell_start,
+        const int32_t* latitudes, const int32_t* longitudes,
+        const uint32_t* ids, size_t size) {
+        shape_ = shape;
+        cell_start_.View(cell_start,
+            static_cast<size_t>(shape.rows) * shape.columns + 1);
+        latitudes_.View(latitudes, size);
+        longitudes_.View(longitudes, size);
+        ids_.View(ids, size);
+    }
+
+    size_t GridIndex::Query(const Bounds& bounds,
+        std::vector<uint32_t>* positions) const {
+        if (ids_.empty() || bounds.left > shape_.max_longitude ||
+            bounds.right < shape_.min_longitude ||
+            bounds.bottom > shape_.max_latitude ||
+            bounds.top < shape_.min_latitude || bounds.left > bounds.right ||
+            bounds.bottom > bounds.top) {
+            return 0;
+        }
+        uint32_t first_row = RowOf((std::max)(bounds.bottom, shape_.min_latitude));
+        uint32_t last_row = RowOf((std::min)(bounds.top, shape_.max_latitude));
+        uint32_t first_column = ColumnOf((std::max)(bounds.left, shape_.min_longitude));
+        uint32_t last_column = ColumnOf((std::min)(bounds.right, shape_.max_longitude));
+
+        size_t first_match = positions->size();
+        size_t scanned = 0;
+        for (uint32_t row = first_row; row <= last_row; row++) {
+            uint32_t begin = cell_start_[row * shape_.columns + first_column];
+            uint32_t end = cell_start_[row * shape_.columns + last_column + 1];
+            scanned += end - begin;
+            FilterRect(latitudes_.data(), longitudes_.data(), begin, end, bounds,
+                positions);
+        }
+        // FilterRect reports grid entries; map them back to store positions.
+        for (size_t m = first_match; m < positions->size(); m++) {
+            (*positions)[m] = ids_[(*positions)[m]];
+        }
+        // Matches come out grouped by cell; restore store order so the result
+        // is identical to a full scan.
+        std::sort(positions->begin() + first_match, positions->end());
+        return scanned;
+    }
+
+    uint32_t GridIndex::RowOf(int32_t latitude) const {
+        int64_t offset = static_cast<int64_t>(latitude) - shape_.min_latitude;
+        int64_t height =
+            static_cast<int64_t>(shape_.max_latitude) - shape_.min_latitude + 1;
+        return static_cast<uint32_t>(offset * shape_.rows / height);
+    }
+
+    uint32_t GridIndex::ColumnOf(int32_t longitude) const {
+        int64_t offset = static_cast<int64_t>(longitude) - shape_.min_longitude;
+        int64_t width =
+            static_cast<int64_t>(shape_.max_longitude) - shape_.min_longitude + 1;
+        return static_cast<uint32_t>(offset * shape_.columns / width);
+    }
+
+}  // namespace routeguide
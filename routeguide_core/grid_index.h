@@ -0,0 +1,70 @@
+#ifndef ROUTEGUIDE_CORE_GRID_INDEX_H
+#define ROUTEGUIDE_CORE_GRID_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "column.h"
+#include "feature_store.h"
+#include "rect_filter.h"
+
+namespace routeguide {
+
+    // Uniform grid over the bounding box of the feature store, used to answer
+    // ListFeatures rectangle queries without touching every feature. Cells are
+    // laid out row-major and their entries are stored contiguously, so the
+    // cells of one grid row that overlap a query form a single run of entries.
+    // Each run keeps its own copy of the coordinates in two columns, so the
+    // bounds test is one FilterRect call per overlapped row.
+    class GridIndex {
+    public:
+        // Upper bound on the cell count; also keeps the cell arithmetic in
+        // RowOf() and ColumnOf() well inside 64 bits.
+        static constexpr size_t kMaxCells = size_t{ 1 } << 24;
+
+        // Bounding box and dimensions of the grid.
+        struct Shape {
+            int32_t min_latitude;
+            int32_t max_latitude;
+            int32_t min_longitude;
+            int32_t max_longitude;
+            uint32_t rows;
+            uint32_t columns;
+        };
+
+        void Build(const FeatureStore& store);
+
+        // Serves the index from arrays built earlier, e.g. ones stored in a DB
+        // snapshot. cell_start has rows * columns + 1 entries; the other three
+        // arrays have size entries.
+        void View(const Shape& shape, const uint32_t* cell_start,
+            const int32_t* latitudes, const int32_t* longitudes,
+            const uint32_t* ids, size_t size);
+
+        // Appends the positions of all features inside the bounds to
+        // positions, in store order. Returns the number of entries tested.
+        size_t Query(const Bounds& bounds, std::vector<uint32_t>* positions) const;
+
+        size_t size() const { return ids_.size(); }
+        const Shape& shape() const { return shape_; }
+        const Column<uint32_t>& cell_start() const { return cell_start_; }
+        const Column<int32_t>& latitudes() const { return latitudes_; }
+        const Column<int32_t>& longitudes() const { return longitudes_; }
+        const Column<uint32_t>& ids() const { return ids_; }
+
+    private:
+        uint32_t RowOf(int32_t latitude) const;
+        uint32_t ColumnOf(int32_t longitude) const;
+
+        Shape shape_ = { 0, -1, 0, -1, 0, 0 };
+        // cell_start_[c] .. cell_start_[c + 1] are the entries of cell c.
+        Column<uint32_t> cell_start_;
+        Column<int32_t> latitudes_;
+        Column<int32_t> longitudes_;
+        Column<uint32_t> ids_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_GRID_INDEX_H
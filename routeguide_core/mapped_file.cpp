@@ -0,0 +1,123 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace routeguide {
+
+    MappedFile::~MappedFile() { Close(); }
+
+#ifdef _WIN32
+    bool MappedFile::Open(const std::string& path, std::string* error) {
+        Close();
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            *error = "cannot open " + path + " (error " +
+                std::to_string(GetLastError()) + ")";
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            *error = "cannot stat " + path;
+            CloseHandle(file);
+            return false;
+        }
+        file_ = file;
+        size_ = static_cast<size_t>(size.QuadPart);
+        if (size_ == 0) {
+            // Zero-length files cannot be mapped; treat them as empty.
+            return true;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0,
+            nullptr);
+        if (mapping == nullptr) {
+            *error = "cannot map " + path;
+            Close();
+            return false;
+        }
+        mapping_ = mapping;
+        data_ = static_cast<const char*>(
+            MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (data_ == nullptr) {
+            *error = "cannot map " + path;
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data_ != nullptr) {
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_ != nullptr) {
+            CloseHandle(mapping_);
+        }
+        if (file_ != nullptr) {
+            CloseHandle(file_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+        mapping_ = nullptr;
+        file_ = nullptr;
+    }
+
+    void MappedFile::AdviseSequential() const {
+        // The default read-ahead on Windows already suits a linear scan.
+    }
+#else
+    bool MappedFile::Open(const std::string& path, std::string* error) {
+        Close();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            *error = "cannot open " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            *error = "cannot stat " + path + ": " + std::strerror(errno);
+            close(fd);
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                *error = "cannot map " + path + ": " + std::strerror(errno);
+                size_ = 0;
+                close(fd);
+                return false;
+            }
+            data_ = static_cast<const char*>(data);
+        }
+        // The mapping stays valid after the descriptor is closed.
+        close(fd);
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    void MappedFile::AdviseSequential() const {
+        if (data_ != nullptr) {
+            madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+        }
+    }
+#endif
+
+}  // namespace routeguide
@@ -0,0 +1,39 @@
+#ifndef ROUTEGUIDE_CORE_MAPPED_FILE_H
+#define ROUTEGUIDE_CORE_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+namespace routeguide {
+
+    // Read-only memory mapping of a whole file. The mapping is shared with the
+    // page cache, so nothing is copied until a page is touched.
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // Maps path. On failure returns false and describes why in error.
+        bool Open(const std::string& path, std::string* error);
+        void Close();
+
+        // Hints that the mapping is about to be read front to back once.
+        void AdviseSequential() const;
+
+        const char* data() const { return data_; }
+        size_t size() const { return size_; }
+
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+#ifdef _WIN32
+        void* file_ = nullptr;
+        void* mapping_ = nullptr;
+#endif
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_MAPPED_FILE_H
@@ -0,0 +1,55 @@
+#include "point_index.h"
+
+#include <utility>
+#include <vector>
+
+namespace routeguide {
+
+    void PointIndex::Build(const FeatureStore& store) {
+        // Keep the table at most half full so probe sequences stay short.
+        size_t capacity = 16;
+        while (capacity < store.size() * 2) {
+            capacity <<= 1;
+        }
+        std::vector<Slot> slots(capacity, Slot{ 0, kNotFound, 0 });
+        mask_ = capacity - 1;
+        size_ = 0;
+
+        for (size_t i = 0; i < store.size(); i++) {
+            uint64_t key = PackPointKey(store.latitude(i), store.longitude(i));
+            size_t slot = MixPointKey(key) & mask_;
+            while (slots[slot].value != kNotFound && slots[slot].key != key) {
+                slot = (slot + 1) & mask_;
+            }
+            // Later duplicates of a point are ignored: the first feature wins.
+            if (slots[slot].value == kNotFound) {
+                slots[slot].key = key;
+                slots[slot].value = static_cast<uint32_t>(i);
+                size_++;
+            }
+        }
+        slots_.Assign(std::move(slots));
+    }
+
+    void PointIndex::View(const Slot* slots, size_t capacity, size_t size) {
+        slots_.View(slots, capacity);
+        mask_ = capacity - 1;
+        size_ = size;
+    }
+
+    uint32_t PointIndex::Find(int32_t latitude, int32_t longitude) const {
+        if (slots_.empty()) {
+            return kNotFound;
+        }
+        uint64_t key = PackPointKey(latitude, longitude);
+        size_t slot = MixPointKey(key) & mask_;
+        while (slots_[slot].value != kNotFound) {
+            if (slots_[slot].key == key) {
+                return slots_[slot].value;
+            }
+            slot = (slot + 1) & mask_;
+        }
+        return kNotFound;
+    }
+
+}  // namespace routeguide
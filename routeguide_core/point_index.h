@@ -0,0 +1,48 @@
+#ifndef ROUTEGUIDE_CORE_POINT_INDEX_H
+#define ROUTEGUIDE_CORE_POINT_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include "column.h"
+#include "feature_store.h"
+#include "point_key.h"
+
+namespace routeguide {
+
+    // Exact-match index from a (latitude, longitude) pair to the position of a
+    // feature in the feature store. Coordinates are packed into one 64-bit key
+    // and stored in an open-addressing table with linear probing, so a lookup
+    // is a hash plus a short probe over a flat array. When several features
+    // share a point the first one in the store wins, like the old linear scan.
+    class PointIndex {
+    public:
+        static constexpr uint32_t kNotFound = UINT32_MAX;
+
+        struct Slot {
+            uint64_t key;
+            uint32_t value;  // kNotFound marks an empty slot.
+            uint32_t padding;
+        };
+
+        void Build(const FeatureStore& store);
+
+        // Serves the index from a table built earlier, e.g. one stored in a DB
+        // snapshot. capacity must be a power of two.
+        void View(const Slot* slots, size_t capacity, size_t size);
+
+        // Returns the position of the first feature at the given point, or
+        // kNotFound.
+        uint32_t Find(int32_t latitude, int32_t longitude) const;
+
+        size_t size() const { return size_; }
+        const Column<Slot>& slots() const { return slots_; }
+
+    private:
+        Column<Slot> slots_;
+        uint64_t mask_ = 0;
+        size_t size_ = 0;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_POINT_INDEX_H
@@ -0,0 +1,26 @@
+#ifndef ROUTEGUIDE_CORE_POINT_KEY_H
+#define ROUTEGUIDE_CORE_POINT_KEY_H
+
+#include <cstdint>
+
+namespace routeguide {
+
+    // Packs a (latitude, longitude) pair into one 64-bit key.
+    inline uint64_t PackPointKey(int32_t latitude, int32_t longitude) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(latitude)) << 32) |
+            static_cast<uint32_t>(longitude);
+    }
+
+    // splitmix64 finalizer; neighbouring points get unrelated hashes.
+    inline uint64_t MixPointKey(uint64_t key) {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return key;
+    }
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_POINT_KEY_H
@@ -0,0 +1,214 @@
+#include "rect_filter.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ROUTEGUIDE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC emits SSE2 and AVX2 intrinsics without any per-function opt-in.
+#define ROUTEGUIDE_TARGET_SSE2
+#define ROUTEGUIDE_TARGET_AVX2
+#else
+#define ROUTEGUIDE_TARGET_SSE2 __attribute__((target("sse2")))
+#define ROUTEGUIDE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace routeguide {
+
+    namespace {
+        typedef uint32_t* (*FilterKernel)(const int32_t*, const int32_t*, uint32_t,
+            uint32_t, const Bounds&, uint32_t*);
+
+        inline bool Inside(int32_t latitude, int32_t longitude,
+            const Bounds& bounds) {
+            return longitude >= bounds.left && longitude <= bounds.right &&
+                latitude >= bounds.bottom && latitude <= bounds.top;
+        }
+
+        // Each kernel writes matching positions starting at out and returns the
+        // end of what it wrote. out must have room for end - begin positions.
+        uint32_t* FilterScalar(const int32_t* latitudes, const int32_t* longitudes,
+            uint32_t begin, uint32_t end, const Bounds& bounds, uint32_t* out) {
+            for (uint32_t i = begin; i < end; i++) {
+                // Branch-free append; the store is harmless when it misses.
+                *out = i;
+                out += Inside(latitudes[i], longitudes[i], bounds) ? 1 : 0;
+            }
+            return out;
+        }
+
+#ifdef ROUTEGUIDE_X86
+        inline int CountTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return static_cast<int>(index);
+#else
+            return __builtin_ctz(mask);
+#endif
+        }
+
+        inline uint32_t* AppendMask(uint32_t mask, uint32_t base, uint32_t* out) {
+            while (mask != 0) {
+                *out++ = base + CountTrailingZeros(mask);
+                mask &= mask - 1;
+            }
+            return out;
+        }
+
+        // A lane is outside the rectangle if any of the four strict comparisons
+        // holds; the inclusive test is the complement of that.
+        ROUTEGUIDE_TARGET_SSE2
+        uint32_t* FilterSse2(const int32_t* latitudes, const int32_t* longitudes,
+            uint32_t begin, uint32_t end, const Bounds& bounds, uint32_t* out) {
+            const __m128i left = _mm_set1_epi32(bounds.left);
+            const __m128i right = _mm_set1_epi32(bounds.right);
+            const __m128i bottom = _mm_set1_epi32(bounds.bottom);
+            const __m128i top = _mm_set1_epi32(bounds.top);
+            uint32_t i = begin;
+            for (; i + 4 <= end; i += 4) {
+                __m128i lat = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(latitudes + i));
+                __m128i lon = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(longitudes + i));
+                __m128i outside = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpgt_epi32(left, lon), _mm_cmpgt_epi32(lon, right)),
+                    _mm_or_si128(_mm_cmpgt_epi32(bottom, lat), _mm_cmpgt_epi32(lat, top)));
+                uint32_t mask =
+                    ~static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(outside))) & 0xf;
+                out = AppendMask(mask, i, out);
+            }
+            return FilterScalar(latitudes, longitudes, i, end, bounds, out);
+        }
+
+        ROUTEGUIDE_TARGET_AVX2
+        uint32_t* FilterAvx2(const int32_t* latitudes, const int32_t* longitudes,
+            uint32_t begin, uint32_t end, const Bounds& bounds, uint32_t* out) {
+            const __m256i left = _mm256_set1_epi32(bounds.left);
+            const __m256i right = _mm256_set1_epi32(bounds.right);
+            const __m256i bottom = _mm256_set1_epi32(bounds.bottom);
+            const __m256i top = _mm256_set1_epi32(bounds.top);
+            uint32_t i = begin;
+            for (; i + 8 <= end; i += 8) {
+                __m256i lat = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(latitudes + i));
+                __m256i lon = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(longitudes + i));
+                __m256i outside = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpgt_epi32(left, lon),
+                        _mm256_cmpgt_epi32(lon, right)),
+                    _mm256_or_si256(_mm256_cmpgt_epi32(bottom, lat),
+                        _mm256_cmpgt_epi32(lat, top)));
+                uint32_t mask = ~static_cast<uint32_t>(
+                    _mm256_movemask_ps(_mm256_castsi256_ps(outside))) & 0xff;
+                out = AppendMask(mask, i, out);
+            }
+            return FilterScalar(latitudes, longitudes, i, end, bounds, out);
+        }
+
+        bool CpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+            int regs[4];
+            __cpuid(regs, 0);
+            if (regs[0] < 7) {
+                return false;
+            }
+            __cpuid(regs, 1);
+            // The OS must have enabled XSAVE and be saving the YMM registers.
+            const int kOsxsave = 1 << 27;
+            if ((regs[2] & kOsxsave) == 0 || (_xgetbv(0) & 0x6) != 0x6) {
+                return false;
+            }
+            __cpuidex(regs, 7, 0);
+            return (regs[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+
+        bool CpuHasSse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+            return true;  // Part of the x86-64 baseline.
+#elif defined(_MSC_VER) && !defined(__clang__)
+            int regs[4];
+            __cpuid(regs, 1);
+            return (regs[3] & (1 << 26)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+#endif
+        }
+#endif  // ROUTEGUIDE_X86
+
+        struct KernelChoice {
+            FilterKernel kernel;
+            const char* name;
+        };
+
+        const KernelChoice& ChosenKernel() {
+            static const KernelChoice choice = []() {
+#ifdef ROUTEGUIDE_X86
+                if (CpuHasAvx2()) {
+                    return KernelChoice{ FilterAvx2, "avx2" };
+                }
+                if (CpuHasSse2()) {
+                    return KernelChoice{ FilterSse2, "sse2" };
+                }
+                return KernelChoice{ FilterScalar, "scalar" };
+#else
+                return KernelChoice{ FilterScalar, "scalar" };
+#endif
+            }();
+            return choice;
+        }
+
+        void RunKernel(FilterKernel kernel, const int32_t* latitudes,
+            const int32_t* longitudes, uint32_t begin, uint32_t end,
+            const Bounds& bounds, std::vector<uint32_t>* matches) {
+            if (begin >= end) {
+                return;
+            }
+            size_t old_size = matches->size();
+            matches->resize(old_size + (end - begin));
+            uint32_t* first = matches->data() + old_size;
+            uint32_t* last = kernel(latitudes, longitudes, begin, end, bounds, first);
+            matches->resize(old_size + (last - first));
+        }
+    }
+
+    void FilterRect(const int32_t* latitudes, const int32_t* longitudes,
+        uint32_t begin, uint32_t end, const Bounds& bounds,
+        std::vector<uint32_t>* matches) {
+        RunKernel(ChosenKernel().kernel, latitudes, longitudes, begin, end, bounds,
+            matches);
+    }
+
+    const char* RectFilterKernelName() { return ChosenKernel().name; }
+
+    bool FilterRectWith(const char* kernel, const int32_t* latitudes,
+        const int32_t* longitudes, uint32_t begin, uint32_t end,
+        const Bounds& bounds, std::vector<uint32_t>* matches) {
+        FilterKernel chosen = nullptr;
+        if (std::strcmp(kernel, "scalar") == 0) {
+            chosen = FilterScalar;
+        }
+#ifdef ROUTEGUIDE_X86
+        else if (std::strcmp(kernel, "sse2") == 0 && CpuHasSse2()) {
+            chosen = FilterSse2;
+        }
+        else if (std::strcmp(kernel, "avx2") == 0 && CpuHasAvx2()) {
+            chosen = FilterAvx2;
+        }
+#endif
+        if (chosen == nullptr) {
+            return false;
+        }
+        RunKernel(chosen, latitudes, longitudes, begin, end, bounds, matches);
+        return true;
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,37 @@
+#ifndef ROUTEGUIDE_CORE_RECT_FILTER_H
+#define ROUTEGUIDE_CORE_RECT_FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace routeguide {
+
+    // Inclusive latitude/longitude bounds of a rectangle query.
+    struct Bounds {
+        int32_t left;
+        int32_t right;
+        int32_t bottom;
+        int32_t top;
+    };
+
+    // Appends to matches every position i in [begin, end) for which
+    // (latitudes[i], longitudes[i]) lies inside bounds, in increasing order.
+    // The kernel is picked once at startup from what the CPU supports: AVX2
+    // (8 points per step), SSE2 (4 points per step) or plain scalar code.
+    void FilterRect(const int32_t* latitudes, const int32_t* longitudes,
+        uint32_t begin, uint32_t end, const Bounds& bounds,
+        std::vector<uint32_t>* matches);
+
+    // Name of the kernel FilterRect dispatches to: "avx2", "sse2" or "scalar".
+    const char* RectFilterKernelName();
+
+    // FilterRect with the kernel of the given name, to compare kernels.
+    // Returns false and appends nothing if the CPU cannot run it.
+    bool FilterRectWith(const char* kernel, const int32_t* latitudes,
+        const int32_t* longitudes, uint32_t begin, uint32_t end,
+        const Bounds& bounds, std::vector<uint32_t>* matches);
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_RECT_FILTER_H
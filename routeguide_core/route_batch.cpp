@@ -0,0 +1,65 @@
+#include "route_batch.h"
+
+namespace routeguide {
+
+    namespace {
+        // Differences and sums modulo 2^32, so that any step fits a sint32
+        // and decoding gives back the exact coordinate.
+        int32_t WrappingDelta(int32_t to, int32_t from) {
+            return static_cast<int32_t>(static_cast<uint32_t>(to) -
+                static_cast<uint32_t>(from));
+        }
+
+        int32_t WrappingSum(int32_t from, int32_t delta) {
+            return static_cast<int32_t>(static_cast<uint32_t>(from) +
+                static_cast<uint32_t>(delta));
+        }
+    }
+
+    void RouteBatchEncoder::Add(int32_t latitude, int32_t longitude,
+        RouteBatch* batch) {
+        batch->add_latitude_deltas(WrappingDelta(latitude, last_latitude_));
+        batch->add_longitude_deltas(WrappingDelta(longitude, last_longitude_));
+        last_latitude_ = latitude;
+        last_longitude_ = longitude;
+    }
+
+    void RouteBatchEncoder::Add(int32_t latitude, int32_t longitude,
+        int64_t time_millis, RouteBatch* batch) {
+        Add(latitude, longitude, batch);
+        batch->add_time_deltas_millis(time_millis - last_time_millis_);
+        last_time_millis_ = time_millis;
+    }
+
+    bool RouteBatchDecoder::Check(const RouteBatch& batch, std::string* error) {
+        int n = batch.latitude_deltas_size();
+        if (batch.longitude_deltas_size() != n) {
+            *error = "RouteBatch has " + std::to_string(n) + " latitude deltas but " +
+                std::to_string(batch.longitude_deltas_size()) + " longitude deltas";
+            return false;
+        }
+        if (batch.time_deltas_millis_size() != 0 && batch.time_deltas_millis_size() != n) {
+            *error = "RouteBatch has " + std::to_string(batch.time_deltas_millis_size()) +
+                " time deltas for " + std::to_string(n) + " points";
+            return false;
+        }
+        return true;
+    }
+
+    void RouteBatchDecoder::Decode(const RouteBatch& batch, int begin, int end,
+        int32_t* latitudes, int32_t* longitudes) {
+        const int32_t* latitude_deltas = batch.latitude_deltas().data();
+        const int32_t* longitude_deltas = batch.longitude_deltas().data();
+        int32_t latitude = last_latitude_;
+        int32_t longitude = last_longitude_;
+        for (int i = begin; i < end; i++) {
+            latitude = WrappingSum(latitude, latitude_deltas[i]);
+            longitude = WrappingSum(longitude, longitude_deltas[i]);
+            *latitudes++ = latitude;
+            *longitudes++ = longitude;
+        }
+        last_latitude_ = latitude;
+        last_longitude_ = longitude;
+    }
+
+}  // namespace routeguide
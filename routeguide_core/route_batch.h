@@ -0,0 +1,48 @@
+#ifndef ROUTEGUIDE_CORE_ROUTE_BATCH_H
+#define ROUTEGUIDE_CORE_ROUTE_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "route_guide.pb.h"
+
+namespace routeguide {
+
+    // Appends the points of a route to RouteBatches as deltas (see
+    // RouteBatch in route_guide.proto). One encoder covers the whole route:
+    // it remembers the last point across batches.
+    class RouteBatchEncoder {
+    public:
+        void Add(int32_t latitude, int32_t longitude, RouteBatch* batch);
+        // The same with the point's time; a route sends times for every
+        // point or for none.
+        void Add(int32_t latitude, int32_t longitude, int64_t time_millis,
+            RouteBatch* batch);
+
+    private:
+        int32_t last_latitude_ = 0;
+        int32_t last_longitude_ = 0;
+        int64_t last_time_millis_ = 0;
+    };
+
+    // Turns the RouteBatches of one route back into coordinates, in order.
+    class RouteBatchDecoder {
+    public:
+        // Whether batch is well formed; if not, error says why.
+        static bool Check(const RouteBatch& batch, std::string* error);
+
+        // Decodes the points [begin, end) of a checked batch into latitudes
+        // and longitudes. Every point of every batch must be decoded, in
+        // route order, since each is relative to the one before.
+        void Decode(const RouteBatch& batch, int begin, int end, int32_t* latitudes,
+            int32_t* longitudes);
+
+    private:
+        int32_t last_latitude_ = 0;
+        int32_t last_longitude_ = 0;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_ROUTE_BATCH_H
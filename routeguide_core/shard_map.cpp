@@ -0,0 +1,61 @@
+#include "shard_map.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "geo_distance.h"
+#include "point_key.h"
+
+namespace routeguide {
+
+    ShardMap::ShardMap(size_t shard_count, double tile_degrees)
+        : shard_count_((std::max)(shard_count, size_t{ 1 })),
+        tile_e7_((std::max)(std::llround(tile_degrees * kCoordFactor), 1LL)) {}
+
+    int64_t ShardMap::Tile(int32_t coordinate) const {
+        // Rounds down, so the tiles either side of 0 do not merge.
+        int64_t tile = coordinate / tile_e7_;
+        if (coordinate < 0 && tile * tile_e7_ != coordinate) {
+            tile--;
+        }
+        return tile;
+    }
+
+    size_t ShardMap::ShardOfTile(int64_t latitude_tile, int64_t longitude_tile) const {
+        uint64_t key = PackPointKey(static_cast<int32_t>(latitude_tile),
+            static_cast<int32_t>(longitude_tile));
+        return static_cast<size_t>(MixPointKey(key) % shard_count_);
+    }
+
+    size_t ShardMap::ShardOf(int32_t latitude, int32_t longitude) const {
+        return ShardOfTile(Tile(latitude), Tile(longitude));
+    }
+
+    void ShardMap::ShardsIn(int32_t latitude1, int32_t longitude1, int32_t latitude2,
+        int32_t longitude2, std::vector<bool>* shards) const {
+        int64_t bottom = Tile((std::min)(latitude1, latitude2));
+        int64_t top = Tile((std::max)(latitude1, latitude2));
+        int64_t left = Tile((std::min)(longitude1, longitude2));
+        int64_t right = Tile((std::max)(longitude1, longitude2));
+        int64_t rows = top - bottom + 1;
+        int64_t columns = right - left + 1;
+        if (shard_count_ == 1 || rows > kMaxTilesPerQuery ||
+            columns > kMaxTilesPerQuery || rows * columns > kMaxTilesPerQuery) {
+            shards->assign(shard_count_, true);
+            return;
+        }
+        shards->assign(shard_count_, false);
+        for (int64_t latitude = bottom; latitude <= top; latitude++) {
+            for (int64_t longitude = left; longitude <= right; longitude++) {
+                (*shards)[ShardOfTile(latitude, longitude)] = true;
+            }
+        }
+    }
+
+    void RetainShard(const ShardMap& map, size_t shard, FeatureDb* db) {
+        db->Retain([&map, shard](int32_t latitude, int32_t longitude) {
+            return map.ShardOf(latitude, longitude) == shard;
+        });
+    }
+
+}  // namespace routeguide
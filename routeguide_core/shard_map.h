@@ -0,0 +1,51 @@
+#ifndef ROUTEGUIDE_CORE_SHARD_MAP_H
+#define ROUTEGUIDE_CORE_SHARD_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "feature_db.h"
+
+namespace routeguide {
+
+    // Splits the feature DB of a sharded deployment into square tiles of a
+    // fixed size and gives each tile to one shard by its hash, so that a
+    // dense region is spread over all shards while a small rectangle still
+    // meets few of them. The router and every backend must use the same
+    // shard count and tile size.
+    class ShardMap {
+    public:
+        // More tiles than this in a rectangle and ShardsIn() stops counting
+        // them: every shard is asked.
+        static const int64_t kMaxTilesPerQuery = 4096;
+
+        ShardMap(size_t shard_count, double tile_degrees);
+
+        size_t shard_count() const { return shard_count_; }
+
+        // The shard owning the tile of a point.
+        size_t ShardOf(int32_t latitude, int32_t longitude) const;
+
+        // Sets, in shards (resized to shard_count()), the shards owning a
+        // tile that meets the rectangle with these corners, which may come
+        // in either order.
+        void ShardsIn(int32_t latitude1, int32_t longitude1, int32_t latitude2,
+            int32_t longitude2, std::vector<bool>* shards) const;
+
+    private:
+        int64_t Tile(int32_t coordinate) const;
+        size_t ShardOfTile(int64_t latitude_tile, int64_t longitude_tile) const;
+
+        size_t shard_count_;
+        // Tile side in E7 units.
+        int64_t tile_e7_;
+    };
+
+    // Drops from db the features that shard does not own, keeping the
+    // others in store order.
+    void RetainShard(const ShardMap& map, size_t shard, FeatureDb* db);
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_SHARD_MAP_H
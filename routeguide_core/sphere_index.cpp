@@ -0,0 +1,212 @@
+#include "sphere_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "geo_distance.h"
+
+namespace routeguide {
+
+    namespace {
+        void UnitVector(int32_t latitude, int32_t longitude, double* out) {
+            GeoPoint p = ToGeoPoint(latitude, longitude);
+            out[0] = p.cos_latitude * std::cos(p.longitude);
+            out[1] = p.cos_latitude * std::sin(p.longitude);
+            out[2] = std::sin(p.latitude);
+        }
+
+        // Great-circle metres for a squared chord on the unit sphere; the same
+        // angle the haversine formula computes.
+        double ChordToMetres(double chord_squared) {
+            double half_chord = std::sqrt(chord_squared) / 2;
+            return 2 * kEarthRadiusMetres * std::asin((std::min)(half_chord, 1.0));
+        }
+
+        double MetresToChordSquared(double metres) {
+            double angle = (std::min)(metres / kEarthRadiusMetres, kPi);
+            double chord = 2 * std::sin(angle / 2);
+            return chord * chord;
+        }
+    }
+
+    // One search. Candidates are (squared chord, store position) pairs; a
+    // nearest search keeps them as a max-heap of the best k, so that the
+    // bound is always the k-th best so far.
+    struct SphereIndex::Query {
+        double point[3];
+        // 0 for a radius search.
+        size_t k = 0;
+        // Squared chord beyond which nothing is of interest.
+        double bound = std::numeric_limits<double>::infinity();
+        std::vector<std::pair<double, uint32_t>> found;
+
+        void Consider(double chord_squared, uint32_t position) {
+            if (chord_squared > bound) {
+                return;
+            }
+            std::pair<double, uint32_t> candidate(chord_squared, position);
+            if (k == 0) {
+                found.push_back(candidate);
+                return;
+            }
+            if (found.size() == k) {
+                if (!(candidate < found.front())) {
+                    return;
+                }
+                std::pop_heap(found.begin(), found.end());
+                found.back() = candidate;
+            }
+            else {
+                found.push_back(candidate);
+            }
+            std::push_heap(found.begin(), found.end());
+            if (found.size() == k) {
+                bound = found.front().first;
+            }
+        }
+    };
+
+    void SphereIndex::Build(const FeatureStore& store) {
+        size_t n = store.size();
+        // Partitioning whole entries keeps every pass over a range sequential.
+        std::vector<Entry> entries(n);
+        for (size_t i = 0; i < n; i++) {
+            UnitVector(store.latitude(i), store.longitude(i), entries[i].point);
+            entries[i].position = static_cast<uint32_t>(i);
+        }
+        std::vector<uint8_t> axes(n, 0);
+        BuildRange(&entries, 0, n, &axes);
+
+        std::vector<double> coords(3 * n);
+        std::vector<uint32_t> ids(n);
+        for (size_t i = 0; i < n; i++) {
+            std::copy(entries[i].point, entries[i].point + 3, &coords[3 * i]);
+            ids[i] = entries[i].position;
+        }
+        coords_.Assign(std::move(coords));
+        ids_.Assign(std::move(ids));
+        axes_.Assign(std::move(axes));
+    }
+
+    void SphereIndex::View(const double* coords, const uint32_t* ids,
+        const uint8_t* axes, size_t size) {
+        coords_.View(coords, 3 * size);
+        ids_.View(ids, size);
+        axes_.View(axes, size);
+    }
+
+    void SphereIndex::BuildRange(std::vector<Entry>* entries, size_t begin,
+        size_t end, std::vector<uint8_t>* axes) {
+        while (end - begin > kLeafSize) {
+            // Split along the axis the range spreads most on.
+            double low[3] = { 2, 2, 2 };
+            double high[3] = { -2, -2, -2 };
+            for (size_t i = begin; i < end; i++) {
+                const double* p = (*entries)[i].point;
+                for (int a = 0; a < 3; a++) {
+                    low[a] = (std::min)(low[a], p[a]);
+                    high[a] = (std::max)(high[a], p[a]);
+                }
+            }
+            int axis = 0;
+            for (int a = 1; a < 3; a++) {
+                if (high[a] - low[a] > high[axis] - low[axis]) {
+                    axis = a;
+                }
+            }
+            size_t mid = begin + (end - begin) / 2;
+            std::nth_element(entries->begin() + begin, entries->begin() + mid,
+                entries->begin() + end, [axis](const Entry& a, const Entry& b) {
+                    return a.point[axis] < b.point[axis];
+                });
+            (*axes)[mid] = static_cast<uint8_t>(axis);
+            BuildRange(entries, begin, mid, axes);
+            begin = mid + 1;
+        }
+    }
+
+    void SphereIndex::Search(Query* query, size_t begin, size_t end) const {
+        while (end - begin > kLeafSize) {
+            size_t mid = begin + (end - begin) / 2;
+            const double* p = &coords_[3 * mid];
+            double dx = query->point[0] - p[0];
+            double dy = query->point[1] - p[1];
+            double dz = query->point[2] - p[2];
+            query->Consider(dx * dx + dy * dy + dz * dz, ids_[mid]);
+            double diff = query->point[axes_[mid]] - p[axes_[mid]];
+            // Descend into the near side first; the far side is only worth a
+            // visit if the splitting plane is within the bound.
+            size_t near_begin = diff < 0 ? begin : mid + 1;
+            size_t near_end = diff < 0 ? mid : end;
+            Search(query, near_begin, near_end);
+            if (diff * diff > query->bound) {
+                return;
+            }
+            begin = diff < 0 ? mid + 1 : begin;
+            end = diff < 0 ? end : mid;
+        }
+        for (size_t i = begin; i < end; i++) {
+            const double* p = &coords_[3 * i];
+            double dx = query->point[0] - p[0];
+            double dy = query->point[1] - p[1];
+            double dz = query->point[2] - p[2];
+            query->Consider(dx * dx + dy * dy + dz * dz, ids_[i]);
+        }
+    }
+
+    void SphereIndex::Nearest(int32_t latitude, int32_t longitude, size_t k,
+        std::vector<Neighbor>* neighbors) const {
+        neighbors->clear();
+        if (k == 0 || ids_.empty()) {
+            return;
+        }
+        Query query;
+        UnitVector(latitude, longitude, query.point);
+        query.k = (std::min)(k, ids_.size());
+        query.found.reserve(query.k);
+        Search(&query, 0, ids_.size());
+        std::sort_heap(query.found.begin(), query.found.end());
+        for (const auto& f : query.found) {
+            neighbors->push_back({ f.second, ChordToMetres(f.first) });
+        }
+    }
+
+    size_t SphereIndex::WithinRadius(int32_t latitude, int32_t longitude,
+        double metres, size_t limit, std::vector<Neighbor>* neighbors) const {
+        neighbors->clear();
+        if (!(metres >= 0) || ids_.empty()) {
+            return 0;
+        }
+        Query query;
+        UnitVector(latitude, longitude, query.point);
+        // The bound is widened by a hair so rounding cannot lose a point on
+        // the circle; the exact test is on metres below.
+        query.bound = MetresToChordSquared(metres) * (1 + 1e-12) + 1e-30;
+        Search(&query, 0, ids_.size());
+        auto outside = std::remove_if(query.found.begin(), query.found.end(),
+            [metres](const std::pair<double, uint32_t>& f) {
+                return ChordToMetres(f.first) > metres;
+            });
+        query.found.erase(outside, query.found.end());
+        size_t total = query.found.size();
+        if (total > limit) {
+            std::partial_sort(query.found.begin(), query.found.begin() + limit,
+                query.found.end());
+            query.found.resize(limit);
+        }
+        else {
+            std::sort(query.found.begin(), query.found.end());
+        }
+        for (const auto& f : query.found) {
+            neighbors->push_back({ f.second, ChordToMetres(f.first) });
+        }
+        return total;
+    }
+
+    size_t SphereIndex::MemoryUsage() const {
+        return coords_.OwnedBytes() + ids_.OwnedBytes() + axes_.OwnedBytes();
+    }
+
+}  // namespace routeguide
@@ -0,0 +1,79 @@
+#ifndef ROUTEGUIDE_CORE_SPHERE_INDEX_H
+#define ROUTEGUIDE_CORE_SPHERE_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "column.h"
+#include "feature_store.h"
+
+namespace routeguide {
+
+    // KD-tree over the features as points on the unit sphere, for nearest
+    // neighbour and radius queries. The straight-line (chord) distance
+    // between two points on the sphere grows with the great-circle distance,
+    // so the tree searches by chord with plain axis-aligned pruning. Results
+    // report the great-circle distance on the sphere RecordRoute's haversine
+    // model uses, converted from the chord.
+    //
+    // The tree is implicit: the points are permuted so that every subtree is
+    // a contiguous range with its splitting point in the middle, and the
+    // split axis of each range is stored at its middle. Ranges of at most
+    // kLeafSize points are scanned linearly.
+    class SphereIndex {
+    public:
+        struct Neighbor {
+            uint32_t position;  // In the feature store.
+            double metres;
+        };
+
+        void Build(const FeatureStore& store);
+
+        // Serves the index from arrays built earlier, e.g. ones stored in a DB
+        // snapshot: 3 * size coordinates, and size ids and axes.
+        void View(const double* coords, const uint32_t* ids, const uint8_t* axes,
+            size_t size);
+
+        // The k features nearest to the point, nearest first. Ties go to the
+        // lower store position.
+        void Nearest(int32_t latitude, int32_t longitude, size_t k,
+            std::vector<Neighbor>* neighbors) const;
+
+        // The features within metres of the point, nearest first, keeping at
+        // most limit. Returns how many there are in all.
+        size_t WithinRadius(int32_t latitude, int32_t longitude, double metres,
+            size_t limit, std::vector<Neighbor>* neighbors) const;
+
+        size_t size() const { return ids_.size(); }
+        size_t MemoryUsage() const;
+
+        const Column<double>& coords() const { return coords_; }
+        const Column<uint32_t>& ids() const { return ids_; }
+        const Column<uint8_t>& axes() const { return axes_; }
+
+    private:
+        static const size_t kLeafSize = 8;
+
+        struct Query;
+
+        struct Entry {
+            double point[3];
+            uint32_t position;
+        };
+
+        static void BuildRange(std::vector<Entry>* entries, size_t begin, size_t end,
+            std::vector<uint8_t>* axes);
+        void Search(Query* query, size_t begin, size_t end) const;
+
+        // Unit vectors of the features, in tree order, x y z interleaved.
+        Column<double> coords_;
+        // Store position of each point, in tree order.
+        Column<uint32_t> ids_;
+        // Split axis of the range whose middle is at i; unused in leaves.
+        Column<uint8_t> axes_;
+    };
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_CORE_SPHERE_INDEX_H
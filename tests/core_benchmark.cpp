@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include "db_loader.h"
+#include "db_snapshot.h"
+#include "feature_db.h"
+#include "geo_distance.h"
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        // One DB per size, shared by the benchmarks that use it.
+        const FeatureDb& SyntheticDb(size_t count) {
+            static std::vector<std::pair<size_t, std::unique_ptr<FeatureDb>>> dbs;
+            for (const auto& db : dbs) {
+                if (db.first == count) {
+                    return *db.second;
+                }
+            }
+            std::unique_ptr<FeatureDb> db(new FeatureDb());
+            FillSyntheticStore(count, 42, db->mutable_store());
+            db->BuildIndexes();
+            dbs.emplace_back(count, std::move(db));
+            return *dbs.back().second;
+        }
+
+        void BM_ParseJsonDb(benchmark::State& state) {
+            FeatureStore source;
+            FillSyntheticStore(state.range(0), 42, &source);
+            std::string json = SyntheticJson(source);
+            FeatureStore store;
+            std::string error;
+            for (auto _ : state) {
+                if (!ParseJsonDb(json.data(), json.size(), &store, &error)) {
+                    state.SkipWithError(error.c_str());
+                    break;
+                }
+            }
+            state.SetBytesProcessed(state.iterations() * json.size());
+            state.SetItemsProcessed(state.iterations() * state.range(0));
+        }
+        BENCHMARK(BM_ParseJsonDb)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+        // Loading a DB of range(0) features from disk, indexes included: the
+        // JSON file is parsed, the snapshot is mapped and validated.
+        void LoadDb(benchmark::State& state, bool snapshot) {
+            std::string path = (std::filesystem::temp_directory_path() /
+                ("routeguide_benchmark_" + std::to_string(state.range(0)) +
+                    (snapshot ? ".rgdb" : ".json"))).string();
+            std::string error;
+            if (snapshot) {
+                if (!WriteSnapshot(SyntheticDb(state.range(0)), path, &error)) {
+                    state.SkipWithError(error.c_str());
+                    return;
+                }
+            }
+            else {
+                std::ofstream(path, std::ios::binary)
+                    << SyntheticJson(SyntheticDb(state.range(0)).store());
+            }
+            for (auto _ : state) {
+                FeatureDb db;
+                if (!db.Load(path, &error)) {
+                    state.SkipWithError(error.c_str());
+                    break;
+                }
+            }
+            std::filesystem::remove(path);
+            state.SetItemsProcessed(state.iterations() * state.range(0));
+        }
+        BENCHMARK_CAPTURE(LoadDb, json, false)->Arg(1000000)->Unit(benchmark::kMillisecond);
+        BENCHMARK_CAPTURE(LoadDb, snapshot, true)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+        void BM_BuildIndexes(benchmark::State& state) {
+            FeatureDb db;
+            FillSyntheticStore(state.range(0), 42, db.mutable_store());
+            for (auto _ : state) {
+                db.BuildIndexes();
+            }
+            state.SetItemsProcessed(state.iterations() * state.range(0));
+        }
+        BENCHMARK(BM_BuildIndexes)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+        void BM_SphereIndexBuild(benchmark::State& state) {
+            const FeatureDb& db = SyntheticDb(state.range(0));
+            SphereIndex index;
+            for (auto _ : state) {
+                index.Build(db.store());
+            }
+            state.SetItemsProcessed(state.iterations() * state.range(0));
+        }
+        BENCHMARK(BM_SphereIndexBuild)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+        // Query points near features, as the nearby RPCs receive them.
+        std::vector<std::pair<int32_t, int32_t>> NearbyPoints(const FeatureStore& store) {
+            std::mt19937 rng(17);
+            std::uniform_int_distribution<int32_t> jitter(-1000000, 1000000);
+            std::vector<std::pair<int32_t, int32_t>> points(1024);
+            for (auto& point : points) {
+                size_t i = rng() % store.size();
+                point.first = (std::max)(-900000000,
+                    (std::min)(900000000, store.latitude(i) + jitter(rng)));
+                point.second = (std::max)(-1800000000,
+                    (std::min)(1800000000, store.longitude(i) + jitter(rng)));
+            }
+            return points;
+        }
+
+        // The range(1) nearest features of a DB of range(0).
+        void BM_NearestFeatures(benchmark::State& state) {
+            const FeatureDb& db = SyntheticDb(state.range(0));
+            auto points = NearbyPoints(db.store());
+            std::vector<SphereIndex::Neighbor> neighbors;
+            size_t next = 0;
+            for (auto _ : state) {
+                const auto& point = points[next++ & (points.size() - 1)];
+                neighbors.clear();
+                db.sphere_index().Nearest(point.first, point.second, state.range(1),
+                    &neighbors);
+            }
+            state.SetItemsProcessed(state.iterations());
+        }
+        BENCHMARK(BM_NearestFeatures)
+            ->Args({ 1000000, 1 })
+            ->Args({ 1000000, 10 })
+            ->Args({ 1000000, 100 });
+
+        // The features within range(1) metres in a DB of range(0).
+        void BM_FeaturesWithinRadius(benchmark::State& state) {
+            const FeatureDb& db = SyntheticDb(state.range(0));
+            auto points = NearbyPoints(db.store());
+            std::vector<SphereIndex::Neighbor> neighbors;
+            size_t next = 0;
+            size_t matches = 0;
+            for (auto _ : state) {
+                const auto& point = points[next++ & (points.size() - 1)];
+                neighbors.clear();
+                matches += db.sphere_index().WithinRadius(point.first, point.second,
+                    static_cast<double>(state.range(1)), 100000, &neighbors);
+            }
+            state.SetItemsProcessed(state.iterations());
+            state.counters["matches"] = benchmark::Counter(
+                static_cast<double>(matches) / state.iterations());
+        }
+        BENCHMARK(BM_FeaturesWithinRadius)
+            ->Args({ 1000000, 10000 })
+            ->Args({ 1000000, 100000 })
+            ->Args({ 1000000, 1000000 });
+
+        // Half the lookups hit a feature, half miss, in random order.
+        void BM_PointLookup(benchmark::State& state) {
+            const FeatureDb& db = SyntheticDb(state.range(0));
+            const FeatureStore& store = db.store();
+            std::mt19937 rng(7);
+            std::vector<std::pair<int32_t, int32_t>> points(4096);
+            for (auto& point : points) {
+                size_t i = rng() % store.size();
+                point.first = store.latitude(i) + static_cast<int32_t>(rng() % 2);
+                point.second = store.longitude(i);
+            }
+            size_t next = 0;
+            for (auto _ : state) {
+                const auto& point = points[next++ & (points.size() - 1)];
+                benchmark::DoNotOptimize(db.FeatureName(point.first, point.second));
+            }
+            state.SetItemsProcessed(state.iterations());
+        }
+        BENCHMARK(BM_PointLookup)->Arg(1000)->Arg(1000000);
+
+        // The point index itself, against the linear scan it replaced.
+        void PointIndexFind(benchmark::State& state, bool scan) {
+            const FeatureDb& db = SyntheticDb(state.range(0));
+            const FeatureStore& store = db.store();
+            const PointIndex& index = db.point_index();
+            std::mt19937 rng(13);
+            std::vector<std::pair<int32_t, int32_t>> points(4096);
+            for (auto& point : points) {
+                size_t i = rng() % store.size();
+                point.first = store.latitude(i);
+                point.second = store.longitude(i);
+            }
+            size_t next = 0;
+            for (auto _ : state) {
+                const auto& point = points[next++ & (points.size() - 1)];
+                uint32_t found = PointIndex::kNotFound;
+                if (scan) {
+                    for (uint32_t i = 0; i < store.size(); i++) {
+                        if (store.latitude(i) == point.first &&
+                            store.longitude(i) == point.second) {
+                            found = i;
+                            break;
+                        }
+                    }
+                }
+                else {
+                    found = index.Find(point.first, point.second);
+                }
+                benchmark::DoNotOptimize(found);
+            }
+            state.SetItemsProcessed(state.iterations());
+        }
+        BENCHMARK_CAPTURE(PointIndexFind, index, false)->Arg(1000)->Arg(1000000);
+        BENCHMARK_CAPTURE(PointIndexFind, scan, true)->Arg(1000)->Arg(1000000);
+
+        // Rectangles of range(1) E7 units a side at random places.
+        void BM_RectangleQuery(benchmark::State& state) {
+            const FeatureDb& db = SyntheticDb(state.range(0));
+            int32_t side = static_cast<int32_t>(state.range(1));
+            std::mt19937 rng(9);
+            std::uniform_int_distribution<int32_t> latitude(-900000000, 900000000 - side);
+            std::uniform_int_distribution<int32_t> longitude(-1800000000, 1800000000 - side);
+            std::vector<Bounds> rectangles(256);
+            for (Bounds& bounds : rectangles) {
+                bounds.bottom = latitude(rng);
+                bounds.top = bounds.bottom + side;
+                bounds.left = longitude(rng);
+                bounds.right = bounds.left + side;
+            }
+            std::vector<uint32_t> positions;
+            size_t next = 0;
+            size_t matches = 0;
+            for (auto _ : state) {
+                positions.clear();
+                db.Query(rectangles[next++ & (rectangles.size() - 1)], &positions);
+                matches += positions.size();
+            }
+            state.SetItemsProcessed(state.iterations());
+            state.counters["matches"] = benchmark::Counter(
+                static_cast<double>(matches) / state.iterations());
+        }
+        BENCHMARK(BM_RectangleQuery)
+            ->Args({ 1000000, 10000000 })
+            ->Args({ 1000000, 100000000 })
+            ->Args({ 1000000, 1000000000 });
+
+        // A random walk of range(0) points, as RecordRoute receives them.
+        void BM_PathLength(benchmark::State& state) {
+            DistanceModel model = static_cast<DistanceModel>(state.range(1));
+            std::mt19937 rng(11);
+            std::uniform_int_distribution<int32_t> step(-100000, 100000);
+            std::vector<int32_t> latitudes(state.range(0)), longitudes(state.range(0));
+            int32_t latitude = 407838351, longitude = -746143763;
+            for (size_t i = 0; i < latitudes.size(); i++) {
+                latitude += step(rng);
+                longitude += step(rng);
+                latitudes[i] = latitude;
+                longitudes[i] = longitude;
+            }
+            for (auto _ : state) {
+                benchmark::DoNotOptimize(PathLength(latitudes.data(), longitudes.data(),
+                    latitudes.size(), model));
+            }
+            state.SetItemsProcessed(state.iterations() * (latitudes.size() - 1));
+        }
+        BENCHMARK(BM_PathLength)
+            ->Args({ 1000, static_cast<int>(DistanceModel::kHaversine) })
+            ->Args({ 1000, static_cast<int>(DistanceModel::kVincenty) });
+
+    }  // namespace
+}  // namespace routeguide
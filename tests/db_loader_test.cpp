@@ -0,0 +1,97 @@
+#include "db_loader.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        bool Parse(const std::string& json, FeatureStore* store, std::string* error) {
+            return ParseJsonDb(json.data(), json.size(), store, error);
+        }
+
+        TEST(DbLoaderTest, ParsesFeatures) {
+            FeatureStore store;
+            std::string error;
+            ASSERT_TRUE(Parse(
+                "[{\"location\": {\"latitude\": 407838351, \"longitude\": -746143763},"
+                " \"name\": \"Patriots Path, Mendham, NJ 07945, USA\"},"
+                " {\"location\": {\"latitude\": 1, \"longitude\": 2}, \"name\": \"\"}]",
+                &store, &error)) << error;
+            ASSERT_EQ(store.size(), 2u);
+            EXPECT_EQ(store.latitude(0), 407838351);
+            EXPECT_EQ(store.longitude(0), -746143763);
+            EXPECT_EQ(store.name(0), "Patriots Path, Mendham, NJ 07945, USA");
+            EXPECT_EQ(store.latitude(1), 1);
+            EXPECT_EQ(store.longitude(1), 2);
+            EXPECT_EQ(store.name(1), "");
+        }
+
+        TEST(DbLoaderTest, AcceptsAnyKeyOrderAndSkipsUnknownKeys) {
+            FeatureStore store;
+            std::string error;
+            ASSERT_TRUE(Parse(
+                "[{\"name\": \"a\", \"extra\": [1, {\"x\": null}, true],"
+                " \"location\": {\"longitude\": -5, \"altitude\": 3.5, \"latitude\": 7}}]",
+                &store, &error)) << error;
+            ASSERT_EQ(store.size(), 1u);
+            EXPECT_EQ(store.latitude(0), 7);
+            EXPECT_EQ(store.longitude(0), -5);
+            EXPECT_EQ(store.name(0), "a");
+        }
+
+        TEST(DbLoaderTest, DecodesEscapes) {
+            FeatureStore store;
+            std::string error;
+            ASSERT_TRUE(Parse(
+                "[{\"location\": {\"latitude\": 0, \"longitude\": 0},"
+                " \"name\": \"q\\\"b\\\\s\\/n\\nu\\u00e9\"}]",
+                &store, &error)) << error;
+            ASSERT_EQ(store.size(), 1u);
+            EXPECT_EQ(store.name(0), "q\"b\\s/n\nu\xc3\xa9");
+        }
+
+        TEST(DbLoaderTest, ParsesEmptyDb) {
+            FeatureStore store;
+            std::string error;
+            ASSERT_TRUE(Parse(" [ ] ", &store, &error)) << error;
+            EXPECT_TRUE(store.empty());
+        }
+
+        TEST(DbLoaderTest, RejectsMalformedInputWithOffset) {
+            const char* cases[] = {
+                "",
+                "{}",
+                "[{\"location\": {\"latitude\": 1, \"longitude\": 2}, \"name\": \"a\"}",
+                "[{\"location\": {\"latitude\": x, \"longitude\": 2}}]",
+                "[{\"name\": \"unterminated}]",
+                "[] trailing",
+            };
+            for (const char* json : cases) {
+                FeatureStore store;
+                std::string error;
+                EXPECT_FALSE(Parse(json, &store, &error)) << json;
+                EXPECT_EQ(error.rfind("offset ", 0), 0u) << error;
+                EXPECT_TRUE(store.empty()) << json;
+            }
+        }
+
+        TEST(DbLoaderTest, RoundTripsSyntheticDb) {
+            FeatureStore expected;
+            FillSyntheticStore(1000, 1, &expected);
+            std::string json = SyntheticJson(expected);
+            FeatureStore store;
+            std::string error;
+            ASSERT_TRUE(Parse(json, &store, &error)) << error;
+            ASSERT_EQ(store.size(), expected.size());
+            for (size_t i = 0; i < store.size(); i++) {
+                EXPECT_EQ(store.latitude(i), expected.latitude(i));
+                EXPECT_EQ(store.longitude(i), expected.longitude(i));
+                EXPECT_EQ(store.name(i), expected.name(i));
+            }
+        }
+
+    }  // namespace
+}  // namespace routeguide
@@ -0,0 +1,215 @@
+#include "db_snapshot.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        // Byte offsets of the header fields the tests corrupt; see Header in
+        // db_snapshot.cpp.
+        const size_t kNameOffsetsSection = 72;
+        const size_t kPointIndexSize = 104;
+        const size_t kPointSlotsSection = 112;
+        const size_t kGridShape = 128;
+        const size_t kGridCellStartSection = 152;
+        const size_t kGridIdsSection = 200;
+        const size_t kVersion = 8;
+        const size_t kEncodedOffsetsSection = 216;
+        const size_t kSphereAxesSection = 280;
+
+        class DbSnapshotTest : public ::testing::Test {
+        protected:
+            void SetUp() override {
+                path_ = (std::filesystem::temp_directory_path() /
+                    ("routeguide_snapshot_test_" + std::to_string(::testing::UnitTest::
+                        GetInstance()->random_seed()) + ".rgdb")).string();
+                FillSyntheticStore(3000, 4, source_.mutable_store());
+                source_.BuildIndexes();
+                std::string error;
+                ASSERT_TRUE(WriteSnapshot(source_, path_, &error)) << error;
+                std::ifstream in(path_, std::ios::binary);
+                bytes_.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+            }
+
+            void TearDown() override { std::filesystem::remove(path_); }
+
+            template <typename T>
+            T Get(size_t at) const {
+                T value;
+                std::memcpy(&value, bytes_.data() + at, sizeof(T));
+                return value;
+            }
+
+            template <typename T>
+            void Put(size_t at, T value) {
+                std::memcpy(&bytes_[at], &value, sizeof(T));
+            }
+
+            // Offset of element i of the section described at header.
+            size_t Element(size_t header, size_t i, size_t size) const {
+                return static_cast<size_t>(Get<uint64_t>(header)) + i * size;
+            }
+
+            // Writes the (modified) bytes back and loads them.
+            bool Load(FeatureDb* db, std::string* error) {
+                {
+                    std::ofstream out(path_, std::ios::binary | std::ios::trunc);
+                    out.write(bytes_.data(), static_cast<std::streamsize>(bytes_.size()));
+                }
+                return db->Load(path_, error);
+            }
+
+            void ExpectRejected(const std::string& message) {
+                FeatureDb db;
+                std::string error;
+                EXPECT_FALSE(Load(&db, &error));
+                EXPECT_EQ(error, message);
+            }
+
+            std::string path_;
+            FeatureDb source_;
+            std::string bytes_;
+        };
+
+        TEST_F(DbSnapshotTest, RoundTrips) {
+            FeatureDb db;
+            std::string error;
+            ASSERT_TRUE(Load(&db, &error)) << error;
+            EXPECT_TRUE(db.mapped());
+            const FeatureStore& store = db.store();
+            const FeatureStore& expected = source_.store();
+            ASSERT_EQ(store.size(), expected.size());
+            for (size_t i = 0; i < store.size(); i++) {
+                EXPECT_EQ(store.latitude(i), expected.latitude(i));
+                EXPECT_EQ(store.longitude(i), expected.longitude(i));
+                EXPECT_EQ(store.name(i), expected.name(i));
+                EXPECT_EQ(db.FeatureName(store.latitude(i), store.longitude(i)),
+                    source_.FeatureName(store.latitude(i), store.longitude(i)));
+            }
+            Bounds bounds = { -400000000, 400000000, -300000000, 300000000 };
+            std::vector<uint32_t> positions, expected_positions;
+            db.Query(bounds, &positions);
+            source_.Query(bounds, &expected_positions);
+            EXPECT_EQ(positions, expected_positions);
+        }
+
+        TEST_F(DbSnapshotTest, MapsWireBytesAndSphereIndex) {
+            FeatureDb db;
+            std::string error;
+            ASSERT_TRUE(Load(&db, &error)) << error;
+            // Served from the mapping, not rebuilt on the heap.
+            EXPECT_EQ(db.encoded().MemoryUsage(), 0u);
+            EXPECT_EQ(db.sphere_index().MemoryUsage(), 0u);
+            ASSERT_EQ(db.encoded().size(), source_.encoded().size());
+            for (size_t i = 0; i < db.encoded().size(); i++) {
+                EXPECT_EQ(db.encoded().Get(i), source_.encoded().Get(i));
+            }
+            std::vector<SphereIndex::Neighbor> found, expected;
+            db.sphere_index().Nearest(377000000, -1220000000, 25, &found);
+            source_.sphere_index().Nearest(377000000, -1220000000, 25, &expected);
+            ASSERT_EQ(found.size(), expected.size());
+            for (size_t i = 0; i < found.size(); i++) {
+                EXPECT_EQ(found[i].position, expected[i].position);
+                EXPECT_EQ(found[i].metres, expected[i].metres);
+            }
+        }
+
+        TEST_F(DbSnapshotTest, ReadsVersion1) {
+            // A version 1 header ends before the new sections, so the bytes
+            // after it are only padding; what it lacks is built.
+            Put<uint32_t>(kVersion, 1);
+            FeatureDb db;
+            std::string error;
+            ASSERT_TRUE(Load(&db, &error)) << error;
+            EXPECT_GT(db.encoded().MemoryUsage(), 0u);
+            ASSERT_EQ(db.encoded().size(), source_.encoded().size());
+            for (size_t i = 0; i < db.encoded().size(); i++) {
+                EXPECT_EQ(db.encoded().Get(i), source_.encoded().Get(i));
+            }
+            EXPECT_EQ(db.sphere_index().size(), source_.sphere_index().size());
+        }
+
+        TEST_F(DbSnapshotTest, RejectsTruncatedFile) {
+            bytes_.resize(bytes_.size() - 1);
+            ExpectRejected("truncated snapshot");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsDescendingNameOffsets) {
+            Put<uint64_t>(Element(kNameOffsetsSection, 10, 8), UINT64_MAX / 2);
+            ExpectRejected("corrupt snapshot: name offsets do not match the name arena");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsPointIndexEntryOutOfRange) {
+            size_t capacity = source_.point_index().slots().size();
+            for (size_t i = 0; i < capacity; i++) {
+                size_t value = Element(kPointSlotsSection, i, 16) + 8;
+                if (Get<uint32_t>(value) != PointIndex::kNotFound) {
+                    Put<uint32_t>(value, 3000);
+                    break;
+                }
+            }
+            ExpectRejected("corrupt snapshot: point index entry out of range");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsFullPointIndex) {
+            size_t capacity = source_.point_index().slots().size();
+            for (size_t i = 0; i < capacity; i++) {
+                size_t value = Element(kPointSlotsSection, i, 16) + 8;
+                if (Get<uint32_t>(value) == PointIndex::kNotFound) {
+                    Put<uint32_t>(value, 0);
+                }
+            }
+            Put<uint64_t>(kPointIndexSize, capacity);
+            ExpectRejected("corrupt snapshot: bad point index size");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsInvertedGridShape) {
+            Put<int32_t>(kGridShape + 4, Get<int32_t>(kGridShape) - 1);
+            ExpectRejected("corrupt snapshot: bad grid shape");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsMoreRowsThanLatitudes) {
+            // Swap rows and columns of a grid a single latitude high.
+            Put<int32_t>(kGridShape + 4, Get<int32_t>(kGridShape));
+            uint32_t rows = Get<uint32_t>(kGridShape + 16);
+            uint32_t columns = Get<uint32_t>(kGridShape + 20);
+            ASSERT_GT(rows, 1u);
+            Put<uint32_t>(kGridShape + 16, columns);
+            Put<uint32_t>(kGridShape + 20, rows);
+            ExpectRejected("corrupt snapshot: bad grid shape");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsDescendingCellStarts) {
+            Put<uint32_t>(Element(kGridCellStartSection, 1, 4), 2999);
+            ExpectRejected("corrupt snapshot: grid cells do not cover the features");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsGridEntryOutOfRange) {
+            Put<uint32_t>(Element(kGridIdsSection, 17, 4), 3000);
+            ExpectRejected("corrupt snapshot: grid entry out of range");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsDescendingEncodedOffsets) {
+            Put<uint64_t>(Element(kEncodedOffsetsSection, 10, 8), UINT64_MAX / 2);
+            ExpectRejected(
+                "corrupt snapshot: encoded offsets do not match the encoded features");
+        }
+
+        TEST_F(DbSnapshotTest, RejectsSphereAxisOutOfRange) {
+            Put<uint8_t>(Element(kSphereAxesSection, 1500, 1), 3);
+            ExpectRejected("corrupt snapshot: sphere index entry out of range");
+        }
+
+    }  // namespace
+}  // namespace routeguide
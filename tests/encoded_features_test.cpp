@@ -0,0 +1,66 @@
+#include "encoded_features.h"
+
+#include <cstdint>
+#include <string>
+
+#include <gtest/gtest.h>
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        // The bytes the server sends must be exactly those of the message it
+        // used to build.
+        void ExpectSerializedFeatures(const FeatureStore& store,
+            const EncodedFeatures& encoded) {
+            ASSERT_EQ(encoded.size(), store.size());
+            Feature feature;
+            for (size_t i = 0; i < store.size(); i++) {
+                store.CopyTo(i, &feature);
+                EXPECT_EQ(encoded.Get(i), feature.SerializeAsString()) << "feature " << i;
+            }
+        }
+
+        TEST(EncodedFeaturesTest, EmptyStore) {
+            FeatureStore store;
+            EncodedFeatures encoded;
+            encoded.Build(store);
+            EXPECT_EQ(encoded.size(), 0u);
+        }
+
+        TEST(EncodedFeaturesTest, EdgeValuesMatchSerializeAsString) {
+            FeatureStore store;
+            store.Add(0, 0, "");
+            store.Add(0, 0, "zero point");
+            store.Add(-1, 1, "minus one");
+            store.Add(-900000000, -1800000000, "south west");
+            store.Add(900000000, 1800000000, "north east");
+            store.Add(INT32_MIN, INT32_MAX, "int32 limits");
+            store.Add(1, 0, std::string(300, 'x'));
+            store.Add(0, -1, "caf\xc3\xa9 \xe6\x9d\xb1\xe4\xba\xac");
+            EncodedFeatures encoded;
+            encoded.Build(store);
+            ExpectSerializedFeatures(store, encoded);
+        }
+
+        TEST(EncodedFeaturesTest, SyntheticStoreMatchesSerializeAsString) {
+            FeatureStore store;
+            FillSyntheticStore(20000, 5, &store);
+            EncodedFeatures encoded;
+            encoded.Build(store);
+            ExpectSerializedFeatures(store, encoded);
+        }
+
+        TEST(EncodedFeaturesTest, ViewServesTheSameBytes) {
+            FeatureStore store;
+            FillSyntheticStore(1000, 6, &store);
+            EncodedFeatures built;
+            built.Build(store);
+            EncodedFeatures view;
+            view.View(built.offsets().data(), built.bytes().data(), built.size());
+            EXPECT_EQ(view.MemoryUsage(), 0u);
+            ExpectSerializedFeatures(store, view);
+        }
+
+    }  // namespace
+}  // namespace routeguide
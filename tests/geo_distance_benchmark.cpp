@@ -0,0 +1,135 @@
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include "geo_distance.h"
+
+namespace routeguide {
+    namespace {
+
+        // A random walk of count points around New Jersey, as RecordRoute
+        // receives them; range(0) sets count.
+        struct Route {
+            explicit Route(size_t count) : latitudes(count), longitudes(count) {
+                std::mt19937 rng(17);
+                std::uniform_int_distribution<int32_t> step(-100000, 100000);
+                int32_t latitude = 407838351, longitude = -746143763;
+                for (size_t i = 0; i < count; i++) {
+                    latitude += step(rng);
+                    longitude += step(rng);
+                    latitudes[i] = latitude;
+                    longitudes[i] = longitude;
+                }
+            }
+            std::vector<int32_t> latitudes;
+            std::vector<int32_t> longitudes;
+        };
+
+        // The server's original GetDistance: single precision, pow() and a
+        // truncated pi, summed into a float.
+        float LegacyDistance(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2) {
+            auto radians = [](float degrees) { return degrees * 3.1415926f / 180; };
+            float lat_1 = lat1 / 10000000.0f, lat_2 = lat2 / 10000000.0f;
+            float lon_1 = lon1 / 10000000.0f, lon_2 = lon2 / 10000000.0f;
+            float a = std::pow(std::sin(radians(lat_2 - lat_1) / 2), 2.0f) +
+                std::cos(radians(lat_1)) * std::cos(radians(lat_2)) *
+                std::pow(std::sin(radians(lon_2 - lon_1) / 2), 2.0f);
+            float c = 2 * std::atan2(std::sqrt(a), std::sqrt(1 - a));
+            return 6371000 * c;
+        }
+
+        void BM_LegacyFloatDistance(benchmark::State& state) {
+            Route route(state.range(0));
+            for (auto _ : state) {
+                float total = 0;
+                for (size_t i = 0; i + 1 < route.latitudes.size(); i++) {
+                    total += LegacyDistance(route.latitudes[i], route.longitudes[i],
+                        route.latitudes[i + 1], route.longitudes[i + 1]);
+                }
+                benchmark::DoNotOptimize(total);
+            }
+            state.SetItemsProcessed(state.iterations() * (route.latitudes.size() - 1));
+        }
+        BENCHMARK(BM_LegacyFloatDistance)->Arg(1000)->Arg(100000);
+
+        // One DistanceMetres call per segment, converting every point twice.
+        void PairwiseDistance(benchmark::State& state, DistanceModel model) {
+            Route route(state.range(0));
+            for (auto _ : state) {
+                DistanceSum total;
+                for (size_t i = 0; i + 1 < route.latitudes.size(); i++) {
+                    total.Add(DistanceMetres(
+                        ToGeoPoint(route.latitudes[i], route.longitudes[i]),
+                        ToGeoPoint(route.latitudes[i + 1], route.longitudes[i + 1]), model));
+                }
+                benchmark::DoNotOptimize(total.value());
+            }
+            state.SetItemsProcessed(state.iterations() * (route.latitudes.size() - 1));
+        }
+        BENCHMARK_CAPTURE(PairwiseDistance, haversine, DistanceModel::kHaversine)
+            ->Arg(1000)->Arg(100000);
+        BENCHMARK_CAPTURE(PairwiseDistance, vincenty, DistanceModel::kVincenty)
+            ->Arg(1000)->Arg(100000);
+
+        // The batch API, as RecordRoute uses it.
+        void BatchSegmentLengths(benchmark::State& state, DistanceModel model) {
+            Route route(state.range(0));
+            std::vector<double> metres(route.latitudes.size() - 1);
+            for (auto _ : state) {
+                SegmentLengths(route.latitudes.data(), route.longitudes.data(),
+                    route.latitudes.size(), model, metres.data());
+                benchmark::DoNotOptimize(metres.data());
+            }
+            state.SetItemsProcessed(state.iterations() * metres.size());
+        }
+        BENCHMARK_CAPTURE(BatchSegmentLengths, haversine, DistanceModel::kHaversine)
+            ->Arg(1000)->Arg(100000);
+        BENCHMARK_CAPTURE(BatchSegmentLengths, vincenty, DistanceModel::kVincenty)
+            ->Arg(1000)->Arg(100000);
+
+        // The spherical route length in long double throughout, as the
+        // reference for the error counters below.
+        long double ReferenceLength(const Route& route) {
+            const long double pi = 3.141592653589793238462643383279502884L;
+            const long double per_e7 = pi / 180 / 1e7L;
+            long double total = 0;
+            for (size_t i = 0; i + 1 < route.latitudes.size(); i++) {
+                long double lat1 = route.latitudes[i] * per_e7;
+                long double lat2 = route.latitudes[i + 1] * per_e7;
+                long double dlat = lat2 - lat1;
+                long double dlon = (route.longitudes[i + 1] - route.longitudes[i]) * per_e7;
+                long double h = std::sin(dlat / 2) * std::sin(dlat / 2) +
+                    std::cos(lat1) * std::cos(lat2) * std::sin(dlon / 2) * std::sin(dlon / 2);
+                total += 2 * kEarthRadiusMetres * std::asin(std::sqrt(h));
+            }
+            return total;
+        }
+
+        // How far the original float path and PathLength drift from the
+        // reference on long routes, reported as counters in metres.
+        void BM_RouteLengthError(benchmark::State& state) {
+            Route route(state.range(0));
+            size_t n = route.latitudes.size();
+            long double reference = ReferenceLength(route);
+            float legacy = 0;
+            for (size_t i = 0; i + 1 < n; i++) {
+                legacy += LegacyDistance(route.latitudes[i], route.longitudes[i],
+                    route.latitudes[i + 1], route.longitudes[i + 1]);
+            }
+            double haversine = 0;
+            for (auto _ : state) {
+                haversine = PathLength(route.latitudes.data(), route.longitudes.data(), n,
+                    DistanceModel::kHaversine);
+                benchmark::DoNotOptimize(haversine);
+            }
+            state.counters["legacy_error_m"] =
+                static_cast<double>(std::abs(legacy - reference));
+            state.counters["haversine_error_m"] =
+                static_cast<double>(std::abs(haversine - reference));
+        }
+        BENCHMARK(BM_RouteLengthError)->Arg(100000)->Arg(1000000)->Iterations(1);
+
+    }  // namespace
+}  // namespace routeguide
@@ -0,0 +1,131 @@
+#include "geo_distance.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace routeguide {
+    namespace {
+
+        TEST(GeoDistanceTest, CoincidentPointsAreZeroApart) {
+            GeoPoint p = ToGeoPoint(407838351, -746143763);
+            EXPECT_EQ(HaversineMetres(p, p), 0.0);
+            EXPECT_EQ(VincentyMetres(p, p), 0.0);
+        }
+
+        TEST(GeoDistanceTest, OneDegreeOfLongitudeOnTheEquator) {
+            GeoPoint from = ToGeoPoint(0, 0);
+            GeoPoint to = ToGeoPoint(0, 10000000);
+            EXPECT_NEAR(HaversineMetres(from, to), kEarthRadiusMetres * kPi / 180, 1e-6);
+            // a * pi / 180 on the WGS-84 ellipsoid.
+            EXPECT_NEAR(VincentyMetres(from, to), 111319.4908, 1e-3);
+        }
+
+        // Degrees, minutes and seconds to E7.
+        int32_t E7(double degrees, double minutes = 0, double seconds = 0) {
+            double value = std::abs(degrees) + minutes / 60 + seconds / 3600;
+            return static_cast<int32_t>(std::lround((degrees < 0 ? -value : value) * 1e7));
+        }
+
+        double Vincenty(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2) {
+            int32_t latitudes[] = { lat1, lat2 };
+            int32_t longitudes[] = { lon1, lon2 };
+            double batch = 0;
+            SegmentLengths(latitudes, longitudes, 2, DistanceModel::kVincenty, &batch);
+            double single = VincentyMetres(ToGeoPoint(lat1, lon1), ToGeoPoint(lat2, lon2));
+            EXPECT_EQ(batch, single);
+            return single;
+        }
+
+        // Reference geodesics on WGS-84. E7 rounding moves each end by up to
+        // 5.6 mm, hence the centimetre tolerances.
+        TEST(GeoDistanceTest, VincentyMatchesReferenceGeodesics) {
+            // Flinders Peak to Buninyong, the worked example of Vincenty's
+            // 1975 paper: 54972.271 m.
+            EXPECT_NEAR(Vincenty(E7(-37, 57, 3.72030), E7(144, 25, 29.52440),
+                E7(-37, 39, 10.15610), E7(143, 55, 35.38390)), 54972.271, 0.02);
+            // Quarter of the equator, a * pi / 2.
+            EXPECT_NEAR(Vincenty(0, 0, 0, E7(90)), 10018754.171, 0.001);
+            // Quarter meridian, equator to pole.
+            EXPECT_NEAR(Vincenty(0, 0, E7(90), 0), 10001965.729, 0.001);
+        }
+
+        TEST(GeoDistanceTest, HaversineMatchesSphere) {
+            const double quarter = kEarthRadiusMetres * kPi / 2;
+            EXPECT_NEAR(HaversineMetres(ToGeoPoint(0, 0), ToGeoPoint(0, E7(90))), quarter, 1e-6);
+            EXPECT_NEAR(HaversineMetres(ToGeoPoint(0, 0), ToGeoPoint(E7(90), 0)), quarter, 1e-6);
+            EXPECT_NEAR(HaversineMetres(ToGeoPoint(E7(-90), 0), ToGeoPoint(E7(90), 0)),
+                2 * quarter, 1e-6);
+            EXPECT_NEAR(HaversineMetres(ToGeoPoint(0, E7(-90)), ToGeoPoint(0, E7(90))),
+                2 * quarter, 1e-6);
+        }
+
+        // (0, 0) to (0.5, 179.5) is the textbook case where Vincenty's
+        // iteration fails. The geodesic is 19936288.579 m; the spherical
+        // fallback must stay within the sphere's 0.5%, in the batch path
+        // too.
+        TEST(GeoDistanceTest, VincentyFallsBackNearAntipodes) {
+            double metres = Vincenty(0, 0, E7(0.5), E7(179.5));
+            EXPECT_NEAR(metres, 19936288.579, 19936288.579 * 0.005);
+        }
+
+        // 100000 steps of 0.001 degrees along the equator add up to the arc
+        // between the ends, to well under a millimetre.
+        TEST(GeoDistanceTest, LongRouteKeepsPrecision) {
+            const size_t n = 100001;
+            std::vector<int32_t> latitudes(n, 0), longitudes(n);
+            for (size_t i = 0; i < n; i++) {
+                longitudes[i] = static_cast<int32_t>(i * 10000) - 500000000;
+            }
+            double expected = kEarthRadiusMetres * 100 * kPi / 180;
+            EXPECT_NEAR(PathLength(latitudes.data(), longitudes.data(), n,
+                DistanceModel::kHaversine), expected, 1e-4);
+        }
+
+        TEST(GeoDistanceTest, ParsesModels) {
+            DistanceModel model = DistanceModel::kHaversine;
+            EXPECT_TRUE(ParseDistanceModel("vincenty", &model));
+            EXPECT_EQ(model, DistanceModel::kVincenty);
+            EXPECT_TRUE(ParseDistanceModel("haversine", &model));
+            EXPECT_EQ(model, DistanceModel::kHaversine);
+            EXPECT_FALSE(ParseDistanceModel("flat", &model));
+        }
+
+        TEST(GeoDistanceTest, SegmentLengthsMatchPairwiseDistances) {
+            std::vector<int32_t> latitudes = { 407838351, 408122808, 413628156, -337500000, 0 };
+            std::vector<int32_t> longitudes = { -746143763, -743999179, -749015924, 1510000000, 0 };
+            size_t n = latitudes.size();
+            for (DistanceModel model : { DistanceModel::kHaversine, DistanceModel::kVincenty }) {
+                std::vector<double> metres(n - 1);
+                SegmentLengths(latitudes.data(), longitudes.data(), n, model, metres.data());
+                double total = 0;
+                for (size_t i = 0; i + 1 < n; i++) {
+                    double expected = DistanceMetres(ToGeoPoint(latitudes[i], longitudes[i]),
+                        ToGeoPoint(latitudes[i + 1], longitudes[i + 1]), model);
+                    EXPECT_NEAR(metres[i], expected, expected * 1e-12) << i;
+                    total += metres[i];
+                }
+                EXPECT_NEAR(PathLength(latitudes.data(), longitudes.data(), n, model), total,
+                    total * 1e-12);
+            }
+        }
+
+        TEST(GeoDistanceTest, CompensatedSumKeepsSmallTerms) {
+            DistanceSum sum;
+            sum.Add(1e16);
+            for (int i = 0; i < 1000; i++) {
+                sum.Add(1.0);
+            }
+            sum.Add(-1e16);
+            EXPECT_EQ(sum.value(), 1000.0);
+
+            DistanceSum other;
+            other.Add(0.5);
+            sum.Add(other);
+            EXPECT_EQ(sum.value(), 1000.5);
+        }
+
+    }  // namespace
+}  // namespace routeguide
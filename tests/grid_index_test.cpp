@@ -0,0 +1,129 @@
+#include "grid_index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        std::vector<uint32_t> ScanAll(const FeatureStore& store, const Bounds& bounds) {
+            std::vector<uint32_t> positions;
+            for (uint32_t i = 0; i < store.size(); i++) {
+                if (store.longitude(i) >= bounds.left && store.longitude(i) <= bounds.right &&
+                    store.latitude(i) >= bounds.bottom && store.latitude(i) <= bounds.top) {
+                    positions.push_back(i);
+                }
+            }
+            return positions;
+        }
+
+        std::vector<uint32_t> Query(const GridIndex& index, const Bounds& bounds) {
+            std::vector<uint32_t> positions;
+            index.Query(bounds, &positions);
+            return positions;
+        }
+
+        TEST(GridIndexTest, EmptyIndexFindsNothing) {
+            FeatureStore store;
+            GridIndex index;
+            index.Build(store);
+            EXPECT_TRUE(Query(index, Bounds{ -10, 10, -10, 10 }).empty());
+        }
+
+        TEST(GridIndexTest, BoundsAreInclusive) {
+            FeatureStore store;
+            store.Add(0, 0, "origin");
+            store.Add(10, 20, "corner");
+            store.Add(11, 20, "above");
+            store.Add(5, 21, "right");
+            GridIndex index;
+            index.Build(store);
+            EXPECT_EQ(Query(index, Bounds{ 0, 20, 0, 10 }), (std::vector<uint32_t>{ 0, 1 }));
+            EXPECT_EQ(Query(index, Bounds{ 20, 20, 10, 10 }), (std::vector<uint32_t>{ 1 }));
+            EXPECT_TRUE(Query(index, Bounds{ 1, 19, 1, 9 }).empty());
+            // Rectangles off the grid on every side.
+            EXPECT_TRUE(Query(index, Bounds{ 30, 40, 0, 10 }).empty());
+            EXPECT_TRUE(Query(index, Bounds{ -40, -30, 0, 10 }).empty());
+            EXPECT_TRUE(Query(index, Bounds{ 0, 20, 30, 40 }).empty());
+            EXPECT_TRUE(Query(index, Bounds{ 0, 20, -40, -30 }).empty());
+        }
+
+        TEST(GridIndexTest, WholeWorldReturnsStoreOrder) {
+            FeatureStore store;
+            FillSyntheticStore(5000, 3, &store);
+            GridIndex index;
+            index.Build(store);
+            Bounds world = { INT32_MIN, INT32_MAX, INT32_MIN, INT32_MAX };
+            EXPECT_EQ(Query(index, world), ScanAll(store, world));
+        }
+
+        // Random rectangles against a linear scan, over DBs spread world-wide,
+        // packed into a small box and sharing few distinct points. Corners are
+        // often taken from stored points, so features on the edges count.
+        TEST(GridIndexTest, MatchesLinearScanOnRandomRectangles) {
+            struct Case {
+                size_t count;
+                int32_t min_latitude, max_latitude, min_longitude, max_longitude;
+            };
+            const Case cases[] = {
+                { 1, 5, 5, 7, 7 },
+                { 300, -900000000, 900000000, -1800000000, 1800000000 },
+                { 20000, -900000000, 900000000, -1800000000, 1800000000 },
+                { 20000, 400000000, 410000000, -750000000, -740000000 },
+                { 5000, 0, 20, 0, 20 },
+                { 5000, 100, 100, -3000, 3000 },
+            };
+            std::mt19937 rng(1234);
+            for (const Case& c : cases) {
+                FeatureStore store;
+                FillSyntheticStore(c.count, static_cast<uint32_t>(c.count), &store,
+                    c.min_latitude, c.max_latitude, c.min_longitude, c.max_longitude);
+                GridIndex index;
+                index.Build(store);
+                // A margin beyond the box, to also probe rectangles off the grid.
+                int64_t margin = (std::max)(int64_t(10),
+                    (int64_t(c.max_longitude) - c.min_longitude) / 4);
+                auto coordinate = [&](int32_t low, int32_t high) {
+                    std::uniform_int_distribution<int64_t> d(
+                        (std::max)(int64_t(INT32_MIN), low - margin),
+                        (std::min)(int64_t(INT32_MAX), high + margin));
+                    return static_cast<int32_t>(d(rng));
+                };
+                for (int i = 0; i < 500; i++) {
+                    int32_t latitudes[2], longitudes[2];
+                    for (int j = 0; j < 2; j++) {
+                        if (rng() % 3 == 0) {
+                            size_t k = rng() % store.size();
+                            latitudes[j] = store.latitude(k);
+                            longitudes[j] = store.longitude(k);
+                        }
+                        else {
+                            latitudes[j] = coordinate(c.min_latitude, c.max_latitude);
+                            longitudes[j] = coordinate(c.min_longitude, c.max_longitude);
+                        }
+                    }
+                    Bounds bounds;
+                    bounds.left = (std::min)(longitudes[0], longitudes[1]);
+                    bounds.right = (std::max)(longitudes[0], longitudes[1]);
+                    bounds.bottom = (std::min)(latitudes[0], latitudes[1]);
+                    bounds.top = (std::max)(latitudes[0], latitudes[1]);
+                    if (i % 50 == 0) {
+                        // Inverted rectangles match nothing.
+                        std::swap(bounds.left, bounds.right);
+                    }
+                    ASSERT_EQ(Query(index, bounds), ScanAll(store, bounds))
+                        << "count " << c.count << " rectangle " << i << ": "
+                        << bounds.left << ".." << bounds.right << " x "
+                        << bounds.bottom << ".." << bounds.top;
+                }
+            }
+        }
+
+    }  // namespace
+}  // namespace routeguide
@@ -0,0 +1,228 @@
+#include "list_page.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        Rectangle MakeRectangle(int32_t lo_latitude, int32_t lo_longitude,
+            int32_t hi_latitude, int32_t hi_longitude, Rectangle::Order order,
+            int32_t max_results) {
+            Rectangle request;
+            request.mutable_lo()->set_latitude(lo_latitude);
+            request.mutable_lo()->set_longitude(lo_longitude);
+            request.mutable_hi()->set_latitude(hi_latitude);
+            request.mutable_hi()->set_longitude(hi_longitude);
+            request.set_order(order);
+            request.set_max_results(max_results);
+            return request;
+        }
+
+        class ListPageTest : public ::testing::Test {
+        protected:
+            void SetUp() override {
+                auto db = std::make_shared<FeatureDb>();
+                // Dense enough that many features share a point, and so a
+                // distance.
+                FillSyntheticStore(3000, 17, db->mutable_store(),
+                    400000000, 410000000, -750000000, -740000000);
+                for (int i = 0; i < 40; i++) {
+                    db->mutable_store()->Add(405000000, -745000000, "centre");
+                }
+                db->BuildIndexes();
+                db_ = db;
+            }
+
+            // Runs SelectPage over the rectangle's matches.
+            bool Select(const Rectangle& request, FeaturePage* page, std::string* error) {
+                page->db = db_;
+                page->positions.clear();
+                Bounds bounds;
+                bounds.left = request.lo().longitude();
+                bounds.right = request.hi().longitude();
+                bounds.bottom = request.lo().latitude();
+                bounds.top = request.hi().latitude();
+                db_->Query(bounds, &page->positions);
+                return SelectPage(request, page, error);
+            }
+
+            // Every page of the listing in turn, concatenated.
+            std::vector<uint32_t> WalkPages(Rectangle request, size_t* pages) {
+                std::vector<uint32_t> all;
+                *pages = 0;
+                while (true) {
+                    FeaturePage page;
+                    std::string error;
+                    EXPECT_TRUE(Select(request, &page, &error)) << error;
+                    (*pages)++;
+                    if (request.max_results() != 0) {
+                        EXPECT_LE(page.positions.size(),
+                            static_cast<size_t>(request.max_results()));
+                    }
+                    all.insert(all.end(), page.positions.begin(), page.positions.end());
+                    if (page.next_page_token.empty() || *pages > 10000) {
+                        return all;
+                    }
+                    request.set_page_token(page.next_page_token);
+                }
+            }
+
+            std::string ExpectRejected(const Rectangle& request) {
+                FeaturePage page;
+                std::string error;
+                EXPECT_FALSE(Select(request, &page, &error)) << request.page_token();
+                EXPECT_FALSE(error.empty());
+                return error;
+            }
+
+            std::shared_ptr<const FeatureDb> db_;
+        };
+
+        TEST_F(ListPageTest, PagesReproduceTheFullListing) {
+            for (Rectangle::Order order :
+                { Rectangle::DB_ORDER, Rectangle::DISTANCE_FROM_CENTER }) {
+                Rectangle request = MakeRectangle(402000000, -748000000, 408000000,
+                    -742000000, order, 0);
+                FeaturePage full;
+                std::string error;
+                ASSERT_TRUE(Select(request, &full, &error)) << error;
+                EXPECT_TRUE(full.next_page_token.empty());
+                ASSERT_GT(full.positions.size(), 500u);
+                for (int32_t max_results : { 1, 7, 64, 500, 100000 }) {
+                    request.set_max_results(max_results);
+                    size_t pages = 0;
+                    EXPECT_EQ(WalkPages(request, &pages), full.positions)
+                        << "order " << order << ", max_results " << max_results;
+                    size_t expected_pages = (std::max)(static_cast<size_t>(1),
+                        (full.positions.size() + max_results - 1) / max_results);
+                    EXPECT_EQ(pages, expected_pages);
+                }
+            }
+        }
+
+        TEST_F(ListPageTest, DistanceOrderIsNearestFirstWithTiesByPosition) {
+            Rectangle request = MakeRectangle(404000000, -746000000, 406000000,
+                -744000000, Rectangle::DISTANCE_FROM_CENTER, 0);
+            FeaturePage page;
+            std::string error;
+            ASSERT_TRUE(Select(request, &page, &error)) << error;
+            GeoPoint center = ListCenter(request);
+            const FeatureStore& store = db_->store();
+            for (size_t i = 1; i < page.positions.size(); i++) {
+                uint32_t a = page.positions[i - 1], b = page.positions[i];
+                double da = HaversineMetres(center,
+                    ToGeoPoint(store.latitude(a), store.longitude(a)));
+                double db = HaversineMetres(center,
+                    ToGeoPoint(store.latitude(b), store.longitude(b)));
+                EXPECT_TRUE(da < db || (da == db && a < b)) << i;
+            }
+            // The 40 features at the centre come first, in store order.
+            ASSERT_GE(page.positions.size(), 40u);
+            EXPECT_TRUE(std::is_sorted(page.positions.begin(),
+                page.positions.begin() + 40));
+            EXPECT_EQ(store.latitude(page.positions[39]), 405000000);
+        }
+
+        TEST_F(ListPageTest, ZeroMaxResultsIsUnlimited) {
+            Rectangle request = MakeRectangle(400000000, -750000000, 410000000,
+                -740000000, Rectangle::DB_ORDER, 0);
+            FeaturePage page;
+            std::string error;
+            ASSERT_TRUE(Select(request, &page, &error)) << error;
+            EXPECT_EQ(page.positions.size(), db_->store().size());
+            EXPECT_TRUE(page.next_page_token.empty());
+        }
+
+        TEST_F(ListPageTest, LastFullPageHasNoToken) {
+            Rectangle request = MakeRectangle(400000000, -750000000, 410000000,
+                -740000000, Rectangle::DB_ORDER,
+                static_cast<int32_t>(db_->store().size()));
+            FeaturePage page;
+            std::string error;
+            ASSERT_TRUE(Select(request, &page, &error)) << error;
+            EXPECT_EQ(page.positions.size(), db_->store().size());
+            EXPECT_TRUE(page.next_page_token.empty());
+        }
+
+        TEST_F(ListPageTest, RejectsBadRequests) {
+            Rectangle request = MakeRectangle(400000000, -750000000, 410000000,
+                -740000000, Rectangle::DB_ORDER, -1);
+            ExpectRejected(request);
+            request.set_max_results(10);
+            request.set_order(static_cast<Rectangle::Order>(7));
+            ExpectRejected(request);
+        }
+
+        TEST_F(ListPageTest, RejectsMalformedTokens) {
+            Rectangle db_order = MakeRectangle(400000000, -750000000, 410000000,
+                -740000000, Rectangle::DB_ORDER, 10);
+            for (const char* token : { "x", "db:", "db:-1", "db:+1", "db:1x", "db: 1",
+                "db:0x10", "DB:1", "db:99999999999999999999", "near:0:1" }) {
+                db_order.set_page_token(token);
+                ExpectRejected(db_order);
+            }
+            Rectangle near = db_order;
+            near.set_order(Rectangle::DISTANCE_FROM_CENTER);
+            for (const char* token : { "near:", "near:0", "near:0:", "near::1",
+                "near:g:1", "near:0:1:", "near:0:-1", "near:-0:1", "db:1",
+                "near:00000000000000000000:1" }) {
+                near.set_page_token(token);
+                ExpectRejected(near);
+            }
+        }
+
+        TEST_F(ListPageTest, RejectsTokensOfTheOtherOrder) {
+            Rectangle request = MakeRectangle(400000000, -750000000, 410000000,
+                -740000000, Rectangle::DB_ORDER, 10);
+            FeaturePage page;
+            std::string error;
+            ASSERT_TRUE(Select(request, &page, &error)) << error;
+            std::string db_token = page.next_page_token;
+            ASSERT_EQ(db_token.compare(0, 3, "db:"), 0);
+            request.set_order(Rectangle::DISTANCE_FROM_CENTER);
+            ASSERT_TRUE(Select(request, &page, &error)) << error;
+            std::string near_token = page.next_page_token;
+            ASSERT_EQ(near_token.compare(0, 5, "near:"), 0);
+
+            request.set_page_token(db_token);
+            ExpectRejected(request);
+            request.set_order(Rectangle::DB_ORDER);
+            request.set_page_token(near_token);
+            ExpectRejected(request);
+        }
+
+        TEST_F(ListPageTest, RejectsOutOfRangeTokens) {
+            Rectangle request = MakeRectangle(400000000, -750000000, 410000000,
+                -740000000, Rectangle::DB_ORDER, 10);
+            std::string size = std::to_string(db_->store().size());
+            request.set_page_token("db:" + size);
+            EXPECT_EQ(ExpectRejected(request), "page_token out of range");
+            request.set_page_token("db:4294967296");
+            ExpectRejected(request);
+            // The last position is a valid place to resume from.
+            request.set_page_token("db:" + std::to_string(db_->store().size() - 1));
+            FeaturePage page;
+            std::string error;
+            EXPECT_TRUE(Select(request, &page, &error)) << error;
+            EXPECT_TRUE(page.positions.empty());
+
+            request.set_order(Rectangle::DISTANCE_FROM_CENTER);
+            request.set_page_token("near:0000000000000000:" + size);
+            EXPECT_EQ(ExpectRejected(request), "page_token out of range");
+            // Negative, infinite and NaN distances.
+            for (const char* bits : { "8000000000000001", "7ff0000000000000",
+                "7ff8000000000000", "4200000000000000" }) {
+                request.set_page_token(std::string("near:") + bits + ":0");
+                ExpectRejected(request);
+            }
+        }
+
+    }  // namespace
+}  // namespace routeguide
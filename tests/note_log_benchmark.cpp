@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include "note_log.h"
+#include "note_store.h"
+#include "server_metrics.h"
+
+namespace routeguide {
+    namespace {
+
+        // Notes over this many locations, so each keeps few and a post
+        // copies back little.
+        const int32_t kLocations = 1 << 16;
+
+        RouteNote BenchmarkNote(int64_t i) {
+            RouteNote note;
+            note.mutable_location()->set_latitude(static_cast<int32_t>(i % kLocations) * 100);
+            note.mutable_location()->set_longitude(static_cast<int32_t>(i % 7) * 100);
+            note.set_message("benchmark note");
+            return note;
+        }
+
+        // A NoteLog in a fresh temporary directory, removed afterwards.
+        class TempNoteLog {
+        public:
+            TempNoteLog()
+                : dir_((std::filesystem::temp_directory_path() /
+                    "routeguide_note_log_benchmark").string()) {
+                std::filesystem::remove_all(dir_);
+                NoteLogOptions options;
+                options.dir = dir_;
+                options.snapshot_interval = std::chrono::seconds(0);
+                log_.reset(new NoteLog(options, &store_, &metrics_));
+                ok_ = log_->Open(&error_);
+            }
+
+            ~TempNoteLog() {
+                log_.reset();
+                std::filesystem::remove_all(dir_);
+            }
+
+            // Null, with error() saying why, if the log did not open.
+            NoteLog* log() { return ok_ ? log_.get() : nullptr; }
+            const std::string& error() const { return error_; }
+
+        private:
+            std::string dir_;
+            NoteStore store_;
+            ServerMetrics metrics_;
+            std::unique_ptr<NoteLog> log_;
+            bool ok_ = false;
+            std::string error_;
+        };
+
+        // The in-memory store alone, as the server keeps notes without a log.
+        void BM_NoteStorePost(benchmark::State& state) {
+            NoteStore store;
+            NoteList earlier;
+            int64_t i = 0;
+            for (auto _ : state) {
+                earlier.Clear();
+                store.Post(BenchmarkNote(i++), &earlier);
+            }
+            state.SetItemsProcessed(state.iterations());
+        }
+        BENCHMARK(BM_NoteStorePost);
+
+        // Posts range(0) notes to the log, then waits until the last is on
+        // disk, as a RouteChat stream does before it completes. The notes of
+        // one batch share the syncs they wait for.
+        void BM_NoteLogIngest(benchmark::State& state) {
+            TempNoteLog temp;
+            if (temp.log() == nullptr) {
+                state.SkipWithError(temp.error().c_str());
+                return;
+            }
+            NoteList earlier;
+            int64_t i = 0;
+            bool durable = true;
+            for (auto _ : state) {
+                uint64_t ticket = 0;
+                for (int64_t n = 0; n < state.range(0); n++) {
+                    earlier.Clear();
+                    ticket = temp.log()->Post(BenchmarkNote(i++), &earlier, nullptr);
+                }
+                durable = temp.log()->WaitDurable(ticket) && durable;
+            }
+            if (!durable) {
+                state.SkipWithError("a note log write failed");
+            }
+            state.SetItemsProcessed(state.iterations() * state.range(0));
+        }
+        BENCHMARK(BM_NoteLogIngest)->Arg(1)->Arg(16)->Arg(256)->UseRealTime();
+
+        // Posts to a log holding range(0) notes while another thread keeps
+        // snapshotting it, and reports the slowest post: how long a snapshot
+        // holds posts back.
+        void BM_NoteLogPostDuringSnapshot(benchmark::State& state) {
+            TempNoteLog temp;
+            if (temp.log() == nullptr) {
+                state.SkipWithError(temp.error().c_str());
+                return;
+            }
+            NoteList earlier;
+            int64_t i = 0;
+            for (; i < state.range(0); i++) {
+                earlier.Clear();
+                temp.log()->Post(BenchmarkNote(i), &earlier, nullptr);
+            }
+            std::atomic<bool> stop{ false };
+            std::atomic<uint64_t> snapshots{ 0 };
+            std::thread snapshotter([&temp, &stop, &snapshots] {
+                std::string error;
+                while (!stop.load() && temp.log()->Snapshot(&error)) {
+                    snapshots++;
+                }
+            });
+            std::chrono::steady_clock::duration slowest(0);
+            for (auto _ : state) {
+                earlier.Clear();
+                auto start = std::chrono::steady_clock::now();
+                temp.log()->Post(BenchmarkNote(i++), &earlier, nullptr);
+                slowest = (std::max)(slowest, std::chrono::steady_clock::now() - start);
+            }
+            stop = true;
+            snapshotter.join();
+            state.counters["snapshots"] = static_cast<double>(snapshots.load());
+            state.counters["slowest_post_ms"] = std::chrono::duration<double, std::milli>(
+                slowest).count();
+            state.SetItemsProcessed(state.iterations());
+        }
+        BENCHMARK(BM_NoteLogPostDuringSnapshot)->Arg(1 << 18)->UseRealTime()
+            ->MinTime(1.0);
+
+    }  // namespace
+}  // namespace routeguide
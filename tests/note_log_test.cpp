@@ -0,0 +1,256 @@
+#include "note_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace routeguide {
+    namespace {
+
+        // Notes by location, each location's in store order. Notes at
+        // different locations have no order to keep.
+        using Contents = std::map<std::pair<int32_t, int32_t>, std::vector<std::string>>;
+
+        Contents ContentsOf(const NoteStore& store) {
+            Contents contents;
+            store.Export([&contents](const RouteNote& note,
+                std::chrono::steady_clock::duration /*age*/) {
+                contents[{ note.location().latitude(), note.location().longitude() }]
+                    .push_back(note.message());
+            });
+            return contents;
+        }
+
+        RouteNote MakeNote(int32_t latitude, int32_t longitude, const std::string& message) {
+            RouteNote note;
+            note.mutable_location()->set_latitude(latitude);
+            note.mutable_location()->set_longitude(longitude);
+            note.set_message(message);
+            return note;
+        }
+
+        // Bytes a note takes in a log file: size, CRC, time, point, message.
+        size_t RecordBytes(const std::string& message) {
+            return 4 + 4 + 8 + 4 + 4 + message.size();
+        }
+
+        class NoteLogTest : public ::testing::Test {
+        protected:
+            void SetUp() override {
+                dir_ = std::filesystem::temp_directory_path() /
+                    ("routeguide_note_log_test_" + std::to_string(::testing::UnitTest::
+                        GetInstance()->random_seed()) + "_" + ::testing::UnitTest::
+                        GetInstance()->current_test_info()->name());
+                std::filesystem::remove_all(dir_);
+                limits_.max_notes_per_location = 0;
+                limits_.max_notes = 0;
+            }
+
+            void TearDown() override {
+                log_.reset();
+                std::filesystem::remove_all(dir_);
+            }
+
+            // Opens a log over a new, empty store, as a restarted server does.
+            void Open(size_t replay_threads = 4) {
+                log_.reset();
+                store_.reset(new NoteStore(limits_, 16));
+                NoteLogOptions options;
+                options.dir = dir_.string();
+                options.snapshot_interval = std::chrono::seconds(0);
+                options.replay_threads = replay_threads;
+                log_.reset(new NoteLog(options, store_.get(), &metrics_));
+                std::string error;
+                ASSERT_TRUE(log_->Open(&error)) << error;
+            }
+
+            // Posts count notes over locations points, and waits until they
+            // are on disk.
+            void Post(int count, int locations, const std::string& prefix) {
+                NoteList earlier;
+                uint64_t ticket = 0;
+                for (int i = 0; i < count; i++) {
+                    earlier.Clear();
+                    ticket = log_->Post(MakeNote(i % locations, -(i % locations) * 7,
+                        prefix + std::to_string(i)), &earlier, nullptr);
+                }
+                ASSERT_TRUE(log_->WaitDurable(ticket));
+            }
+
+            // The files of one kind in the directory, in name order.
+            std::vector<std::filesystem::path> Files(const std::string& suffix) const {
+                std::vector<std::filesystem::path> files;
+                for (const auto& entry : std::filesystem::directory_iterator(dir_)) {
+                    if (entry.path().extension() == suffix) {
+                        files.push_back(entry.path());
+                    }
+                }
+                std::sort(files.begin(), files.end());
+                return files;
+            }
+
+            std::filesystem::path dir_;
+            NoteLimits limits_;
+            ServerMetrics metrics_;
+            std::unique_ptr<NoteStore> store_;
+            std::unique_ptr<NoteLog> log_;
+        };
+
+        TEST_F(NoteLogTest, ReopenRestoresTheNotes) {
+            Open();
+            Post(1000, 37, "note ");
+            Contents before = ContentsOf(*store_);
+            ASSERT_EQ(before.size(), 37u);
+            Open();
+            EXPECT_EQ(ContentsOf(*store_), before);
+            // And once more, now from two segments, on one thread.
+            Post(10, 37, "more ");
+            before = ContentsOf(*store_);
+            Open(1);
+            EXPECT_EQ(ContentsOf(*store_), before);
+        }
+
+        TEST_F(NoteLogTest, EmptyDirectoryRestoresNothing) {
+            Open();
+            EXPECT_TRUE(ContentsOf(*store_).empty());
+            Open();
+            EXPECT_TRUE(ContentsOf(*store_).empty());
+        }
+
+        TEST_F(NoteLogTest, TornLastRecordIsSkipped) {
+            Open();
+            Post(100, 10, "note ");
+            Contents before = ContentsOf(*store_);
+            log_.reset();
+            // Cut the last record, note 99 at location 9, inside its CRC.
+            std::vector<std::filesystem::path> segments = Files(".log");
+            ASSERT_EQ(segments.size(), 1u);
+            uint64_t size = std::filesystem::file_size(segments[0]);
+            std::filesystem::resize_file(segments[0],
+                size - RecordBytes("note 99") + 6);
+            before[{ 9, -63 }].pop_back();
+
+            Open();
+            EXPECT_EQ(ContentsOf(*store_), before);
+            // New notes go to a new segment, not after the torn record.
+            Post(1, 10, "after ");
+            before[{ 0, 0 }].push_back("after 0");
+            Open();
+            EXPECT_EQ(ContentsOf(*store_), before);
+        }
+
+        TEST_F(NoteLogTest, CorruptRecordEndsItsSegment) {
+            Open();
+            Post(100, 10, "note ");
+            Contents before = ContentsOf(*store_);
+            log_.reset();
+            // Flip a byte of note 90's message: it and every later note in
+            // the segment are dropped, whatever shard they belong to.
+            std::filesystem::path segment = Files(".log")[0];
+            uint64_t size = std::filesystem::file_size(segment);
+            uint64_t at = size - 10 * RecordBytes("note 90") + 24;
+            {
+                std::fstream file(segment, std::ios::in | std::ios::out | std::ios::binary);
+                file.seekg(static_cast<std::streamoff>(at));
+                char c = 0;
+                file.get(c);
+                EXPECT_EQ(c, 'n');
+                file.seekp(static_cast<std::streamoff>(at));
+                file.put('N');
+            }
+            for (int i = 90; i < 100; i++) {
+                before[{ i % 10, -(i % 10) * 7 }].pop_back();
+            }
+            Open();
+            EXPECT_EQ(ContentsOf(*store_), before);
+        }
+
+        TEST_F(NoteLogTest, SnapshotThenSegments) {
+            Open();
+            Post(500, 20, "before ");
+            std::string error;
+            ASSERT_TRUE(log_->Snapshot(&error)) << error;
+            Post(300, 30, "after ");
+            Contents before = ContentsOf(*store_);
+            log_.reset();
+            // The segments before the snapshot are gone.
+            EXPECT_EQ(Files(".snapshot").size(), 1u);
+            EXPECT_EQ(Files(".log").size(), 1u);
+
+            Open();
+            EXPECT_EQ(ContentsOf(*store_), before);
+            // A second snapshot replaces the first.
+            ASSERT_TRUE(log_->Snapshot(&error)) << error;
+            Post(5, 5, "last ");
+            before = ContentsOf(*store_);
+            Open();
+            EXPECT_EQ(Files(".snapshot").size(), 1u);
+            EXPECT_EQ(ContentsOf(*store_), before);
+        }
+
+        TEST_F(NoteLogTest, SnapshotWhilePosting) {
+            Open();
+            const int kThreads = 4;
+            const int kNotes = 2000;
+            std::atomic<int> done{ 0 };
+            std::vector<std::thread> posters;
+            for (int t = 0; t < kThreads; t++) {
+                // Each poster has locations of its own, so each location's
+                // notes have one order.
+                posters.emplace_back([this, t, &done] {
+                    NoteList earlier;
+                    uint64_t ticket = 0;
+                    for (int i = 0; i < kNotes; i++) {
+                        earlier.Clear();
+                        ticket = log_->Post(MakeNote(t, i % 50, std::to_string(i)),
+                            &earlier, nullptr);
+                    }
+                    EXPECT_TRUE(log_->WaitDurable(ticket));
+                    done++;
+                });
+            }
+            int snapshots = 0;
+            while (done < kThreads || snapshots == 0) {
+                std::string error;
+                EXPECT_TRUE(log_->Snapshot(&error)) << error;
+                snapshots++;
+            }
+            for (std::thread& poster : posters) {
+                poster.join();
+            }
+            Contents before = ContentsOf(*store_);
+            size_t notes = 0;
+            for (const auto& location : before) {
+                notes += location.second.size();
+            }
+            ASSERT_EQ(notes, static_cast<size_t>(kThreads * kNotes));
+
+            Open();
+            EXPECT_EQ(ContentsOf(*store_), before);
+        }
+
+        TEST_F(NoteLogTest, ReplayKeepsTheStoreLimits) {
+            limits_.max_notes_per_location = 3;
+            Open();
+            Post(40, 4, "note ");
+            Contents before = ContentsOf(*store_);
+            for (const auto& location : before) {
+                EXPECT_EQ(location.second.size(), 3u);
+            }
+            Open();
+            EXPECT_EQ(ContentsOf(*store_), before);
+        }
+
+    }  // namespace
+}  // namespace routeguide
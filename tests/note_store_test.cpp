@@ -0,0 +1,171 @@
+#include "note_store.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace routeguide {
+    namespace {
+
+        RouteNote MakeNote(int32_t latitude, int32_t longitude, const std::string& message) {
+            RouteNote note;
+            note.mutable_location()->set_latitude(latitude);
+            note.mutable_location()->set_longitude(longitude);
+            note.set_message(message);
+            return note;
+        }
+
+        // Posts a note and returns the messages stored earlier at its point.
+        std::vector<std::string> Post(NoteStore* store, int32_t latitude,
+            int32_t longitude, const std::string& message) {
+            NoteList earlier;
+            store->Post(MakeNote(latitude, longitude, message), &earlier);
+            std::vector<std::string> messages;
+            for (const RouteNote& note : earlier) {
+                EXPECT_EQ(note.location().latitude(), latitude);
+                EXPECT_EQ(note.location().longitude(), longitude);
+                messages.push_back(note.message());
+            }
+            return messages;
+        }
+
+        size_t Exported(const NoteStore& store) {
+            size_t notes = 0;
+            store.Export([&notes](const RouteNote& /*note*/,
+                std::chrono::steady_clock::duration /*age*/) { notes++; });
+            return notes;
+        }
+
+        TEST(NoteStoreTest, ReturnsEarlierNotesAtTheSamePointOldestFirst) {
+            NoteStore store;
+            EXPECT_TRUE(Post(&store, 1, 2, "a").empty());
+            EXPECT_TRUE(Post(&store, 2, 1, "elsewhere").empty());
+            EXPECT_EQ(Post(&store, 1, 2, "b"), (std::vector<std::string>{ "a" }));
+            EXPECT_EQ(Post(&store, 1, 2, "c"), (std::vector<std::string>{ "a", "b" }));
+            EXPECT_EQ(store.Stats().notes, 4u);
+        }
+
+        TEST(NoteStoreTest, LocationCapDropsTheOldest) {
+            NoteLimits limits;
+            limits.max_notes_per_location = 3;
+            NoteStore store(limits);
+            for (int i = 0; i < 10; i++) {
+                Post(&store, 5, 5, std::to_string(i));
+            }
+            // The ring keeps reusing its slots for the newest three.
+            EXPECT_EQ(Post(&store, 5, 5, "last"),
+                (std::vector<std::string>{ "7", "8", "9" }));
+            EXPECT_EQ(Post(&store, 6, 6, "other point").size(), 0u);
+            NoteStoreStats stats = store.Stats();
+            EXPECT_EQ(stats.notes, 4u);
+            EXPECT_EQ(stats.evicted_location_cap, 8u);
+            EXPECT_EQ(stats.evicted_global_cap, 0u);
+        }
+
+        TEST(NoteStoreTest, TotalCapDropsTheOldestOfTheShard) {
+            NoteLimits limits;
+            limits.max_notes_per_location = 0;
+            limits.max_notes = 4;
+            NoteStore store(limits, 1);
+            for (int i = 0; i < 6; i++) {
+                Post(&store, i, 0, std::to_string(i));
+            }
+            // 0 and 1 went first, then 2 and 3 to make room for these.
+            EXPECT_TRUE(Post(&store, 0, 0, "again").empty());
+            EXPECT_TRUE(Post(&store, 1, 0, "again").empty());
+            NoteStoreStats stats = store.Stats();
+            EXPECT_EQ(stats.notes, 4u);
+            EXPECT_EQ(stats.evicted_global_cap, 4u);
+            EXPECT_EQ(Post(&store, 5, 0, "again"), (std::vector<std::string>{ "5" }));
+        }
+
+        TEST(NoteStoreTest, TotalCapIsSplitBetweenShards) {
+            NoteLimits limits;
+            limits.max_notes_per_location = 0;
+            limits.max_notes = 64;
+            NoteStore store(limits, 16);
+            for (int i = 0; i < 5000; i++) {
+                Post(&store, i % 997, i % 13, "note");
+            }
+            NoteStoreStats stats = store.Stats();
+            EXPECT_LE(stats.notes, 64u);
+            EXPECT_EQ(stats.notes + stats.evicted_global_cap, 5000u);
+        }
+
+        TEST(NoteStoreTest, LocationAndTotalCapsTogether) {
+            NoteLimits limits;
+            limits.max_notes_per_location = 2;
+            limits.max_notes = 3;
+            NoteStore store(limits, 1);
+            Post(&store, 1, 1, "a1");
+            Post(&store, 1, 1, "a2");
+            Post(&store, 1, 1, "a3");
+            Post(&store, 2, 2, "b1");
+            Post(&store, 2, 2, "b2");
+            // a1 went to the location cap; its stale arrival frees no room, so
+            // a2 and then a3 go to the total cap.
+            EXPECT_TRUE(Post(&store, 1, 1, "a4").empty());
+            NoteStoreStats stats = store.Stats();
+            EXPECT_EQ(stats.notes, 3u);
+            EXPECT_EQ(stats.evicted_location_cap, 1u);
+            EXPECT_EQ(stats.evicted_global_cap, 2u);
+            // Room for b3 is made before the copy, so b1 is already gone.
+            EXPECT_EQ(Post(&store, 2, 2, "b3"), (std::vector<std::string>{ "b2" }));
+        }
+
+        TEST(NoteStoreTest, ExpiredNotesAreNeverReturned) {
+            NoteLimits limits;
+            limits.ttl = std::chrono::seconds(60);
+            NoteStore store(limits);
+            store.Restore(MakeNote(1, 1, "old"), std::chrono::seconds(61));
+            store.Restore(MakeNote(1, 1, "recent"), std::chrono::seconds(30));
+            EXPECT_EQ(Post(&store, 1, 1, "new"), (std::vector<std::string>{ "recent" }));
+            EXPECT_EQ(store.Stats().expired, 1u);
+        }
+
+        TEST(NoteStoreTest, SweepExpiresShardsNobodyPostsTo) {
+            NoteLimits limits;
+            limits.ttl = std::chrono::seconds(60);
+            NoteStore store(limits);
+            for (int i = 0; i < 100; i++) {
+                store.Restore(MakeNote(i, -i, "old"), std::chrono::seconds(120));
+            }
+            store.Restore(MakeNote(1000, 1000, "recent"), std::chrono::seconds(1));
+            // Not returned on export even before the sweep.
+            EXPECT_EQ(Exported(store), 1u);
+            // Restoring into a shard expires what it held, but 64 shards
+            // leave most of the old notes in place.
+            EXPECT_GT(store.Stats().notes, 50u);
+            store.Sweep();
+            NoteStoreStats stats = store.Stats();
+            EXPECT_EQ(stats.notes, 1u);
+            EXPECT_EQ(stats.expired, 100u);
+            EXPECT_EQ(Exported(store), 1u);
+        }
+
+        TEST(NoteStoreTest, SweepRunsOnItsOwn) {
+            NoteLimits limits;
+            limits.ttl = std::chrono::seconds(1);
+            NoteStore store(limits);
+            Post(&store, 1, 1, "soon gone");
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (store.Stats().notes != 0 && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            EXPECT_EQ(store.Stats().notes, 0u);
+            EXPECT_EQ(store.Stats().expired, 1u);
+        }
+
+        TEST(NoteStoreTest, NoTtlKeepsOldNotes) {
+            NoteStore store;
+            store.Restore(MakeNote(1, 1, "old"), std::chrono::hours(24 * 365));
+            store.Sweep();
+            EXPECT_EQ(Post(&store, 1, 1, "new"), (std::vector<std::string>{ "old" }));
+        }
+
+    }  // namespace
+}  // namespace routeguide
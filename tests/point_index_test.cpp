@@ -0,0 +1,58 @@
+#include "point_index.h"
+
+#include <gtest/gtest.h>
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        TEST(PointIndexTest, EmptyIndexFindsNothing) {
+            PointIndex index;
+            EXPECT_EQ(index.Find(0, 0), PointIndex::kNotFound);
+            FeatureStore store;
+            index.Build(store);
+            EXPECT_EQ(index.Find(0, 0), PointIndex::kNotFound);
+            EXPECT_EQ(index.size(), 0u);
+        }
+
+        TEST(PointIndexTest, FirstFeatureAtAPointWins) {
+            FeatureStore store;
+            store.Add(10, 20, "first");
+            store.Add(30, 40, "other");
+            store.Add(10, 20, "second");
+            PointIndex index;
+            index.Build(store);
+            EXPECT_EQ(index.size(), 2u);
+            EXPECT_EQ(index.Find(10, 20), 0u);
+            EXPECT_EQ(index.Find(30, 40), 1u);
+            EXPECT_EQ(index.Find(20, 10), PointIndex::kNotFound);
+            EXPECT_EQ(index.Find(10, 21), PointIndex::kNotFound);
+        }
+
+        TEST(PointIndexTest, MatchesLinearScan) {
+            FeatureStore store;
+            FillSyntheticStore(20000, 2, &store);
+            PointIndex index;
+            index.Build(store);
+            for (size_t i = 0; i < store.size(); i++) {
+                uint32_t expected = 0;
+                while (store.latitude(expected) != store.latitude(i) ||
+                    store.longitude(expected) != store.longitude(i)) {
+                    expected++;
+                }
+                ASSERT_EQ(index.Find(store.latitude(i), store.longitude(i)), expected) << i;
+            }
+            // Points next to stored ones.
+            for (size_t i = 0; i < 1000; i++) {
+                int32_t latitude = store.latitude(i) + 1;
+                int32_t longitude = store.longitude(i);
+                bool present = false;
+                for (size_t j = 0; j < store.size() && !present; j++) {
+                    present = store.latitude(j) == latitude && store.longitude(j) == longitude;
+                }
+                EXPECT_EQ(index.Find(latitude, longitude) != PointIndex::kNotFound, present);
+            }
+        }
+
+    }  // namespace
+}  // namespace routeguide
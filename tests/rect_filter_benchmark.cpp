@@ -0,0 +1,111 @@
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include "rect_filter.h"
+#include "route_guide.pb.h"
+
+namespace routeguide {
+    namespace {
+
+        // range(0) points spread over the world, in two columns, and a
+        // rectangle holding about 1% of them.
+        struct Points {
+            explicit Points(size_t count) : latitudes(count), longitudes(count) {
+                std::mt19937 rng(5);
+                std::uniform_int_distribution<int32_t> latitude(-900000000, 900000000);
+                std::uniform_int_distribution<int32_t> longitude(-1800000000, 1800000000);
+                for (size_t i = 0; i < count; i++) {
+                    latitudes[i] = latitude(rng);
+                    longitudes[i] = longitude(rng);
+                }
+            }
+            std::vector<int32_t> latitudes;
+            std::vector<int32_t> longitudes;
+        };
+
+        const Bounds kBounds = { -180000000, 180000000, -90000000, 90000000 };
+
+        const Points& SharedPoints(size_t count) {
+            static size_t shared_count = 0;
+            static Points* shared = nullptr;
+            if (shared_count != count) {
+                delete shared;
+                shared = new Points(count);
+                shared_count = count;
+            }
+            return *shared;
+        }
+
+        // What ListFeatures did before the column store: one Feature message
+        // per point, tested field by field.
+        void BM_FilterFeatureMessages(benchmark::State& state) {
+            const Points& points = SharedPoints(state.range(0));
+            std::vector<Feature> features(points.latitudes.size());
+            for (size_t i = 0; i < features.size(); i++) {
+                features[i].mutable_location()->set_latitude(points.latitudes[i]);
+                features[i].mutable_location()->set_longitude(points.longitudes[i]);
+            }
+            std::vector<uint32_t> matches;
+            for (auto _ : state) {
+                matches.clear();
+                for (uint32_t i = 0; i < features.size(); i++) {
+                    const Point& p = features[i].location();
+                    if (p.longitude() >= kBounds.left && p.longitude() <= kBounds.right &&
+                        p.latitude() >= kBounds.bottom && p.latitude() <= kBounds.top) {
+                        matches.push_back(i);
+                    }
+                }
+                benchmark::DoNotOptimize(matches.data());
+            }
+            state.SetItemsProcessed(state.iterations() * features.size());
+        }
+        BENCHMARK(BM_FilterFeatureMessages)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+
+        // The same test as a plain branchy loop over the columns.
+        void BM_FilterColumnsLoop(benchmark::State& state) {
+            const Points& points = SharedPoints(state.range(0));
+            uint32_t count = static_cast<uint32_t>(points.latitudes.size());
+            std::vector<uint32_t> matches;
+            for (auto _ : state) {
+                matches.clear();
+                for (uint32_t i = 0; i < count; i++) {
+                    int32_t latitude = points.latitudes[i];
+                    int32_t longitude = points.longitudes[i];
+                    if (longitude >= kBounds.left && longitude <= kBounds.right &&
+                        latitude >= kBounds.bottom && latitude <= kBounds.top) {
+                        matches.push_back(i);
+                    }
+                }
+                benchmark::DoNotOptimize(matches.data());
+            }
+            state.SetItemsProcessed(state.iterations() * count);
+        }
+        BENCHMARK(BM_FilterColumnsLoop)
+            ->Arg(1 << 20)->Arg(1 << 24)->Arg(100000000)->Unit(benchmark::kMillisecond);
+
+        void FilterWith(benchmark::State& state, const char* kernel) {
+            const Points& points = SharedPoints(state.range(0));
+            uint32_t count = static_cast<uint32_t>(points.latitudes.size());
+            std::vector<uint32_t> matches;
+            for (auto _ : state) {
+                matches.clear();
+                if (!FilterRectWith(kernel, points.latitudes.data(), points.longitudes.data(),
+                    0, count, kBounds, &matches)) {
+                    state.SkipWithError("kernel not supported on this CPU");
+                    break;
+                }
+                benchmark::DoNotOptimize(matches.data());
+            }
+            state.SetItemsProcessed(state.iterations() * count);
+        }
+        BENCHMARK_CAPTURE(FilterWith, scalar, "scalar")
+            ->Arg(1 << 20)->Arg(1 << 24)->Arg(100000000)->Unit(benchmark::kMillisecond);
+        BENCHMARK_CAPTURE(FilterWith, sse2, "sse2")
+            ->Arg(1 << 20)->Arg(1 << 24)->Arg(100000000)->Unit(benchmark::kMillisecond);
+        BENCHMARK_CAPTURE(FilterWith, avx2, "avx2")
+            ->Arg(1 << 20)->Arg(1 << 24)->Arg(100000000)->Unit(benchmark::kMillisecond);
+
+    }  // namespace
+}  // namespace routeguide
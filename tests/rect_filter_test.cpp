@@ -0,0 +1,54 @@
+#include "rect_filter.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace routeguide {
+    namespace {
+
+        // Every kernel the CPU runs must return what the scalar one does, for
+        // ranges that do and do not fill whole vectors.
+        TEST(RectFilterTest, KernelsAgree) {
+            std::mt19937 rng(3);
+            std::uniform_int_distribution<int32_t> coordinate(-20, 20);
+            std::vector<int32_t> latitudes(1000), longitudes(1000);
+            for (size_t i = 0; i < latitudes.size(); i++) {
+                latitudes[i] = coordinate(rng);
+                longitudes[i] = coordinate(rng);
+            }
+            const Bounds bounds[] = {
+                { -5, 5, -5, 5 },
+                { 0, 0, 0, 0 },
+                { INT32_MIN, INT32_MAX, INT32_MIN, INT32_MAX },
+                { 5, -5, -5, 5 },
+            };
+            for (const Bounds& b : bounds) {
+                for (uint32_t begin : { 0u, 3u, 17u }) {
+                    for (uint32_t end : { 0u, 7u, 8u, 999u, 1000u }) {
+                        std::vector<uint32_t> expected = { 12345 };
+                        ASSERT_TRUE(FilterRectWith("scalar", latitudes.data(),
+                            longitudes.data(), begin, end, b, &expected));
+                        for (const char* kernel : { "sse2", "avx2" }) {
+                            std::vector<uint32_t> matches = { 12345 };
+                            if (FilterRectWith(kernel, latitudes.data(), longitudes.data(),
+                                begin, end, b, &matches)) {
+                                EXPECT_EQ(matches, expected) << kernel;
+                            }
+                        }
+                        std::vector<uint32_t> matches = { 12345 };
+                        FilterRect(latitudes.data(), longitudes.data(), begin, end, b, &matches);
+                        EXPECT_EQ(matches, expected);
+                    }
+                }
+            }
+            std::vector<uint32_t> matches;
+            EXPECT_FALSE(FilterRectWith("neon", latitudes.data(), longitudes.data(), 0, 8,
+                bounds[0], &matches));
+            EXPECT_TRUE(matches.empty());
+        }
+
+    }  // namespace
+}  // namespace routeguide
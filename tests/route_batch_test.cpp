@@ -0,0 +1,267 @@
+#include "route_batch.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "route_guide_state.h"
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        struct RoutePoint {
+            int32_t latitude;
+            int32_t longitude;
+        };
+
+        // Encodes the route into batches of at most batch_points points.
+        std::vector<RouteBatch> Encode(const std::vector<RoutePoint>& route,
+            size_t batch_points, bool with_times) {
+            RouteBatchEncoder encoder;
+            std::vector<RouteBatch> batches;
+            for (size_t i = 0; i < route.size(); i++) {
+                if (i % batch_points == 0) {
+                    batches.emplace_back();
+                }
+                if (with_times) {
+                    encoder.Add(route[i].latitude, route[i].longitude,
+                        1700000000000 + static_cast<int64_t>(i) * 1000, &batches.back());
+                }
+                else {
+                    encoder.Add(route[i].latitude, route[i].longitude, &batches.back());
+                }
+            }
+            return batches;
+        }
+
+        // Decodes the batches, each through the wire, in pieces of at most
+        // piece points.
+        std::vector<RoutePoint> Decode(const std::vector<RouteBatch>& batches,
+            int piece) {
+            RouteBatchDecoder decoder;
+            std::vector<RoutePoint> route;
+            for (const RouteBatch& sent : batches) {
+                RouteBatch batch;
+                EXPECT_TRUE(batch.ParseFromString(sent.SerializeAsString()));
+                std::string error;
+                EXPECT_TRUE(RouteBatchDecoder::Check(batch, &error)) << error;
+                int n = batch.latitude_deltas_size();
+                for (int begin = 0; begin < n; begin += piece) {
+                    int end = (std::min)(begin + piece, n);
+                    std::vector<int32_t> latitudes(end - begin), longitudes(end - begin);
+                    decoder.Decode(batch, begin, end, latitudes.data(), longitudes.data());
+                    for (int i = 0; i < end - begin; i++) {
+                        route.push_back({ latitudes[i], longitudes[i] });
+                    }
+                }
+            }
+            return route;
+        }
+
+        void ExpectSameRoute(const std::vector<RoutePoint>& a,
+            const std::vector<RoutePoint>& b) {
+            ASSERT_EQ(a.size(), b.size());
+            for (size_t i = 0; i < a.size(); i++) {
+                EXPECT_EQ(a[i].latitude, b[i].latitude) << "point " << i;
+                EXPECT_EQ(a[i].longitude, b[i].longitude) << "point " << i;
+            }
+        }
+
+        TEST(RouteBatchTest, ExtremeStepsRoundTrip) {
+            // Every step between the int32 limits, both ways, wraps.
+            std::vector<RoutePoint> route = {
+                { INT32_MIN, INT32_MAX }, { INT32_MAX, INT32_MIN },
+                { INT32_MIN, INT32_MIN }, { INT32_MAX, INT32_MAX },
+                { 0, 0 }, { -1, 1 }, { INT32_MAX, -1 }, { INT32_MIN, 0 },
+                { 900000000, -1800000000 }, { -900000000, 1800000000 },
+            };
+            for (size_t batch_points : { 1, 3, 100 }) {
+                for (int piece : { 1, 2, 100 }) {
+                    ExpectSameRoute(Decode(Encode(route, batch_points, false), piece), route);
+                    ExpectSameRoute(Decode(Encode(route, batch_points, true), piece), route);
+                }
+            }
+        }
+
+        TEST(RouteBatchTest, RandomRoutesRoundTrip) {
+            std::mt19937 rng(11);
+            std::uniform_int_distribution<int32_t> any(INT32_MIN, INT32_MAX);
+            std::uniform_int_distribution<int32_t> step(-10000, 10000);
+            std::vector<RoutePoint> route;
+            RoutePoint at = { 407000000, -740000000 };
+            for (int i = 0; i < 5000; i++) {
+                if (rng() % 50 == 0) {
+                    at = { any(rng), any(rng) };
+                }
+                else {
+                    at.latitude += step(rng);
+                    at.longitude += step(rng);
+                }
+                route.push_back(at);
+            }
+            ExpectSameRoute(Decode(Encode(route, 333, true), 64), route);
+        }
+
+        TEST(RouteBatchTest, SmallStepsTakeTwoBytes) {
+            std::vector<RoutePoint> route;
+            for (int i = 0; i < 100; i++) {
+                route.push_back({ 407000000 + i * 8191, -740000000 - i * 8191 });
+            }
+            std::vector<RouteBatch> batches = Encode(route, 100, false);
+            ASSERT_EQ(batches.size(), 1u);
+            // Only the steps: the first point is a long way from (0, 0).
+            batches[0].mutable_latitude_deltas()->Set(0, 0);
+            batches[0].mutable_longitude_deltas()->Set(0, 0);
+            // Two packed fields of 100 two-byte varints, each with a tag and
+            // a two-byte length, give or take the zeros.
+            EXPECT_LE(batches[0].ByteSizeLong(), 2u * (3 + 200));
+        }
+
+        TEST(RouteBatchTest, EmptyBatchesAreValid) {
+            std::vector<RoutePoint> route = { { 1, 2 }, { 3, 4 } };
+            std::vector<RouteBatch> batches(1);
+            std::vector<RouteBatch> encoded = Encode(route, 1, true);
+            batches.push_back(encoded[0]);
+            batches.emplace_back();
+            batches.emplace_back();
+            batches.push_back(encoded[1]);
+            batches.emplace_back();
+            ExpectSameRoute(Decode(batches, 8), route);
+            EXPECT_TRUE(Decode(std::vector<RouteBatch>(3), 8).empty());
+        }
+
+        TEST(RouteBatchTest, RejectsMismatchedCounts) {
+            std::string error;
+            RouteBatch batch;
+            batch.add_latitude_deltas(1);
+            EXPECT_FALSE(RouteBatchDecoder::Check(batch, &error));
+            EXPECT_EQ(error, "RouteBatch has 1 latitude deltas but 0 longitude deltas");
+            batch.add_longitude_deltas(1);
+            EXPECT_TRUE(RouteBatchDecoder::Check(batch, &error));
+            batch.add_longitude_deltas(1);
+            EXPECT_FALSE(RouteBatchDecoder::Check(batch, &error));
+            batch.add_latitude_deltas(1);
+            batch.add_time_deltas_millis(5);
+            EXPECT_FALSE(RouteBatchDecoder::Check(batch, &error));
+            EXPECT_EQ(error, "RouteBatch has 1 time deltas for 2 points");
+            batch.add_time_deltas_millis(5);
+            EXPECT_TRUE(RouteBatchDecoder::Check(batch, &error));
+            batch.add_time_deltas_millis(5);
+            EXPECT_FALSE(RouteBatchDecoder::Check(batch, &error));
+        }
+
+        TEST(RouteBatchTest, TruncatedBatchesAreRejected) {
+            std::vector<RoutePoint> route;
+            for (int i = 0; i < 50; i++) {
+                route.push_back({ i * 100000, -i * 3000000 });
+            }
+            for (bool with_times : { false, true }) {
+                RouteBatch full = Encode(route, 50, with_times)[0];
+                std::string bytes = full.SerializeAsString();
+                // Cut after the longitudes, a batch without times is well
+                // formed; the route itself then mixes the two, which only
+                // loses the times the summary ignores.
+                RouteBatch without_times = full;
+                without_times.clear_time_deltas_millis();
+                size_t points_end = without_times.ByteSizeLong();
+                for (size_t size = 1; size < bytes.size(); size++) {
+                    if (with_times && size == points_end) {
+                        continue;
+                    }
+                    RouteBatch batch;
+                    std::string error;
+                    EXPECT_FALSE(batch.ParseFromString(bytes.substr(0, size)) &&
+                        RouteBatchDecoder::Check(batch, &error))
+                        << size << " of " << bytes.size() << " bytes";
+                }
+            }
+        }
+
+        class RecordRouteTest : public ::testing::TestWithParam<size_t> {
+        protected:
+            void SetUp() override {
+                path_ = (std::filesystem::temp_directory_path() /
+                    ("routeguide_route_batch_test_" + std::to_string(GetParam()) +
+                        ".json")).string();
+                FeatureStore store;
+                FillSyntheticStore(2000, 3, &store, 406000000, 408000000, -741000000,
+                    -739000000);
+                std::ofstream(path_, std::ios::binary) << SyntheticJson(store);
+                for (size_t i = 0; i < store.size(); i += 7) {
+                    route_.push_back({ store.latitude(i), store.longitude(i) });
+                    route_.push_back({ store.latitude(i) + 3, store.longitude(i) - 2 });
+                }
+            }
+
+            void TearDown() override {
+                std::filesystem::remove(path_);
+            }
+
+            std::string path_;
+            std::vector<RoutePoint> route_;
+        };
+
+        TEST_P(RecordRouteTest, BatchedSummaryMatchesRecordRoute) {
+            RouteGuideOptions options;
+            options.route_batch_points = 37;
+            options.route_workers = GetParam();
+            RouteGuideState state(path_, options);
+
+            RouteSummary expected;
+            {
+                RouteRecorder recorder(state);
+                Point point;
+                for (const RoutePoint& p : route_) {
+                    point.set_latitude(p.latitude);
+                    point.set_longitude(p.longitude);
+                    recorder.Add(point);
+                }
+                recorder.Finish(&expected);
+            }
+            ASSERT_EQ(expected.point_count(), static_cast<int32_t>(route_.size()));
+            ASSERT_GT(expected.feature_count(), 0);
+            ASSERT_GT(expected.distance(), 0);
+
+            // Batches that straddle the recorder's own, and empty ones.
+            for (size_t batch_points : { 1, 10, 37, 100, 5000 }) {
+                RouteRecorder recorder(state);
+                std::string error;
+                ASSERT_TRUE(recorder.Add(RouteBatch(), &error)) << error;
+                for (const RouteBatch& batch : Encode(route_, batch_points, true)) {
+                    ASSERT_TRUE(recorder.Add(batch, &error)) << error;
+                }
+                RouteSummary summary;
+                recorder.Finish(&summary);
+                EXPECT_EQ(summary.point_count(), expected.point_count()) << batch_points;
+                EXPECT_EQ(summary.feature_count(), expected.feature_count())
+                    << batch_points;
+                EXPECT_EQ(summary.distance(), expected.distance()) << batch_points;
+            }
+        }
+
+        TEST_P(RecordRouteTest, MalformedBatchIsRejected) {
+            RouteGuideOptions options;
+            options.route_workers = GetParam();
+            RouteGuideState state(path_, options);
+            RouteRecorder recorder(state);
+            RouteBatch batch;
+            batch.add_latitude_deltas(1);
+            std::string error;
+            EXPECT_FALSE(recorder.Add(batch, &error));
+            EXPECT_FALSE(error.empty());
+            RouteSummary summary;
+            recorder.Finish(&summary);
+            EXPECT_EQ(summary.point_count(), 0);
+        }
+
+        INSTANTIATE_TEST_SUITE_P(Workers, RecordRouteTest, ::testing::Values(0, 3));
+
+    }  // namespace
+}  // namespace routeguide
@@ -0,0 +1,551 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/client_context.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <gtest/gtest.h>
+#include "async_server.h"
+#include "route_batch.h"
+#include "route_guide.grpc.pb.h"
+#include "route_guide_impl.h"
+#include "route_guide_state.h"
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        const size_t kFeatures = 20000;
+        const int32_t kSouth = 400000000, kNorth = 410000000;
+        const int32_t kWest = -750000000, kEast = -740000000;
+
+        // One RouteGuide server on its own state, reached through an
+        // in-process channel: RouteGuideImpl when completion_queues is 0,
+        // else the completion-queue server.
+        class TestServer {
+        public:
+            TestServer(const std::string& db_path, int completion_queues,
+                const RouteGuideOptions& options = RouteGuideOptions()) {
+                state_.reset(new RouteGuideState(db_path, options));
+                std::shared_ptr<grpc::Channel> channel;
+                if (completion_queues == 0) {
+                    impl_.reset(new RouteGuideImpl(state_.get()));
+                    grpc::ServerBuilder builder;
+                    builder.RegisterService(impl_.get());
+                    server_ = builder.BuildAndStart();
+                    channel = server_->InProcessChannel(grpc::ChannelArguments());
+                }
+                else {
+                    async_.reset(new AsyncRouteGuideServer(state_.get(), completion_queues));
+                    EXPECT_TRUE(async_->Start(""));
+                    channel = async_->InProcessChannel();
+                }
+                stub_ = RouteGuide::NewStub(channel);
+            }
+
+            ~TestServer() {
+                stub_.reset();
+                if (server_ != nullptr) {
+                    server_->Shutdown(std::chrono::system_clock::now() +
+                        std::chrono::seconds(1));
+                    server_.reset();
+                }
+                async_.reset();
+            }
+
+            RouteGuide::Stub* stub() { return stub_.get(); }
+
+        private:
+            std::unique_ptr<RouteGuideState> state_;
+            std::unique_ptr<RouteGuideImpl> impl_;
+            std::unique_ptr<grpc::Server> server_;
+            std::unique_ptr<AsyncRouteGuideServer> async_;
+            std::unique_ptr<RouteGuide::Stub> stub_;
+        };
+
+        Point MakePoint(int32_t latitude, int32_t longitude) {
+            Point point;
+            point.set_latitude(latitude);
+            point.set_longitude(longitude);
+            return point;
+        }
+
+        // Messages compare by their bytes.
+        template <typename Message>
+        std::vector<std::string> Serialized(const std::vector<Message>& messages) {
+            std::vector<std::string> bytes;
+            for (const Message& message : messages) {
+                bytes.push_back(message.SerializeAsString());
+            }
+            return bytes;
+        }
+
+        // Runs every test against the synchronous and callback RouteGuideImpl,
+        // which is also the baseline, and the completion-queue server.
+        class RouteGuideServerTest : public ::testing::TestWithParam<int> {
+        protected:
+            static void SetUpTestSuite() {
+                path_ = new std::string((std::filesystem::temp_directory_path() /
+                    "routeguide_server_test.json").string());
+                store_ = new FeatureStore();
+                FillSyntheticStore(kFeatures, 21, store_, kSouth, kNorth, kWest, kEast);
+                std::ofstream(*path_, std::ios::binary) << SyntheticJson(*store_);
+            }
+
+            static void TearDownTestSuite() {
+                std::filesystem::remove(*path_);
+                delete path_;
+                delete store_;
+            }
+
+            void SetUp() override {
+                baseline_.reset(new TestServer(*path_, 0));
+                server_.reset(new TestServer(*path_, GetParam()));
+            }
+
+            // Features and a few points with none, all in the DB's box.
+            std::vector<Point> SomePoints(uint32_t seed, size_t count) const {
+                std::mt19937 rng(seed);
+                std::vector<Point> points;
+                for (size_t i = 0; i < count; i++) {
+                    if (rng() % 4 == 0) {
+                        points.push_back(MakePoint(kSouth + static_cast<int32_t>(rng() %
+                            (kNorth - kSouth)), kWest + static_cast<int32_t>(rng() %
+                                (kEast - kWest))));
+                    }
+                    else {
+                        size_t k = rng() % store_->size();
+                        points.push_back(MakePoint(store_->latitude(k),
+                            store_->longitude(k)));
+                    }
+                }
+                return points;
+            }
+
+            // Every page of a listing, with the status of the last call.
+            static grpc::Status ListAll(RouteGuide::Stub* stub, Rectangle request,
+                std::vector<Feature>* features, size_t* pages) {
+                *pages = 0;
+                while (true) {
+                    grpc::ClientContext context;
+                    auto reader = stub->ListFeatures(&context, request);
+                    Feature feature;
+                    while (reader->Read(&feature)) {
+                        features->push_back(feature);
+                    }
+                    grpc::Status status = reader->Finish();
+                    (*pages)++;
+                    if (!status.ok()) {
+                        return status;
+                    }
+                    const auto& trailers = context.GetServerTrailingMetadata();
+                    auto token = trailers.find(kNextPageTokenKey);
+                    if (token == trailers.end()) {
+                        return status;
+                    }
+                    request.set_page_token(std::string(token->second.data(),
+                        token->second.size()));
+                }
+            }
+
+            static RouteSummary Record(RouteGuide::Stub* stub,
+                const std::vector<Point>& route) {
+                grpc::ClientContext context;
+                RouteSummary summary;
+                auto writer = stub->RecordRoute(&context, &summary);
+                for (const Point& point : route) {
+                    EXPECT_TRUE(writer->Write(point));
+                }
+                writer->WritesDone();
+                EXPECT_TRUE(writer->Finish().ok());
+                return summary;
+            }
+
+            static RouteSummary RecordBatched(RouteGuide::Stub* stub,
+                const std::vector<Point>& route, size_t batch_points) {
+                grpc::ClientContext context;
+                RouteSummary summary;
+                auto writer = stub->RecordRouteBatched(&context, &summary);
+                RouteBatchEncoder encoder;
+                RouteBatch batch;
+                for (size_t i = 0; i < route.size(); i++) {
+                    encoder.Add(route[i].latitude(), route[i].longitude(), &batch);
+                    if (batch.latitude_deltas_size() == static_cast<int>(batch_points) ||
+                        i + 1 == route.size()) {
+                        EXPECT_TRUE(writer->Write(batch));
+                        batch.Clear();
+                    }
+                }
+                writer->WritesDone();
+                EXPECT_TRUE(writer->Finish().ok());
+                return summary;
+            }
+
+            // Posts the notes on one stream while another thread reads the
+            // replies, as a client must once the replies outgrow the flow
+            // control window.
+            static std::vector<RouteNote> Chat(RouteGuide::Stub* stub,
+                const std::vector<RouteNote>& notes) {
+                grpc::ClientContext context;
+                auto stream = stub->RouteChat(&context);
+                std::vector<RouteNote> replies;
+                std::thread reader([&stream, &replies] {
+                    RouteNote reply;
+                    while (stream->Read(&reply)) {
+                        replies.push_back(reply);
+                    }
+                });
+                for (const RouteNote& note : notes) {
+                    EXPECT_TRUE(stream->Write(note));
+                }
+                stream->WritesDone();
+                reader.join();
+                EXPECT_TRUE(stream->Finish().ok());
+                return replies;
+            }
+
+            static std::string* path_;
+            static FeatureStore* store_;
+            std::unique_ptr<TestServer> baseline_;
+            std::unique_ptr<TestServer> server_;
+        };
+
+        std::string* RouteGuideServerTest::path_ = nullptr;
+        FeatureStore* RouteGuideServerTest::store_ = nullptr;
+
+        TEST_P(RouteGuideServerTest, GetFeature) {
+            for (const Point& point : SomePoints(1, 300)) {
+                Feature expected, feature;
+                {
+                    grpc::ClientContext context;
+                    ASSERT_TRUE(baseline_->stub()->GetFeature(&context, point,
+                        &expected).ok());
+                }
+                grpc::ClientContext context;
+                ASSERT_TRUE(server_->stub()->GetFeature(&context, point, &feature).ok());
+                EXPECT_EQ(feature.SerializeAsString(), expected.SerializeAsString());
+                EXPECT_EQ(feature.location().SerializeAsString(),
+                    point.SerializeAsString());
+            }
+        }
+
+        TEST_P(RouteGuideServerTest, GetFeaturesAndStreamFeatures) {
+            PointList points;
+            for (const Point& point : SomePoints(2, 500)) {
+                *points.add_points() = point;
+            }
+            FeatureList expected, features;
+            {
+                grpc::ClientContext context;
+                ASSERT_TRUE(baseline_->stub()->GetFeatures(&context, points,
+                    &expected).ok());
+            }
+            ASSERT_EQ(expected.features_size(), points.points_size());
+            {
+                grpc::ClientContext context;
+                ASSERT_TRUE(server_->stub()->GetFeatures(&context, points,
+                    &features).ok());
+            }
+            EXPECT_EQ(features.SerializeAsString(), expected.SerializeAsString());
+
+            // The same points in lists of 1, 7 and 100 on one stream.
+            grpc::ClientContext context;
+            auto stream = server_->stub()->StreamFeatures(&context);
+            int next = 0;
+            for (int size : { 1, 7, 100, 392 }) {
+                PointList part;
+                for (int i = 0; i < size; i++) {
+                    *part.add_points() = points.points(next + i);
+                }
+                ASSERT_TRUE(stream->Write(part));
+                FeatureList answer;
+                ASSERT_TRUE(stream->Read(&answer));
+                ASSERT_EQ(answer.features_size(), size);
+                for (int i = 0; i < size; i++) {
+                    EXPECT_EQ(answer.features(i).SerializeAsString(),
+                        expected.features(next + i).SerializeAsString());
+                }
+                next += size;
+            }
+            stream->WritesDone();
+            EXPECT_TRUE(stream->Finish().ok());
+        }
+
+        TEST_P(RouteGuideServerTest, ListFeatures) {
+            for (Rectangle::Order order :
+                { Rectangle::DB_ORDER, Rectangle::DISTANCE_FROM_CENTER }) {
+                Rectangle request;
+                *request.mutable_lo() = MakePoint(402000000, -748000000);
+                *request.mutable_hi() = MakePoint(406000000, -745000000);
+                request.set_order(order);
+                std::vector<Feature> expected;
+                size_t pages = 0;
+                ASSERT_TRUE(ListAll(baseline_->stub(), request, &expected, &pages).ok());
+                ASSERT_EQ(pages, 1u);
+                ASSERT_GT(expected.size(), 1000u);
+                if (order == Rectangle::DB_ORDER) {
+                    // Store order, every feature in the rectangle.
+                    std::vector<Feature> scanned;
+                    for (size_t i = 0; i < store_->size(); i++) {
+                        if (store_->latitude(i) >= 402000000 &&
+                            store_->latitude(i) <= 406000000 &&
+                            store_->longitude(i) >= -748000000 &&
+                            store_->longitude(i) <= -745000000) {
+                            scanned.emplace_back();
+                            store_->CopyTo(i, &scanned.back());
+                        }
+                    }
+                    EXPECT_EQ(Serialized(expected), Serialized(scanned));
+                }
+                for (int32_t max_results : { 0, 1, 97, 1000000 }) {
+                    request.set_max_results(max_results);
+                    std::vector<Feature> features;
+                    ASSERT_TRUE(ListAll(server_->stub(), request, &features, &pages).ok());
+                    EXPECT_EQ(Serialized(features), Serialized(expected))
+                        << "order " << order << ", max_results " << max_results;
+                    if (max_results == 97) {
+                        EXPECT_EQ(pages, (expected.size() + 96) / 97);
+                    }
+                }
+            }
+        }
+
+        TEST_P(RouteGuideServerTest, ListFeaturesRejectsBadRequests) {
+            Rectangle request;
+            *request.mutable_lo() = MakePoint(kSouth, kWest);
+            *request.mutable_hi() = MakePoint(kNorth, kEast);
+            request.set_max_results(10);
+            for (const char* token : { "near:0:1", "db:x", "db:99999999" }) {
+                request.set_page_token(token);
+                std::vector<Feature> features;
+                size_t pages = 0;
+                EXPECT_EQ(ListAll(server_->stub(), request, &features, &pages)
+                    .error_code(), grpc::StatusCode::INVALID_ARGUMENT) << token;
+                EXPECT_TRUE(features.empty());
+            }
+            request.set_page_token("");
+            request.set_max_results(-1);
+            std::vector<Feature> features;
+            size_t pages = 0;
+            EXPECT_EQ(ListAll(server_->stub(), request, &features, &pages).error_code(),
+                grpc::StatusCode::INVALID_ARGUMENT);
+        }
+
+        TEST_P(RouteGuideServerTest, ListFeaturesStopsWhenCancelled) {
+            Rectangle request;
+            *request.mutable_lo() = MakePoint(kSouth, kWest);
+            *request.mutable_hi() = MakePoint(kNorth, kEast);
+            for (int round = 0; round < 5; round++) {
+                grpc::ClientContext context;
+                auto reader = server_->stub()->ListFeatures(&context, request);
+                Feature feature;
+                size_t read = 0;
+                for (int i = 0; i < 10 * round + 1; i++) {
+                    ASSERT_TRUE(reader->Read(&feature));
+                    read++;
+                }
+                context.TryCancel();
+                while (reader->Read(&feature)) {
+                    read++;
+                }
+                // Unless the whole page was already on its way.
+                grpc::Status status = reader->Finish();
+                if (status.ok()) {
+                    EXPECT_EQ(read, kFeatures);
+                }
+                else {
+                    EXPECT_EQ(status.error_code(), grpc::StatusCode::CANCELLED);
+                }
+            }
+            // The server carries on.
+            std::vector<Feature> features;
+            size_t pages = 0;
+            ASSERT_TRUE(ListAll(server_->stub(), request, &features, &pages).ok());
+            EXPECT_EQ(features.size(), kFeatures);
+        }
+
+        TEST_P(RouteGuideServerTest, RecordRoute) {
+            std::vector<Point> route = SomePoints(3, 3000);
+            RouteSummary expected = Record(baseline_->stub(), route);
+            EXPECT_EQ(expected.point_count(), 3000);
+            EXPECT_GT(expected.feature_count(), 0);
+            EXPECT_GT(expected.distance(), 0);
+            for (const RouteSummary& summary : { Record(server_->stub(), route),
+                RecordBatched(server_->stub(), route, 1),
+                RecordBatched(server_->stub(), route, 500),
+                RecordBatched(baseline_->stub(), route, 5000) }) {
+                EXPECT_EQ(summary.point_count(), expected.point_count());
+                EXPECT_EQ(summary.feature_count(), expected.feature_count());
+                EXPECT_EQ(summary.distance(), expected.distance());
+            }
+            EXPECT_EQ(Record(server_->stub(), {}).point_count(), 0);
+        }
+
+        TEST_P(RouteGuideServerTest, RecordRouteBatchedRejectsMalformedBatches) {
+            grpc::ClientContext context;
+            RouteSummary summary;
+            auto writer = server_->stub()->RecordRouteBatched(&context, &summary);
+            RouteBatch batch;
+            batch.add_latitude_deltas(1);
+            batch.add_longitude_deltas(1);
+            writer->Write(batch);
+            batch.add_latitude_deltas(2);
+            writer->Write(batch);
+            writer->WritesDone();
+            EXPECT_EQ(writer->Finish().error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+        }
+
+        TEST_P(RouteGuideServerTest, RouteChat) {
+            std::mt19937 rng(4);
+            std::vector<RouteNote> notes;
+            std::map<std::pair<int32_t, int32_t>, std::vector<std::string>> posted;
+            std::vector<std::string> expected;
+            for (int i = 0; i < 300; i++) {
+                RouteNote note;
+                int32_t latitude = static_cast<int32_t>(rng() % 12);
+                int32_t longitude = -latitude;
+                *note.mutable_location() = MakePoint(latitude, longitude);
+                note.set_message("note " + std::to_string(i));
+                notes.push_back(note);
+                std::vector<std::string>& earlier = posted[{ latitude, longitude }];
+                expected.insert(expected.end(), earlier.begin(), earlier.end());
+                earlier.push_back(note.message());
+            }
+            std::vector<RouteNote> baseline_replies = Chat(baseline_->stub(), notes);
+            std::vector<RouteNote> replies = Chat(server_->stub(), notes);
+            std::vector<std::string> messages;
+            for (const RouteNote& reply : replies) {
+                messages.push_back(reply.message());
+            }
+            EXPECT_EQ(messages, expected);
+            EXPECT_EQ(Serialized(replies), Serialized(baseline_replies));
+
+            // A second stream sees the first one's notes.
+            RouteNote again = notes[0];
+            again.set_message("again");
+            std::vector<RouteNote> later = Chat(server_->stub(), { again });
+            std::pair<int32_t, int32_t> at(again.location().latitude(),
+                again.location().longitude());
+            EXPECT_EQ(later.size(), posted[at].size());
+        }
+
+        TEST_P(RouteGuideServerTest, RouteChatDeliversLiveNotes) {
+            RouteGuideOptions options;
+            options.live_note_queue = 64;
+            TestServer server(*path_, GetParam(), options);
+            RouteNote note;
+            *note.mutable_location() = MakePoint(7, -7);
+
+            grpc::ClientContext a_context;
+            auto a = server.stub()->RouteChat(&a_context);
+            note.set_message("a1");
+            ASSERT_TRUE(a->Write(note));
+            note.set_message("a2");
+            ASSERT_TRUE(a->Write(note));
+            // The reply to a2 shows that a is subscribed.
+            RouteNote reply;
+            ASSERT_TRUE(a->Read(&reply));
+            EXPECT_EQ(reply.message(), "a1");
+
+            grpc::ClientContext b_context;
+            auto b = server.stub()->RouteChat(&b_context);
+            note.set_message("b1");
+            ASSERT_TRUE(b->Write(note));
+            ASSERT_TRUE(b->Read(&reply));
+            EXPECT_EQ(reply.message(), "a1");
+            ASSERT_TRUE(b->Read(&reply));
+            EXPECT_EQ(reply.message(), "a2");
+            // a never posted here, so it does not hear of this one.
+            RouteNote elsewhere;
+            *elsewhere.mutable_location() = MakePoint(8, -8);
+            elsewhere.set_message("b2");
+            ASSERT_TRUE(b->Write(elsewhere));
+            note.set_message("b3");
+            ASSERT_TRUE(b->Write(note));
+            ASSERT_TRUE(b->Read(&reply));
+            EXPECT_EQ(reply.message(), "a1");
+            ASSERT_TRUE(b->Read(&reply));
+            EXPECT_EQ(reply.message(), "a2");
+            ASSERT_TRUE(b->Read(&reply));
+            EXPECT_EQ(reply.message(), "b1");
+
+            // a gets b's notes at its location live, in order.
+            ASSERT_TRUE(a->Read(&reply));
+            EXPECT_EQ(reply.message(), "b1");
+            EXPECT_EQ(reply.location().latitude(), 7);
+            ASSERT_TRUE(a->Read(&reply));
+            EXPECT_EQ(reply.message(), "b3");
+
+            // Once a has gone, b's notes are only stored.
+            a->WritesDone();
+            EXPECT_FALSE(a->Read(&reply));
+            EXPECT_TRUE(a->Finish().ok());
+            note.set_message("b4");
+            ASSERT_TRUE(b->Write(note));
+            b->WritesDone();
+            int earlier = 0;
+            while (b->Read(&reply)) {
+                earlier++;
+            }
+            // a1, a2, b1 and b3.
+            EXPECT_EQ(earlier, 4);
+            EXPECT_TRUE(b->Finish().ok());
+        }
+
+        TEST_P(RouteGuideServerTest, NearestAndWithinRadius) {
+            for (const Point& point : SomePoints(5, 50)) {
+                NearestRequest nearest;
+                *nearest.mutable_point() = point;
+                nearest.set_k(static_cast<int32_t>(point.latitude() % 40));
+                NearbyFeatureList expected, found;
+                {
+                    grpc::ClientContext context;
+                    ASSERT_TRUE(baseline_->stub()->NearestFeatures(&context, nearest,
+                        &expected).ok());
+                }
+                {
+                    grpc::ClientContext context;
+                    ASSERT_TRUE(server_->stub()->NearestFeatures(&context, nearest,
+                        &found).ok());
+                }
+                EXPECT_EQ(found.features_size(), (std::max)(nearest.k(), 0));
+                EXPECT_EQ(found.SerializeAsString(), expected.SerializeAsString());
+
+                expected.Clear();
+                found.Clear();
+                RadiusRequest radius;
+                *radius.mutable_point() = point;
+                radius.set_metres(2000);
+                radius.set_max_results(25);
+                {
+                    grpc::ClientContext context;
+                    ASSERT_TRUE(baseline_->stub()->FeaturesWithinRadius(&context, radius,
+                        &expected).ok());
+                }
+                {
+                    grpc::ClientContext context;
+                    ASSERT_TRUE(server_->stub()->FeaturesWithinRadius(&context, radius,
+                        &found).ok());
+                }
+                EXPECT_EQ(found.SerializeAsString(), expected.SerializeAsString());
+            }
+        }
+
+        INSTANTIATE_TEST_SUITE_P(Flavours, RouteGuideServerTest, ::testing::Values(0, 1, 3),
+            [](const ::testing::TestParamInfo<int>& info) {
+            return info.param == 0 ? std::string("Callback") :
+                "CompletionQueues" + std::to_string(info.param);
+        });
+
+    }  // namespace
+}  // namespace routeguide
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <grpcpp/client_context.h>
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <gtest/gtest.h>
+#include "route_guide.grpc.pb.h"
+#include "route_guide_impl.h"
+#include "route_guide_state.h"
+#include "route_router.h"
+#include "shard_map.h"
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        const size_t kShards = 3;
+        const double kTileDegrees = 0.1;
+        // Within a degree of (0, 0), so there are tiles either side of zero.
+        const int32_t kBox = 10000000;
+
+        Point MakePoint(int32_t latitude, int32_t longitude) {
+            Point point;
+            point.set_latitude(latitude);
+            point.set_longitude(longitude);
+            return point;
+        }
+
+        RouteGuideOptions ShardOptions(size_t shard_count, size_t shard_index) {
+            RouteGuideOptions options;
+            options.shard_count = shard_count;
+            options.shard_index = shard_index;
+            options.shard_tile_degrees = kTileDegrees;
+            return options;
+        }
+
+        // A RouteGuideImpl on its own state. Backends listen on a loopback
+        // port for the router to dial; the others are only reached in
+        // process.
+        class Backend {
+        public:
+            Backend(const std::string& db_path, const RouteGuideOptions& options,
+                bool listen) {
+                state_.reset(new RouteGuideState(db_path, options));
+                impl_.reset(new RouteGuideImpl(state_.get()));
+                grpc::ServerBuilder builder;
+                if (listen) {
+                    builder.AddListeningPort("127.0.0.1:0",
+                        grpc::InsecureServerCredentials(), &port_);
+                }
+                builder.RegisterService(impl_.get());
+                server_ = builder.BuildAndStart();
+            }
+
+            ~Backend() {
+                server_->Shutdown(std::chrono::system_clock::now() +
+                    std::chrono::seconds(1));
+            }
+
+            std::string address() const { return "127.0.0.1:" + std::to_string(port_); }
+            grpc::Server* server() { return server_.get(); }
+
+        private:
+            int port_ = 0;
+            std::unique_ptr<RouteGuideState> state_;
+            std::unique_ptr<RouteGuideImpl> impl_;
+            std::unique_ptr<grpc::Server> server_;
+        };
+
+        // Three shards behind a router, and the same DB on one unsharded
+        // server to compare with.
+        class RouteRouterTest : public ::testing::Test {
+        protected:
+            static void SetUpTestSuite() {
+                path_ = new std::string((std::filesystem::temp_directory_path() /
+                    "routeguide_router_test.json").string());
+                store_ = new FeatureStore();
+                FillSyntheticStore(6000, 31, store_, -kBox, kBox, -kBox, kBox);
+                // Features the same distance from (0, 0) on tiles either
+                // side of it, and so mostly on different shards.
+                for (int32_t d : { 1000, 2000, 5000 }) {
+                    for (int32_t latitude : { -d, 0, d }) {
+                        for (int32_t longitude : { -d, 0, d }) {
+                            if (latitude != 0 || longitude != 0) {
+                                store_->Add(latitude, longitude,
+                                    "tie " + std::to_string(store_->size()));
+                            }
+                        }
+                    }
+                }
+                std::ofstream(*path_, std::ios::binary) << SyntheticJson(*store_);
+            }
+
+            static void TearDownTestSuite() {
+                std::filesystem::remove(*path_);
+                delete path_;
+                delete store_;
+            }
+
+            void SetUp() override {
+                std::vector<std::string> addresses;
+                for (size_t shard = 0; shard < kShards; shard++) {
+                    shards_.emplace_back(new Backend(*path_,
+                        ShardOptions(kShards, shard), true));
+                    addresses.push_back(shards_.back()->address());
+                }
+                router_.reset(new RouteRouter(addresses, ShardOptions(kShards, 0)));
+                ASSERT_TRUE(router_->WaitForBackends(
+                    std::chrono::system_clock::now() + std::chrono::seconds(10)));
+                grpc::ServerBuilder builder;
+                builder.RegisterService(router_.get());
+                router_server_ = builder.BuildAndStart();
+                router_stub_ = RouteGuide::NewStub(
+                    router_server_->InProcessChannel(grpc::ChannelArguments()));
+                baseline_.reset(new Backend(*path_, RouteGuideOptions(), false));
+                baseline_stub_ = RouteGuide::NewStub(
+                    baseline_->server()->InProcessChannel(grpc::ChannelArguments()));
+            }
+
+            void TearDown() override {
+                router_stub_.reset();
+                baseline_stub_.reset();
+                if (router_server_ != nullptr) {
+                    router_server_->Shutdown(std::chrono::system_clock::now() +
+                        std::chrono::seconds(1));
+                }
+                router_server_.reset();
+                router_.reset();
+                baseline_.reset();
+                shards_.clear();
+            }
+
+            // Every page of a listing, with the status of the last call.
+            static grpc::Status ListAll(RouteGuide::Stub* stub, Rectangle request,
+                std::vector<Feature>* features, size_t* pages) {
+                *pages = 0;
+                while (true) {
+                    grpc::ClientContext context;
+                    auto reader = stub->ListFeatures(&context, request);
+                    Feature feature;
+                    while (reader->Read(&feature)) {
+                        features->push_back(feature);
+                    }
+                    grpc::Status status = reader->Finish();
+                    (*pages)++;
+                    if (!status.ok()) {
+                        return status;
+                    }
+                    const auto& trailers = context.GetServerTrailingMetadata();
+                    auto token = trailers.find(kNextPageTokenKey);
+                    if (token == trailers.end()) {
+                        return status;
+                    }
+                    request.set_page_token(std::string(token->second.data(),
+                        token->second.size()));
+                }
+            }
+
+            static std::vector<std::string> Names(const NearbyFeatureList& list) {
+                std::vector<std::string> names;
+                for (const NearbyFeature& nearby : list.features()) {
+                    names.push_back(nearby.feature().name());
+                }
+                std::sort(names.begin(), names.end());
+                return names;
+            }
+
+            // The list holds the baseline's features at its distances, with
+            // each tie in shard order. Returns the ties across shards; no
+            // limit here cuts through a tie.
+            size_t ExpectMerged(const NearbyFeatureList& found,
+                const NearbyFeatureList& expected) const {
+                EXPECT_EQ(found.features_size(), expected.features_size());
+                EXPECT_EQ(found.truncated(), expected.truncated());
+                if (found.features_size() != expected.features_size()) {
+                    return 0;
+                }
+                size_t ties = 0;
+                for (int i = 0; i < found.features_size(); i++) {
+                    EXPECT_EQ(found.features(i).metres(), expected.features(i).metres());
+                    if (i == 0 || found.features(i).metres() !=
+                        found.features(i - 1).metres()) {
+                        continue;
+                    }
+                    size_t before = ShardOf(found.features(i - 1).feature());
+                    size_t shard = ShardOf(found.features(i).feature());
+                    EXPECT_LE(before, shard) << "at " << i;
+                    ties += before != shard ? 1 : 0;
+                }
+                EXPECT_EQ(Names(found), Names(expected));
+                return ties;
+            }
+
+            size_t ShardOf(const Feature& feature) const {
+                return map_.ShardOf(feature.location().latitude(),
+                    feature.location().longitude());
+            }
+
+            static std::string* path_;
+            static FeatureStore* store_;
+            ShardMap map_{ kShards, kTileDegrees };
+            std::vector<std::unique_ptr<Backend>> shards_;
+            std::unique_ptr<RouteRouter> router_;
+            std::unique_ptr<grpc::Server> router_server_;
+            std::unique_ptr<RouteGuide::Stub> router_stub_;
+            std::unique_ptr<Backend> baseline_;
+            std::unique_ptr<RouteGuide::Stub> baseline_stub_;
+        };
+
+        std::string* RouteRouterTest::path_ = nullptr;
+        FeatureStore* RouteRouterTest::store_ = nullptr;
+
+        TEST_F(RouteRouterTest, NearbyTiesGoToTheLowerShard) {
+            size_t ties = 0;
+            for (int32_t k : { 8, 24, 200 }) {
+                NearestRequest nearest;
+                *nearest.mutable_point() = MakePoint(0, 0);
+                nearest.set_k(k);
+                NearbyFeatureList expected, found;
+                {
+                    grpc::ClientContext context;
+                    ASSERT_TRUE(baseline_stub_->NearestFeatures(&context, nearest,
+                        &expected).ok());
+                }
+                grpc::ClientContext context;
+                ASSERT_TRUE(router_stub_->NearestFeatures(&context, nearest, &found).ok());
+                ties += ExpectMerged(found, expected);
+            }
+            for (double metres : { 60.0, 5000.0 }) {
+                RadiusRequest radius;
+                *radius.mutable_point() = MakePoint(0, 0);
+                radius.set_metres(metres);
+                NearbyFeatureList expected, found;
+                {
+                    grpc::ClientContext context;
+                    ASSERT_TRUE(baseline_stub_->FeaturesWithinRadius(&context, radius,
+                        &expected).ok());
+                }
+                grpc::ClientContext context;
+                ASSERT_TRUE(router_stub_->FeaturesWithinRadius(&context, radius,
+                    &found).ok());
+                ties += ExpectMerged(found, expected);
+            }
+            EXPECT_GT(ties, 0u);
+        }
+
+        TEST_F(RouteRouterTest, ListFeaturesPagesRoundTrip) {
+            Rectangle request;
+            *request.mutable_lo() = MakePoint(-kBox / 2, -kBox / 2);
+            *request.mutable_hi() = MakePoint(kBox / 2 + 1, kBox / 2);
+            // DB order is shard by shard, each in store order.
+            std::vector<std::string> expected;
+            for (size_t shard = 0; shard < kShards; shard++) {
+                for (size_t i = 0; i < store_->size(); i++) {
+                    int32_t latitude = store_->latitude(i);
+                    int32_t longitude = store_->longitude(i);
+                    if (latitude >= -kBox / 2 && latitude <= kBox / 2 + 1 &&
+                        longitude >= -kBox / 2 && longitude <= kBox / 2 &&
+                        map_.ShardOf(latitude, longitude) == shard) {
+                        Feature feature;
+                        store_->CopyTo(i, &feature);
+                        expected.push_back(feature.SerializeAsString());
+                    }
+                }
+            }
+            ASSERT_GT(expected.size(), 1000u);
+            for (Rectangle::Order order :
+                { Rectangle::DB_ORDER, Rectangle::DISTANCE_FROM_CENTER }) {
+                request.set_order(order);
+                std::vector<std::string> streamed;
+                for (int32_t max_results : { 0, 1, 7, 100, 1000000 }) {
+                    request.set_max_results(max_results);
+                    std::vector<Feature> features;
+                    size_t pages = 0;
+                    ASSERT_TRUE(ListAll(router_stub_.get(), request, &features,
+                        &pages).ok());
+                    std::vector<std::string> listed;
+                    for (const Feature& feature : features) {
+                        listed.push_back(feature.SerializeAsString());
+                    }
+                    if (max_results == 0) {
+                        EXPECT_EQ(pages, 1u);
+                        streamed = listed;
+                    }
+                    if (max_results == 100) {
+                        EXPECT_EQ(pages, (expected.size() + 99) / 100);
+                    }
+                    // Pages of any size give what one stream does.
+                    EXPECT_EQ(listed, streamed)
+                        << "order " << order << ", max_results " << max_results;
+                }
+                if (order == Rectangle::DB_ORDER) {
+                    EXPECT_EQ(streamed, expected);
+                }
+                else {
+                    std::vector<std::string> sorted = streamed;
+                    std::sort(sorted.begin(), sorted.end());
+                    std::vector<std::string> all = expected;
+                    std::sort(all.begin(), all.end());
+                    EXPECT_EQ(sorted, all);
+                }
+            }
+        }
+
+        TEST_F(RouteRouterTest, ListFeaturesRejectsMalformedTokens) {
+            Rectangle request;
+            *request.mutable_lo() = MakePoint(-kBox, -kBox);
+            *request.mutable_hi() = MakePoint(kBox, kBox);
+            request.set_max_results(10);
+            // A backend's token, too few or too many entries, and a bad
+            // token for one shard.
+            for (const char* token : { "db:0", "shards:", "shards:,", "shards:,,,",
+                "shards:db:x,," }) {
+                request.set_page_token(token);
+                std::vector<Feature> features;
+                size_t pages = 0;
+                EXPECT_EQ(ListAll(router_stub_.get(), request, &features, &pages)
+                    .error_code(), grpc::StatusCode::INVALID_ARGUMENT) << token;
+                EXPECT_TRUE(features.empty()) << token;
+            }
+            // Every shard done: an empty last page.
+            request.set_page_token("shards:~,~,~");
+            std::vector<Feature> features;
+            size_t pages = 0;
+            EXPECT_TRUE(ListAll(router_stub_.get(), request, &features, &pages).ok());
+            EXPECT_TRUE(features.empty());
+            EXPECT_EQ(pages, 1u);
+        }
+
+    }  // namespace
+}  // namespace routeguide
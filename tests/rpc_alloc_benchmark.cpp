@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <google/protobuf/arena.h>
+#include <grpcpp/client_context.h>
+#include "async_server.h"
+#include "route_guide.grpc.pb.h"
+#include "route_guide_state.h"
+#include "synthetic_features.h"
+
+// Every malloc of the process is counted, gRPC's and protobuf's included,
+// by interposing malloc, calloc and realloc over glibc's.
+namespace {
+    std::atomic<uint64_t> allocations{ 0 };
+}
+
+#ifdef __GLIBC__
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* p, size_t size);
+
+    void* malloc(size_t size) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* p, size_t size) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(p, size);
+    }
+}
+#endif
+
+namespace routeguide {
+    namespace {
+
+        const size_t kFeatures = 10000;
+
+        // The completion-queue server on a synthetic DB, reached through an
+        // in-process channel, so the counts leave out the network but keep
+        // both ends of every call. The client parses its responses onto an
+        // arena, so its own share is small.
+        class InProcessServer {
+        public:
+            explicit InProcessServer(size_t notes_per_location)
+                : path_((std::filesystem::temp_directory_path() /
+                    "routeguide_rpc_benchmark.json").string()) {
+                FeatureStore store;
+                FillSyntheticStore(kFeatures, 42, &store);
+                std::ofstream(path_, std::ios::binary) << SyntheticJson(store);
+                RouteGuideOptions options;
+                options.note_limits.max_notes_per_location = notes_per_location;
+                state_.reset(new RouteGuideState(path_, options));
+                server_.reset(new AsyncRouteGuideServer(state_.get(), 1));
+                if (server_->Start("")) {
+                    stub_ = RouteGuide::NewStub(server_->InProcessChannel());
+                }
+            }
+
+            ~InProcessServer() {
+                server_.reset();
+                std::filesystem::remove(path_);
+            }
+
+            // Null if the server did not start.
+            RouteGuide::Stub* stub() const { return stub_.get(); }
+            const FeatureStore& store() const { return state_->db()->store(); }
+
+        private:
+            std::string path_;
+            std::unique_ptr<RouteGuideState> state_;
+            std::unique_ptr<AsyncRouteGuideServer> server_;
+            std::unique_ptr<RouteGuide::Stub> stub_;
+        };
+
+        // Reports the allocations counted since start, per call and per item.
+        void ReportAllocations(benchmark::State& state, uint64_t start, uint64_t items) {
+            double counted = static_cast<double>(allocations.load() - start);
+            state.counters["allocs_per_call"] = counted / state.iterations();
+            if (items > 0) {
+                state.counters["allocs_per_item"] = counted / items;
+            }
+        }
+
+        bool CanCount(benchmark::State& state, const InProcessServer& server) {
+#ifndef __GLIBC__
+            state.SkipWithError("counting allocations needs glibc");
+            return false;
+#endif
+            if (server.stub() == nullptr) {
+                state.SkipWithError("the in-process server did not start");
+                return false;
+            }
+            return true;
+        }
+
+        Point FeaturePoint(const FeatureStore& store, size_t i) {
+            Point point;
+            point.set_latitude(store.latitude(i % store.size()));
+            point.set_longitude(store.longitude(i % store.size()));
+            return point;
+        }
+
+        // GetFeature, answered from the DB's wire bytes.
+        void BM_GetFeatureAllocations(benchmark::State& state) {
+            InProcessServer server(256);
+            if (!CanCount(state, server)) {
+                return;
+            }
+            size_t next = 0;
+            uint64_t start = allocations.load();
+            for (auto _ : state) {
+                grpc::ClientContext context;
+                google::protobuf::Arena arena;
+                server.stub()->GetFeature(&context, FeaturePoint(server.store(), next++),
+                    google::protobuf::Arena::CreateMessage<Feature>(&arena));
+            }
+            ReportAllocations(state, start, 0);
+        }
+        BENCHMARK(BM_GetFeatureAllocations);
+
+        // GetFeatures of range(0) points; the server builds the reply on the
+        // call's arena.
+        void BM_GetFeaturesAllocations(benchmark::State& state) {
+            InProcessServer server(256);
+            if (!CanCount(state, server)) {
+                return;
+            }
+            PointList points;
+            for (int64_t i = 0; i < state.range(0); i++) {
+                *points.add_points() = FeaturePoint(server.store(), i * 7);
+            }
+            uint64_t start = allocations.load();
+            for (auto _ : state) {
+                grpc::ClientContext context;
+                google::protobuf::Arena arena;
+                server.stub()->GetFeatures(&context, points,
+                    google::protobuf::Arena::CreateMessage<FeatureList>(&arena));
+            }
+            ReportAllocations(state, start, state.iterations() * state.range(0));
+        }
+        BENCHMARK(BM_GetFeaturesAllocations)->Arg(1)->Arg(100);
+
+        // NearestFeatures with k = range(0).
+        void BM_NearestFeaturesAllocations(benchmark::State& state) {
+            InProcessServer server(256);
+            if (!CanCount(state, server)) {
+                return;
+            }
+            size_t next = 0;
+            uint64_t start = allocations.load();
+            for (auto _ : state) {
+                grpc::ClientContext context;
+                NearestRequest request;
+                *request.mutable_point() = FeaturePoint(server.store(), next++);
+                request.set_k(static_cast<int32_t>(state.range(0)));
+                google::protobuf::Arena arena;
+                server.stub()->NearestFeatures(&context, request,
+                    google::protobuf::Arena::CreateMessage<NearbyFeatureList>(&arena));
+            }
+            ReportAllocations(state, start, state.iterations() * state.range(0));
+        }
+        BENCHMARK(BM_NearestFeaturesAllocations)->Arg(10)->Arg(100);
+
+        // Posts count more notes over 16 locations on one RouteChat stream,
+        // reading each note's replies before posting the next: the server
+        // writes at most one reply at a time, and an in-process channel
+        // buffers none. posted counts the notes posted before.
+        void Chat(const InProcessServer& server, int64_t count, size_t notes_per_location,
+            int64_t* posted) {
+            grpc::ClientContext context;
+            auto stream = server.stub()->RouteChat(&context);
+            google::protobuf::Arena arena;
+            RouteNote* note = google::protobuf::Arena::CreateMessage<RouteNote>(&arena);
+            RouteNote* reply = google::protobuf::Arena::CreateMessage<RouteNote>(&arena);
+            note->set_message("benchmark note");
+            bool ok = true;
+            for (int64_t i = 0; i < count && ok; i++, (*posted)++) {
+                note->mutable_location()->set_latitude(
+                    static_cast<int32_t>(*posted % 16) * 1000);
+                note->mutable_location()->set_longitude(0);
+                ok = stream->Write(*note);
+                size_t earlier = (std::min)(static_cast<size_t>(*posted / 16),
+                    notes_per_location);
+                for (size_t j = 0; j < earlier && ok; j++) {
+                    ok = stream->Read(reply);
+                }
+            }
+            stream->WritesDone();
+            stream->Finish();
+        }
+
+        // A RouteChat stream posting range(0) notes, with every location
+        // already holding its limit of range(1) notes, so each note is
+        // answered with range(1) earlier ones. Items are notes posted.
+        void BM_RouteChatAllocations(benchmark::State& state) {
+            size_t notes_per_location = static_cast<size_t>(state.range(1));
+            InProcessServer server(notes_per_location);
+            if (!CanCount(state, server)) {
+                return;
+            }
+            int64_t posted = 0;
+            Chat(server, 16 * state.range(1), notes_per_location, &posted);
+            uint64_t start = allocations.load();
+            for (auto _ : state) {
+                Chat(server, state.range(0), notes_per_location, &posted);
+            }
+            ReportAllocations(state, start, state.iterations() * state.range(0));
+        }
+        BENCHMARK(BM_RouteChatAllocations)->Args({ 16, 16 })->Args({ 16, 256 });
+
+    }  // namespace
+}  // namespace routeguide
@@ -0,0 +1,190 @@
+#include "shard_map.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        const int32_t kDegree = 10000000;
+
+        // The shards owning any point of the rectangle, by visiting the
+        // lowest point of every tile that meets it.
+        std::vector<bool> ShardsByTile(const ShardMap& map, int64_t tile_e7,
+            int32_t bottom, int32_t top, int32_t left, int32_t right) {
+            auto tile_start = [tile_e7](int32_t coordinate) {
+                int64_t tile = coordinate / tile_e7;
+                if (coordinate < 0 && tile * tile_e7 != coordinate) {
+                    tile--;
+                }
+                return tile * tile_e7;
+            };
+            std::vector<bool> shards(map.shard_count(), false);
+            for (int64_t latitude = tile_start(bottom); latitude <= top;
+                latitude += tile_e7) {
+                for (int64_t longitude = tile_start(left); longitude <= right;
+                    longitude += tile_e7) {
+                    shards[map.ShardOf(
+                        static_cast<int32_t>((std::max)(latitude, int64_t{ bottom })),
+                        static_cast<int32_t>((std::max)(longitude, int64_t{ left })))] = true;
+                }
+            }
+            return shards;
+        }
+
+        TEST(ShardMapTest, PointsOfATileShareItsShard) {
+            ShardMap map(1024, 1.0);
+            // The tile from 0 up to, not including, one degree.
+            EXPECT_EQ(map.ShardOf(0, 0), map.ShardOf(kDegree - 1, kDegree - 1));
+            EXPECT_EQ(map.ShardOf(0, 0), map.ShardOf(kDegree - 1, 0));
+            // Negative coordinates round down: -1 is in the tile from minus
+            // one degree, up to 0.
+            EXPECT_EQ(map.ShardOf(-1, -1), map.ShardOf(-kDegree, -kDegree));
+            EXPECT_EQ(map.ShardOf(-1, 5), map.ShardOf(-kDegree, kDegree - 1));
+            // The antimeridian and the poles are tiles like any other.
+            EXPECT_EQ(map.ShardOf(0, 1800000000), map.ShardOf(kDegree - 1, 1800000000));
+            EXPECT_EQ(map.ShardOf(0, -1800000000), map.ShardOf(0, -1790000001));
+            EXPECT_EQ(map.ShardOf(900000000, 0), map.ShardOf(900000000, kDegree - 1));
+            EXPECT_EQ(map.ShardOf(-900000000, 0), map.ShardOf(-890000001, 0));
+        }
+
+        TEST(ShardMapTest, TilesEitherSideOfZeroAreDistinct) {
+            ShardMap map(1024, 1.0);
+            // Were -1 and 0 in one tile, every row would give them one shard.
+            int differ_latitude = 0, differ_longitude = 0, differ_minus_one = 0;
+            for (int32_t row = -50; row < 50; row++) {
+                differ_latitude += map.ShardOf(-1, row * kDegree) !=
+                    map.ShardOf(0, row * kDegree) ? 1 : 0;
+                differ_longitude += map.ShardOf(row * kDegree, -1) !=
+                    map.ShardOf(row * kDegree, 0) ? 1 : 0;
+                differ_minus_one += map.ShardOf(-kDegree, row * kDegree) !=
+                    map.ShardOf(-kDegree - 1, row * kDegree) ? 1 : 0;
+            }
+            EXPECT_GT(differ_latitude, 90);
+            EXPECT_GT(differ_longitude, 90);
+            EXPECT_GT(differ_minus_one, 90);
+        }
+
+        TEST(ShardMapTest, ShardsInMatchesTheTiles) {
+            std::mt19937 rng(3);
+            for (double degrees : { 0.1, 1.0, 7.5 }) {
+                ShardMap map(13, degrees);
+                int64_t tile_e7 = static_cast<int64_t>(degrees * kDegree + 0.5);
+                std::uniform_int_distribution<int32_t> latitude(-900000000, 900000000);
+                std::uniform_int_distribution<int32_t> longitude(-1800000000, 1800000000);
+                // Up to forty tiles, but no more than 90 degrees.
+                std::uniform_int_distribution<int32_t> size(0, static_cast<int32_t>(
+                    (std::min)(tile_e7 * 40, int64_t{ 900000000 })));
+                for (int i = 0; i < 500; i++) {
+                    int32_t bottom = latitude(rng), left = longitude(rng);
+                    if (i % 5 == 0) {
+                        // Up against the poles and the antimeridian.
+                        bottom = i % 2 == 0 ? 900000000 - size(rng) : -900000000;
+                        left = i % 3 == 0 ? 1800000000 - size(rng) : -1800000000;
+                    }
+                    int32_t top = static_cast<int32_t>((std::min)(
+                        int64_t{ bottom } + size(rng), int64_t{ 900000000 }));
+                    int32_t right = static_cast<int32_t>((std::min)(
+                        int64_t{ left } + size(rng), int64_t{ 1800000000 }));
+                    std::vector<bool> shards;
+                    // Corners in either order.
+                    if (i % 2 == 0) {
+                        map.ShardsIn(bottom, left, top, right, &shards);
+                    }
+                    else {
+                        map.ShardsIn(top, right, bottom, left, &shards);
+                    }
+                    ASSERT_EQ(shards.size(), 13u);
+                    EXPECT_EQ(shards, ShardsByTile(map, tile_e7, bottom, top, left, right))
+                        << degrees << ": " << bottom << ".." << top << ", " << left
+                        << ".." << right;
+                }
+            }
+        }
+
+        TEST(ShardMapTest, LargeRectanglesAskEveryShard) {
+            ShardMap map(6, 0.01);
+            std::vector<bool> shards;
+            map.ShardsIn(-900000000, -1800000000, 900000000, 1800000000, &shards);
+            EXPECT_EQ(shards, std::vector<bool>(6, true));
+            map.ShardsIn(INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX, &shards);
+            EXPECT_EQ(shards, std::vector<bool>(6, true));
+            // One tile high but too many wide.
+            map.ShardsIn(0, 0, 0, 4097 * 100000, &shards);
+            EXPECT_EQ(shards, std::vector<bool>(6, true));
+            // A single point asks one shard.
+            map.ShardsIn(5, 5, 5, 5, &shards);
+            EXPECT_EQ(std::count(shards.begin(), shards.end(), true), 1);
+            EXPECT_TRUE(shards[map.ShardOf(5, 5)]);
+        }
+
+        TEST(ShardMapTest, OneShardOwnsEverything) {
+            ShardMap map(1, 1.0);
+            EXPECT_EQ(map.ShardOf(INT32_MIN, INT32_MAX), 0u);
+            std::vector<bool> shards;
+            map.ShardsIn(0, 0, 1, 1, &shards);
+            EXPECT_EQ(shards, std::vector<bool>(1, true));
+            // Zero shards are taken as one.
+            EXPECT_EQ(ShardMap(0, 1.0).shard_count(), 1u);
+        }
+
+        TEST(ShardMapTest, DenseRegionsSpreadOverAllShards) {
+            ShardMap map(8, 1.0);
+            std::vector<int> tiles(8, 0);
+            for (int32_t row = 40; row < 60; row++) {
+                for (int32_t column = -80; column < -60; column++) {
+                    tiles[map.ShardOf(row * kDegree, column * kDegree)]++;
+                }
+            }
+            for (size_t shard = 0; shard < tiles.size(); shard++) {
+                EXPECT_GT(tiles[shard], 20) << "shard " << shard;
+            }
+        }
+
+        TEST(ShardMapTest, RetainShardPartitionsTheDb) {
+            FeatureDb full;
+            FillSyntheticStore(5000, 9, full.mutable_store());
+            full.mutable_store()->Add(900000000, 1800000000, "north east");
+            full.mutable_store()->Add(-900000000, -1800000000, "south west");
+            full.mutable_store()->Add(-1, -1, "minus one");
+            full.BuildIndexes();
+            ShardMap map(5, 2.0);
+            std::vector<size_t> owner;
+            for (size_t i = 0; i < full.store().size(); i++) {
+                owner.push_back(map.ShardOf(full.store().latitude(i),
+                    full.store().longitude(i)));
+            }
+            size_t total = 0;
+            for (size_t shard = 0; shard < 5; shard++) {
+                FeatureDb db;
+                FillSyntheticStore(5000, 9, db.mutable_store());
+                db.mutable_store()->Add(900000000, 1800000000, "north east");
+                db.mutable_store()->Add(-900000000, -1800000000, "south west");
+                db.mutable_store()->Add(-1, -1, "minus one");
+                db.BuildIndexes();
+                RetainShard(map, shard, &db);
+                // The features the shard owns, in store order.
+                size_t k = 0;
+                for (size_t i = 0; i < full.store().size(); i++) {
+                    if (owner[i] != shard) {
+                        continue;
+                    }
+                    ASSERT_LT(k, db.store().size());
+                    EXPECT_EQ(db.store().latitude(k), full.store().latitude(i));
+                    EXPECT_EQ(db.store().longitude(k), full.store().longitude(i));
+                    EXPECT_EQ(db.store().name(k), full.store().name(i));
+                    k++;
+                }
+                EXPECT_EQ(k, db.store().size());
+                total += db.store().size();
+            }
+            EXPECT_EQ(total, full.store().size());
+        }
+
+    }  // namespace
+}  // namespace routeguide
@@ -0,0 +1,251 @@
+#include "sphere_index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "geo_distance.h"
+#include "synthetic_features.h"
+
+namespace routeguide {
+    namespace {
+
+        // The index converts chord lengths and the scan uses the haversine
+        // formula; the two round differently, most near antipodes.
+        double Tolerance(double metres) {
+            return 1e-6 + metres * 1e-7;
+        }
+
+        // Haversine metres from the point to every feature, with positions,
+        // nearest first and ties by position.
+        std::vector<std::pair<double, uint32_t>> ScanAll(const FeatureStore& store,
+            int32_t latitude, int32_t longitude) {
+            GeoPoint from = ToGeoPoint(latitude, longitude);
+            std::vector<std::pair<double, uint32_t>> all;
+            for (uint32_t i = 0; i < store.size(); i++) {
+                GeoPoint to = ToGeoPoint(store.latitude(i), store.longitude(i));
+                all.emplace_back(HaversineMetres(from, to), i);
+            }
+            std::sort(all.begin(), all.end());
+            return all;
+        }
+
+        // Positions are distinct, metres never decrease, features at the same
+        // distance come in store order, and each distance is the scan's.
+        void ExpectConsistent(const std::vector<SphereIndex::Neighbor>& found,
+            const std::vector<double>& scanned) {
+            std::vector<bool> seen(scanned.size());
+            for (size_t i = 0; i < found.size(); i++) {
+                ASSERT_LT(found[i].position, scanned.size());
+                EXPECT_FALSE(seen[found[i].position]) << "position " << found[i].position;
+                seen[found[i].position] = true;
+                EXPECT_NEAR(found[i].metres, scanned[found[i].position],
+                    Tolerance(found[i].metres));
+                if (i > 0) {
+                    EXPECT_LE(found[i - 1].metres, found[i].metres);
+                    if (found[i - 1].metres == found[i].metres) {
+                        EXPECT_LT(found[i - 1].position, found[i].position);
+                    }
+                }
+            }
+        }
+
+        struct Case {
+            size_t count;
+            int32_t min_latitude, max_latitude;
+            // May run past 180 degrees; such longitudes wrap to the west.
+            int64_t min_longitude, max_longitude;
+        };
+
+        class SphereIndexTest : public ::testing::TestWithParam<Case> {
+        protected:
+            int32_t Latitude(std::mt19937& rng) const {
+                const Case& c = GetParam();
+                return std::uniform_int_distribution<int32_t>(c.min_latitude,
+                    c.max_latitude)(rng);
+            }
+
+            int32_t Longitude(std::mt19937& rng) const {
+                const Case& c = GetParam();
+                int64_t longitude = std::uniform_int_distribution<int64_t>(
+                    c.min_longitude, c.max_longitude)(rng);
+                if (longitude > 1800000000) {
+                    longitude -= 3600000000;
+                }
+                return static_cast<int32_t>(longitude);
+            }
+
+            // Points spread over the case's box, a fraction of them reusing an
+            // earlier point so that some distances tie exactly.
+            void Fill(uint32_t seed) {
+                std::mt19937 rng(seed);
+                for (size_t i = 0; i < GetParam().count; i++) {
+                    if (i > 0 && rng() % 8 == 0) {
+                        size_t earlier = rng() % i;
+                        store_.Add(store_.latitude(earlier), store_.longitude(earlier),
+                            "again");
+                    }
+                    else {
+                        store_.Add(Latitude(rng), Longitude(rng), "feature");
+                    }
+                }
+                index_.Build(store_);
+            }
+
+            // A query point: often a stored one, else anywhere in the box.
+            std::pair<int32_t, int32_t> QueryPoint(std::mt19937& rng) const {
+                if (rng() % 3 == 0) {
+                    size_t k = rng() % store_.size();
+                    return { store_.latitude(k), store_.longitude(k) };
+                }
+                return { Latitude(rng), Longitude(rng) };
+            }
+
+            FeatureStore store_;
+            SphereIndex index_;
+        };
+
+        TEST_P(SphereIndexTest, NearestMatchesBruteForce) {
+            Fill(static_cast<uint32_t>(GetParam().count));
+            ASSERT_EQ(index_.size(), store_.size());
+            std::mt19937 rng(99);
+            size_t n = store_.size();
+            const size_t ks[] = { 0, 1, 2, 5, 17, n - 1, n, n + 3 };
+            for (int i = 0; i < 300; i++) {
+                std::pair<int32_t, int32_t> point = QueryPoint(rng);
+                auto all = ScanAll(store_, point.first, point.second);
+                std::vector<double> scanned(n);
+                for (const auto& a : all) {
+                    scanned[a.second] = a.first;
+                }
+                size_t k = ks[rng() % (sizeof(ks) / sizeof(ks[0]))];
+                std::vector<SphereIndex::Neighbor> found;
+                index_.Nearest(point.first, point.second, k, &found);
+                ASSERT_EQ(found.size(), (std::min)(k, n))
+                    << "k " << k << " at " << point.first << ", " << point.second;
+                ExpectConsistent(found, scanned);
+                // Rank by rank, the distances are the scan's; so nothing
+                // left out is nearer than the last one kept.
+                for (size_t r = 0; r < found.size(); r++) {
+                    ASSERT_NEAR(found[r].metres, all[r].first, Tolerance(all[r].first))
+                        << "rank " << r << " of " << k << " at " << point.first << ", "
+                        << point.second;
+                }
+            }
+        }
+
+        TEST_P(SphereIndexTest, WithinRadiusMatchesBruteForce) {
+            Fill(static_cast<uint32_t>(GetParam().count) + 1);
+            std::mt19937 rng(77);
+            size_t n = store_.size();
+            const double radii[] = { 0, 0.5, 100, 1000, 25000, 300000, 5e6, 2.1e7 };
+            const size_t limits[] = { 0, 1, 10, n + 1 };
+            for (int i = 0; i < 300; i++) {
+                std::pair<int32_t, int32_t> point = QueryPoint(rng);
+                auto all = ScanAll(store_, point.first, point.second);
+                std::vector<double> scanned(n);
+                for (const auto& a : all) {
+                    scanned[a.second] = a.first;
+                }
+                double metres = radii[rng() % (sizeof(radii) / sizeof(radii[0]))];
+                size_t limit = limits[rng() % (sizeof(limits) / sizeof(limits[0]))];
+                std::vector<SphereIndex::Neighbor> found;
+                size_t total = index_.WithinRadius(point.first, point.second, metres,
+                    limit, &found);
+                // Only features within a rounding error of the circle may go
+                // either way.
+                size_t inside = 0, maybe = 0;
+                for (const auto& a : all) {
+                    inside += a.first <= metres - Tolerance(metres) ? 1 : 0;
+                    maybe += a.first <= metres + Tolerance(metres) ? 1 : 0;
+                }
+                ASSERT_GE(total, inside) << metres << " m at " << point.first << ", "
+                    << point.second;
+                ASSERT_LE(total, maybe) << metres << " m at " << point.first << ", "
+                    << point.second;
+                ASSERT_EQ(found.size(), (std::min)(limit, total));
+                ExpectConsistent(found, scanned);
+                for (const SphereIndex::Neighbor& f : found) {
+                    EXPECT_LE(f.metres, metres);
+                }
+                // A limit keeps the nearest.
+                std::vector<SphereIndex::Neighbor> unlimited;
+                index_.WithinRadius(point.first, point.second, metres, n, &unlimited);
+                ASSERT_EQ(unlimited.size(), total);
+                for (size_t r = 0; r < found.size(); r++) {
+                    EXPECT_EQ(found[r].position, unlimited[r].position);
+                }
+            }
+        }
+
+        INSTANTIATE_TEST_SUITE_P(Regions, SphereIndexTest, ::testing::Values(
+            // Fewer features than most k.
+            Case{ 5, -900000000, 900000000, -1800000000, 1800000000 },
+            Case{ 20000, -900000000, 900000000, -1800000000, 1800000000 },
+            // Either side of the antimeridian.
+            Case{ 5000, -100000000, 100000000, 1790000000, 1810000000 },
+            Case{ 5000, 890000000, 900000000, -1800000000, 1800000000 },
+            Case{ 5000, -900000000, -890000000, -1800000000, 1800000000 },
+            // One city, features centimetres apart.
+            Case{ 5000, 407000000, 407000100, -740000000, -739999900 }));
+
+        TEST(SphereIndexTest, EmptyIndexFindsNothing) {
+            FeatureStore store;
+            SphereIndex index;
+            index.Build(store);
+            std::vector<SphereIndex::Neighbor> found;
+            index.Nearest(0, 0, 3, &found);
+            EXPECT_TRUE(found.empty());
+            EXPECT_EQ(index.WithinRadius(0, 0, 1e7, 10, &found), 0u);
+            EXPECT_TRUE(found.empty());
+        }
+
+        TEST(SphereIndexTest, ZeroRadiusFindsCoincidentFeatures) {
+            FeatureStore store;
+            FillSyntheticStore(2000, 8, &store);
+            store.Add(store.latitude(40), store.longitude(40), "again");
+            store.Add(store.latitude(40), store.longitude(40) + 1, "next door");
+            SphereIndex index;
+            index.Build(store);
+            std::vector<uint32_t> expected;
+            for (uint32_t i = 0; i < store.size(); i++) {
+                if (store.latitude(i) == store.latitude(40) &&
+                    store.longitude(i) == store.longitude(40)) {
+                    expected.push_back(i);
+                }
+            }
+            ASSERT_GE(expected.size(), 2u);
+            std::vector<SphereIndex::Neighbor> found;
+            EXPECT_EQ(index.WithinRadius(store.latitude(40), store.longitude(40), 0, 10,
+                &found), expected.size());
+            std::vector<uint32_t> positions;
+            for (const SphereIndex::Neighbor& f : found) {
+                EXPECT_EQ(f.metres, 0);
+                positions.push_back(f.position);
+            }
+            EXPECT_EQ(positions, expected);
+            EXPECT_EQ(index.WithinRadius(0, 1, -1, 10, &found), 0u);
+            EXPECT_TRUE(found.empty());
+        }
+
+        TEST(SphereIndexTest, NearestCrossesTheAntimeridian) {
+            FeatureStore store;
+            store.Add(0, -1799999000, "just west of it");
+            store.Add(0, 1790000000, "a degree east");
+            store.Add(0, 1799999000, "just east of it");
+            SphereIndex index;
+            index.Build(store);
+            std::vector<SphereIndex::Neighbor> found;
+            index.Nearest(0, 1800000000, 2, &found);
+            ASSERT_EQ(found.size(), 2u);
+            EXPECT_EQ((std::min)(found[0].position, found[1].position), 0u);
+            EXPECT_EQ((std::max)(found[0].position, found[1].position), 2u);
+            EXPECT_NEAR(found[0].metres, 11.1, 0.1);
+            EXPECT_NEAR(found[1].metres, 11.1, 0.1);
+        }
+
+    }  // namespace
+}  // namespace routeguide
@@ -0,0 +1,55 @@
+#ifndef ROUTEGUIDE_TESTS_SYNTHETIC_FEATURES_H
+#define ROUTEGUIDE_TESTS_SYNTHETIC_FEATURES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "feature_store.h"
+
+namespace routeguide {
+
+    // Deterministic random features for tests and benchmarks: points spread
+    // uniformly over the box, every one with a short name. A fraction of the
+    // features reuses an earlier point, as real DBs do.
+    inline void FillSyntheticStore(size_t count, uint32_t seed, FeatureStore* store,
+        int32_t min_latitude = -900000000, int32_t max_latitude = 900000000,
+        int32_t min_longitude = -1800000000, int32_t max_longitude = 1800000000) {
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<int32_t> latitude(min_latitude, max_latitude);
+        std::uniform_int_distribution<int32_t> longitude(min_longitude, max_longitude);
+        store->Clear();
+        store->Reserve(count, count * 12);
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0 && rng() % 16 == 0) {
+                size_t earlier = rng() % i;
+                store->Add(store->latitude(earlier), store->longitude(earlier),
+                    "feature " + std::to_string(i));
+            }
+            else {
+                store->Add(latitude(rng), longitude(rng), "feature " + std::to_string(i));
+            }
+        }
+    }
+
+    // The store as a JSON DB in the format of route_guide_db.json.
+    inline std::string SyntheticJson(const FeatureStore& store) {
+        std::string json = "[";
+        for (size_t i = 0; i < store.size(); i++) {
+            json += i == 0 ? "{" : ", {";
+            json += "\n    \"location\": {\n        \"latitude\": ";
+            json += std::to_string(store.latitude(i));
+            json += ",\n        \"longitude\": ";
+            json += std::to_string(store.longitude(i));
+            json += "\n    },\n    \"name\": \"";
+            json += store.name(i);
+            json += "\"\n}";
+        }
+        json += "]";
+        return json;
+    }
+
+}  // namespace routeguide
+
+#endif  // ROUTEGUIDE_TESTS_SYNTHETIC_FEATURES_H